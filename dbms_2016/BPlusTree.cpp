@@ -0,0 +1,407 @@
+#include "BPlusTree.h"
+
+#include <algorithm>
+#include <iterator>
+
+BPlusTree::BPlusTree() :
+	mRoot(NULL), mFirst(NULL), mSize(0)
+{
+}
+
+BPlusTree::~BPlusTree()
+{
+	clear();
+}
+
+void BPlusTree::clear()
+{
+	if (mRoot != NULL)
+		free(mRoot);
+	mRoot = NULL;
+	mFirst = NULL;
+	mSize = 0;
+}
+
+void BPlusTree::free(Node * node)
+{
+	if (node->leaf)
+	{
+		delete static_cast<LeafNode *>(node);
+		return;
+	}
+
+	InnerNode *inner = static_cast<InnerNode *>(node);
+	for (uint32_t i = 0; i < inner->num; i++)
+		free(inner->children[i]);
+	delete inner;
+}
+
+void BPlusTree::insert(const attr_t & key, uint32_t addr)
+{
+	mSize++;
+	if (mRoot == NULL)
+	{
+		LeafNode *leaf = new LeafNode;
+		leaf->leaf = true;
+		leaf->num = 1;
+		leaf->keys[0] = key;
+		leaf->addrs[0] = addr;
+		leaf->next = NULL;
+		mRoot = mFirst = leaf;
+		return;
+	}
+
+	attr_t split_key;
+	uint32_t split_addr;
+	Node *split_node;
+	if (!insert(mRoot, key, addr, split_key, split_addr, split_node))
+		return;
+
+	// Root split, tree grows by one level
+	InnerNode *root = new InnerNode;
+	root->leaf = false;
+	root->num = 2;
+	root->keys[0] = split_key;
+	root->addrs[0] = split_addr;
+	root->children[0] = mRoot;
+	root->children[1] = split_node;
+	subtree_stat(mRoot, root->counts[0], root->sums[0]);
+	subtree_stat(split_node, root->counts[1], root->sums[1]);
+	mRoot = root;
+}
+
+void BPlusTree::subtree_stat(const Node * node, uint32_t & count, int64_t & key_sum)
+{
+	count = 0;
+	key_sum = 0;
+	if (node->leaf)
+	{
+		const LeafNode *leaf = static_cast<const LeafNode *>(node);
+		count = leaf->num;
+		for (uint32_t i = 0; i < leaf->num; i++)
+			key_sum += key_value(leaf->keys[i]);
+		return;
+	}
+
+	const InnerNode *inner = static_cast<const InnerNode *>(node);
+	for (uint32_t i = 0; i < inner->num; i++)
+	{
+		count += inner->counts[i];
+		key_sum += inner->sums[i];
+	}
+}
+
+uint32_t BPlusTree::total(int64_t & key_sum) const
+{
+	uint32_t count = 0;
+	key_sum = 0;
+	if (mRoot != NULL)
+		subtree_stat(mRoot, count, key_sum);
+	return count;
+}
+
+/*
+	BPlusTree::insert()
+
+	insert below node, return true if node is split,
+	then split_node is the new right sibling starting with (split_key, split_addr)
+*/
+bool BPlusTree::insert(Node * node, const attr_t & key, uint32_t addr, attr_t & split_key, uint32_t & split_addr, Node *& split_node)
+{
+	if (node->leaf)
+	{
+		LeafNode *leaf = static_cast<LeafNode *>(node);
+		uint32_t pos = 0;
+		while (pos < leaf->num && entry_less(leaf->keys[pos], leaf->addrs[pos], key, addr))
+			pos++;
+
+		LeafNode *target = leaf;
+		LeafNode *right = NULL;
+		if (leaf->num == BTREE_LEAF_MAX)
+		{
+			// Move upper half to a new right sibling
+			right = new LeafNode;
+			right->leaf = true;
+			right->num = BTREE_LEAF_MAX - BTREE_LEAF_MAX / 2;
+			for (uint32_t i = 0; i < right->num; i++)
+			{
+				right->keys[i] = leaf->keys[BTREE_LEAF_MAX / 2 + i];
+				right->addrs[i] = leaf->addrs[BTREE_LEAF_MAX / 2 + i];
+			}
+			leaf->num = BTREE_LEAF_MAX / 2;
+			right->next = leaf->next;
+			leaf->next = right;
+
+			if (pos > leaf->num)
+			{
+				target = right;
+				pos -= leaf->num;
+			}
+		}
+
+		for (uint32_t i = target->num; i > pos; i--)
+		{
+			target->keys[i] = target->keys[i - 1];
+			target->addrs[i] = target->addrs[i - 1];
+		}
+		target->keys[pos] = key;
+		target->addrs[pos] = addr;
+		target->num++;
+
+		if (right == NULL)
+			return false;
+		split_key = right->keys[0];
+		split_addr = right->addrs[0];
+		split_node = right;
+		return true;
+	}
+
+	InnerNode *inner = static_cast<InnerNode *>(node);
+	uint32_t child = 0;
+	while (child < inner->num - 1u && !entry_less(key, addr, inner->keys[child], inner->addrs[child]))
+		child++;
+
+	inner->counts[child]++;
+	inner->sums[child] += key_value(key);
+
+	attr_t child_key;
+	uint32_t child_addr;
+	Node *child_node;
+	if (!insert(inner->children[child], key, addr, child_key, child_addr, child_node))
+		return false;
+
+	// Separator child_key goes before child + 1
+	attr_t keys[BTREE_INNER_MAX];
+	uint32_t addrs[BTREE_INNER_MAX];
+	Node *children[BTREE_INNER_MAX + 1];
+	uint32_t counts[BTREE_INNER_MAX + 1];
+	int64_t sums[BTREE_INNER_MAX + 1];
+	uint32_t num = inner->num;
+	for (uint32_t i = 0, j = 0; i < num - 1u; i++, j++)
+	{
+		if (i == child)
+			j++;
+		keys[j] = inner->keys[i];
+		addrs[j] = inner->addrs[i];
+	}
+	keys[child] = child_key;
+	addrs[child] = child_addr;
+	for (uint32_t i = 0, j = 0; i < num; i++, j++)
+	{
+		children[j] = inner->children[i];
+		counts[j] = inner->counts[i];
+		sums[j] = inner->sums[i];
+		if (i == child)
+			children[++j] = child_node;
+	}
+	subtree_stat(children[child], counts[child], sums[child]);
+	subtree_stat(child_node, counts[child + 1], sums[child + 1]);
+	num++;
+
+	if (num <= BTREE_INNER_MAX)
+	{
+		for (uint32_t i = 0; i < num - 1; i++)
+		{
+			inner->keys[i] = keys[i];
+			inner->addrs[i] = addrs[i];
+		}
+		for (uint32_t i = 0; i < num; i++)
+		{
+			inner->children[i] = children[i];
+			inner->counts[i] = counts[i];
+			inner->sums[i] = sums[i];
+		}
+		inner->num = num;
+		return false;
+	}
+
+	// Left keeps half the children, middle separator moves up
+	uint32_t left_num = num / 2;
+	InnerNode *right = new InnerNode;
+	right->leaf = false;
+	right->num = num - left_num;
+
+	inner->num = left_num;
+	for (uint32_t i = 0; i < left_num - 1; i++)
+	{
+		inner->keys[i] = keys[i];
+		inner->addrs[i] = addrs[i];
+	}
+	for (uint32_t i = 0; i < left_num; i++)
+	{
+		inner->children[i] = children[i];
+		inner->counts[i] = counts[i];
+		inner->sums[i] = sums[i];
+	}
+
+	split_key = keys[left_num - 1];
+	split_addr = addrs[left_num - 1];
+
+	for (uint32_t i = 0; i < right->num - 1u; i++)
+	{
+		right->keys[i] = keys[left_num + i];
+		right->addrs[i] = addrs[left_num + i];
+	}
+	for (uint32_t i = 0; i < right->num; i++)
+	{
+		right->children[i] = children[left_num + i];
+		right->counts[i] = counts[left_num + i];
+		right->sums[i] = sums[left_num + i];
+	}
+
+	split_node = right;
+	return true;
+}
+
+/*
+	BPlusTree::bulk_load()
+
+	build leaves left to right from sorted entries, then inner levels bottom up,
+	a few entries into a large tree are inserted one by one instead
+*/
+void BPlusTree::bulk_load(const EntryVector & entries)
+{
+	if (entries.empty())
+		return;
+
+	if (mSize > 0 && entries.size() < mSize / 8)
+	{
+		for (const auto & entry : entries)
+			insert(entry.first, entry.second);
+		return;
+	}
+
+	if (mSize == 0)
+	{
+		build(entries);
+		return;
+	}
+
+	EntryVector current, merged;
+	collect(current);
+	merged.reserve(current.size() + entries.size());
+	std::merge(current.begin(), current.end(), entries.begin(), entries.end(), std::back_inserter(merged),
+		[](const std::pair<attr_t, uint32_t> & a, const std::pair<attr_t, uint32_t> & b)
+	{
+		return entry_less(a.first, a.second, b.first, b.second);
+	});
+	clear();
+	build(merged);
+}
+
+void BPlusTree::build(const EntryVector & entries)
+{
+	std::vector<Node *> level;
+	std::vector<uint32_t> firsts;	// first entry of each node
+	LeafNode *prev = NULL;
+
+	// Leaves are filled up, index is read mostly
+	for (uint32_t begin = 0; begin < entries.size(); begin += BTREE_LEAF_MAX)
+	{
+		LeafNode *leaf = new LeafNode;
+		leaf->leaf = true;
+		leaf->num = std::min<uint32_t>(BTREE_LEAF_MAX, entries.size() - begin);
+		for (uint32_t i = 0; i < leaf->num; i++)
+		{
+			leaf->keys[i] = entries[begin + i].first;
+			leaf->addrs[i] = entries[begin + i].second;
+		}
+		leaf->next = NULL;
+
+		if (prev == NULL)
+			mFirst = leaf;
+		else
+			prev->next = leaf;
+		prev = leaf;
+
+		level.push_back(leaf);
+		firsts.push_back(begin);
+	}
+
+	while (level.size() > 1)
+	{
+		std::vector<Node *> parents;
+		std::vector<uint32_t> parent_firsts;
+		for (uint32_t begin = 0; begin < level.size(); begin += BTREE_INNER_MAX)
+		{
+			InnerNode *inner = new InnerNode;
+			inner->leaf = false;
+			inner->num = std::min<uint32_t>(BTREE_INNER_MAX, level.size() - begin);
+			for (uint32_t i = 0; i < inner->num; i++)
+			{
+				inner->children[i] = level[begin + i];
+				subtree_stat(level[begin + i], inner->counts[i], inner->sums[i]);
+				if (i > 0)
+				{
+					inner->keys[i - 1] = entries[firsts[begin + i]].first;
+					inner->addrs[i - 1] = entries[firsts[begin + i]].second;
+				}
+			}
+			parents.push_back(inner);
+			parent_firsts.push_back(firsts[begin]);
+		}
+		level.swap(parents);
+		firsts.swap(parent_firsts);
+	}
+
+	mRoot = level[0];
+	mSize = entries.size();
+}
+
+void BPlusTree::collect(EntryVector & out) const
+{
+	out.reserve(out.size() + mSize);
+	for (auto it = begin(); it != end(); ++it)
+		out.emplace_back(it.key(), it.addr());
+}
+
+BPlusTree::const_iterator BPlusTree::lower_bound(const attr_t & key) const
+{
+	return partition_point([&key](const attr_t & k) { return compare(k, key) < 0; });
+}
+
+BPlusTree::const_iterator BPlusTree::upper_bound(const attr_t & key) const
+{
+	return partition_point([&key](const attr_t & k) { return compare(k, key) <= 0; });
+}
+
+/*
+	BPlusTree::lower_bound()
+
+	finger search, try the hint leaf and its sibling before descending from root
+*/
+BPlusTree::const_iterator BPlusTree::lower_bound(const attr_t & key, const_iterator hint) const
+{
+	// Every entry is less than a smaller key
+	if (hint == end())
+		return end();
+
+	const LeafNode *leaf = hint.mLeaf;
+	if (compare(leaf->keys[leaf->num - 1], key) >= 0)
+		return search_leaf(leaf, hint.mPos, key);
+
+	leaf = leaf->next;
+	if (leaf == NULL)
+		return end();
+	if (compare(leaf->keys[leaf->num - 1], key) >= 0)
+		return search_leaf(leaf, 0, key);
+
+	return lower_bound(key);
+}
+
+BPlusTree::const_iterator BPlusTree::search_leaf(const LeafNode * leaf, uint32_t from, const attr_t & key) const
+{
+	uint32_t lo = from, hi = leaf->num;
+	while (lo < hi)
+	{
+		uint32_t mid = (lo + hi) / 2;
+		if (compare(leaf->keys[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == leaf->num)
+		return const_iterator(leaf->next, 0);
+	return const_iterator(leaf, lo);
+}
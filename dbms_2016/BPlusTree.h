@@ -0,0 +1,240 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+#include "database_type.h"
+
+// Entries per node, key arrays are 8 cache lines, addr arrays 2 cache lines
+#define BTREE_LEAF_MAX 32
+#define BTREE_INNER_MAX 32
+
+/*
+	BPlusTree
+
+	in-memory B+tree of (key, addr) entries for TreeIndexFile,
+	entries are ordered by key then addr, so duplicated keys are allowed
+	and every entry is unique, VARCHAR keys are ordered by whole string
+
+	keys and addrs of a node are separate sorted arrays,
+	leaves are linked to their siblings for range scans,
+	inner nodes keep entry number and INTEGER key sum of each child,
+	so entries of a key range are counted and summed in O(log n)
+
+	usage:
+		for (auto it = tree.lower_bound(k); it != tree.end() && it.key() == k; ++it)
+			it.addr()
+*/
+class BPlusTree
+{
+	struct Node
+	{
+		bool leaf;
+		uint16_t num;
+	};
+
+	struct LeafNode
+		: public Node
+	{
+		attr_t keys[BTREE_LEAF_MAX];
+		uint32_t addrs[BTREE_LEAF_MAX];
+		LeafNode *next;
+	};
+
+	// Separator i is the first entry of child i + 1
+	struct InnerNode
+		: public Node
+	{
+		attr_t keys[BTREE_INNER_MAX - 1];
+		uint32_t addrs[BTREE_INNER_MAX - 1];
+		Node *children[BTREE_INNER_MAX];
+		uint32_t counts[BTREE_INNER_MAX];	// entries below each child
+		int64_t sums[BTREE_INNER_MAX];		// INTEGER key sum below each child
+	};
+public:
+	typedef std::vector<std::pair<attr_t, uint32_t>> EntryVector;
+
+	class const_iterator
+	{
+	public:
+		const_iterator() : mLeaf(NULL), mPos(0) {}
+		const_iterator(const LeafNode *leaf, uint32_t pos) : mLeaf(leaf), mPos(pos) {}
+
+		inline const attr_t &key() const { return mLeaf->keys[mPos]; }
+		inline uint32_t addr() const { return mLeaf->addrs[mPos]; }
+
+		inline const_iterator &operator++()
+		{
+			if (++mPos >= mLeaf->num)
+			{
+				mLeaf = mLeaf->next;
+				mPos = 0;
+			}
+			return *this;
+		}
+
+		inline const_iterator operator++(int)
+		{
+			const_iterator it = *this;
+			++(*this);
+			return it;
+		}
+
+		inline bool operator==(const const_iterator &it) const { return mLeaf == it.mLeaf && mPos == it.mPos; }
+		inline bool operator!=(const const_iterator &it) const { return !(*this == it); }
+	private:
+		friend class BPlusTree;
+		const LeafNode *mLeaf;
+		uint32_t mPos;
+	};
+
+	BPlusTree();
+	~BPlusTree();
+
+	void insert(const attr_t &key, uint32_t addr);
+
+	// Entries must be sorted by (key, addr)
+	void bulk_load(const EntryVector &entries);
+
+	void clear();
+	uint32_t size() const { return mSize; }
+
+	const_iterator begin() const { return const_iterator(mFirst, 0); }
+	const_iterator end() const { return const_iterator(); }
+
+	// First entry with key not less than / larger than key
+	const_iterator lower_bound(const attr_t &key) const;
+	const_iterator upper_bound(const attr_t &key) const;
+
+	// lower_bound() starting from hint, keys of successive calls are ascending
+	const_iterator lower_bound(const attr_t &key, const_iterator hint) const;
+
+	// First entry for which pred(key) is false, pred must hold on a prefix of entries
+	template <class Pred>
+	const_iterator partition_point(Pred pred) const;
+
+	// Entries before partition_point(pred) and their INTEGER key sum, without visiting them
+	template <class Pred>
+	uint32_t count_prefix(Pred pred, int64_t &key_sum) const;
+
+	// All entries and their INTEGER key sum, from the counts of the root
+	uint32_t total(int64_t &key_sum) const;
+
+	// Whole-string order, consistent with operator== of attr_t
+	static inline int compare(const attr_t &a, const attr_t &b);
+private:
+	Node *mRoot;
+	LeafNode *mFirst;
+	uint32_t mSize;
+
+	static inline bool entry_less(const attr_t &a_key, uint32_t a_addr, const attr_t &b_key, uint32_t b_addr);
+	static inline int64_t key_value(const attr_t &key) { return (key.Domain() == INTEGER_DOMAIN) ? key.Int() : 0; }
+	static void subtree_stat(const Node *node, uint32_t &count, int64_t &key_sum);
+
+	bool insert(Node *node, const attr_t &key, uint32_t addr, attr_t &split_key, uint32_t &split_addr, Node *&split_node);
+	void free(Node *node);
+	void collect(EntryVector &out) const;
+	void build(const EntryVector &entries);
+	const_iterator search_leaf(const LeafNode *leaf, uint32_t from, const attr_t &key) const;
+};
+
+inline int BPlusTree::compare(const attr_t & a, const attr_t & b)
+{
+	if (a.Domain() == INTEGER_DOMAIN)
+		return (a.Int() < b.Int()) ? -1 : (a.Int() > b.Int()) ? 1 : 0;
+	if (a == b)
+		return 0;
+	return strncmp(a.Varchar(), b.Varchar(), ATTR_SIZE_MAX);
+}
+
+inline bool BPlusTree::entry_less(const attr_t & a_key, uint32_t a_addr, const attr_t & b_key, uint32_t b_addr)
+{
+	int cmp = compare(a_key, b_key);
+	return cmp < 0 || (cmp == 0 && a_addr < b_addr);
+}
+
+template<class Pred>
+inline BPlusTree::const_iterator BPlusTree::partition_point(Pred pred) const
+{
+	if (mRoot == NULL)
+		return end();
+
+	const Node *node = mRoot;
+	while (!node->leaf)
+	{
+		const InnerNode *inner = static_cast<const InnerNode *>(node);
+		uint32_t lo = 0, hi = inner->num - 1;
+		while (lo < hi)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			if (pred(inner->keys[mid]))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		node = inner->children[lo];
+	}
+
+	const LeafNode *leaf = static_cast<const LeafNode *>(node);
+	uint32_t lo = 0, hi = leaf->num;
+	while (lo < hi)
+	{
+		uint32_t mid = (lo + hi) / 2;
+		if (pred(leaf->keys[mid]))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	// Partition point is the first entry of next leaf
+	if (lo == leaf->num)
+		return const_iterator(leaf->next, 0);
+	return const_iterator(leaf, lo);
+}
+
+template<class Pred>
+inline uint32_t BPlusTree::count_prefix(Pred pred, int64_t & key_sum) const
+{
+	uint32_t count = 0;
+	key_sum = 0;
+	if (mRoot == NULL)
+		return 0;
+
+	// Children left of the one holding the partition point are all counted
+	const Node *node = mRoot;
+	while (!node->leaf)
+	{
+		const InnerNode *inner = static_cast<const InnerNode *>(node);
+		uint32_t lo = 0, hi = inner->num - 1;
+		while (lo < hi)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			if (pred(inner->keys[mid]))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (uint32_t i = 0; i < lo; i++)
+		{
+			count += inner->counts[i];
+			key_sum += inner->sums[i];
+		}
+		node = inner->children[lo];
+	}
+
+	const LeafNode *leaf = static_cast<const LeafNode *>(node);
+	uint32_t lo = 0, hi = leaf->num;
+	while (lo < hi)
+	{
+		uint32_t mid = (lo + hi) / 2;
+		if (pred(leaf->keys[mid]))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (uint32_t i = 0; i < lo; i++)
+		key_sum += key_value(leaf->keys[i]);
+	return count + lo;
+}
@@ -0,0 +1,358 @@
+#include "Benchmark.h"
+#include "DatabaseLite.h"
+#include "FileUtil.h"
+#include "WorkerPool.h"
+
+#include "system.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Column without index in a combination
+#define BENCH_NO_INDEX -1
+#define BENCH_INDEX_CHOICES 4
+
+static const int kIndexChoices[] = { BENCH_NO_INDEX, HASH, TREE, BITMAP };
+static const char *kIndexNames[] = { "NONE", "HASH", "TREE", "BITMAP" };
+
+/*
+	Count output lines instead of printing them
+*/
+class LineCountBuf
+	: public std::streambuf
+{
+public:
+	LineCountBuf() : mLines(0) {}
+	uint64_t lines() const { return mLines; }
+protected:
+	int overflow(int c)
+	{
+		if (c == '\n')
+			mLines++;
+		return c;
+	}
+
+	std::streamsize xsputn(const char *s, std::streamsize n)
+	{
+		for (std::streamsize i = 0; i < n; i++)
+			mLines += (s[i] == '\n');
+		return n;
+	}
+private:
+	uint64_t mLines;
+};
+
+static const char *index_name(int type)
+{
+	for (int i = 0; i < BENCH_INDEX_CHOICES; i++)
+		if (kIndexChoices[i] == type)
+			return kIndexNames[i];
+	return "NONE";
+}
+
+Benchmark::Benchmark(uint64_t rows) : mRows(rows)
+{
+	mQueries = {
+		{ "query1", "SELECT * FROM trans WHERE attr5 = 0;",
+			{ { "trans", "attr5" } }, { "trans" } },
+		{ "query2", "SELECT COUNT(*) FROM user1, trans WHERE user1.attr1 = trans.attr2 AND user1.attr5 > 50000;",
+			{ { "user1", "attr1" }, { "trans", "attr2" }, { "user1", "attr5" } }, { "user1", "trans" } },
+		{ "query3", "SELECT COUNT(*) FROM user1 WHERE attr3 > 100000 AND attr3 < 200000;",
+			{ { "user1", "attr3" } }, { "user1" } },
+		{ "query4", "SELECT COUNT(*) FROM trans;",
+			{}, { "trans" } },
+		{ "query5", "SELECT SUM(attr4) FROM user1 WHERE attr3 = 1510503 OR attr5 > 500000;",
+			{ { "user1", "attr3" }, { "user1", "attr5" } }, { "user1" } }
+	};
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+/*
+	Benchmark::run()
+
+	load generated tables once, then for each query
+	create/drop indexes to reach every combination and time the query
+*/
+void Benchmark::run()
+{
+	std::string rows = std::to_string(mRows);
+	std::string user_path = "bench_user1_" + rows + ".csv";
+	std::string trans_path = "bench_trans_" + rows + ".csv";
+	generate(user_path.c_str(), trans_path.c_str());
+
+	remove("bench.dbs");
+	DatabaseLite db("bench.dbs");
+
+	std::string setup =
+		"CREATE TABLE user1 (attr1 int, attr2 varchar(20), attr3 int, attr4 int, attr5 int);"
+		"CREATE TABLE trans (attr1 varchar(40), attr2 int, attr3 int, attr4 int, attr5 int);"
+		"COPY user1 FROM '" + user_path + "';"
+		"COPY trans FROM '" + trans_path + "';";
+
+	LineCountBuf null_buf;
+	std::streambuf *cout_buf = std::cout.rdbuf(&null_buf);
+	db.exec(setup);
+	std::cout.rdbuf(cout_buf);
+
+	mResults.clear();
+	for (const Query & query : mQueries)
+		run_query(db, query);
+}
+
+/*
+	Benchmark::run_query()
+
+	enumerate 4^k index combinations of query columns,
+	indexes are left none before returning
+*/
+void Benchmark::run_query(DatabaseLite & db, const Query & query)
+{
+	const int k = query.columns.size();
+	std::vector<int> state(k, BENCH_NO_INDEX);
+
+	int combinations = 1;
+	for (int i = 0; i < k; i++)
+		combinations *= BENCH_INDEX_CHOICES;
+
+	for (int c = 0; c <= combinations; c++)
+	{
+		// Last round only resets indexes
+		bool reset = c == combinations;
+
+		std::string indexes;
+		for (int i = 0, code = c; i < k; i++, code /= BENCH_INDEX_CHOICES)
+		{
+			int type = reset ? BENCH_NO_INDEX : kIndexChoices[code % BENCH_INDEX_CHOICES];
+			const IndexColumn & column = query.columns[i];
+			if (state[i] != type)
+			{
+				if (state[i] != BENCH_NO_INDEX)
+					db.exec_drop_index(column.table, column.attr);
+				if (type != BENCH_NO_INDEX)
+					db.exec_create_index(column.table, column.attr, (IndexType)type);
+				state[i] = type;
+			}
+
+			if (!indexes.empty())
+				indexes += ",";
+			indexes += std::string(column.table) + "." + column.attr + "=" + index_name(type);
+		}
+		if (reset)
+			break;
+
+		std::string sql = query.sql;
+		double best_ms = 0;
+		uint64_t output_rows = 0;
+		for (int r = 0; r < BENCH_REPEAT; r++)
+		{
+			LineCountBuf count_buf;
+			std::streambuf *cout_buf = std::cout.rdbuf(&count_buf);
+
+			auto begin = std::chrono::steady_clock::now();
+			db.exec(sql);
+			auto end = std::chrono::steady_clock::now();
+
+			std::cout.rdbuf(cout_buf);
+
+			double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+			if (r == 0 || ms < best_ms)
+				best_ms = ms;
+			output_rows = count_buf.lines();
+		}
+
+		Result result;
+		result.query = query.name;
+		result.indexes = indexes;
+		result.inputRows = mRows * query.tables.size();
+		result.outputRows = output_rows;
+		result.wallMs = best_ms;
+		result.rowsPerSec = (best_ms > 0) ? result.inputRows / (best_ms / 1000.0) : 0;
+		result.peakRssKb = peak_rss_kb();
+		mResults.push_back(result);
+
+		printf("%s\t%s\t%.3f ms\t%.0f rows/s\n", query.name, indexes.c_str(), best_ms, result.rowsPerSec);
+	}
+}
+
+/*
+	Benchmark::generate()
+
+	distribution follows user.sql / trans.sql,
+	trans.attr2 refers to user1.attr1, most trans.attr5 are 0
+	files of the same scale are reused
+*/
+void Benchmark::generate(const char * user_path, const char * trans_path)
+{
+	std::mt19937_64 rng(2016);
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+
+	if (!FileUtil::exist(user_path))
+	{
+		FILE *file = fopen(user_path, "w");
+		char name[21];
+		for (uint64_t i = 1; i <= mRows; i++)
+		{
+			int len = 2 + rng() % 10;
+			for (int j = 0; j < len; j++)
+				name[j] = letters[rng() % 26];
+			name[len] = '\0';
+
+			int attr3 = rng() % 2600000;
+			int attr4 = 50 + rng() % 80;
+			int attr5 = attr3 / (1 + rng() % 5);
+			fprintf(file, "%llu,%s,%d,%d,%d\n", (unsigned long long)i, name, attr3, attr4, attr5);
+		}
+		fclose(file);
+	}
+
+	if (!FileUtil::exist(trans_path))
+	{
+		FILE *file = fopen(trans_path, "w");
+		for (uint64_t i = 1; i <= mRows; i++)
+		{
+			unsigned long long attr1 = rng() % 4000000000ULL;
+			unsigned long long attr2 = 1 + rng() % mRows;
+			int attr3 = 100 + rng() % 700;
+			int attr4 = (rng() % 3 == 0) ? 0 : rng() % 200;
+			int attr5 = (rng() % 5 < 3) ? 0 : rng() % 1000;
+			fprintf(file, "%llu,%llu,%d,%d,%d\n", attr1, attr2, attr3, attr4, attr5);
+		}
+		fclose(file);
+	}
+}
+
+void Benchmark::write_json(const char * json_path)
+{
+	FILE *file = fopen(json_path, "w");
+	if (file == NULL)
+		throw exception_t(BENCH_BAD_BASELINE, json_path);
+
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"rows\": %llu,\n", (unsigned long long)mRows);
+	fprintf(file, "\t\"layout\": \"%s\",\n", columnar ? "column" : "row");
+	fprintf(file, "\t\"workers\": %d,\n", WorkerPool::instance().size());
+	fprintf(file, "\t\"results\": [\n");
+	for (int i = 0; i < mResults.size(); i++)
+	{
+		const Result & r = mResults[i];
+		fprintf(file, "\t\t{\"query\": \"%s\", \"indexes\": \"%s\", \"input_rows\": %llu, \"output_rows\": %llu, "
+			"\"wall_ms\": %.3f, \"rows_per_sec\": %.0f, \"peak_rss_kb\": %llu}%s\n",
+			r.query.c_str(), r.indexes.c_str(),
+			(unsigned long long)r.inputRows, (unsigned long long)r.outputRows,
+			r.wallMs, r.rowsPerSec, (unsigned long long)r.peakRssKb,
+			(i + 1 < mResults.size()) ? "," : "");
+	}
+	fprintf(file, "\t]\n}\n");
+	fclose(file);
+}
+
+// Value of "key" in a flat JSON object, string without quotes
+static bool json_field(const std::string & object, const char * key, std::string & value)
+{
+	std::string pattern = std::string("\"") + key + "\"";
+	size_t pos = object.find(pattern);
+	if (pos == std::string::npos)
+		return false;
+	pos = object.find(':', pos + pattern.size());
+	if (pos == std::string::npos)
+		return false;
+	pos = object.find_first_not_of(" \t", pos + 1);
+	if (pos == std::string::npos)
+		return false;
+
+	if (object[pos] == '"')
+	{
+		size_t end = object.find('"', pos + 1);
+		value = object.substr(pos + 1, end - pos - 1);
+	}
+	else
+	{
+		size_t end = object.find_first_of(",}", pos);
+		value = object.substr(pos, end - pos);
+	}
+	return true;
+}
+
+/*
+	Benchmark::compare()
+
+	match results by query and indexes, baseline is a json written by write_json()
+*/
+int Benchmark::compare(const char * baseline_path)
+{
+	std::ifstream ifs(baseline_path);
+	if (!ifs)
+		throw exception_t(BENCH_BAD_BASELINE, baseline_path);
+	std::stringstream ss;
+	ss << ifs.rdbuf();
+	std::string json = ss.str();
+
+	std::map<std::string, double> baseline;
+	size_t pos = json.find("\"results\"");
+	if (pos == std::string::npos)
+		throw exception_t(BENCH_BAD_BASELINE, "Baseline has no results");
+
+	while ((pos = json.find('{', pos)) != std::string::npos)
+	{
+		size_t end = json.find('}', pos);
+		if (end == std::string::npos)
+			break;
+		std::string object = json.substr(pos, end - pos + 1);
+		std::string query, indexes, wall_ms;
+		if (json_field(object, "query", query) && json_field(object, "indexes", indexes) && json_field(object, "wall_ms", wall_ms))
+			baseline[query + "|" + indexes] = atof(wall_ms.c_str());
+		pos = end + 1;
+	}
+
+	int regressions = 0;
+	for (const Result & r : mResults)
+	{
+		auto it = baseline.find(r.query + "|" + r.indexes);
+		if (it == baseline.end())
+			continue;
+
+		double base_ms = it->second;
+		if (r.wallMs > base_ms * (1 + BENCH_TOLERANCE) && r.wallMs - base_ms > BENCH_MIN_DELTA_MS)
+		{
+			printf("REGRESSION %s\t%s\t%.3f ms (baseline %.3f ms)\n", r.query.c_str(), r.indexes.c_str(), r.wallMs, base_ms);
+			regressions++;
+		}
+	}
+	printf("%d regressions against %s\n", regressions, baseline_path);
+	return regressions;
+}
+
+uint64_t Benchmark::peak_rss_kb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize / 1024;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
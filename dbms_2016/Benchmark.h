@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "IndexFile.h"
+
+// Each query is run BENCH_REPEAT times, the fastest run is reported
+#define BENCH_REPEAT 3
+
+// Slower than baseline by this ratio (and BENCH_MIN_DELTA_MS) is a regression
+#define BENCH_TOLERANCE 0.2
+#define BENCH_MIN_DELTA_MS 1.0
+
+#define BENCH_BAD_BASELINE 0x1
+
+/*
+	Benchmark
+
+	reproduce query1-5 of report.txt on synthetic user1/trans tables,
+	every query is run under all none/HASH/TREE/BITMAP combinations of its join and filter columns
+	usage:
+		Benchmark bench(rows);
+		bench.run();
+		bench.write_json("bench.json");
+		int regressions = bench.compare("baseline.json");
+*/
+class Benchmark
+{
+public:
+	struct Result
+	{
+		std::string query;
+		std::string indexes;	// "user1.attr1=TREE,trans.attr2=NONE"
+		uint64_t inputRows;
+		uint64_t outputRows;
+		double wallMs;
+		double rowsPerSec;
+		uint64_t peakRssKb;
+	};
+
+	Benchmark(uint64_t rows);
+	~Benchmark();
+
+	void run();
+	void write_json(const char *json_path);
+
+	// Print results slower than baseline, return number of regressions
+	int compare(const char *baseline_path);
+
+	static uint64_t peak_rss_kb();
+private:
+	struct IndexColumn
+	{
+		const char *table;
+		const char *attr;
+	};
+
+	struct Query
+	{
+		const char *name;
+		const char *sql;
+		std::vector<IndexColumn> columns;
+		std::vector<const char *> tables;
+	};
+
+	uint64_t mRows;
+	std::vector<Query> mQueries;
+	std::vector<Result> mResults;
+
+	void generate(const char *user_path, const char *trans_path);
+	void run_query(class DatabaseLite &db, const Query &query);
+};
@@ -0,0 +1,518 @@
+#include "BulkLoader.h"
+#include "MappedFile.h"
+#include "FileUtil.h"
+
+#include "system.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+static inline void skip_space(const char *&p, const char *end)
+{
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+}
+
+static inline bool is_ident_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+// Case-insensitive keyword, not followed by identifier character
+static bool match_keyword(const char *&p, const char *end, const char *keyword)
+{
+	skip_space(p, end);
+	const char *q = p;
+	for (; *keyword != '\0'; keyword++, q++)
+	{
+		if (q >= end || toupper((unsigned char)*q) != *keyword)
+			return false;
+	}
+	if (q < end && is_ident_char(*q))
+		return false;
+	p = q;
+	return true;
+}
+
+static bool match_char(const char *&p, const char *end, char c)
+{
+	skip_space(p, end);
+	if (p < end && *p == c)
+	{
+		p++;
+		return true;
+	}
+	return false;
+}
+
+static bool parse_ident(const char *&p, const char *end, std::string &ident)
+{
+	skip_space(p, end);
+	const char *q = p;
+	while (q < end && is_ident_char(*q))
+		q++;
+	if (q == p)
+		return false;
+	ident.assign(p, q);
+	p = q;
+	return true;
+}
+
+static bool parse_string(const char *&p, const char *end, std::string &str)
+{
+	skip_space(p, end);
+	if (p >= end || *p != '\'')
+		return false;
+	const char *q = std::find(p + 1, end, '\'');
+	if (q == end)
+		return false;
+	str.assign(p + 1, q);
+	p = q + 1;
+	return true;
+}
+
+// Whole of s is a decimal int, spaces around it are allowed
+static bool to_int(const char *s, int &ival)
+{
+	char *s_end;
+	errno = 0;
+	long lval = strtol(s, &s_end, 10);
+	while (isspace((unsigned char)*s_end))
+		s_end++;
+	if (s_end == s || *s_end != '\0' || errno == ERANGE || lval < INT_MIN || lval > INT_MAX)
+		return false;
+	ival = (int)lval;
+	return true;
+}
+
+// Not an integer literal is false, one out of int range throws with p left at it
+static bool parse_int(const char *&p, const char *end, int &ival)
+{
+	skip_space(p, end);
+	const char *q = p;
+	if (q < end && (*q == '-' || *q == '+'))
+		q++;
+	const char *digits = q;
+	while (q < end && isdigit((unsigned char)*q))
+		q++;
+	if (q == digits || (q < end && is_ident_char(*q)))
+		return false;
+
+	std::string literal(p, q);
+	if (!to_int(literal.c_str(), ival))
+		throw exception_t(BULK_VALUE_ERROR, ("integer out of range '" + literal + "'").c_str());
+	p = q;
+	return true;
+}
+
+// Literal must match domain of column
+static bool parse_value(const char *&p, const char *end, uint8_t attr_type, attr_t &attr)
+{
+	if (attr_type == ATTR_TYPE_INTEGER)
+	{
+		int ival;
+		if (!parse_int(p, end, ival))
+			return false;
+		attr = ival;
+	}
+	else
+	{
+		std::string sval;
+		if (!parse_string(p, end, sval))
+			return false;
+		attr = sval.c_str();
+	}
+	return true;
+}
+
+static void init_tuple(LightTable &table, AttrTuple &tuple)
+{
+	tuple.resize(table.tuple_size());
+	for (int i = 0; i < tuple.size(); i++)
+	{
+		if (table.get_attr_type(i) == ATTR_TYPE_INTEGER)
+			tuple[i] = 0;
+		else
+			tuple[i] = "";
+	}
+}
+
+BulkLoader::BulkLoader(DatabaseLiteFile & dbf) :
+	mDbf(dbf), mBatchTable(NULL), mSkipped(0)
+{
+}
+
+BulkLoader::~BulkLoader()
+{
+}
+
+bool BulkLoader::exec(const std::string & stmt, uint32_t line)
+{
+	const char *begin = stmt.c_str();
+	const char *p = begin;
+	const char *end = p + stmt.size();
+
+	try
+	{
+		if (match_keyword(p, end, "INSERT"))
+			return exec_insert(p, end);
+		if (match_keyword(p, end, "COPY"))
+			return exec_copy(p, end);
+		if (match_keyword(p, end, "LOAD"))
+			return exec_load_data(p, end);
+	}
+	catch (exception_t e)
+	{
+		if (e.code != BULK_VALUE_ERROR)
+			throw;
+		// p is left at the bad value
+		std::string msg = "line " + std::to_string(line + std::count(begin, p, '\n')) + ": " + e.msg;
+		throw exception_t(BULK_VALUE_ERROR, msg.c_str());
+	}
+	return false;
+}
+
+/*
+	BulkLoader::exec_insert()
+
+	INSERT INTO t [(col, ...)] VALUES (v, ...), (v, ...), ...
+	whole statement is parsed before any tuple is put,
+	so a statement of other shape can still go through SQLParser
+*/
+bool BulkLoader::exec_insert(const char *& p, const char * end)
+{
+	std::string tablename;
+	if (!match_keyword(p, end, "INTO") || !parse_ident(p, end, tablename))
+		return false;
+
+	LightTable & table = mDbf.get_table(tablename);
+
+	// Column mapping, order mapping if no column list
+	std::vector<int> col_ids;
+	if (match_char(p, end, '('))
+	{
+		std::string colname;
+		do
+		{
+			if (!parse_ident(p, end, colname) || !table.has_attr(colname))
+				return false;
+			col_ids.push_back(table.get_attr_id(colname));
+		} while (match_char(p, end, ','));
+
+		if (!match_char(p, end, ')'))
+			return false;
+	}
+	else
+	{
+		for (int i = 0; i < table.tuple_size(); i++)
+			col_ids.push_back(i);
+	}
+
+	if (!match_keyword(p, end, "VALUES"))
+		return false;
+
+	std::vector<AttrTuple> tuples;
+	do
+	{
+		if (!match_char(p, end, '('))
+			return false;
+
+		tuples.emplace_back();
+		AttrTuple & tuple = tuples.back();
+		init_tuple(table, tuple);
+
+		int i = 0;
+		do
+		{
+			if (i >= col_ids.size() || !parse_value(p, end, table.get_attr_type(col_ids[i]), tuple[col_ids[i]]))
+				return false;
+			i++;
+		} while (match_char(p, end, ','));
+
+		if (!match_char(p, end, ')'))
+			return false;
+	} while (match_char(p, end, ','));
+
+	match_char(p, end, ';');
+	skip_space(p, end);
+	if (p != end)
+		return false;
+
+	for (AttrTuple & tuple : tuples)
+		put(table, tuple);
+	return true;
+}
+
+/*
+	BulkLoader::exec_copy()
+
+	COPY t FROM 'file' [DELIMITER 'c'] [HEADER]
+*/
+bool BulkLoader::exec_copy(const char *& p, const char * end)
+{
+	std::string tablename, path, delim = ",";
+	if (!parse_ident(p, end, tablename) || !match_keyword(p, end, "FROM") || !parse_string(p, end, path))
+		return false;
+
+	if (match_keyword(p, end, "DELIMITER") && (!parse_string(p, end, delim) || delim.size() != 1))
+		return false;
+	bool header = match_keyword(p, end, "HEADER");
+
+	match_char(p, end, ';');
+	skip_space(p, end);
+	if (p != end)
+		return false;
+
+	copy(mDbf.get_table(tablename), path.c_str(), delim[0], header);
+	return true;
+}
+
+/*
+	BulkLoader::exec_load_data()
+
+	LOAD DATA INFILE 'file' INTO TABLE t [FIELDS TERMINATED BY 'c'] [IGNORE 1 LINES]
+*/
+bool BulkLoader::exec_load_data(const char *& p, const char * end)
+{
+	std::string tablename, path, delim = ",";
+	if (!match_keyword(p, end, "DATA") || !match_keyword(p, end, "INFILE") || !parse_string(p, end, path)
+		|| !match_keyword(p, end, "INTO") || !match_keyword(p, end, "TABLE") || !parse_ident(p, end, tablename))
+		return false;
+
+	if (match_keyword(p, end, "FIELDS"))
+	{
+		if (!match_keyword(p, end, "TERMINATED") || !match_keyword(p, end, "BY")
+			|| !parse_string(p, end, delim) || delim.size() != 1)
+			return false;
+	}
+
+	bool header = false;
+	if (match_keyword(p, end, "IGNORE"))
+	{
+		int lines;
+		if (!parse_int(p, end, lines) || lines != 1 || !match_keyword(p, end, "LINES"))
+			return false;
+		header = true;
+	}
+
+	match_char(p, end, ';');
+	skip_space(p, end);
+	if (p != end)
+		return false;
+
+	copy(mDbf.get_table(tablename), path.c_str(), delim[0], header);
+	return true;
+}
+
+/*
+	BulkLoader::copy()
+
+	one tuple per line, fields in column order separated by delim,
+	a field may be quoted by '"', "" in quoted field is a '"',
+	a line must have one field per column and nothing after a closing quote
+*/
+uint32_t BulkLoader::copy(LightTable & table, const char * csv_path, char delim, bool header)
+{
+	if (!FileUtil::exist(csv_path))
+		throw exception_t(BULK_OPEN_ERROR, csv_path);
+
+	MappedFile file;
+	if (!file.map(csv_path))
+		return 0;
+
+	const char *p = file.data();
+	const char *end = p + file.size();
+	const int tuple_size = table.tuple_size();
+
+	AttrTuple tuple;
+	std::string field;
+	uint32_t line = 0, num = 0;
+	while (p < end)
+	{
+		const char *eol = std::find(p, end, '\n');
+		const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+		line++;
+
+		if (line_end == p || (header && line == 1))
+		{
+			p = (eol < end) ? eol + 1 : end;
+			continue;
+		}
+
+		init_tuple(table, tuple);
+		int i = 0;
+		const char *q = p;
+		for (;; i++)
+		{
+			field.clear();
+			if (q < line_end && *q == '"')
+			{
+				for (q++; q < line_end; q++)
+				{
+					if (*q == '"' && q + 1 < line_end && q[1] == '"')
+						field.push_back(*q++);
+					else if (*q == '"')
+						break;
+					else
+						field.push_back(*q);
+				}
+				if (q >= line_end)
+				{
+					std::string msg = std::string(csv_path) + ":" + std::to_string(line) + ": unterminated quote";
+					throw exception_t(BULK_CSV_ERROR, msg.c_str());
+				}
+				if (++q < line_end && *q != delim)
+				{
+					std::string msg = std::string(csv_path) + ":" + std::to_string(line) + ": text after closing quote";
+					throw exception_t(BULK_CSV_ERROR, msg.c_str());
+				}
+			}
+			else
+			{
+				const char *field_end = std::find(q, line_end, delim);
+				field.assign(q, field_end);
+				q = field_end;
+			}
+
+			if (i >= tuple_size)
+			{
+				std::string msg = std::string(csv_path) + ":" + std::to_string(line) + ": too many fields";
+				throw exception_t(BULK_CSV_ERROR, msg.c_str());
+			}
+
+			if (table.get_attr_type(i) == ATTR_TYPE_INTEGER)
+			{
+				int ival;
+				if (!to_int(field.c_str(), ival))
+				{
+					std::string msg = std::string(csv_path) + ":" + std::to_string(line) + ": bad integer '" + field + "'";
+					throw exception_t(BULK_CSV_ERROR, msg.c_str());
+				}
+				tuple[i] = ival;
+			}
+			else
+			{
+				tuple[i] = field.c_str();
+			}
+
+			if (q >= line_end)
+				break;
+			q++;
+		}
+
+		if (i + 1 < tuple_size)
+		{
+			std::string msg = std::string(csv_path) + ":" + std::to_string(line) + ": too few fields";
+			throw exception_t(BULK_CSV_ERROR, msg.c_str());
+		}
+
+		put(table, tuple);
+		num++;
+		p = (eol < end) ? eol + 1 : end;
+	}
+	return num;
+}
+
+void BulkLoader::finish()
+{
+	flush();
+	for (LightTable *table : mTables)
+		table->bulk_end();
+	mTables.clear();
+
+	if (mSkipped > 0)
+		Error("Skip %u duplicated tuples\n", mSkipped);
+	mSkipped = 0;
+}
+
+bool BulkLoader::next_statement(const std::string & script, size_t & pos, std::string & stmt)
+{
+	bool quoted = false;
+	size_t begin = pos;
+	for (; pos < script.size(); pos++)
+	{
+		if (script[pos] == '\'')
+			quoted = !quoted;
+		else if (script[pos] == ';' && !quoted)
+			break;
+	}
+
+	stmt.assign(script, begin, pos - begin);
+	if (pos < script.size())
+		pos++;
+
+	// Trailing spaces after last ';'
+	return stmt.find_first_not_of(" \t\r\n") != std::string::npos || pos < script.size();
+}
+
+bool BulkLoader::is_bulk(const std::string & stmt)
+{
+	const char *p = stmt.c_str();
+	const char *end = p + stmt.size();
+	return match_keyword(p, end, "INSERT") || match_keyword(p, end, "COPY") || match_keyword(p, end, "LOAD");
+}
+
+void BulkLoader::put(LightTable & table, AttrTuple & tuple)
+{
+	if (mBatchTable != &table)
+	{
+		flush();
+		mBatchTable = &table;
+	}
+
+	mBatch.push_back(tuple);
+	if (mBatch.size() >= BULK_BATCH_SIZE)
+		flush();
+}
+
+/*
+	BulkLoader::flush()
+
+	a table enters bulk mode on its first full batch,
+	few tuples are inserted one by one, not worth rebuilding indexes
+*/
+void BulkLoader::flush()
+{
+	if (mBatchTable == NULL || mBatch.empty())
+	{
+		mBatchTable = NULL;
+		return;
+	}
+
+	LightTable & table = *mBatchTable;
+	if (std::find(mTables.begin(), mTables.end(), &table) == mTables.end())
+	{
+		if (mBatch.size() >= BULK_BATCH_SIZE)
+		{
+			table.bulk_begin();
+			mTables.push_back(&table);
+		}
+	}
+
+	if (std::find(mTables.begin(), mTables.end(), &table) != mTables.end())
+	{
+		mSkipped += mBatch.size() - table.bulk_append(mBatch);
+	}
+	else
+	{
+		for (AttrTuple & tuple : mBatch)
+		{
+			try
+			{
+				table.insert(tuple);
+			}
+			catch (exception_t e)
+			{
+				if (e.code != INSERT_DUPLICATE_TUPLE)
+					throw;
+				mSkipped++;
+			}
+		}
+	}
+	mBatch.clear();
+	mBatchTable = NULL;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "database_type.h"
+#include "LightTable.h"
+#include "DatabaseLiteFile.h"
+
+#define BULK_BATCH_SIZE 4096
+
+#define BULK_CSV_ERROR 0x1
+#define BULK_OPEN_ERROR 0x2
+#define BULK_VALUE_ERROR 0x3
+
+/*
+	BulkLoader
+
+	fast path of
+		INSERT INTO t [(col, ...)] VALUES (...), (...), ...
+		COPY t FROM 'file' [DELIMITER 'c'] [HEADER]
+		LOAD DATA INFILE 'file' INTO TABLE t [FIELDS TERMINATED BY 'c'] [IGNORE 1 LINES]
+	statements are scanned without SQLParser, tuples are appended in batches
+	and secondary indexes of each touched table are built once in finish()
+	a tuple whose primary key or whole tuple is already in the table is
+	skipped and counted, finish() reports the count, the rest still loads,
+	DatabaseLite::exec_insert() skips them the same way
+	usage:
+		BulkLoader loader(dbf);
+		if (!loader.exec(stmt))
+			... // other statement, finish() then use SQLParser
+		loader.finish();
+*/
+class BulkLoader
+{
+public:
+	BulkLoader(DatabaseLiteFile &dbf);
+	~BulkLoader();
+
+	// Return false if stmt is not a bulk statement of supported shape, nothing is loaded
+	// An integer out of int range throws BULK_VALUE_ERROR with its line, stmt starts at line
+	bool exec(const std::string &stmt, uint32_t line = 1);
+
+	// Return number of tuples read from file
+	uint32_t copy(LightTable &table, const char *csv_path, char delim, bool header);
+
+	// Flush batches and build indexes, report skipped duplicated tuples
+	void finish();
+
+	// Split script at ';' outside of quotes, return false at end of script
+	static bool next_statement(const std::string &script, size_t &pos, std::string &stmt);
+
+	// Statement starts with INSERT, COPY or LOAD
+	static bool is_bulk(const std::string &stmt);
+private:
+	DatabaseLiteFile &mDbf;
+	std::vector<LightTable *> mTables;
+	LightTable *mBatchTable;
+	std::vector<AttrTuple> mBatch;
+	uint32_t mSkipped;
+
+	// p is left where parsing stopped
+	bool exec_insert(const char *&p, const char *end);
+	bool exec_copy(const char *&p, const char *end);
+	bool exec_load_data(const char *&p, const char *end);
+
+	void put(LightTable &table, AttrTuple &tuple);
+	void flush();
+};
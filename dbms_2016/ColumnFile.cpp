@@ -0,0 +1,722 @@
+#include "ColumnFile.h"
+#include "ScanKernel.h"
+
+#include "system.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+/*
+	Same semantic as attr_t comparison operators,
+	EQ/NEQ compare whole string, LESS/LARGE compare ATTR_NUM_MAX prefix
+*/
+static inline bool varchar_match(const char *a, relation_type_t rel_type, const char *b)
+{
+	switch (rel_type)
+	{
+	case EQ: return strncmp(a, b, ATTR_SIZE_MAX) == 0;
+	case NEQ: return strncmp(a, b, ATTR_SIZE_MAX) != 0;
+	case LESS: return strncmp(a, b, ATTR_NUM_MAX) < 0;
+	case LARGE: return strncmp(a, b, ATTR_NUM_MAX) > 0;
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unknown relation type.");
+	}
+}
+
+ColumnFile::ColumnFile() : mRowsize(0), mSize(0), mDirty(false)
+{
+}
+
+ColumnFile::~ColumnFile()
+{
+}
+
+void ColumnFile::init(const SequenceElementType * types, SizeVector & sizes, int num)
+{
+	mMap.unmap();
+	mColumns.clear();
+	mColumns.resize(num);
+	for (int i = 0; i < num; i++)
+	{
+		Column & column = mColumns[i];
+		column.type = types[i];
+		column.width = (types[i] == SEQ_VARCHAR) ? sizeof(int32_t) : DatFile::width(types[i], sizes[i]);
+		column.data = NULL;
+		column.dictWidth = DatFile::width(types[i], sizes[i]);
+		column.dictNum = 0;
+		column.dict = NULL;
+		column.sorted = true;
+	}
+
+	mSizes.assign(sizes.begin(), sizes.end());
+
+	mRowsize = 0;
+	for (int i = 0; i < mSizes.size(); i++)
+		mRowsize += mSizes[i];
+	mSize = 0;
+	mDirty = true;
+}
+
+uint32_t ColumnFile::put(const AttrTuple & tuple)
+{
+	assert(tuple.size() == mColumns.size());
+
+	if (mMap.mapped())
+		own();
+
+	for (int i = 0; i < mColumns.size(); i++)
+	{
+		Column & column = mColumns[i];
+		size_t offset = column.owned.size();
+		column.owned.resize(offset + column.width, 0);
+
+		switch (column.type)
+		{
+		case SEQ_INT:
+		{
+			int32_t ival = tuple[i].Int();
+			memcpy(&column.owned[offset], &ival, sizeof(int32_t));
+			break;
+		}
+		case SEQ_VARCHAR:
+		{
+			int32_t code = encode(column, tuple[i].Varchar());
+			memcpy(&column.owned[offset], &code, sizeof(int32_t));
+			break;
+		}
+		default:
+			throw exception_t(COLFILE_UNEXPECTED_TYPE, "Unexpected type");
+		}
+		column.data = column.owned.data();
+	}
+	mDirty = true;
+	return mSize++;
+}
+
+AttrTuple ColumnFile::get(uint32_t index)
+{
+	if (index >= mSize)
+		throw COLFILE_BAD_POS;
+
+	AttrTuple tuple(mColumns.size());
+	for (int i = 0; i < mColumns.size(); i++)
+		tuple[i] = get_attr(index, i);
+	return tuple;
+}
+
+attr_t ColumnFile::get_attr(uint32_t index, int col)
+{
+	if (index >= mSize)
+		throw COLFILE_BAD_POS;
+
+	if (mColumns[col].type == SEQ_INT)
+		return attr_t(get_int(index, col));
+	else
+		return attr_t(get_varchar(index, col));
+}
+
+bool ColumnFile::equal(uint32_t index, const AttrTuple & tuple)
+{
+	for (int i = 0; i < mColumns.size(); i++)
+	{
+		if (mColumns[i].type == SEQ_INT)
+		{
+			if (tuple[i].Domain() != INTEGER_DOMAIN || tuple[i].Int() != get_int(index, i))
+				return false;
+		}
+		else
+		{
+			if (tuple[i].Domain() != VARCHAR_DOMAIN || !varchar_match(get_varchar(index, i), EQ, tuple[i].Varchar()))
+				return false;
+		}
+	}
+	return true;
+}
+
+/*
+	ColumnFile::scan()
+
+	compare column with a constant, store matched row addrs
+	integer column is evaluated by ScanKernel (SIMD)
+*/
+uint32_t ColumnFile::scan(int col, relation_type_t rel_type, const attr_t & kAttr, std::vector<uint32_t>& match_addrs) const
+{
+	return scan(col, rel_type, kAttr, 0, mSize, match_addrs);
+}
+
+uint32_t ColumnFile::scan(int col, relation_type_t rel_type, const attr_t & kAttr, uint32_t begin, uint32_t end, std::vector<uint32_t>& match_addrs) const
+{
+	const Column & column = mColumns[col];
+	const attr_domain_t domain = (column.type == SEQ_INT) ? INTEGER_DOMAIN : VARCHAR_DOMAIN;
+
+	// Domain mismatch, nothing is equal
+	if (kAttr.Domain() != domain)
+	{
+		switch (rel_type)
+		{
+		case EQ:
+			return match_addrs.size();
+		case NEQ:
+			for (uint32_t i = begin; i < end; i++)
+				match_addrs.push_back(i);
+			return match_addrs.size();
+		default:
+			throw exception_t(COLFILE_UNEXPECTED_TYPE, "Cannot compare integer with varchar.");
+		}
+	}
+
+	relation_type_t code_rel;
+	int32_t code;
+	if (domain == INTEGER_DOMAIN)
+	{
+		ScanKernel::scan_int(int_column(col), begin, end, rel_type, kAttr.Int(), match_addrs);
+	}
+	else if (code_predicate(col, rel_type, kAttr.Varchar(), code_rel, code))
+	{
+		ScanKernel::scan_int(code_column(col), begin, end, code_rel, code, match_addrs);
+	}
+	else
+	{
+		const char *k = kAttr.Varchar();
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (varchar_match(get_varchar(i, col), rel_type, k))
+				match_addrs.push_back(i);
+		}
+	}
+	return match_addrs.size();
+}
+
+/*
+	ColumnFile::scan()
+
+	compare two columns of the same row, store matched row addrs
+*/
+uint32_t ColumnFile::scan(int col1, relation_type_t rel_type, int col2, std::vector<uint32_t>& match_addrs) const
+{
+	return scan(col1, rel_type, col2, 0, mSize, match_addrs);
+}
+
+uint32_t ColumnFile::scan(int col1, relation_type_t rel_type, int col2, uint32_t begin, uint32_t end, std::vector<uint32_t>& match_addrs) const
+{
+	const Column & c1 = mColumns[col1];
+	const Column & c2 = mColumns[col2];
+
+	if (c1.type != c2.type)
+	{
+		switch (rel_type)
+		{
+		case EQ:
+			return match_addrs.size();
+		case NEQ:
+			for (uint32_t i = begin; i < end; i++)
+				match_addrs.push_back(i);
+			return match_addrs.size();
+		default:
+			throw exception_t(COLFILE_UNEXPECTED_TYPE, "Cannot compare integer with varchar.");
+		}
+	}
+
+	if (c1.type == SEQ_INT)
+	{
+		ScanKernel::scan_int(int_column(col1), rel_type, int_column(col2), begin, end, match_addrs);
+	}
+	else
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (varchar_match(get_varchar(i, col1), rel_type, get_varchar(i, col2)))
+				match_addrs.push_back(i);
+		}
+	}
+	return match_addrs.size();
+}
+
+/*
+	ColumnFile::refine()
+
+	residual filter on candidate addrs, compact addrs in place
+*/
+uint32_t ColumnFile::refine(int col, relation_type_t rel_type, const attr_t & kAttr, std::vector<uint32_t>& addrs) const
+{
+	const Column & column = mColumns[col];
+	const attr_domain_t domain = (column.type == SEQ_INT) ? INTEGER_DOMAIN : VARCHAR_DOMAIN;
+
+	if (kAttr.Domain() != domain)
+	{
+		switch (rel_type)
+		{
+		case EQ:
+			addrs.clear();
+			return 0;
+		case NEQ:
+			return addrs.size();
+		default:
+			throw exception_t(COLFILE_UNEXPECTED_TYPE, "Cannot compare integer with varchar.");
+		}
+	}
+
+	uint32_t out = 0;
+	relation_type_t code_rel = rel_type;
+	int32_t code = 0;
+	if (domain == INTEGER_DOMAIN || code_predicate(col, rel_type, kAttr.Varchar(), code_rel, code))
+	{
+		// VARCHAR with code predicate is refined the same as INTEGER
+		const int32_t *values = int_column(col);
+		const int32_t k = (domain == INTEGER_DOMAIN) ? kAttr.Int() : code;
+		for (uint32_t i = 0; i < addrs.size(); i++)
+		{
+			uint32_t addr = addrs[i];
+			int32_t v = values[addr];
+			bool match;
+			switch (code_rel)
+			{
+			case EQ: match = v == k; break;
+			case NEQ: match = v != k; break;
+			case LESS: match = v < k; break;
+			case LARGE: match = v > k; break;
+			default:
+				throw exception_t(UNKNOWN_RELATION_TYPE, "Unknown relation type.");
+			}
+			addrs[out] = addr;
+			out += match;
+		}
+	}
+	else
+	{
+		const char *k = kAttr.Varchar();
+		for (uint32_t i = 0; i < addrs.size(); i++)
+		{
+			if (varchar_match(get_varchar(addrs[i], col), rel_type, k))
+				addrs[out++] = addrs[i];
+		}
+	}
+	addrs.resize(out);
+	return out;
+}
+
+/*
+	ColumnFile::scan_range()
+
+	integer column, or VARCHAR with sorted dictionary as a code range,
+	is evaluated by one ScanKernel pass comparing both bounds
+*/
+uint32_t ColumnFile::scan_range(int col, const attr_t & lo, const attr_t & hi, uint32_t begin, uint32_t end, std::vector<uint32_t>& match_addrs) const
+{
+	int32_t code_lo, code_hi;
+	if (code_range(col, lo, hi, code_lo, code_hi))
+	{
+		ScanKernel::scan_int_range(int_column(col), begin, end, code_lo, code_hi, match_addrs);
+		return match_addrs.size();
+	}
+
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const char *v = get_varchar(i, col);
+		if (varchar_match(v, LARGE, lo.Varchar()) && varchar_match(v, LESS, hi.Varchar()))
+			match_addrs.push_back(i);
+	}
+	return match_addrs.size();
+}
+
+uint32_t ColumnFile::refine_range(int col, const attr_t & lo, const attr_t & hi, std::vector<uint32_t>& addrs) const
+{
+	uint32_t out = 0;
+	int32_t code_lo, code_hi;
+	if (code_range(col, lo, hi, code_lo, code_hi))
+	{
+		const int32_t *values = int_column(col);
+		for (uint32_t i = 0; i < addrs.size(); i++)
+		{
+			uint32_t addr = addrs[i];
+			addrs[out] = addr;
+			out += (values[addr] > code_lo) & (values[addr] < code_hi);
+		}
+	}
+	else
+	{
+		for (uint32_t i = 0; i < addrs.size(); i++)
+		{
+			const char *v = get_varchar(addrs[i], col);
+			if (varchar_match(v, LARGE, lo.Varchar()) && varchar_match(v, LESS, hi.Varchar()))
+				addrs[out++] = addrs[i];
+		}
+	}
+	addrs.resize(out);
+	return out;
+}
+
+/*
+	ColumnFile::write_back()
+
+	write each column as one DatFile block,
+	nothing to write if no row is put since read_from()
+*/
+void ColumnFile::write_back()
+{
+	assert(!mColumns.empty());
+
+	if (!mDirty)
+		return;
+
+	seal();
+
+	TypeVector types(mColumns.size());
+	SizeVector dict_nums(mColumns.size());
+	for (int i = 0; i < mColumns.size(); i++)
+	{
+		types[i] = mColumns[i].type;
+		dict_nums[i] = mColumns[i].dictNum;
+	}
+
+	std::vector<DatFile::Block> blocks;
+	DatFile::write_header(mFile, types.data(), mSizes.data(), mColumns.size(), mSize, dict_nums.data(), blocks);
+
+	for (int i = 0; i < mColumns.size(); i++)
+	{
+		const Column & column = mColumns[i];
+		DatFile::pad_to(mFile, blocks[i].offset);
+		if (mSize > 0)
+			fwrite(column.data, column.width, mSize, mFile);
+
+		if (blocks[i].encoding == DatFile::DICT_ENCODING)
+		{
+			DatFile::pad_to(mFile, blocks[i].dictOffset);
+			if (column.dictNum > 0)
+				fwrite(column.dict, column.dictWidth, column.dictNum, mFile);
+		}
+	}
+	fflush(mFile);
+	mDirty = false;
+}
+
+/*
+	ColumnFile::read_from()
+
+	map data file, columns point into the mapping directly,
+	files written before DatFile are decoded row by row into owned columns
+*/
+void ColumnFile::read_from()
+{
+	assert(!mColumns.empty());
+
+	if (!mMap.map(mFilepath.c_str()) || mRowsize == 0)
+		return;
+
+	if (DatFile::match(mMap))
+	{
+		TypeVector types(mColumns.size());
+		for (int i = 0; i < mColumns.size(); i++)
+			types[i] = mColumns[i].type;
+
+		std::vector<DatFile::BlockRef> blocks;
+		uint32_t row_num = DatFile::parse(mMap, types.data(), mSizes.data(), mColumns.size(), blocks);
+
+		bool plain_varchar = false;
+		for (int i = 0; i < mColumns.size(); i++)
+		{
+			Column & column = mColumns[i];
+			const DatFile::BlockRef & block = blocks[i];
+			if (block.encoding == DatFile::DICT_ENCODING)
+			{
+				// Codes index dict directly in every scan, check them once here
+				const int32_t *codes = (const int32_t *)block.data;
+				for (uint32_t r = 0; r < row_num; r++)
+				{
+					if ((uint32_t)codes[r] >= block.dictNum)
+						throw exception_t(MAPFILE_BAD_FORMAT, "Corrupted dictionary code");
+				}
+				column.data = block.data;
+				column.dict = block.dict;
+				column.dictNum = block.dictNum;
+			}
+			else if (column.type == SEQ_VARCHAR)
+			{
+				// Written before dictionary encoding, encode into owned column
+				column.owned.resize((size_t)column.width * row_num);
+				for (uint32_t r = 0; r < row_num; r++)
+				{
+					int32_t code = encode(column, block.data + (size_t)r * column.dictWidth);
+					memcpy(&column.owned[(size_t)r * column.width], &code, sizeof(int32_t));
+				}
+				column.data = column.owned.data();
+				plain_varchar = true;
+			}
+			else
+			{
+				column.data = block.data;
+			}
+		}
+		mSize = row_num;
+
+		// Rewritten with dictionary on next save, which writes over the mapped
+		// blocks at new offsets, so the columns still in the mapping are copied first
+		mDirty = plain_varchar;
+		if (plain_varchar)
+		{
+			own();
+			seal();
+		}
+		return;
+	}
+
+	uint32_t row_num = mMap.size() / mRowsize;
+	for (int i = 0; i < mColumns.size(); i++)
+		mColumns[i].owned.reserve((size_t)mColumns[i].width * row_num);
+
+	for (uint32_t r = 0; r < row_num; r++)
+		decode_row(mMap.data() + (size_t)r * mRowsize);
+	mMap.unmap();
+	seal();
+
+	// Rewritten in DatFile format on next save
+	mDirty = true;
+}
+
+inline void ColumnFile::decode_row(const char * row)
+{
+	uint32_t offset = 0;
+	for (int i = 0; i < mColumns.size(); i++)
+	{
+		Column & column = mColumns[i];
+		size_t pos = column.owned.size();
+		column.owned.resize(pos + column.width, 0);
+
+		switch (column.type)
+		{
+		case SEQ_INT:
+			memcpy(&column.owned[pos], row + offset, std::min<uint32_t>(mSizes[i], sizeof(int32_t)));
+			break;
+		case SEQ_VARCHAR:
+		{
+			char sval[ATTR_SIZE_MAX + 2] = { 0 };
+			memcpy(sval, row + offset, strnlen(row + offset, std::min<uint32_t>(mSizes[i], column.dictWidth - 1)));
+			int32_t code = encode(column, sval);
+			memcpy(&column.owned[pos], &code, sizeof(int32_t));
+			break;
+		}
+		default:
+			throw exception_t(COLFILE_UNEXPECTED_TYPE, "Unexpected type");
+		}
+		column.data = column.owned.data();
+		offset += mSizes[i];
+	}
+	mSize++;
+}
+
+/*
+	ColumnFile::own()
+
+	copy mapped columns to owned memory before they grow
+*/
+void ColumnFile::own()
+{
+	for (Column & column : mColumns)
+	{
+		if (column.data != column.owned.data())
+		{
+			column.owned.assign(column.data, column.data + (size_t)column.width * mSize);
+			column.data = column.owned.data();
+		}
+		if (column.dict != column.ownedDict.data())
+		{
+			column.ownedDict.assign(column.dict, column.dict + (size_t)column.dictWidth * column.dictNum);
+			column.dict = column.ownedDict.data();
+		}
+	}
+	mMap.unmap();
+}
+
+bool ColumnFile::find_code(int col, const char * value, int32_t & code) const
+{
+	const Column & column = mColumns[col];
+
+	// Longer than any stored value
+	if (strnlen(value, ATTR_SIZE_MAX) > column.dictWidth - 1)
+		return false;
+
+	if (!column.sorted)
+	{
+		auto res = column.codeMap.find(attr_t(value));
+		if (res == column.codeMap.end())
+			return false;
+		code = res->second;
+		return true;
+	}
+
+	uint32_t lo = 0, hi = column.dictNum;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = strncmp(column.dict + (size_t)mid * column.dictWidth, value, column.dictWidth);
+		if (cmp == 0)
+		{
+			code = mid;
+			return true;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+void ColumnFile::translate(int col, const ColumnFile & other, int other_col, std::vector<int32_t>& codes) const
+{
+	const Column & column = mColumns[col];
+	codes.resize(column.dictNum);
+	for (uint32_t d = 0; d < column.dictNum; d++)
+	{
+		int32_t code;
+		codes[d] = other.find_code(other_col, column.dict + (size_t)d * column.dictWidth, code) ? code : -1;
+	}
+}
+
+void ColumnFile::seal()
+{
+	for (Column & column : mColumns)
+	{
+		if (column.type != SEQ_VARCHAR)
+			continue;
+		sort_dict(column);
+
+		// Sorted dictionary is searched directly, map is rebuilt by next put()
+		std::unordered_map<attr_t, int32_t, attr_t_hash>().swap(column.codeMap);
+	}
+}
+
+/*
+	ColumnFile::encode()
+
+	code of value truncated to column width, new value is appended to dictionary,
+	dictionary stays sorted while values are put in ascending order
+*/
+int32_t ColumnFile::encode(Column & column, const char * value)
+{
+	char sval[ATTR_SIZE_MAX + 2] = { 0 };
+	strncpy(sval, value, column.dictWidth - 1);
+
+	if (column.codeMap.size() != column.dictNum)
+	{
+		column.codeMap.clear();
+		column.codeMap.reserve(column.dictNum);
+		for (uint32_t d = 0; d < column.dictNum; d++)
+			column.codeMap.emplace(attr_t(column.dict + (size_t)d * column.dictWidth), d);
+	}
+
+	auto res = column.codeMap.emplace(attr_t(sval), (int32_t)column.dictNum);
+	if (!res.second)
+		return res.first->second;
+
+	if (column.dictNum > 0
+		&& strncmp(sval, column.dict + (size_t)(column.dictNum - 1) * column.dictWidth, column.dictWidth) < 0)
+		column.sorted = false;
+
+	size_t offset = column.ownedDict.size();
+	column.ownedDict.resize(offset + column.dictWidth, 0);
+	memcpy(&column.ownedDict[offset], sval, column.dictWidth - 1);
+	column.dict = column.ownedDict.data();
+	return column.dictNum++;
+}
+
+/*
+	ColumnFile::sort_dict()
+
+	reorder dictionary ascending and rewrite codes,
+	an unsorted dictionary is always owned since it is grown by put()
+*/
+void ColumnFile::sort_dict(Column & column)
+{
+	if (column.sorted)
+		return;
+
+	const uint32_t width = column.dictWidth;
+	const char *old_dict = column.dict;
+
+	std::vector<int32_t> order(column.dictNum);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [old_dict, width](int32_t a, int32_t b) {
+		return strncmp(old_dict + (size_t)a * width, old_dict + (size_t)b * width, width) < 0;
+	});
+
+	std::vector<int32_t> remap(column.dictNum);
+	std::vector<char> dict((size_t)width * column.dictNum);
+	for (uint32_t d = 0; d < column.dictNum; d++)
+	{
+		remap[order[d]] = d;
+		memcpy(&dict[(size_t)d * width], old_dict + (size_t)order[d] * width, width);
+	}
+
+	int32_t *codes = (int32_t *)column.owned.data();
+	for (uint32_t r = 0; r < mSize; r++)
+		codes[r] = remap[codes[r]];
+
+	for (auto & entry : column.codeMap)
+		entry.second = remap[entry.second];
+
+	column.ownedDict.swap(dict);
+	column.dict = column.ownedDict.data();
+	column.sorted = true;
+}
+
+/*
+	ColumnFile::code_predicate()
+
+	rewrite (value rel k) as (code code_rel code),
+	values ordered by ATTR_NUM_MAX prefix are a contiguous range of a sorted dictionary,
+	return false if predicate needs the strings
+*/
+bool ColumnFile::code_predicate(int col, relation_type_t rel_type, const char * k, relation_type_t & code_rel, int32_t & code) const
+{
+	const Column & column = mColumns[col];
+	code_rel = rel_type;
+
+	switch (rel_type)
+	{
+	case EQ:
+	case NEQ:
+		// Absent value never equals to any code
+		if (!find_code(col, k, code))
+			code = -1;
+		return true;
+	case LESS:
+	case LARGE:
+	{
+		if (!column.sorted)
+			return false;
+
+		// First code whose value is not less (LESS) or larger (LARGE) than k
+		uint32_t lo = 0, hi = column.dictNum;
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			int cmp = strncmp(column.dict + (size_t)mid * column.dictWidth, k, ATTR_NUM_MAX);
+			if (cmp < 0 || (rel_type == LARGE && cmp == 0))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		code = (rel_type == LESS) ? (int32_t)lo : (int32_t)lo - 1;
+		return true;
+	}
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unknown relation type.");
+	}
+}
+
+// Bounds as int32 compared on the column, false if VARCHAR dictionary is unsorted
+bool ColumnFile::code_range(int col, const attr_t & lo, const attr_t & hi, int32_t & code_lo, int32_t & code_hi) const
+{
+	if (mColumns[col].type == SEQ_INT)
+	{
+		code_lo = lo.Int();
+		code_hi = hi.Int();
+		return true;
+	}
+
+	relation_type_t code_rel;
+	return code_predicate(col, LARGE, lo.Varchar(), code_rel, code_lo)
+		&& code_predicate(col, LESS, hi.Varchar(), code_rel, code_hi);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "DiskFile.h"
+#include "database_type.h"
+#include "SequenceFile.h"
+#include "MappedFile.h"
+
+#define COLFILE_UNEXPECTED_TYPE 0x1
+#define COLFILE_BAD_POS 0x2
+
+/*
+	ColumnFile
+
+	Column-major counterpart of SequenceFile, share the same on-disk format (DatFile)
+
+	In memory, each column is an array of fixed-width values,
+	INTEGER column is a contiguous int32 array,
+	VARCHAR column is an int32 code array plus a dictionary of
+	distinct '\0' padded char[dictWidth] values,
+	EQ/NEQ compare codes, LESS/LARGE compare codes once dictionary is sorted
+	loaded columns point into the mapped file (zero-copy),
+	they are copied to owned memory on first put()
+*/
+class ColumnFile
+	: public DiskFile
+{
+	typedef std::vector<SequenceElementType> TypeVector;
+	typedef std::vector<uint32_t> SizeVector;
+
+	struct Column
+	{
+		SequenceElementType type;
+		uint32_t width;				// bytes per value, VARCHAR stores int32 code
+		const char *data;			// mapped block or owned.data()
+		std::vector<char> owned;
+
+		// VARCHAR dictionary
+		uint32_t dictWidth;
+		uint32_t dictNum;
+		const char *dict;			// mapped block or ownedDict.data()
+		std::vector<char> ownedDict;
+		bool sorted;				// code order is value order
+		std::unordered_map<attr_t, int32_t, attr_t_hash> codeMap;	// value to code, built on first put
+	};
+public:
+	ColumnFile();
+	~ColumnFile();
+
+	void init(const SequenceElementType *types, SizeVector & sizes, int num);
+	uint32_t put(const AttrTuple &tuple);
+	AttrTuple get(uint32_t index);
+	attr_t get_attr(uint32_t index, int col);
+	bool equal(uint32_t index, const AttrTuple &tuple);
+
+	inline int32_t get_int(uint32_t index, int col) const { return int_column(col)[index]; }
+	inline const char *get_varchar(uint32_t index, int col) const { return mColumns[col].dict + (size_t)code_column(col)[index] * mColumns[col].dictWidth; }
+	inline const int32_t *int_column(int col) const { return (const int32_t *)mColumns[col].data; }
+	inline const int32_t *code_column(int col) const { return (const int32_t *)mColumns[col].data; }
+	inline SequenceElementType type(int col) const { return mColumns[col].type; }
+	uint32_t size() const { return mSize; }
+
+	uint32_t scan(int col, relation_type_t rel_type, const attr_t &kAttr, std::vector<uint32_t> &match_addrs) const;
+	uint32_t scan(int col1, relation_type_t rel_type, int col2, std::vector<uint32_t> &match_addrs) const;
+
+	// Scan rows [begin, end) only
+	uint32_t scan(int col, relation_type_t rel_type, const attr_t &kAttr, uint32_t begin, uint32_t end, std::vector<uint32_t> &match_addrs) const;
+	uint32_t scan(int col1, relation_type_t rel_type, int col2, uint32_t begin, uint32_t end, std::vector<uint32_t> &match_addrs) const;
+
+	// Keep addrs whose value satisfy (col rel k)
+	uint32_t refine(int col, relation_type_t rel_type, const attr_t &kAttr, std::vector<uint32_t> &addrs) const;
+
+	// lo < col < hi in one pass, bounds are of the column domain
+	uint32_t scan_range(int col, const attr_t &lo, const attr_t &hi, uint32_t begin, uint32_t end, std::vector<uint32_t> &match_addrs) const;
+	uint32_t refine_range(int col, const attr_t &lo, const attr_t &hi, std::vector<uint32_t> &addrs) const;
+
+	// Code of a VARCHAR value, return false if value is not in dictionary
+	bool find_code(int col, const char *value, int32_t &code) const;
+
+	// Map each code of col to code of the same value in other_col of other, -1 if absent
+	void translate(int col, const ColumnFile &other, int other_col, std::vector<int32_t> &codes) const;
+
+	// Sort dictionaries grown by put(), so LESS/LARGE can compare codes
+	void seal();
+
+	void write_back();
+	void read_from();
+
+private:
+	std::vector<Column> mColumns;
+	SizeVector mSizes;
+	uint32_t mRowsize;
+	uint32_t mSize;
+
+	MappedFile mMap;
+	bool mDirty;
+
+	inline void decode_row(const char *row);
+	void own();
+
+	int32_t encode(Column &column, const char *value);
+	void sort_dict(Column &column);
+	bool code_predicate(int col, relation_type_t rel_type, const char *k, relation_type_t &code_rel, int32_t &code) const;
+	bool code_range(int col, const attr_t &lo, const attr_t &hi, int32_t &code_lo, int32_t &code_hi) const;
+};
@@ -0,0 +1,163 @@
+#include "CostModel.h"
+
+#include "system.h"
+
+#include <algorithm>
+#include <cmath>
+
+static inline double clamp_sel(double sel)
+{
+	return std::max(0.0, std::min(1.0, sel));
+}
+
+static inline double tree_depth(uint32_t rows)
+{
+	return std::log2((double)rows + 2.0);
+}
+
+/*
+	Fraction of values < k, interpolate inside the equi-depth bucket
+*/
+static double fraction_below(const ColumnStat & stat, int k)
+{
+	const int *bounds = stat.bounds;
+	if (k <= bounds[0])
+		return 0.0;
+	if (k > bounds[STAT_HISTOGRAM_BUCKETS])
+		return 1.0;
+
+	int b = 0;
+	while (b < STAT_HISTOGRAM_BUCKETS - 1 && bounds[b + 1] < k)
+		b++;
+
+	double width = (double)bounds[b + 1] - (double)bounds[b];
+	double inner = (width > 0) ? ((double)k - (double)bounds[b]) / width : 0.0;
+	return clamp_sel((b + inner) / STAT_HISTOGRAM_BUCKETS);
+}
+
+double CostModel::selectivity(const ColumnStat & stat, uint8_t attr_type, relation_type_t rel_type, const attr_t & k)
+{
+	attr_domain_t domain = (attr_type == ATTR_TYPE_INTEGER) ? INTEGER_DOMAIN : VARCHAR_DOMAIN;
+	bool analyzed = stat.rowNum > 0 && stat.distinctNum > 0;
+
+	// Integer never equals to varchar
+	if (k.Domain() != domain)
+	{
+		switch (rel_type)
+		{
+		case EQ: return 0.0;
+		case NEQ: return 1.0;
+		default: return DEFAULT_SEL_RANGE;
+		}
+	}
+
+	double eq = analyzed ? 1.0 / stat.distinctNum : DEFAULT_SEL_EQ;
+	if (analyzed && domain == INTEGER_DOMAIN && (k.Int() < stat.minValue || k.Int() > stat.maxValue))
+		eq = 0.0;
+
+	switch (rel_type)
+	{
+	case EQ:
+		return eq;
+	case NEQ:
+		return 1.0 - eq;
+	case LESS:
+		if (!analyzed || domain != INTEGER_DOMAIN)
+			return DEFAULT_SEL_RANGE;
+		return fraction_below(stat, k.Int());
+	case LARGE:
+		if (!analyzed || domain != INTEGER_DOMAIN)
+			return DEFAULT_SEL_RANGE;
+		return clamp_sel(1.0 - fraction_below(stat, k.Int()) - eq);
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unknown relation type.");
+	}
+}
+
+/*
+	CostModel::range_selectivity()
+
+	rows not below hi and rows not above lo are disjoint on a histogram,
+	without one both bounds are independent guesses
+*/
+double CostModel::range_selectivity(const ColumnStat & stat, uint8_t attr_type, const attr_t & lo, const attr_t & hi)
+{
+	double below_hi = selectivity(stat, attr_type, LESS, hi);
+	double above_lo = selectivity(stat, attr_type, LARGE, lo);
+	bool analyzed = stat.rowNum > 0 && stat.distinctNum > 0;
+	if (!analyzed || attr_type != ATTR_TYPE_INTEGER)
+		return below_hi * above_lo;
+	return clamp_sel(below_hi + above_lo - 1.0);
+}
+
+double CostModel::join_eq_rows(const ColumnStat & a, const ColumnStat & b, uint32_t a_rows, uint32_t b_rows)
+{
+	uint32_t distinct = std::max(a.distinctNum, b.distinctNum);
+	if (distinct == 0)
+		return (double)a_rows * b_rows * DEFAULT_SEL_EQ;
+	return (double)a_rows * b_rows / distinct;
+}
+
+double CostModel::scan(uint32_t rows, uint8_t attr_type, bool columnar)
+{
+	if (!columnar)
+		return rows * COST_SCAN_ROW;
+	return rows * ((attr_type == ATTR_TYPE_INTEGER) ? COST_SCAN_COLUMN : COST_SCAN_COLUMN_VARCHAR);
+}
+
+double CostModel::index_lookup(IndexType type, relation_type_t rel_type, uint32_t rows, double selectivity)
+{
+	double out_rows = selectivity * rows;
+	switch (type)
+	{
+	case HASH: case PHASH:
+		switch (rel_type)
+		{
+		case EQ: return COST_HASH_PROBE + out_rows * COST_EMIT;
+		case NEQ: return rows * (COST_HASH_PROBE + COST_EMIT);
+		default: return COST_INFINITE;
+		}
+	case TREE: case PTREE:
+		switch (rel_type)
+		{
+		case NEQ: return rows * (COST_TREE_STEP + COST_EMIT);
+		default: return tree_depth(rows) * COST_TREE_STEP + out_rows * (COST_TREE_STEP + COST_EMIT);
+		}
+	case BITMAP:
+		// NEQ unites the other bitmaps 64 rows a word
+		switch (rel_type)
+		{
+		case EQ: return COST_HASH_PROBE + out_rows * COST_EMIT;
+		case NEQ: return rows / 64.0 * COST_BITMAP_WORD + out_rows * COST_EMIT;
+		default: return COST_INFINITE;
+		}
+	default:
+		return COST_INFINITE;
+	}
+}
+
+double CostModel::index_join(IndexType type, uint32_t iter_rows, uint32_t fix_rows, double out_rows)
+{
+	double probe = (type == TREE || type == PTREE) ? tree_depth(fix_rows) * COST_TREE_STEP : COST_HASH_PROBE;
+	return iter_rows * probe + out_rows * COST_EMIT;
+}
+
+double CostModel::merge_join(uint32_t a_rows, uint32_t b_rows, double out_rows)
+{
+	return ((double)a_rows + b_rows) * COST_TREE_STEP + out_rows * COST_EMIT;
+}
+
+double CostModel::sort_merge_join(uint32_t a_rows, bool a_sorted, uint32_t b_rows, bool b_sorted, double out_rows)
+{
+	double cost = ((double)a_rows + b_rows) * COST_SCAN_ROW + out_rows * COST_EMIT;
+	if (!a_sorted)
+		cost += a_rows * std::log2((double)a_rows + 2.0) * COST_SORT_STEP;
+	if (!b_sorted)
+		cost += b_rows * std::log2((double)b_rows + 2.0) * COST_SORT_STEP;
+	return cost;
+}
+
+double CostModel::build_hash_join(uint32_t build_rows, uint32_t probe_rows, double out_rows)
+{
+	return build_rows * COST_HASH_BUILD + probe_rows * COST_HASH_PROBE + out_rows * COST_EMIT;
+}
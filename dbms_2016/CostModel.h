@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "database_type.h"
+#include "LightTableFile.h"
+
+// Relative cost of one unit of work, a row layout compare is 1
+#define COST_SCAN_ROW 1.0
+#define COST_SCAN_COLUMN 0.1
+#define COST_SCAN_COLUMN_VARCHAR 0.5
+#define COST_TREE_STEP 3.0
+#define COST_HASH_PROBE 2.0
+#define COST_HASH_BUILD 3.0
+#define COST_BITMAP_WORD 1.0
+#define COST_SORT_STEP 1.0
+#define COST_EMIT 1.0
+#define COST_INFINITE 1e30
+
+// Selectivity when attribute has no statistics
+#define DEFAULT_SEL_EQ 0.1
+#define DEFAULT_SEL_RANGE (1.0 / 3.0)
+
+/*
+	CostModel
+
+	estimate selectivity from ColumnStat,
+	and estimate cost of scan, index lookup and join strategies
+	costs are relative, only used to compare approaches
+*/
+namespace CostModel
+{
+	// Fraction of rows satisfy (attr rel k)
+	double selectivity(const ColumnStat &stat, uint8_t attr_type, relation_type_t rel_type, const attr_t &k);
+
+	// Fraction of rows satisfy (lo < attr < hi)
+	double range_selectivity(const ColumnStat &stat, uint8_t attr_type, const attr_t &lo, const attr_t &hi);
+
+	// Estimated rows of equi-join output
+	double join_eq_rows(const ColumnStat &a, const ColumnStat &b, uint32_t a_rows, uint32_t b_rows);
+
+	double scan(uint32_t rows, uint8_t attr_type, bool columnar);
+	double index_lookup(IndexType type, relation_type_t rel_type, uint32_t rows, double selectivity);
+
+	// Each of iter_rows probes an index on fix_rows, out_rows are emitted
+	double index_join(IndexType type, uint32_t iter_rows, uint32_t fix_rows, double out_rows);
+	double merge_join(uint32_t a_rows, uint32_t b_rows, double out_rows);
+
+	// Sides not in tree order are sorted first, then both are merged sequentially
+	double sort_merge_join(uint32_t a_rows, bool a_sorted, uint32_t b_rows, bool b_sorted, double out_rows);
+	double build_hash_join(uint32_t build_rows, uint32_t probe_rows, double out_rows);
+}
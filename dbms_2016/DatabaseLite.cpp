@@ -1,10 +1,38 @@
 #include "DatabaseLite.h"
+#include "WorkerPool.h"
+#include "BulkLoader.h"
+
+#include <algorithm>
 
 #define UNKOWN_STMT_TYPE 0x1
 #define UNEXPECTED_ERROR 0x2
 #define AMBIGUOUS_ERROR 0x3
 
-DatabaseLite::DatabaseLite(const char *dbs_filepath)
+/*
+	DatabaseLite::AggregateSink
+
+	accumulate aggregates directly from join output
+*/
+class DatabaseLite::AggregateSink
+	: public AddrPairSink
+{
+public:
+	AggregateSink(DatabaseLite &db, std::vector<SelectEntry> &aggre_list, std::vector<int64_t> &aggre_counters) :
+		mDb(db), mAggreList(aggre_list), mAggreCounters(aggre_counters) {}
+
+	void put(uint32_t a_addr, uint32_t b_addr)
+	{
+		for (int i = 0; i < mAggreList.size(); i++)
+			mDb.exec_select_aggre({ a_addr, b_addr }, mAggreList[i], mAggreCounters[i]);
+	}
+private:
+	DatabaseLite &mDb;
+	std::vector<SelectEntry> &mAggreList;
+	std::vector<int64_t> &mAggreCounters;
+};
+
+DatabaseLite::DatabaseLite(const char *dbs_filepath) :
+	mSink(new TsvSink(std::cout))
 {
 	bool exist = FileUtil::exist(dbs_filepath);
 	mDbf.open(dbs_filepath, exist ? "r+" : "w+");
@@ -16,53 +44,57 @@ DatabaseLite::DatabaseLite(const char *dbs_filepath)
 
 DatabaseLite::~DatabaseLite()
 {
+	delete mSink;
+}
 
+void DatabaseLite::set_output(std::ostream & os, ResultFormat format)
+{
+	ResultSink *sink = ResultSink::create(format, os);
+	delete mSink;
+	mSink = sink;
 }
 
+/*
+	DatabaseLite::exec()
+
+	INSERT/COPY/LOAD DATA go through BulkLoader, other statements through SQLParser,
+	bulk tuples are flushed and indexed before the next other statement
+*/
 void DatabaseLite::exec(std::string & command, bool profile)
 {
-	sql::SQLParserResult *parser = sql::SQLParser::parseSQLString(command);
+	clock_t begin, end;
+	double time_spent;
+
+	begin = clock();
+
+	BulkLoader loader(mDbf);
+	std::string pending;
 	try
 	{
-		if (parser->isValid)
+		size_t pos = 0;
+		uint32_t line = 1;
+		std::string stmt;
+		while (BulkLoader::next_statement(command, pos, stmt))
 		{
-			clock_t begin, end;
-			double time_spent;
-
-			begin = clock();
-
-			for (sql::SQLStatement *stmt : parser->statements)
-			{
-				switch (stmt->type())
-				{
-				case sql::kStmtSelect:
-					exec_select(stmt);
-					break;
-				case sql::kStmtCreate:
-					exec_create(stmt);
-					break;
-				case sql::kStmtInsert:
-					exec_insert(stmt);
-					break;
-				default:
-					throw exception_t(UNKOWN_STMT_TYPE, "Unknown stmt type");
-				}
-			}
-
-			if (profile)
+			uint32_t stmt_line = line;
+			line += std::count(stmt.begin(), stmt.end(), '\n');
+			if (BulkLoader::is_bulk(stmt))
 			{
-				end = clock();
-				time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
-				printf("Time elapsed: %lf\n", time_spent);
+				exec_sql(pending);
+				pending.clear();
+				if (loader.exec(stmt, stmt_line))
+					continue;
 			}
+			loader.finish();
+			pending += stmt + ";";
 		}
-		else
-		{
-			Error("Parser error, %s\n", parser->errorMsg);
-		}
+		loader.finish();
+		exec_sql(pending);
 	}
 	catch (exception_t e)
 	{
+		// Keep indexes consistent with tuples already appended
+		loader.finish();
 		switch (e.code)
 		{
 		default:
@@ -70,6 +102,44 @@ void DatabaseLite::exec(std::string & command, bool profile)
 			break;
 		}
 	}
+
+	if (profile)
+	{
+		end = clock();
+		time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
+		printf("Time elapsed: %lf\n", time_spent);
+	}
+}
+
+void DatabaseLite::exec_sql(std::string & sql)
+{
+	if (sql.find_first_not_of(" \t\r\n;") == std::string::npos)
+		return;
+
+	sql::SQLParserResult *parser = sql::SQLParser::parseSQLString(sql);
+	if (!parser->isValid)
+	{
+		Error("Parser error, %s\n", parser->errorMsg);
+		return;
+	}
+
+	for (sql::SQLStatement *stmt : parser->statements)
+	{
+		switch (stmt->type())
+		{
+		case sql::kStmtSelect:
+			exec_select(stmt);
+			break;
+		case sql::kStmtCreate:
+			exec_create(stmt);
+			break;
+		case sql::kStmtInsert:
+			exec_insert(stmt);
+			break;
+		default:
+			throw exception_t(UNKOWN_STMT_TYPE, "Unknown stmt type");
+		}
+	}
 }
 
 void DatabaseLite::exec(std::string & command)
@@ -83,6 +153,20 @@ void DatabaseLite::exec_create_index(std::string tablename, std::string attrname
 	table.create_index(attrname.c_str(), type);
 }
 
+void DatabaseLite::exec_drop_index(std::string tablename, std::string attrname)
+{
+	LightTable & table = mDbf.get_table(tablename);
+	table.drop_index(attrname.c_str());
+}
+
+uint32_t DatabaseLite::exec_bulk_load(std::string tablename, std::string csv_path, char delim)
+{
+	BulkLoader loader(mDbf);
+	uint32_t num = loader.copy(mDbf.get_table(tablename), csv_path.c_str(), delim, false);
+	loader.finish();
+	return num;
+}
+
 void DatabaseLite::load(std::string dbs_filepath)
 {
 	mDbf.open(dbs_filepath.c_str(), "r+");
@@ -195,18 +279,49 @@ void DatabaseLite::exec_insert(sql::SQLStatement * stmt)
 				throw exception_t(UNEXPECTED_ERROR, "Unknown expr value type");
 		}
 	}
-	table_ref.insert(tuple);
+
+	// Skipped as on the bulk path, see BulkLoader
+	try
+	{
+		table_ref.insert(tuple);
+	}
+	catch (exception_t e)
+	{
+		if (e.code != INSERT_DUPLICATE_TUPLE)
+			throw;
+		Error("Skip 1 duplicated tuples\n");
+	}
 }
 
+/*
+	DatabaseLite::exec_select()
+
+	result rows are buffered in mSink and written out when the statement ends,
+	rows put before an error are still written
+*/
 void DatabaseLite::exec_select(sql::SQLStatement * stmt)
+{
+	try
+	{
+		exec_select_rows(stmt);
+	}
+	catch (exception_t e)
+	{
+		mSink->flush();
+		throw;
+	}
+	mSink->flush();
+}
+
+void DatabaseLite::exec_select_rows(sql::SQLStatement * stmt)
 {
 	if (stmt == NULL)
 		throw exception_t(UNEXPECTED_ERROR, "Select statement conversion error, null statement.");
 
 	sql::SelectStatement & select_stmt = static_cast<sql::SelectStatement&>(*stmt);
 
-	std::vector<std::pair<sql::TableRef *, LightTable*>> from_tables; // At most two table, use linear search faster
-	std::vector<std::vector<AddrPair>> where_addr_pairs;
+	std::vector<std::pair<sql::TableRef *, LightTable*>> from_tables; // Few tables, use linear search faster
+	std::vector<WhereRows> where_rows;
 	std::pair<LightTable *, LightTable *> table_comb;
 	std::vector<std::tuple<LightTable *, int, int, DatabaseAggregateType, bool>> select_cols;
 	std::vector<std::tuple<LightTable *, int, int, DatabaseAggregateType, bool>> aggre_list; //table, tuple id, col id, type
@@ -215,9 +330,24 @@ void DatabaseLite::exec_select(sql::SQLStatement * stmt)
 
 	parse_from_clause(select_stmt.fromTable, from_tables);
 
+	// More than two tables are joined in the order of JoinPlanner
+	if (from_tables.size() > 2)
+	{
+		exec_select_multiway(select_stmt, from_tables);
+		return;
+	}
+
+	// Aggregate without materializing where_rows
+	if (select_stmt.hasAggregation() && exec_select_aggre_pushdown(select_stmt, from_tables))
+		return;
+
+	// Stream batches through an operator tree
+	if (exec_select_pipeline(select_stmt, from_tables))
+		return;
+
 	if (select_stmt.hasWhere())
 	{
-		parse_where_clause(select_stmt.whereClause, from_tables, where_addr_pairs, table_comb);
+		parse_where_clause(select_stmt.whereClause, from_tables, where_rows, table_comb);
 	}
 	else
 	{
@@ -240,61 +370,43 @@ void DatabaseLite::exec_select(sql::SQLStatement * stmt)
 			parse_select_entry(col_ref, from_tables, table_comb, aggre_type, aggre_list);
 		}
 
-		std::vector<int> aggre_counters(aggre_list.size(), 0);
+		std::vector<int64_t> aggre_counters(aggre_list.size(), 0);
 
-		if (select_stmt.hasWhere())
+		// Tables without where clause are handled by exec_select_aggre_pushdown
+		if (!select_stmt.hasWhere())
+			throw exception_t(UNEXPECTED_ERROR, "No table selected");
+
+		// Rows of one table are addrs of the bitmap, paired with themselves
+		const WhereRows & result = where_rows.back();
+		bool reflexive = table_comb.first == table_comb.second;
+		std::vector<uint32_t> addrs;
+		if (reflexive)
+			result.rows.to_addrs(addrs);
+
+		// Per-worker partial aggregates, merged after all morsels
+		std::vector<std::vector<int64_t>> partials(WorkerPool::instance().size(), std::vector<int64_t>(aggre_list.size(), 0));
+		WorkerPool::instance().run(reflexive ? addrs.size() : result.pairs.size(), [&](const Morsel & m)
 		{
-			for (auto pair : where_addr_pairs.back())
+			std::vector<int64_t> & partial = partials[m.worker];
+			for (uint32_t j = m.begin; j < m.end; j++)
 			{
-				for (int i = 0; i < aggre_counters.size(); i++)
+				std::pair<int, int> pair = reflexive ? std::pair<int, int>(addrs[j], addrs[j]) : std::pair<int, int>(result.pairs[j]);
+				for (int i = 0; i < partial.size(); i++)
 				{
-					exec_select_aggre(pair, aggre_list[i], aggre_counters[i]);
+					exec_select_aggre(pair, aggre_list[i], partial[i]);
 				}
 			}
+		});
 
+		for (auto & partial : partials)
+		{
 			for (int i = 0; i < aggre_counters.size(); i++)
-				std::cout << aggre_counters[i] << "\t";
-			std::cout << "\n";
+				aggre_counters[i] += partial[i];
 		}
-		else
-		{
-			if (from_tables.size() == 2)
-			{
-				LightTable *tables[2] = { from_tables[0].second , from_tables[1].second };
-				for (int ai = 0; ai < tables[0]->size(); ai++)
-				{
-					for (int bi = 0; bi < tables[1]->size(); bi++)
-					{
-						for (int i = 0; i < aggre_list.size(); i++)
-						{
-							exec_select_aggre({ ai, bi }, aggre_list[i], aggre_counters[i]);
-						}
-					}
-				}
-				for (int i = 0; i < aggre_counters.size(); i++)
-					std::cout << aggre_counters[i] << "\t";
-				std::cout << "\n";
-			}
-			else if(from_tables.size() == 1)
-			{
-				LightTable *tables[1] = { from_tables[0].second };
-				for (int ai = 0; ai < tables[0]->size(); ai++)
-				{
-					for (int i = 0; i < aggre_list.size(); i++)
-					{
-						exec_select_aggre({ ai, ai }, aggre_list[i], aggre_counters[i]);
-					}
-				}
 
-				for (int i = 0; i < aggre_counters.size(); i++)
-					std::cout << aggre_counters[i] << "\t";
-				std::cout << "\n";
-			}
-			else
-			{
-				throw exception_t(UNEXPECTED_ERROR, "No table selected");
-			}
-		}
+		for (int i = 0; i < aggre_counters.size(); i++)
+			mSink->put(aggre_counters[i]);
+		mSink->end_row();
 	}
 	else
 	{
@@ -306,7 +418,7 @@ void DatabaseLite::exec_select(sql::SQLStatement * stmt)
 
 		if (select_stmt.hasWhere())
 		{
-			for (auto pair : where_addr_pairs.back())
+			auto print_row = [&](const AddrPair & pair)
 			{
 				for (auto col : select_cols)
 				{
@@ -314,11 +426,16 @@ void DatabaseLite::exec_select(sql::SQLStatement * stmt)
 					int colid = std::get<2>(col);
 					LightTable * bind_table = std::get<0>(col);
 
-					auto & tuple = bind_table->get_tuple(addr);
-					std::cout << tuple.at(colid) << "\t";
+					mSink->put(*bind_table, addr, colid);
 				}
-				std::cout << "\n";
-			}
+				mSink->end_row();
+			};
+
+			if (table_comb.first == table_comb.second)
+				where_rows.back().rows.for_each([&](uint32_t addr) { print_row(AddrPair(addr, addr)); });
+			else
+				for (const AddrPair & pair : where_rows.back().pairs)
+					print_row(pair);
 		}
 		else
 		{
@@ -335,10 +452,9 @@ void DatabaseLite::exec_select(sql::SQLStatement * stmt)
 							int colid = std::get<2>(col);
 							LightTable * bind_table = std::get<0>(col);
 
-							auto & tuple = bind_table->get_tuple(addr);
-							std::cout << tuple.at(colid) << "\t";
+							mSink->put(*bind_table, addr, colid);
 						}
-						std::cout << "\n";
+						mSink->end_row();
 					}
 				}
 			}
@@ -353,58 +469,377 @@ void DatabaseLite::exec_select(sql::SQLStatement * stmt)
 						int colid = std::get<2>(col);
 						LightTable * bind_table = std::get<0>(col);
 
-						auto & tuple = bind_table->get_tuple(addr);
-						std::cout << tuple.at(colid) << "\t";
+						mSink->put(*bind_table, addr, colid);
 					}
-					std::cout << "\n";
+					mSink->end_row();
 				}
 			}
 		}
 	}
 }
 
-void DatabaseLite::exec_select_aggre(std::pair<int, int> pair, SelectEntry aggre_ent, int & aggre_counter)
+void DatabaseLite::exec_select_aggre(std::pair<int, int> pair, SelectEntry aggre_ent, int64_t & aggre_counter)
+{
+	AggregateOperator::accumulate(pair.first, pair.second, aggre_ent, aggre_counter);
+}
+
+/*
+	DatabaseLite::exec_select_aggre_pushdown()
+
+	aggregate without materializing where_rows
+	1. no where clause, or AND / OR of constant predicates on one table:
+	   computed from the filtered rows, the other table only multiplies,
+	   AND of predicates on one tree indexed attr is counted on the index
+	2. one join predicate between two tables:
+	   join output is consumed by AggregateSink directly
+	return false if where clause has other shape
+*/
+bool DatabaseLite::exec_select_aggre_pushdown(sql::SelectStatement & select_stmt, std::vector<FromEntry> & from_tables)
 {
-	bool isStar = std::get<4>(aggre_ent);
-	DatabaseAggregateType aggre_type = std::get<3>(aggre_ent);
+	if (from_tables.empty() || from_tables.size() > 2)
+		return false;
+
+	std::vector<sql::AggregationFunction*> *func_list = select_stmt.aggregation_list;
+	std::vector<SelectEntry> aggre_list;
+	std::vector<int64_t> aggre_counters(func_list->size(), 0);
+	std::pair<LightTable *, LightTable *> table_comb;
 
-	if (isStar && aggre_type == SUM)
-		throw exception_t(UNEXPECTED_ERROR, "Sum(*) illegal");
-	if (isStar)
+	sql::Expr *where_clause = select_stmt.hasWhere() ? select_stmt.whereClause : NULL;
+	LightTable *filter_table = NULL;
+	std::vector<Predicate> predicates;
+	PredicateTree tree;
+
+	bool conj = where_clause == NULL || collect_conjunction(where_clause, from_tables, filter_table, predicates);
+	if (!conj)
+	{
+		filter_table = NULL;
+		predicates.clear();
+	}
+	if (conj || collect_predicate_tree(where_clause, from_tables, filter_table, tree))
 	{
-		switch (aggre_type)
+		if (filter_table == NULL)
+			filter_table = from_tables[0].second;
+		LightTable *other = NULL;
+		if (from_tables.size() == 2)
+			other = (from_tables[0].second == filter_table) ? from_tables[1].second : from_tables[0].second;
+
+		table_comb = { filter_table, (other != NULL) ? other : filter_table };
+		for (int i = 0; i < func_list->size(); i++)
 		{
-		case COUNT:
-			aggre_counter++;
-			break;
-		default:
-			throw exception_t(UNEXPECTED_ERROR, "Sum(*) illegal");
+			DatabaseAggregateType aggre_type = func_list->at(i)->type == sql::AggregationFunction::kCount ? COUNT : SUM;
+			parse_select_entry(func_list->at(i)->attribute, from_tables, table_comb, aggre_type, aggre_list);
+		}
+
+		// COUNT of integer columns and SUM of the indexed one are read from tree index counts
+		int key_id = -1;
+		uint32_t index_count = 0;
+		int64_t key_sum = 0;
+		bool from_index = !predicates.empty() && filter_table->count_with_index(predicates, key_id, index_count, key_sum);
+		for (int i = 0; i < aggre_list.size() && from_index; i++)
+		{
+			const SelectEntry & aggre_ent = aggre_list[i];
+			if (std::get<4>(aggre_ent) || std::get<0>(aggre_ent) != filter_table)
+				continue;
+			int col_id = std::get<2>(aggre_ent);
+			from_index = filter_table->get_attr_type(col_id) == ATTR_TYPE_INTEGER
+				&& (std::get<3>(aggre_ent) == COUNT || col_id == key_id);
+		}
+
+		std::vector<uint32_t> match_addrs;
+		const std::vector<uint32_t> *addrs = NULL;
+		if (!predicates.empty() && !from_index)
+		{
+			filter_table->filter_conjunction(predicates, match_addrs);
+			addrs = &match_addrs;
+		}
+		else if (!conj)
+		{
+			RowBitmap rows;
+			filter_table->filter_tree(tree, rows);
+			rows.to_addrs(match_addrs);
+			addrs = &match_addrs;
+		}
+
+		// Products of row counts pass 2^31 long before either table does
+		int64_t filter_rows = from_index ? index_count : (addrs != NULL) ? addrs->size() : filter_table->size();
+		int64_t other_rows = (other != NULL) ? other->size() : 1;
+		for (int i = 0; i < aggre_list.size(); i++)
+		{
+			const SelectEntry & aggre_ent = aggre_list[i];
+			if (std::get<4>(aggre_ent))
+			{
+				if (std::get<3>(aggre_ent) != COUNT)
+					throw exception_t(UNEXPECTED_ERROR, "Sum(*) illegal");
+				aggre_counters[i] = filter_rows * other_rows;
+			}
+			else if (std::get<0>(aggre_ent) == filter_table && from_index)
+				aggre_counters[i] = ((std::get<3>(aggre_ent) == COUNT) ? filter_rows : key_sum) * other_rows;
+			else if (std::get<0>(aggre_ent) == filter_table)
+				aggre_counters[i] = exec_select_aggre_rows(aggre_ent, addrs) * other_rows;
+			else
+				aggre_counters[i] = filter_rows * exec_select_aggre_rows(aggre_ent, NULL);
 		}
 	}
 	else
 	{
-		int addr = (std::get<1>(aggre_ent) == 0) ? pair.first : pair.second;
-		int colid = std::get<2>(aggre_ent);
-		LightTable * bind_table = std::get<0>(aggre_ent);
-		auto & tuple = bind_table->get_tuple(addr);
-		uint8_t attr_type = bind_table->get_attr_type(colid);
+		// Single join predicate
+		if (where_clause->type != sql::kExprOperator
+			|| (where_clause->op_type != sql::Expr::SIMPLE_OP && where_clause->op_type != sql::Expr::NOT_EQUALS))
+			return false;
+
+		sql::Expr *operands[2] = { where_clause->expr, where_clause->expr2 };
+		if (operands[0] == NULL || operands[1] == NULL
+			|| operands[0]->type != sql::kExprColumnRef || operands[1]->type != sql::kExprColumnRef)
+			return false;
+
+		LightTable *tables[2] = { match_table(operands[0], from_tables), match_table(operands[1], from_tables) };
+		if (tables[0] == tables[1])
+			return false;
 
-		switch (aggre_type)
+		table_comb = { tables[0], tables[1] };
+		for (int i = 0; i < func_list->size(); i++)
 		{
-		case COUNT:
-			if (attr_type == ATTR_TYPE_INTEGER ||
-				(attr_type == ATTR_TYPE_VARCHAR
-					&& tuple.at(colid).size() > 0))
-				aggre_counter++;
-			break;
-		case SUM:
-			if (attr_type == ATTR_TYPE_VARCHAR)
-				throw exception_t(UNEXPECTED_ERROR, "Varchar cannot sum.");
-			aggre_counter += tuple.at(colid).Int();
-			break;
-		default:
-			break;
+			DatabaseAggregateType aggre_type = func_list->at(i)->type == sql::AggregationFunction::kCount ? COUNT : SUM;
+			parse_select_entry(func_list->at(i)->attribute, from_tables, table_comb, aggre_type, aggre_list);
+		}
+
+		AggregateSink sink(*this, aggre_list, aggre_counters);
+		LightTable::join_cross(
+			*tables[0],
+			operands[0]->name,
+			expr_op_to_rel(where_clause),
+			*tables[1],
+			operands[1]->name,
+			sink);
+	}
+
+	for (int i = 0; i < aggre_counters.size(); i++)
+		mSink->put(aggre_counters[i]);
+	mSink->end_row();
+
+	return true;
+}
+
+/*
+	DatabaseLite::exec_select_aggre_rows()
+
+	aggregate one column over addrs of its table, all rows if addrs is NULL
+*/
+int64_t DatabaseLite::exec_select_aggre_rows(SelectEntry aggre_ent, const std::vector<uint32_t>* addrs)
+{
+	LightTable *bind_table = std::get<0>(aggre_ent);
+	uint32_t num = (addrs != NULL) ? addrs->size() : bind_table->size();
+
+	// Per-worker partial aggregates, merged after all morsels
+	std::vector<int64_t> partials(WorkerPool::instance().size(), 0);
+	WorkerPool::instance().run(num, [&](const Morsel & m)
+	{
+		int64_t partial = 0;
+		for (uint32_t i = m.begin; i < m.end; i++)
+		{
+			int addr = (addrs != NULL) ? addrs->at(i) : i;
+			exec_select_aggre({ addr, addr }, aggre_ent, partial);
+		}
+		partials[m.worker] += partial;
+	});
+
+	int64_t aggre_counter = 0;
+	for (int64_t partial : partials)
+		aggre_counter += partial;
+	return aggre_counter;
+}
+
+/*
+	DatabaseLite::exec_select_pipeline()
+
+	where clause is AND of constant predicates and at most one EQ/LESS/LARGE join,
+	build Scan/IndexScan -> Filter -> HashJoin/MergeJoin/SortMergeJoin/Product -> Project/Aggregate
+	and pull batches from it, rows are printed as soon as produced
+	return false if where clause has other shape
+*/
+bool DatabaseLite::exec_select_pipeline(sql::SelectStatement & select_stmt, std::vector<FromEntry> & from_tables)
+{
+	if (!select_stmt.hasWhere() || from_tables.empty() || from_tables.size() > 2)
+		return false;
+
+	// Same table twice cannot be told apart by LightTable *
+	if (from_tables.size() == 2 && from_tables[0].second == from_tables[1].second)
+		return false;
+
+	std::vector<Predicate> predicates[2];
+	sql::Expr *join_expr = NULL;
+	if (!split_conjunction(select_stmt.whereClause, from_tables, predicates, join_expr))
+		return false;
+
+	LightTable *tables[2] = { from_tables[0].second, from_tables.back().second };
+	std::pair<LightTable *, LightTable *> table_comb(tables[0], tables[1]);
+	LightOperator *root;
+
+	if (join_expr != NULL)
+	{
+		sql::Expr *keys[2] = { join_expr->expr, join_expr->expr2 };
+		relation_type_t rel_type = expr_op_to_rel(join_expr);
+		if (match_table(keys[0], from_tables) != tables[0])
+		{
+			// b.key < a.key is a.key > b.key
+			std::swap(keys[0], keys[1]);
+			rel_type = (rel_type == LESS) ? LARGE : (rel_type == LARGE) ? LESS : rel_type;
+		}
+
+		root = LightTable::join_path(
+			*tables[0], tables[0]->get_attr_id(keys[0]->name), predicates[0],
+			rel_type,
+			*tables[1], tables[1]->get_attr_id(keys[1]->name), predicates[1]);
+	}
+	else if (from_tables.size() == 2)
+	{
+		root = new ProductOperator(tables[0]->access_path(predicates[0]), tables[1]->access_path(predicates[1]));
+	}
+	else
+	{
+		root = tables[0]->access_path(predicates[0]);
+	}
+
+	std::vector<SelectEntry> entries;
+	if (select_stmt.hasAggregation())
+	{
+		std::vector<sql::AggregationFunction*> *func_list = select_stmt.aggregation_list;
+		for (int i = 0; i < func_list->size(); i++)
+		{
+			DatabaseAggregateType aggre_type = func_list->at(i)->type == sql::AggregationFunction::kCount ? COUNT : SUM;
+			parse_select_entry(func_list->at(i)->attribute, from_tables, table_comb, aggre_type, entries);
 		}
+
+		AggregateOperator aggregate(root, entries);
+		aggregate.exec(*mSink);
+	}
+	else
+	{
+		std::vector<sql::Expr*> * select_clause = select_stmt.selectList;
+		for (int i = 0; i < select_clause->size(); i++)
+			parse_select_entry(select_clause->at(i), from_tables, table_comb, NO_AGGRE, entries);
+
+		ProjectOperator project(root, entries);
+		project.exec(*mSink);
+	}
+
+	return true;
+}
+
+/*
+	DatabaseLite::exec_select_multiway()
+
+	from clause of more than two tables, where clause is AND of terms on
+	one table and (col rel col) joins between two tables,
+	each table is filtered by its terms, then JoinPlanner joins them
+	in the order of least estimated intermediate rows
+*/
+void DatabaseLite::exec_select_multiway(sql::SelectStatement & select_stmt, std::vector<FromEntry> & from_tables)
+{
+	int n = from_tables.size();
+	std::vector<LightTable *> tables;
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = 0; j < i; j++)
+			if (from_tables[j].second == from_tables[i].second)
+				throw exception_t(UNEXPECTED_ERROR, "Same table joined more than once.");
+		tables.push_back(from_tables[i].second);
+	}
+	auto position = [&](LightTable *table) { return std::find(tables.begin(), tables.end(), table) - tables.begin(); };
+
+	std::vector<sql::Expr *> terms;
+	if (select_stmt.hasWhere() && !flatten_conjunction(select_stmt.whereClause, terms))
+		throw exception_t(UNEXPECTED_ERROR, "Where statement parsing error: missing operand.");
+
+	std::vector<std::vector<sql::Expr *>> table_terms(n);
+	std::vector<JoinEdge> edges;
+	for (sql::Expr *term : terms)
+	{
+		LightTable *table = NULL;
+		if (term_table(term, from_tables, table))
+		{
+			if (table == NULL)
+				throw exception_t(UNEXPECTED_ERROR, "Constant expression is forbidden.");
+			table_terms[position(table)].push_back(term);
+			continue;
+		}
+
+		if (term->type != sql::kExprOperator
+			|| (term->op_type != sql::Expr::SIMPLE_OP && term->op_type != sql::Expr::NOT_EQUALS)
+			|| term->expr == NULL || term->expr->type != sql::kExprColumnRef
+			|| term->expr2 == NULL || term->expr2->type != sql::kExprColumnRef)
+			throw exception_t(UNEXPECTED_ERROR, "Where clause of more than two tables must be AND of joins and terms on one table.");
+
+		LightTable *a = match_table(term->expr, from_tables);
+		LightTable *b = match_table(term->expr2, from_tables);
+		int a_key_id = a->get_attr_id(term->expr->name);
+		int b_key_id = b->get_attr_id(term->expr2->name);
+		if (a_key_id < 0 || b_key_id < 0)
+			throw exception_t(UNEXPECTED_ERROR, "Attribute not found.");
+		edges.push_back({ (int)position(a), a_key_id, expr_op_to_rel(term), (int)position(b), b_key_id });
+	}
+
+	std::vector<RowBitmap> rows(n);
+	std::vector<const RowBitmap *> join_rows(n, NULL);
+	for (int i = 0; i < n; i++)
+	{
+		if (table_terms[i].empty())
+			continue;
+		filter_where_terms(table_terms[i], from_tables[i], rows[i]);
+		join_rows[i] = &rows[i];
+	}
+
+	AddrTuples tuples;
+	JoinPlanner planner(tables, join_rows, edges);
+	planner.exec(tuples);
+
+	// Comb id of an entry is the position of its table
+	std::pair<LightTable *, LightTable *> table_comb(tables[0], tables[1]);
+	std::vector<SelectEntry> entries;
+	if (select_stmt.hasAggregation())
+	{
+		std::vector<sql::AggregationFunction*> *func_list = select_stmt.aggregation_list;
+		for (int i = 0; i < func_list->size(); i++)
+		{
+			DatabaseAggregateType aggre_type = func_list->at(i)->type == sql::AggregationFunction::kCount ? COUNT : SUM;
+			parse_select_entry(func_list->at(i)->attribute, from_tables, table_comb, aggre_type, entries);
+		}
+	}
+	else
+	{
+		std::vector<sql::Expr*> * select_clause = select_stmt.selectList;
+		for (int i = 0; i < select_clause->size(); i++)
+			parse_select_entry(select_clause->at(i), from_tables, table_comb, NO_AGGRE, entries);
+	}
+	for (SelectEntry & entry : entries)
+	{
+		if (std::get<0>(entry) != NULL)
+			std::get<1>(entry) = position(std::get<0>(entry));
+	}
+
+	if (select_stmt.hasAggregation())
+	{
+		std::vector<int64_t> aggre_counters(entries.size(), 0);
+		for (uint32_t r = 0; r < tuples.size(); r++)
+		{
+			for (int i = 0; i < entries.size(); i++)
+			{
+				uint32_t addr = (std::get<0>(entries[i]) != NULL) ? tuples.addrs[std::get<1>(entries[i])][r] : 0;
+				AggregateOperator::accumulate(addr, addr, entries[i], aggre_counters[i]);
+			}
+		}
+
+		for (int i = 0; i < aggre_counters.size(); i++)
+			mSink->put(aggre_counters[i]);
+		mSink->end_row();
+		return;
+	}
+
+	for (uint32_t r = 0; r < tuples.size(); r++)
+	{
+		for (const SelectEntry & entry : entries)
+			mSink->put(*std::get<0>(entry), tuples.addrs[std::get<1>(entry)][r], std::get<2>(entry));
+		mSink->end_row();
 	}
 }
 
@@ -422,7 +857,7 @@ void DatabaseLite::parse_select_entry(
 		{
 			if (col_ref->hasTable())
 			{
-				for (int i = 0; i < 2 && i < from_tables.size(); i++)
+				for (int i = 0; i < from_tables.size(); i++)
 				{
 					if (strcmp(col_ref->table, from_tables[i].first->name) != 0)
 						continue;
@@ -442,7 +877,7 @@ void DatabaseLite::parse_select_entry(
 		}
 		else
 		{
-			for (int i = 0; i < 2 && i < from_tables.size(); i++)
+			for (int i = 0; i < from_tables.size(); i++)
 			{
 				if (col_ref->hasTable())
 				{
@@ -491,9 +926,42 @@ void DatabaseLite::parse_from_clause(
 void DatabaseLite::parse_where_clause(
 	sql::Expr * where_clause, 
 	std::vector<std::pair<sql::TableRef*, LightTable*>> & from_tables,
-	std::vector<std::vector<AddrPair>> & where_addr_pairs,
+	std::vector<WhereRows> & where_rows,
 	std::pair<LightTable *, LightTable *> & table_comb)
 {
+	// AND of constant predicates on one table, evaluate by estimated selectivity
+	LightTable *conj_table = NULL;
+	std::vector<Predicate> predicates;
+	if (collect_conjunction(where_clause, from_tables, conj_table, predicates) && predicates.size() >= 2)
+	{
+		std::vector<uint32_t> match_addrs;
+		conj_table->filter_conjunction(predicates, match_addrs);
+
+		where_rows.resize(where_rows.size() + 1);
+		where_rows.back().rows.add(match_addrs);
+		table_comb.first = table_comb.second = conj_table;
+
+		expand_where_pairs(from_tables, where_rows, table_comb);
+		return;
+	}
+
+	// AND / OR of constant predicates on one table, by index postings and residual filters
+	PredicateTree tree;
+	conj_table = NULL;
+	if (collect_predicate_tree(where_clause, from_tables, conj_table, tree))
+	{
+		where_rows.resize(where_rows.size() + 1);
+		conj_table->filter_tree(tree, where_rows.back().rows);
+		table_comb.first = table_comb.second = conj_table;
+
+		expand_where_pairs(from_tables, where_rows, table_comb);
+		return;
+	}
+
+	// Terms on one table filter it before the join
+	if (push_down_where(where_clause, from_tables, where_rows, table_comb))
+		return;
+
 	std::vector<std::pair<LightTable *, LightTable *>> tableCombs; // Used to check orders before merge
 	std::stack<sql::Expr *> tokenStack;
 	std::stack<sql::Expr *> opStack;
@@ -540,9 +1008,9 @@ void DatabaseLite::parse_where_clause(
 		assert(expr != NULL);
 
 		// AND, OR
-		if ((expr->op_type == sql::Expr::AND || expr->op_type == sql::Expr::OR) && where_addr_pairs.size() >= 2)
+		if ((expr->op_type == sql::Expr::AND || expr->op_type == sql::Expr::OR) && where_rows.size() >= 2)
 		{
-			if(where_addr_pairs.size() != 2)
+			if(where_rows.size() != 2)
 				throw exception_t(UNEXPECTED_ERROR, "No correct number of pairs when merge.");
 			/// TODO: Check order
 			// Check order (force them to be in same)
@@ -551,18 +1019,18 @@ void DatabaseLite::parse_where_clause(
 			oit++;
 			auto & comb2 = *oit;
 
-			where_addr_pairs.resize(where_addr_pairs.size() + 1);
+			where_rows.resize(where_rows.size() + 1);
 			std::vector<LightTable *> candidate_tables;
 			for (auto from_table : from_tables)
 				candidate_tables.emplace_back(from_table.second);
 			merge_type_t merge_type = (expr->op_type == sql::Expr::AND) ? AND : OR;
 			table_comb = LightTable::merge(
 				comb2,
-				where_addr_pairs.at(0),
+				where_rows.at(0),
 				merge_type, 
 				comb1,
-				where_addr_pairs.at(1),
-				where_addr_pairs.back(),
+				where_rows.at(1),
+				where_rows.back(),
 				candidate_tables);
 		}
 		// =, <>, <, >
@@ -581,14 +1049,14 @@ void DatabaseLite::parse_where_clause(
 
 				if (tables[0] == tables[1])
 				{
-					where_addr_pairs.resize(where_addr_pairs.size() + 1);
+					where_rows.resize(where_rows.size() + 1);
 					tableCombs.emplace_back(
 						LightTable::join_self(
 							*tables[0],
 							operands[0]->name,
 							expr_op_to_rel(expr),
 							operands[1]->name,
-							where_addr_pairs.back())
+							where_rows.back().rows)
 					);
 
 					// if has two table, expand it
@@ -596,14 +1064,14 @@ void DatabaseLite::parse_where_clause(
 				}
 				else
 				{
-					where_addr_pairs.resize(where_addr_pairs.size() + 1);
+					where_rows.resize(where_rows.size() + 1);
 					tableCombs.emplace_back(LightTable::join_cross(
 						*tables[0],
 						operands[0]->name,
 						expr_op_to_rel(expr),
 						*tables[1],
 						operands[1]->name,
-						where_addr_pairs.back()));
+						where_rows.back().pairs));
 					table_comb.first = tables[0];
 					table_comb.second = tables[1];
 				}
@@ -623,13 +1091,13 @@ void DatabaseLite::parse_where_clause(
 					if (pair.second != table)
 						onto_table = pair.second;
 	
-				where_addr_pairs.resize(where_addr_pairs.size() + 1);
+				where_rows.resize(where_rows.size() + 1);
 				tableCombs.emplace_back(LightTable::join_self(
 					*table,
 					operands[0]->name,
 					expr_op_to_rel(expr),
 					expr_to_attr(operands[1]),
-					where_addr_pairs.back()));
+					where_rows.back().rows));
 
 				// if has two table, expand it
 				table_comb.first = table_comb.second = table;
@@ -641,25 +1109,341 @@ void DatabaseLite::parse_where_clause(
 		}
 	}
 
+	expand_where_pairs(from_tables, where_rows, table_comb);
+}
+
+/*
+	DatabaseLite::collect_conjunction()
+
+	collect (colref op literal) joined by AND only, all on the same table
+	return false if where clause has other shape
+*/
+bool DatabaseLite::collect_conjunction(
+	sql::Expr * expr,
+	std::vector<std::pair<sql::TableRef*, LightTable*>> & from_tables,
+	LightTable *& table,
+	std::vector<Predicate> & predicates)
+{
+	if (expr == NULL || expr->type != sql::kExprOperator)
+		return false;
+
+	if (expr->op_type == sql::Expr::AND)
+		return collect_conjunction(expr->expr, from_tables, table, predicates)
+			&& collect_conjunction(expr->expr2, from_tables, table, predicates);
+
+	if (expr->op_type != sql::Expr::SIMPLE_OP && expr->op_type != sql::Expr::NOT_EQUALS)
+		return false;
+
+	sql::Expr *colref = expr->expr;
+	sql::Expr *literal = expr->expr2;
+	if (colref == NULL || literal == NULL || colref->type != sql::kExprColumnRef)
+		return false;
+	if (literal->type != sql::kExprLiteralInt && literal->type != sql::kExprLiteralString)
+		return false;
+
+	LightTable *bind_table = match_table(colref, from_tables);
+	if (table != NULL && table != bind_table)
+		return false;
+	table = bind_table;
+
+	predicates.push_back({ bind_table->get_attr_id(colref->name), expr_op_to_rel(expr), expr_to_attr(literal), 0.0, attr_t() });
+	return true;
+}
+
+/*
+	DatabaseLite::collect_predicate_tree()
+
+	collect AND / OR of (colref op literal), all on the same table,
+	terms of the same operator are flattened into one node
+	return false if where clause has other shape
+*/
+bool DatabaseLite::collect_predicate_tree(
+	sql::Expr * expr,
+	std::vector<FromEntry> & from_tables,
+	LightTable *& table,
+	PredicateTree & tree)
+{
+	if (expr == NULL || expr->type != sql::kExprOperator)
+		return false;
+
+	if (expr->op_type != sql::Expr::AND && expr->op_type != sql::Expr::OR)
+	{
+		tree.merge_type = AND;
+		return collect_conjunction(expr, from_tables, table, tree.predicates);
+	}
+
+	tree.merge_type = (expr->op_type == sql::Expr::AND) ? AND : OR;
+	return collect_tree_term(expr->expr, from_tables, table, tree)
+		&& collect_tree_term(expr->expr2, from_tables, table, tree);
+}
+
+bool DatabaseLite::collect_tree_term(
+	sql::Expr * expr,
+	std::vector<FromEntry> & from_tables,
+	LightTable *& table,
+	PredicateTree & tree)
+{
+	if (expr == NULL || expr->type != sql::kExprOperator)
+		return false;
+
+	bool is_and = expr->op_type == sql::Expr::AND, is_or = expr->op_type == sql::Expr::OR;
+	if ((is_and && tree.merge_type == AND) || (is_or && tree.merge_type == OR))
+		return collect_tree_term(expr->expr, from_tables, table, tree)
+			&& collect_tree_term(expr->expr2, from_tables, table, tree);
+
+	if (is_and || is_or)
+	{
+		tree.children.emplace_back();
+		return collect_predicate_tree(expr, from_tables, table, tree.children.back());
+	}
+	return collect_conjunction(expr, from_tables, table, tree.predicates);
+}
+
+/*
+	DatabaseLite::split_conjunction()
+
+	split AND of (col rel literal) into predicates of each from table,
+	and (col rel col) of two tables into join_expr, at most one is allowed,
+	rel is EQ, or LESS/LARGE on columns of the same type
+	return false on other shapes
+*/
+bool DatabaseLite::split_conjunction(
+	sql::Expr * expr,
+	std::vector<FromEntry> & from_tables,
+	std::vector<Predicate> * predicates,
+	sql::Expr *& join_expr)
+{
+	if (expr == NULL || expr->type != sql::kExprOperator)
+		return false;
+
+	if (expr->op_type == sql::Expr::AND)
+		return split_conjunction(expr->expr, from_tables, predicates, join_expr)
+			&& split_conjunction(expr->expr2, from_tables, predicates, join_expr);
+
+	if (expr->op_type != sql::Expr::SIMPLE_OP && expr->op_type != sql::Expr::NOT_EQUALS)
+		return false;
+
+	sql::Expr *colref = expr->expr;
+	sql::Expr *operand = expr->expr2;
+	if (colref == NULL || operand == NULL || colref->type != sql::kExprColumnRef)
+		return false;
+
+	LightTable *bind_table = match_table(colref, from_tables);
+	int side = (bind_table == from_tables[0].second) ? 0 : 1;
+
+	if (operand->type == sql::kExprColumnRef)
+	{
+		LightTable *other_table = match_table(operand, from_tables);
+		relation_type_t rel_type = expr_op_to_rel(expr);
+		if (join_expr != NULL || rel_type == NEQ || other_table == bind_table)
+			return false;
+		if (rel_type != EQ && bind_table->get_attr_type(bind_table->get_attr_id(colref->name))
+			!= other_table->get_attr_type(other_table->get_attr_id(operand->name)))
+			return false;
+		join_expr = expr;
+		return true;
+	}
+
+	if (operand->type != sql::kExprLiteralInt && operand->type != sql::kExprLiteralString)
+		return false;
+
+	predicates[side].push_back({ bind_table->get_attr_id(colref->name), expr_op_to_rel(expr), expr_to_attr(operand), 0.0, attr_t() });
+	return true;
+}
+
+/*
+	DatabaseLite::push_down_where()
+
+	where clause is AND of one join between the two tables and terms each on
+	one table (predicates, self joins, OR of them), terms are evaluated first
+	and only rows left on each side are joined, instead of joining all rows
+	and merging the result with the terms
+	return false if where clause has other shape
+*/
+bool DatabaseLite::push_down_where(
+	sql::Expr * where_clause,
+	std::vector<FromEntry> & from_tables,
+	std::vector<WhereRows> & where_rows,
+	std::pair<LightTable *, LightTable *> & table_comb)
+{
+	if (from_tables.size() != 2 || from_tables[0].second == from_tables[1].second)
+		return false;
+
+	std::vector<sql::Expr *> terms;
+	if (!flatten_conjunction(where_clause, terms))
+		return false;
+
+	sql::Expr *join_expr = NULL;
+	std::vector<sql::Expr *> side_terms[2];
+	for (sql::Expr *term : terms)
+	{
+		LightTable *table = NULL;
+		if (term_table(term, from_tables, table))
+		{
+			if (table == NULL)
+				return false;
+			side_terms[(table == from_tables[0].second) ? 0 : 1].push_back(term);
+			continue;
+		}
+
+		// Not on one table, must be the only colref rel colref
+		if (join_expr != NULL || term->type != sql::kExprOperator
+			|| (term->op_type != sql::Expr::SIMPLE_OP && term->op_type != sql::Expr::NOT_EQUALS)
+			|| term->expr == NULL || term->expr->type != sql::kExprColumnRef
+			|| term->expr2 == NULL || term->expr2->type != sql::kExprColumnRef)
+			return false;
+		join_expr = term;
+	}
+	if (join_expr == NULL || (side_terms[0].empty() && side_terms[1].empty()))
+		return false;
+
+	LightTable *tables[2] = { match_table(join_expr->expr, from_tables), match_table(join_expr->expr2, from_tables) };
+	RowBitmap rows[2];
+	const RowBitmap *join_rows[2] = { NULL, NULL };
+	for (int i = 0; i < 2; i++)
+	{
+		int side = (tables[i] == from_tables[0].second) ? 0 : 1;
+		if (side_terms[side].empty())
+			continue;
+		filter_where_terms(side_terms[side], from_tables[side], rows[i]);
+		join_rows[i] = &rows[i];
+	}
+
+	where_rows.resize(where_rows.size() + 1);
+	table_comb = LightTable::join_rows(
+		*tables[0],
+		join_expr->expr->name,
+		join_rows[0],
+		expr_op_to_rel(join_expr),
+		*tables[1],
+		join_expr->expr2->name,
+		join_rows[1],
+		where_rows.back().pairs);
+	return true;
+}
+
+/*
+	DatabaseLite::flatten_conjunction()
+
+	terms of nested AND in order, return false on a missing operand
+*/
+bool DatabaseLite::flatten_conjunction(sql::Expr * expr, std::vector<sql::Expr*>& terms)
+{
+	std::stack<sql::Expr *> input;
+	input.push(expr);
+	while (!input.empty())
+	{
+		sql::Expr *term = input.top(); input.pop();
+		if (term == NULL)
+			return false;
+		if (term->type == sql::kExprOperator && term->op_type == sql::Expr::AND)
+		{
+			input.push(term->expr2);
+			input.push(term->expr);
+		}
+		else
+			terms.push_back(term);
+	}
+	return true;
+}
+
+/*
+	DatabaseLite::filter_where_terms()
+
+	rows of from_table satisfying AND of terms, constant predicates and
+	AND / OR of them are one predicate tree, its OR terms refine the rows
+	of the others, other terms by the stack evaluation on this table alone,
+	then intersected
+*/
+void DatabaseLite::filter_where_terms(
+	std::vector<sql::Expr *> & terms,
+	FromEntry & from_table,
+	RowBitmap & rows)
+{
+	std::vector<FromEntry> one_table(1, from_table);
+	PredicateTree tree;
+	tree.merge_type = AND;
+	std::vector<sql::Expr *> others;
+	for (sql::Expr *term : terms)
+	{
+		LightTable *table = NULL;
+		PredicateTree term_tree;
+		if (!collect_predicate_tree(term, one_table, table, term_tree))
+			others.push_back(term);
+		else if (term_tree.merge_type == AND)
+			tree.predicates.insert(tree.predicates.end(), term_tree.predicates.begin(), term_tree.predicates.end());
+		else
+			tree.children.push_back(term_tree);
+	}
+
+	bool first = true;
+	if (!tree.predicates.empty() || !tree.children.empty())
+	{
+		from_table.second->filter_tree(tree, rows);
+		first = false;
+	}
+
+	for (sql::Expr *term : others)
+	{
+		std::vector<WhereRows> term_rows;
+		std::pair<LightTable *, LightTable *> term_comb;
+		parse_where_clause(term, one_table, term_rows, term_comb);
+
+		if (first)
+			rows = term_rows.back().rows;
+		else
+			RowBitmap::merge(rows, AND, term_rows.back().rows, rows);
+		first = false;
+	}
+}
+
+/*
+	DatabaseLite::term_table()
+
+	the only table referred by colrefs of expr, NULL if none
+	return false if more than one
+*/
+bool DatabaseLite::term_table(sql::Expr * expr, std::vector<FromEntry> & from_tables, LightTable *& table)
+{
+	if (expr == NULL)
+		return true;
+
+	if (expr->type == sql::kExprColumnRef)
+	{
+		LightTable *bind_table = match_table(expr, from_tables);
+		if (table != NULL && table != bind_table)
+			return false;
+		table = bind_table;
+		return true;
+	}
+
+	return term_table(expr->expr, from_tables, table) && term_table(expr->expr2, from_tables, table);
+}
+
+void DatabaseLite::expand_where_pairs(
+	std::vector<std::pair<sql::TableRef*, LightTable*>> & from_tables,
+	std::vector<WhereRows> & where_rows,
+	std::pair<LightTable *, LightTable *> & table_comb)
+{
 	if (from_tables.size() == 2)
 	{
 		// Two table from, but where one, product it
 		if (table_comb.first == table_comb.second)
 		{
-			where_addr_pairs.resize(where_addr_pairs.size() + 1);
-			std::vector<AddrPair> & pairs = where_addr_pairs.at(where_addr_pairs.size() - 2);
+			where_rows.resize(where_rows.size() + 1);
+			const RowBitmap & rows = where_rows.at(where_rows.size() - 2).rows;
+			std::vector<AddrPair> & pairs = where_rows.back().pairs;
 
 			LightTable *other = (from_tables[0].second == table_comb.first) ? from_tables[1].second : from_tables[0].second;
 			
 			table_comb.second = other;
 			
-			for (int i = 0; i < pairs.size(); i++)
+			uint32_t other_size = other->size();
+			rows.for_each([&](uint32_t addr)
 			{
-				for (int j = 0; j < other->size(); j++)
-				{
-					where_addr_pairs.back().emplace_back(i, j);
-				}
-			}
+				for (uint32_t j = 0; j < other_size; j++)
+					pairs.emplace_back(addr, j);
+			});
 		}
 	}
 }
@@ -3,14 +3,11 @@
 #include "database_type.h"
 #include "database_util.h"
 #include "LightTable.h"
+#include "LightOperator.h"
+#include "JoinPlanner.h"
 #include "SQLParser.h"
 #include "DatabaseLiteFile.h"
 
-enum DatabaseAggregateType
-{
-	NO_AGGRE, COUNT, SUM
-};
-
 /*
 	DatabaseLite
 
@@ -28,17 +25,32 @@ public:
 
 	void exec(std::string & command, bool profile);
 	void exec(std::string & command);
+	// attrname "a,b" is a composite index over a then b
 	void exec_create_index(std::string tablename, std::string attrname, IndexType type);
+	void exec_drop_index(std::string tablename, std::string attrname);
+	uint32_t exec_bulk_load(std::string tablename, std::string csv_path, char delim);
+
+	// Select results go to os in format, TSV on std::cout by default
+	void set_output(std::ostream & os, ResultFormat format);
 	void load(std::string dbs_filepath);
 	void save();
 private:
+	class AggregateSink;
+
 	DatabaseLiteFile mDbf;
+	ResultSink *mSink;
 
+	void exec_sql(std::string & sql);
 	void exec_create(sql::SQLStatement *stmt);
 	void exec_insert(sql::SQLStatement *stmt);
 	void exec_select(sql::SQLStatement *stmt);
+	void exec_select_rows(sql::SQLStatement *stmt);
 
-	void exec_select_aggre(std::pair<int, int> pair, SelectEntry aggre_ent, int & aggre_counter);
+	void exec_select_aggre(std::pair<int, int> pair, SelectEntry aggre_ent, int64_t & aggre_counter);
+	bool exec_select_aggre_pushdown(sql::SelectStatement & select_stmt, std::vector<FromEntry> & from_tables);
+	int64_t exec_select_aggre_rows(SelectEntry aggre_ent, const std::vector<uint32_t> *addrs);
+	bool exec_select_pipeline(sql::SelectStatement & select_stmt, std::vector<FromEntry> & from_tables);
+	void exec_select_multiway(sql::SelectStatement & select_stmt, std::vector<FromEntry> & from_tables);
 
 	void parse_select_entry(
 		sql::Expr *col_ref,
@@ -55,7 +67,51 @@ private:
 	void parse_where_clause(
 		sql::Expr * where_clause, 
 		std::vector<std::pair<sql::TableRef *, LightTable*>> & from_tables,
-		std::vector<std::vector<AddrPair>> & where_addr_pairs,
+		std::vector<WhereRows> & where_rows,
+		std::pair<LightTable *, LightTable *> & table_comb);
+
+	bool collect_conjunction(
+		sql::Expr * expr,
+		std::vector<std::pair<sql::TableRef *, LightTable*>> & from_tables,
+		LightTable *& table,
+		std::vector<Predicate> & predicates);
+
+	bool collect_predicate_tree(
+		sql::Expr * expr,
+		std::vector<FromEntry> & from_tables,
+		LightTable *& table,
+		PredicateTree & tree);
+
+	bool collect_tree_term(
+		sql::Expr * expr,
+		std::vector<FromEntry> & from_tables,
+		LightTable *& table,
+		PredicateTree & tree);
+
+	bool split_conjunction(
+		sql::Expr * expr,
+		std::vector<FromEntry> & from_tables,
+		std::vector<Predicate> * predicates,
+		sql::Expr *& join_expr);
+
+	bool flatten_conjunction(sql::Expr * expr, std::vector<sql::Expr *> & terms);
+
+	bool push_down_where(
+		sql::Expr * where_clause,
+		std::vector<FromEntry> & from_tables,
+		std::vector<WhereRows> & where_rows,
+		std::pair<LightTable *, LightTable *> & table_comb);
+
+	void filter_where_terms(
+		std::vector<sql::Expr *> & terms,
+		FromEntry & from_table,
+		RowBitmap & rows);
+
+	bool term_table(sql::Expr * expr, std::vector<FromEntry> & from_tables, LightTable *& table);
+
+	void expand_where_pairs(
+		std::vector<std::pair<sql::TableRef *, LightTable*>> & from_tables,
+		std::vector<WhereRows> & where_rows,
 		std::pair<LightTable *, LightTable *> & table_comb);
 
 	LightTable * match_table(sql::Expr * colref, std::vector<std::pair<sql::TableRef *, LightTable*>> & from_tables);
@@ -22,7 +22,7 @@ LightTable & DatabaseLiteFile::get_table(std::string tablename)
 void DatabaseLiteFile::set_table(std::string tablename, std::vector<table_attr_desc_t> &attr_descs)
 {
 	LightTable *pTable = new LightTable;
-	pTable->create(tablename.c_str(), attr_descs.data(), attr_descs.size());
+	pTable->create(tablename.c_str(), attr_descs.data(), attr_descs.size(), columnar ? COLUMN_LAYOUT : ROW_LAYOUT);
 	
 	auto res = mTables.insert({ tablename, pTable });
 	if (!res.second)
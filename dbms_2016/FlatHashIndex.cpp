@@ -0,0 +1,280 @@
+#include "FlatHashIndex.h"
+
+FlatHashIndex::FlatHashIndex(attr_domain_t domain) :
+	mDomain(domain), mGroupMask(0), mSize(0), mMapped(false)
+{
+	mCtrl.assign(FLAT_HASH_GROUP_WIDTH, FLAT_HASH_EMPTY);
+	mSlots.assign(FLAT_HASH_GROUP_WIDTH, FLAT_HASH_NIL);
+	sync();
+}
+
+FlatHashIndex::~FlatHashIndex()
+{
+}
+
+void FlatHashIndex::insert(const attr_t & key, uint32_t addr)
+{
+	if (mMapped)
+		own();
+	append(find_or_add(key), addr);
+
+	// Chains longer than the posting lists are folded in, O(1) amortized
+	if (mPendingAddrs.size() > mAddrs.size() + FLAT_HASH_GROUP_WIDTH)
+		compact();
+}
+
+void FlatHashIndex::bulk_insert(const std::vector<std::pair<attr_t, uint32_t>> & entries)
+{
+	if (mMapped)
+		own();
+	mPendingAddrs.reserve(mPendingAddrs.size() + entries.size());
+	mPendingNext.reserve(mPendingNext.size() + entries.size());
+	for (const auto & entry : entries)
+		append(find_or_add(entry.first), entry.second);
+	compact();
+}
+
+uint32_t FlatHashIndex::find(const attr_t & key) const
+{
+	if (key.Domain() != mDomain)
+		return FLAT_HASH_NIL;
+	return find(key, hash(key));
+}
+
+/*
+	FlatHashIndex::find()
+
+	high bits of hash pick the first group, low 7 bits are matched
+	against control bytes, a group with an empty slot ends the probe
+*/
+uint32_t FlatHashIndex::find(const attr_t & key, uint32_t hash) const
+{
+	int8_t h2 = hash & 0x7F;
+	uint32_t group = (hash >> 7) & mGroupMask;
+	while (true)
+	{
+		for (uint32_t mask = match(group, h2); mask != 0; mask &= mask - 1)
+		{
+			uint32_t key_id = mSlotsData[group * FLAT_HASH_GROUP_WIDTH + ctz(mask)];
+			const Key & entry = mKeysData[key_id];
+			if (entry.hash == hash && key_equal(entry, key))
+				return key_id;
+		}
+		if (match_empty(group) != 0)
+			return FLAT_HASH_NIL;
+		group = (group + 1) & mGroupMask;
+	}
+}
+
+void FlatHashIndex::prefetch(uint32_t hash) const
+{
+	uint32_t group = (hash >> 7) & mGroupMask;
+#ifdef FLAT_HASH_SSE2
+	_mm_prefetch((const char *)(mCtrlData + group * FLAT_HASH_GROUP_WIDTH), _MM_HINT_T0);
+	_mm_prefetch((const char *)(mSlotsData + group * FLAT_HASH_GROUP_WIDTH), _MM_HINT_T0);
+#endif
+}
+
+attr_t FlatHashIndex::key_attr(uint32_t key) const
+{
+	const Key & entry = mKeysData[key];
+	if (mDomain == INTEGER_DOMAIN)
+		return attr_t(entry.ival);
+	return attr_t(mArenaData + entry.soff);
+}
+
+uint32_t FlatHashIndex::find_or_add(const attr_t & key)
+{
+	uint32_t h = hash(key);
+	uint32_t key_id = find(key, h);
+	if (key_id != FLAT_HASH_NIL)
+		return key_id;
+
+	// Keep load factor <= 7/8, a probe always meets an empty slot
+	if ((mKeys.size() + 1) * 8 > mCtrl.size() * 7)
+		grow();
+
+	Key entry = { h, 0, 0, 0, 0, FLAT_HASH_NIL, FLAT_HASH_NIL, 0 };
+	if (mDomain == INTEGER_DOMAIN)
+		entry.ival = key.Int();
+	else
+	{
+		const char *str = key.Varchar();
+		entry.soff = mArena.size();
+		mArena.insert(mArena.end(), str, str + strnlen(str, ATTR_SIZE_MAX));
+		mArena.push_back('\0');
+	}
+	mKeys.push_back(entry);
+	sync();
+
+	key_id = mKeys.size() - 1;
+	place(key_id);
+	return key_id;
+}
+
+void FlatHashIndex::place(uint32_t key_id)
+{
+	uint32_t h = mKeys[key_id].hash;
+	uint32_t group = (h >> 7) & mGroupMask;
+	uint32_t mask;
+	while ((mask = match_empty(group)) == 0)
+		group = (group + 1) & mGroupMask;
+
+	uint32_t slot = group * FLAT_HASH_GROUP_WIDTH + ctz(mask);
+	mCtrl[slot] = h & 0x7F;
+	mSlots[slot] = key_id;
+}
+
+void FlatHashIndex::grow()
+{
+	uint32_t slot_num = mCtrl.size() * 2;
+	mCtrl.assign(slot_num, FLAT_HASH_EMPTY);
+	mSlots.assign(slot_num, FLAT_HASH_NIL);
+	mGroupMask = slot_num / FLAT_HASH_GROUP_WIDTH - 1;
+	sync();
+
+	// Keys are unique, only need an empty slot
+	for (uint32_t i = 0; i < mKeys.size(); i++)
+		place(i);
+}
+
+void FlatHashIndex::append(uint32_t key_id, uint32_t addr)
+{
+	Key & entry = mKeys[key_id];
+	uint32_t p = mPendingAddrs.size();
+	mPendingAddrs.push_back(addr);
+	mPendingNext.push_back(FLAT_HASH_NIL);
+
+	if (entry.pending == FLAT_HASH_NIL)
+		entry.pending = p;
+	else
+		mPendingNext[entry.pendingTail] = p;
+	entry.pendingTail = p;
+	entry.pendingCount++;
+	mSize++;
+}
+
+/*
+	FlatHashIndex::compact()
+
+	rebuild posting lists in key order, each followed by its pending chain
+*/
+void FlatHashIndex::compact()
+{
+	if (mPendingAddrs.empty())
+		return;
+
+	std::vector<uint32_t> addrs;
+	addrs.reserve(mSize);
+	for (Key & entry : mKeys)
+	{
+		uint32_t begin = addrs.size();
+		addrs.insert(addrs.end(), mAddrs.begin() + entry.begin, mAddrs.begin() + entry.begin + entry.count);
+		for (uint32_t p = entry.pending; p != FLAT_HASH_NIL; p = mPendingNext[p])
+			addrs.push_back(mPendingAddrs[p]);
+
+		entry.begin = begin;
+		entry.count = addrs.size() - begin;
+		entry.pending = entry.pendingTail = FLAT_HASH_NIL;
+		entry.pendingCount = 0;
+	}
+
+	mAddrs.swap(addrs);
+	std::vector<uint32_t>().swap(mPendingAddrs);
+	std::vector<uint32_t>().swap(mPendingNext);
+	sync();
+}
+
+void FlatHashIndex::sync()
+{
+	mCtrlData = mCtrl.data();
+	mSlotsData = mSlots.data();
+	mKeysData = mKeys.data();
+	mArenaData = mArena.data();
+	mAddrsData = mAddrs.data();
+	mSlotNum = mCtrl.size();
+	mKeyNum = mKeys.size();
+	mArenaSize = mArena.size();
+}
+
+void FlatHashIndex::image(const void * data[FLAT_HASH_SECTION_NUM], uint64_t sizes[FLAT_HASH_SECTION_NUM])
+{
+	if (!mMapped)
+		compact();
+
+	mMeta.domain = mDomain;
+	mMeta.groupNum = mSlotNum / FLAT_HASH_GROUP_WIDTH;
+	mMeta.keyNum = mKeyNum;
+	mMeta.addrNum = mSize;
+	mMeta.arenaSize = mArenaSize;
+	mMeta.reserved = 0;
+
+	data[0] = &mMeta;			sizes[0] = sizeof(Meta);
+	data[1] = mCtrlData;		sizes[1] = (uint64_t)mSlotNum * sizeof(int8_t);
+	data[2] = mSlotsData;		sizes[2] = (uint64_t)mSlotNum * sizeof(uint32_t);
+	data[3] = mKeysData;		sizes[3] = (uint64_t)mKeyNum * sizeof(Key);
+	data[4] = mArenaData;		sizes[4] = mArenaSize;
+	data[5] = mAddrsData;		sizes[5] = (uint64_t)mSize * sizeof(uint32_t);
+}
+
+/*
+	FlatHashIndex::map()
+
+	sizes are checked against meta, arrays are not copied
+*/
+bool FlatHashIndex::map(const char * const data[FLAT_HASH_SECTION_NUM], const uint64_t sizes[FLAT_HASH_SECTION_NUM])
+{
+	if (sizes[0] != sizeof(Meta))
+		return false;
+
+	Meta meta;
+	memcpy(&meta, data[0], sizeof(Meta));
+	uint64_t slot_num = (uint64_t)meta.groupNum * FLAT_HASH_GROUP_WIDTH;
+	if (meta.domain != (uint32_t)mDomain || meta.groupNum == 0 || (meta.groupNum & (meta.groupNum - 1)) != 0
+		|| sizes[1] != slot_num * sizeof(int8_t)
+		|| sizes[2] != slot_num * sizeof(uint32_t)
+		|| sizes[3] != (uint64_t)meta.keyNum * sizeof(Key)
+		|| sizes[4] != meta.arenaSize
+		|| sizes[5] != (uint64_t)meta.addrNum * sizeof(uint32_t))
+		return false;
+
+	mCtrl.clear();
+	mSlots.clear();
+	mKeys.clear();
+	mArena.clear();
+	mAddrs.clear();
+	mPendingAddrs.clear();
+	mPendingNext.clear();
+
+	mCtrlData = (const int8_t *)data[1];
+	mSlotsData = (const uint32_t *)data[2];
+	mKeysData = (const Key *)data[3];
+	mArenaData = data[4];
+	mAddrsData = (const uint32_t *)data[5];
+	mSlotNum = slot_num;
+	mKeyNum = meta.keyNum;
+	mArenaSize = meta.arenaSize;
+	mGroupMask = meta.groupNum - 1;
+	mSize = meta.addrNum;
+	mMapped = true;
+	return true;
+}
+
+/*
+	FlatHashIndex::own()
+
+	copy mapped arrays to owned memory before they change
+*/
+void FlatHashIndex::own()
+{
+	if (!mMapped)
+		return;
+
+	mCtrl.assign(mCtrlData, mCtrlData + mSlotNum);
+	mSlots.assign(mSlotsData, mSlotsData + mSlotNum);
+	mKeys.assign(mKeysData, mKeysData + mKeyNum);
+	mArena.assign(mArenaData, mArenaData + mArenaSize);
+	mAddrs.assign(mAddrsData, mAddrsData + mSize);
+	mMapped = false;
+	sync();
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "database_type.h"
+#include "HashUtil.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLAT_HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Slots of a group share one probe, matches one SSE2 compare of control bytes
+#define FLAT_HASH_GROUP_WIDTH 16
+#define FLAT_HASH_EMPTY ((int8_t)0x80)
+#define FLAT_HASH_NIL 0xFFFFFFFF
+
+// Probes hashed and prefetched ahead of the one being looked up
+#define FLAT_HASH_PREFETCH_DISTANCE 8
+
+// Meta, control bytes, slots, keys, arena, addrs
+#define FLAT_HASH_SECTION_NUM 6
+
+/*
+	FlatHashIndex
+
+	persistent open-addressing hash index of HashIndexFile, Swiss table style:
+	a control byte per slot holds 7 bits of the hash, a group of 16 control
+	bytes is matched at once, slots point to unique keys
+
+	addrs of a key are a contiguous posting list in mAddrs,
+	insert() appends to a pending chain, chains are compacted into
+	posting lists once they outgrow them, so insertion is amortized O(1)
+
+	arrays are flat so they are persisted as is, map() serves lookups
+	straight from a mapped image until the first insertion copies it
+
+	usage:
+		uint32_t key = index.find(attr);
+		if (key != FLAT_HASH_NIL)
+			index.for_each(key, [&](uint32_t addr) { ... });
+*/
+class FlatHashIndex
+{
+	struct Key
+	{
+		uint32_t hash;
+		int32_t ival;		// INTEGER key
+		uint32_t soff;		// VARCHAR key offset in arena
+		uint32_t begin;		// posting list in mAddrs
+		uint32_t count;
+		uint32_t pending;	// chain of addrs not compacted yet
+		uint32_t pendingTail;
+		uint32_t pendingCount;
+	};
+
+	struct Meta
+	{
+		uint32_t domain;
+		uint32_t groupNum;
+		uint32_t keyNum;
+		uint32_t addrNum;
+		uint32_t arenaSize;
+		uint32_t reserved;
+	};
+public:
+	FlatHashIndex(attr_domain_t domain);
+	~FlatHashIndex();
+
+	void insert(const attr_t &key, uint32_t addr);
+
+	// Posting lists are laid out once after all entries are chained
+	void bulk_insert(const std::vector<std::pair<attr_t, uint32_t>> &entries);
+
+	// Key id of key, FLAT_HASH_NIL if absent
+	uint32_t find(const attr_t &key) const;
+	uint32_t find(const attr_t &key, uint32_t hash) const;
+	void prefetch(uint32_t hash) const;
+
+	// Addrs of a key in insertion order
+	template <class Func>
+	inline void for_each(uint32_t key, Func func) const;
+
+	inline uint32_t key_num() const { return mKeyNum; }
+	inline uint32_t size() const { return mSize; }
+	inline uint32_t count(uint32_t key) const { return mKeysData[key].count + mKeysData[key].pendingCount; }
+	attr_t key_attr(uint32_t key) const;
+
+	// Sections to persist, pending chains are compacted first
+	void image(const void *data[FLAT_HASH_SECTION_NUM], uint64_t sizes[FLAT_HASH_SECTION_NUM]);
+
+	// Use sections of image(), they must outlive the index or own()
+	bool map(const char *const data[FLAT_HASH_SECTION_NUM], const uint64_t sizes[FLAT_HASH_SECTION_NUM]);
+	void own();
+
+	static inline uint32_t hash(const attr_t &key);
+private:
+	attr_domain_t mDomain;
+	uint32_t mGroupMask;
+	uint32_t mSize;
+	std::vector<int8_t> mCtrl;
+	std::vector<uint32_t> mSlots;	// key id of a full slot
+	std::vector<Key> mKeys;
+	std::vector<char> mArena;
+	std::vector<uint32_t> mAddrs;
+	std::vector<uint32_t> mPendingAddrs;
+	std::vector<uint32_t> mPendingNext;
+
+	// Arrays in use, the vectors above or a mapped image
+	const int8_t *mCtrlData;
+	const uint32_t *mSlotsData;
+	const Key *mKeysData;
+	const char *mArenaData;
+	const uint32_t *mAddrsData;
+	uint32_t mSlotNum;
+	uint32_t mKeyNum;
+	uint32_t mArenaSize;
+	bool mMapped;
+	Meta mMeta;		// Section 0 of image()
+
+	static inline uint32_t ctz(uint32_t mask);
+	inline uint32_t match(uint32_t group, int8_t h2) const;
+	inline uint32_t match_empty(uint32_t group) const;
+	inline bool key_equal(const Key &entry, const attr_t &key) const;
+
+	uint32_t find_or_add(const attr_t &key);
+	void place(uint32_t key_id);
+	void grow();
+	void append(uint32_t key_id, uint32_t addr);
+	void compact();
+	void sync();
+};
+
+template<class Func>
+inline void FlatHashIndex::for_each(uint32_t key, Func func) const
+{
+	const Key & entry = mKeysData[key];
+	const uint32_t *addrs = mAddrsData + entry.begin;
+	for (uint32_t i = 0; i < entry.count; i++)
+		func(addrs[i]);
+	for (uint32_t p = entry.pending; p != FLAT_HASH_NIL; p = mPendingNext[p])
+		func(mPendingAddrs[p]);
+}
+
+inline uint32_t FlatHashIndex::hash(const attr_t & key)
+{
+	// Stable across runs as it is persisted
+	if (key.Domain() == INTEGER_DOMAIN)
+		return HashUtil::hash_int(key.Int());
+	return HashUtil::hash_varchar(key.Varchar());
+}
+
+// Lowest set bit of a nonzero mask
+inline uint32_t FlatHashIndex::ctz(uint32_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long bit;
+	_BitScanForward(&bit, mask);
+	return bit;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Bitmask of slots in group whose control byte is h2
+inline uint32_t FlatHashIndex::match(uint32_t group, int8_t h2) const
+{
+	const int8_t *ctrl = mCtrlData + group * FLAT_HASH_GROUP_WIDTH;
+#ifdef FLAT_HASH_SSE2
+	__m128i bytes = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(h2)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < FLAT_HASH_GROUP_WIDTH; i++)
+		mask |= (uint32_t)(ctrl[i] == h2) << i;
+	return mask;
+#endif
+}
+
+inline uint32_t FlatHashIndex::match_empty(uint32_t group) const
+{
+	return match(group, FLAT_HASH_EMPTY);
+}
+
+inline bool FlatHashIndex::key_equal(const Key & entry, const attr_t & key) const
+{
+	if (mDomain == INTEGER_DOMAIN)
+		return entry.ival == key.Int();
+	return strncmp(mArenaData + entry.soff, key.Varchar(), ATTR_SIZE_MAX) == 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "database_type.h"
+
+/*
+	HashUtil
+
+	key hashes shared by JoinHashTable and FlatHashIndex,
+	FlatHashIndex persists them in .idx files, so changing
+	either function makes existing index files unreadable
+*/
+namespace HashUtil
+{
+	// murmur3 finalizer
+	inline uint32_t hash_int(int32_t key)
+	{
+		uint32_t h = (uint32_t)key;
+		h ^= h >> 16;
+		h *= 0x85ebca6b;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35;
+		h ^= h >> 16;
+		return h;
+	}
+
+	// FNV-1a of at most ATTR_SIZE_MAX chars
+	inline uint32_t hash_varchar(const char *key)
+	{
+		uint32_t h = 2166136261u;
+		for (int i = 0; i < ATTR_SIZE_MAX && key[i] != '\0'; i++)
+		{
+			h ^= (unsigned char)key[i];
+			h *= 16777619u;
+		}
+		return h;
+	}
+}
@@ -4,11 +4,14 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 
 using namespace std;
 
 IndexFile::IndexFile(attr_domain_t keydomain, uint32_t keysize, IndexType index_type) : 
-	mKeydomain(keydomain), mKeysize(keysize), mType(index_type)
+	mKeydomain(keydomain), mKeysize(keysize), mType(index_type),
+	mStale(true), mImageNum(0), mLogOffset(0), mLogNum(0)
 {
 }
 
@@ -16,8 +19,203 @@ IndexFile::~IndexFile()
 {
 }
 
+void IndexFile::bulk_set(IndexEntryVector & entries)
+{
+	for (const auto & entry : entries)
+		set(entry.first, entry.second);
+}
+
+uint32_t IndexFile::get_batch(IndexEntryVector & probes, std::vector<AddrPair>& match_pairs)
+{
+	for (const auto & probe : probes)
+		get(probe.first, probe.second, match_pairs);
+	return match_pairs.size();
+}
+
+void IndexFile::log_entry(const attr_t & key, uint32_t addr)
+{
+	if (mStale)
+		return;
+
+	// Too many to append, image will be rewritten anyway
+	if (mLogNum + mLog.size() >= std::max<uint64_t>(INDEXFILE_LOG_MIN, mImageNum / INDEXFILE_LOG_RATIO))
+	{
+		mStale = true;
+		IndexEntryVector().swap(mLog);
+		return;
+	}
+	mLog.emplace_back(key, addr);
+}
+
+/*
+	IndexFile::write_back()
+
+	nothing is written if the index is unchanged since load,
+	a few insertions are appended to the log, otherwise the image is rewritten
+*/
+void IndexFile::write_back()
+{
+	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
+
+	if (!mStale)
+	{
+		if (mLog.empty())
+			return;
+
+		fseek(mFile, mLogOffset + mLogNum * (mKeysize + sizeof(uint32_t)), SEEK_SET);
+		for (const auto & entry : mLog)
+			write_back_pair(entry.first, entry.second);
+		mLogNum += mLog.size();
+		IndexEntryVector().swap(mLog);
+
+		fseek(mFile, offsetof(IndexFileHeader, logNum), SEEK_SET);
+		fwrite(&mLogNum, sizeof(uint64_t), 1, mFile);
+		fflush(mFile);
+		return;
+	}
+
+	// File is overwritten below the mapping
+	release_image();
+	mImage.unmap();
+
+	IndexFileHeader header;
+	memset(&header, 0, sizeof(IndexFileHeader));
+	fseek(mFile, 0, SEEK_SET);
+	fwrite(&header, sizeof(IndexFileHeader), 1, mFile);
+
+	mSectionOffsets.clear();
+	mSectionSizes.clear();
+	uint64_t entry_num = write_image();
+	assert(mSectionOffsets.size() <= INDEXFILE_SECTION_MAX);
+
+	header.magic = INDEXFILE_MAGIC;
+	header.version = INDEXFILE_VERSION;
+	header.type = mType;
+	header.domain = mKeydomain;
+	header.keysize = mKeysize;
+	header.sectionNum = mSectionOffsets.size();
+	header.imageNum = entry_num;
+	header.logOffset = pad_to_page();
+	header.logNum = 0;
+	for (uint32_t i = 0; i < header.sectionNum; i++)
+	{
+		header.offsets[i] = mSectionOffsets[i];
+		header.sizes[i] = mSectionSizes[i];
+	}
+
+	fseek(mFile, 0, SEEK_SET);
+	fwrite(&header, sizeof(IndexFileHeader), 1, mFile);
+	fflush(mFile);
+
+	mStale = false;
+	mImageNum = entry_num;
+	mLogOffset = header.logOffset;
+	mLogNum = 0;
+	IndexEntryVector().swap(mLog);
+}
+
+void IndexFile::write_section(const void * data, uint64_t size)
+{
+	uint64_t offset = pad_to_page();
+	if (size > 0)
+		fwrite(data, 1, size, mFile);
+
+	mSectionOffsets.push_back(offset);
+	mSectionSizes.push_back(size);
+}
+
+uint64_t IndexFile::pad_to_page()
+{
+	static const char zeros[INDEXFILE_PAGE] = { 0 };
+	uint64_t pos = ftell(mFile);
+	uint64_t offset = (pos + INDEXFILE_PAGE - 1) / INDEXFILE_PAGE * INDEXFILE_PAGE;
+	if (offset > pos)
+		fwrite(zeros, 1, offset - pos, mFile);
+	return offset;
+}
+
+/*
+	IndexFile::read_from()
+
+	map the image and use it in place, then replay the log,
+	a file without header is a plain log and is rewritten on next save
+*/
+void IndexFile::read_from()
+{
+	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
+	fseek(mFile, 0, SEEK_SET);
+
+	// No entry is logged while loading
+	mStale = true;
+
+	IndexFileHeader header;
+	if (fread(&header, sizeof(IndexFileHeader), 1, mFile) != 1 || header.magic != INDEXFILE_MAGIC)
+	{
+		fseek(mFile, 0, SEEK_SET);
+		IndexEntryVector entries;
+		read_log(UINT64_MAX, entries);
+		bulk_set(entries);
+		return;
+	}
+
+	if (header.version != INDEXFILE_VERSION || header.type != mType || header.domain != mKeydomain
+		|| header.keysize != mKeysize || header.sectionNum > INDEXFILE_SECTION_MAX)
+		throw exception_t(INDEX_BAD_FILE, ("Index file does not match index: " + mFilepath).c_str());
+
+	fflush(mFile);
+	if (!mImage.map(mFilepath.c_str()))
+		throw exception_t(INDEX_BAD_FILE, ("Cannot map index file: " + mFilepath).c_str());
+
+	std::vector<IndexSection> sections(header.sectionNum);
+	for (uint32_t i = 0; i < header.sectionNum; i++)
+	{
+		if (header.offsets[i] + header.sizes[i] > mImage.size())
+			throw exception_t(INDEX_BAD_FILE, ("Index file is truncated: " + mFilepath).c_str());
+		sections[i].data = mImage.data() + header.offsets[i];
+		sections[i].size = header.sizes[i];
+	}
+	if (!load_image(sections))
+		mImage.unmap();
+
+	IndexEntryVector entries;
+	fseek(mFile, header.logOffset, SEEK_SET);
+	read_log(header.logNum, entries);
+	if (!entries.empty())
+		bulk_set(entries);
+
+	mStale = false;
+	mImageNum = header.imageNum;
+	mLogOffset = header.logOffset;
+	mLogNum = entries.size();
+	IndexEntryVector().swap(mLog);
+}
+
+void IndexFile::read_log(uint64_t max_num, IndexEntryVector & entries)
+{
+	uint32_t addr;
+	if (mKeydomain == INTEGER_DOMAIN)
+	{
+		int ival;
+		while (entries.size() < max_num && read_from_pair(&ival, &addr))
+		{
+			entries.emplace_back(attr_t(ival), addr);
+		}
+	}
+	else if (mKeydomain == VARCHAR_DOMAIN)
+	{
+		char sval[ATTR_SIZE_MAX + 1];
+		memset(sval, 0, ATTR_SIZE_MAX + 1);
+
+		while (entries.size() < max_num && read_from_pair(sval, &addr))
+		{
+			entries.emplace_back(attr_t(sval), addr);
+			memset(sval, 0, ATTR_SIZE_MAX + 1);
+		}
+	}
+}
+
 HashIndexFile::HashIndexFile(attr_domain_t keydomain, uint32_t keysize) : 
-	IndexFile(keydomain, keysize, HASH)
+	IndexFile(keydomain, keysize, HASH), mHashIndex(keydomain)
 {
 }
 
@@ -27,58 +225,89 @@ HashIndexFile::~HashIndexFile()
 
 bool HashIndexFile::set(const attr_t & attr_ref, const uint32_t record_addr)
 {
-	// Multi_map always insertion success
-	mHashIndexTable.insert(pair<attr_t, uint32_t>(attr_ref, record_addr));
+	// Duplicated keys always insertion success
+	mHashIndex.insert(attr_ref, record_addr);
+	log_entry(attr_ref, record_addr);
 	return true;
 }
 
+void HashIndexFile::bulk_set(IndexEntryVector & entries)
+{
+	// Posting lists are laid out once for the whole batch
+	mHashIndex.bulk_insert(entries);
+	for (const auto & entry : entries)
+		log_entry(entry.first, entry.second);
+}
+
 uint32_t HashIndexFile::get(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs)
 {
-	auto result = mHashIndexTable.equal_range(attr_ref);
-	if (result.first == result.second)
+	uint32_t key = mHashIndex.find(attr_ref);
+	if (key == FLAT_HASH_NIL)
 		return 0;
 
-	uint32_t cnt = 0;
-	for (auto it = result.first; it != result.second; it++) 
-	{
-		match_addrs.push_back(it->second);
-		cnt++;
-	}
-	return cnt;
+	mHashIndex.for_each(key, [&](uint32_t addr) { match_addrs.push_back(addr); });
+	return mHashIndex.count(key);
 }
 
 uint32_t HashIndexFile::get(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs)
 {
-	auto result = mHashIndexTable.equal_range(attr_ref);
-	if (result.first == result.second)
+	uint32_t key = mHashIndex.find(attr_ref);
+	if (key == FLAT_HASH_NIL)
 		return 0;
 
-	for (auto it = result.first; it != result.second; it++)
-	{
-		match_pairs.emplace_back(it->second, it->second);
-	}
+	mHashIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(addr, addr); });
 	return match_pairs.size();
 }
 
 uint32_t HashIndexFile::get(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs)
 {
-	auto result = mHashIndexTable.equal_range(attr_ref);
-	if (result.first == result.second)
+	uint32_t key = mHashIndex.find(attr_ref);
+	if (key == FLAT_HASH_NIL)
 		return 0;
 
-	for (auto it = result.first; it != result.second; it++)
+	mHashIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(fix_addr, addr); });
+	return match_pairs.size();
+}
+
+/*
+	HashIndexFile::get_batch()
+
+	hash probes ahead and prefetch their groups, so cache misses of
+	successive probes overlap, probes keep their order
+*/
+uint32_t HashIndexFile::get_batch(IndexEntryVector & probes, std::vector<AddrPair>& match_pairs)
+{
+	std::vector<uint32_t> hashes(probes.size());
+	for (uint32_t i = 0; i < probes.size(); i++)
+		hashes[i] = FlatHashIndex::hash(probes[i].first);
+
+	for (uint32_t i = 0; i < probes.size() && i < FLAT_HASH_PREFETCH_DISTANCE; i++)
+		mHashIndex.prefetch(hashes[i]);
+
+	for (uint32_t i = 0; i < probes.size(); i++)
 	{
-		match_pairs.emplace_back(fix_addr, it->second);
+		if (i + FLAT_HASH_PREFETCH_DISTANCE < probes.size())
+			mHashIndex.prefetch(hashes[i + FLAT_HASH_PREFETCH_DISTANCE]);
+
+		const attr_t & key_attr = probes[i].first;
+		uint32_t key = (key_attr.Domain() == mKeydomain) ? mHashIndex.find(key_attr, hashes[i]) : FLAT_HASH_NIL;
+		if (key == FLAT_HASH_NIL)
+			continue;
+
+		uint32_t probe_addr = probes[i].second;
+		mHashIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(probe_addr, addr); });
 	}
+
 	return match_pairs.size();
 }
 
 uint32_t HashIndexFile::get_not(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
 {
-	for (auto it = mHashIndexTable.begin(); it != mHashIndexTable.end(); it++)
+	uint32_t eq_key = mHashIndex.find(attr_ref);
+	for (uint32_t key = 0; key < mHashIndex.key_num(); key++)
 	{
-		if (!(it->first == attr_ref))
-			match_addrs.push_back(it->second);
+		if (key != eq_key)
+			mHashIndex.for_each(key, [&](uint32_t addr) { match_addrs.push_back(addr); });
 	}
 
 	return match_addrs.size();
@@ -86,10 +315,11 @@ uint32_t HashIndexFile::get_not(const attr_t & attr_ref, std::vector<uint32_t>&
 
 uint32_t HashIndexFile::get_not(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
 {
-	for (auto it = mHashIndexTable.begin(); it != mHashIndexTable.end(); it++)
+	uint32_t eq_key = mHashIndex.find(attr_ref);
+	for (uint32_t key = 0; key < mHashIndex.key_num(); key++)
 	{
-		if (!(it->first == attr_ref))
-			match_pairs.emplace_back(it->second, it->second);
+		if (key != eq_key)
+			mHashIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(addr, addr); });
 	}
 
 	return match_pairs.size();
@@ -97,66 +327,60 @@ uint32_t HashIndexFile::get_not(const attr_t & attr_ref, std::vector<AddrPair>&
 
 uint32_t HashIndexFile::get_not(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	for (auto it = mHashIndexTable.begin(); it != mHashIndexTable.end(); it++)
+	uint32_t eq_key = mHashIndex.find(attr_ref);
+	for (uint32_t key = 0; key < mHashIndex.key_num(); key++)
 	{
-		if (!(it->first == attr_ref))
-			match_pairs.emplace_back(fix_addr, it->second);
+		if (key != eq_key)
+			mHashIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(fix_addr, addr); });
 	}
 
 	return match_pairs.size();
 }
 
-void HashIndexFile::write_back()
+uint64_t HashIndexFile::write_image()
 {
-	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
-	fseek(mFile, 0, SEEK_SET);
-
-	for (HashIndexTable::iterator it = mHashIndexTable.begin(); it != mHashIndexTable.end(); it++)
-	{
-		if (mKeydomain == INTEGER_DOMAIN)
-			write_back_pair(it->first.Int(), it->second);
-		else if (mKeydomain == VARCHAR_DOMAIN)
-			write_back_pair(it->first.Varchar(), it->second);
-	}
+	const void *data[FLAT_HASH_SECTION_NUM];
+	uint64_t sizes[FLAT_HASH_SECTION_NUM];
+	mHashIndex.image(data, sizes);
+	for (int i = 0; i < FLAT_HASH_SECTION_NUM; i++)
+		write_section(data[i], sizes[i]);
+	return mHashIndex.size();
 }
 
-void HashIndexFile::read_from()
+// Lookups run on the mapped arrays until the first insertion
+bool HashIndexFile::load_image(const std::vector<IndexSection> & sections)
 {
-	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
-	fseek(mFile, 0, SEEK_SET);
+	if (sections.size() != FLAT_HASH_SECTION_NUM)
+		throw exception_t(INDEX_BAD_FILE, "Index file has unexpected sections");
 
-	uint32_t addr;
-	if (mKeydomain == INTEGER_DOMAIN)
+	const char *data[FLAT_HASH_SECTION_NUM];
+	uint64_t sizes[FLAT_HASH_SECTION_NUM];
+	for (int i = 0; i < FLAT_HASH_SECTION_NUM; i++)
 	{
-		int ival;
-		while (read_from_pair(&ival, &addr))
-		{
-			mHashIndexTable.insert(pair<attr_t, uint32_t>(attr_t(ival), addr));
-		}
+		data[i] = sections[i].data;
+		sizes[i] = sections[i].size;
 	}
-	else if (mKeydomain == VARCHAR_DOMAIN)
-	{
-		char sval[ATTR_SIZE_MAX + 1];
-		memset(sval, 0, ATTR_SIZE_MAX + 1);
+	if (!mHashIndex.map(data, sizes))
+		throw exception_t(INDEX_BAD_FILE, "Index file does not match hash layout");
+	return true;
+}
 
-		while (read_from_pair(sval, &addr))
-		{
-			mHashIndexTable.insert(pair<attr_t, uint32_t>(attr_t(sval), addr));
-			memset(sval, 0, ATTR_SIZE_MAX + 1);
-		}
-	}
+void HashIndexFile::release_image()
+{
+	mHashIndex.own();
 }
 
 void HashIndexFile::dump()
 {
-	for (HashIndexTable::iterator it = mHashIndexTable.begin(); it != mHashIndexTable.end(); it++)
+	for (uint32_t key = 0; key < mHashIndex.key_num(); key++)
 	{
-		cout << it->first << " -> " << it->second << endl;
+		attr_t key_attr = mHashIndex.key_attr(key);
+		mHashIndex.for_each(key, [&](uint32_t addr) { cout << key_attr << " -> " << addr << endl; });
 	}
 }
 
 PrimaryIndexFile::PrimaryIndexFile(attr_domain_t keydomain, uint32_t keysize) : 
-	IndexFile(keydomain, keysize, PHASH)
+	IndexFile(keydomain, keysize, PHASH), mPrimaryIndex(keydomain)
 {
 }
 
@@ -166,15 +390,20 @@ PrimaryIndexFile::~PrimaryIndexFile()
 
 bool PrimaryIndexFile::set(const attr_t & attr_ref, const uint32_t record_addr)
 {
-	return mPrimaryIndexTable.insert(pair<attr_t, uint32_t>(attr_ref, record_addr)).second;
+	if (mPrimaryIndex.find(attr_ref) != FLAT_HASH_NIL)
+		return false;
+
+	mPrimaryIndex.insert(attr_ref, record_addr);
+	log_entry(attr_ref, record_addr);
+	return true;
 }
 
 uint32_t PrimaryIndexFile::get(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
 {
-	auto res = mPrimaryIndexTable.find(attr_ref);
-	if (res != mPrimaryIndexTable.end())
+	uint32_t addr;
+	if (get_primary(attr_ref, &addr))
 	{
-		match_addrs.push_back(res->second);
+		match_addrs.push_back(addr);
 		return true;
 	}
 	return false;
@@ -182,10 +411,10 @@ uint32_t PrimaryIndexFile::get(const attr_t & attr_ref, std::vector<uint32_t>& m
 
 uint32_t PrimaryIndexFile::get(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
 {
-	auto res = mPrimaryIndexTable.find(attr_ref);
-	if (res != mPrimaryIndexTable.end())
+	uint32_t addr;
+	if (get_primary(attr_ref, &addr))
 	{
-		match_pairs.emplace_back(res->second, res->second);
+		match_pairs.emplace_back(addr, addr);
 		return true;
 	}
 	return false;
@@ -193,10 +422,10 @@ uint32_t PrimaryIndexFile::get(const attr_t & attr_ref, std::vector<AddrPair>& m
 
 uint32_t PrimaryIndexFile::get(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	auto res = mPrimaryIndexTable.find(attr_ref);
-	if (res != mPrimaryIndexTable.end())
+	uint32_t addr;
+	if (get_primary(attr_ref, &addr))
 	{
-		match_pairs.emplace_back(fix_addr, res->second);
+		match_pairs.emplace_back(fix_addr, addr);
 		return 1;
 	}
 	return 0;
@@ -204,10 +433,11 @@ uint32_t PrimaryIndexFile::get(const attr_t & attr_ref, const uint32_t fix_addr,
 
 uint32_t PrimaryIndexFile::get_not(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
 {
-	for (auto it = mPrimaryIndexTable.begin(); it != mPrimaryIndexTable.end(); it++)
+	uint32_t eq_key = mPrimaryIndex.find(attr_ref);
+	for (uint32_t key = 0; key < mPrimaryIndex.key_num(); key++)
 	{
-		if (!(it->first == attr_ref))
-			match_addrs.push_back(it->second);
+		if (key != eq_key)
+			mPrimaryIndex.for_each(key, [&](uint32_t addr) { match_addrs.push_back(addr); });
 	}
 
 	return match_addrs.size();
@@ -215,10 +445,11 @@ uint32_t PrimaryIndexFile::get_not(const attr_t & attr_ref, std::vector<uint32_t
 
 uint32_t PrimaryIndexFile::get_not(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
 {
-	for (auto it = mPrimaryIndexTable.begin(); it != mPrimaryIndexTable.end(); it++)
+	uint32_t eq_key = mPrimaryIndex.find(attr_ref);
+	for (uint32_t key = 0; key < mPrimaryIndex.key_num(); key++)
 	{
-		if (!(it->first == attr_ref))
-			match_pairs.emplace_back(it->second, it->second);
+		if (key != eq_key)
+			mPrimaryIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(addr, addr); });
 	}
 
 	return match_pairs.size();
@@ -226,10 +457,11 @@ uint32_t PrimaryIndexFile::get_not(const attr_t & attr_ref, std::vector<AddrPair
 
 uint32_t PrimaryIndexFile::get_not(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	for (auto it = mPrimaryIndexTable.begin(); it != mPrimaryIndexTable.end(); it++)
+	uint32_t eq_key = mPrimaryIndex.find(attr_ref);
+	for (uint32_t key = 0; key < mPrimaryIndex.key_num(); key++)
 	{
-		if (!(it->first == attr_ref))
-			match_pairs.emplace_back(fix_addr, it->second);
+		if (key != eq_key)
+			mPrimaryIndex.for_each(key, [&](uint32_t addr) { match_pairs.emplace_back(fix_addr, addr); });
 	}
 
 	return match_pairs.size();
@@ -239,65 +471,57 @@ bool PrimaryIndexFile::get_primary(const attr_t & attr_ref, uint32_t * match_add
 {
 	assert(match_addr != NULL);
 
-	auto res = mPrimaryIndexTable.find(attr_ref);
-	if (res != mPrimaryIndexTable.end())
-	{
-		*match_addr = res->second;
-		return true;
-	}
-	return false;
+	uint32_t key = mPrimaryIndex.find(attr_ref);
+	if (key == FLAT_HASH_NIL)
+		return false;
+
+	mPrimaryIndex.for_each(key, [&](uint32_t addr) { *match_addr = addr; });
+	return true;
 }
 
 bool PrimaryIndexFile::isExist(const attr_t & attr_ref)
 {
-	return (mPrimaryIndexTable.find(attr_ref) != mPrimaryIndexTable.end());
+	return mPrimaryIndex.find(attr_ref) != FLAT_HASH_NIL;
 }
 
-void PrimaryIndexFile::write_back()
+uint64_t PrimaryIndexFile::write_image()
 {
-	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
-	fseek(mFile, 0, SEEK_SET);
-
-	for (HashIndexTable::iterator it = mPrimaryIndexTable.begin(); it != mPrimaryIndexTable.end(); it++)
-	{
-		if (mKeydomain == INTEGER_DOMAIN)
-			write_back_pair(it->first.Int(), it->second);
-		else if (mKeydomain == VARCHAR_DOMAIN)
-			write_back_pair(it->first.Varchar(), it->second);
-	}
+	const void *data[FLAT_HASH_SECTION_NUM];
+	uint64_t sizes[FLAT_HASH_SECTION_NUM];
+	mPrimaryIndex.image(data, sizes);
+	for (int i = 0; i < FLAT_HASH_SECTION_NUM; i++)
+		write_section(data[i], sizes[i]);
+	return mPrimaryIndex.size();
 }
 
-void PrimaryIndexFile::read_from()
+bool PrimaryIndexFile::load_image(const std::vector<IndexSection> & sections)
 {
-	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
-	fseek(mFile, 0, SEEK_SET);
+	if (sections.size() != FLAT_HASH_SECTION_NUM)
+		throw exception_t(INDEX_BAD_FILE, "Index file has unexpected sections");
 
-	uint32_t addr;
-	if (mKeydomain == INTEGER_DOMAIN)
+	const char *data[FLAT_HASH_SECTION_NUM];
+	uint64_t sizes[FLAT_HASH_SECTION_NUM];
+	for (int i = 0; i < FLAT_HASH_SECTION_NUM; i++)
 	{
-		int ival;
-		while (read_from_pair(&ival, &addr))
-		{
-			mPrimaryIndexTable.insert(pair<attr_t, uint32_t>(attr_t(ival), addr));
-		}
-	}
-	else if (mKeydomain == VARCHAR_DOMAIN)
-	{
-		char sval[ATTR_SIZE_MAX + 1];
-		memset(sval, 0, ATTR_SIZE_MAX + 1);
-		while (read_from_pair(sval, &addr))
-		{
-			mPrimaryIndexTable.insert(pair<attr_t, uint32_t>(attr_t(sval), addr));
-			memset(sval, 0, ATTR_SIZE_MAX + 1);
-		}
+		data[i] = sections[i].data;
+		sizes[i] = sections[i].size;
 	}
+	if (!mPrimaryIndex.map(data, sizes))
+		throw exception_t(INDEX_BAD_FILE, "Index file does not match hash layout");
+	return true;
+}
+
+void PrimaryIndexFile::release_image()
+{
+	mPrimaryIndex.own();
 }
 
 void PrimaryIndexFile::dump()
 {
-	for (HashIndexTable::iterator it = mPrimaryIndexTable.begin(); it != mPrimaryIndexTable.end(); it++)
+	for (uint32_t key = 0; key < mPrimaryIndex.key_num(); key++)
 	{
-		cout << it->first << " -> " << it->second << endl;
+		attr_t key_attr = mPrimaryIndex.key_attr(key);
+		mPrimaryIndex.for_each(key, [&](uint32_t addr) { cout << key_attr << " -> " << addr << endl; });
 	}
 }
 
@@ -311,30 +535,43 @@ TreeIndexFile::~TreeIndexFile()
 
 bool TreeIndexFile::set(const attr_t & attr_ref, const uint32_t record_addr)
 {
-	mTreeIndexTable.insert(pair<attr_t, uint32_t>(attr_ref, record_addr));
+	mTree.insert(attr_ref, record_addr);
+	log_entry(attr_ref, record_addr);
 	return true;
 }
 
-uint32_t TreeIndexFile::get(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
+/*
+	TreeIndexFile::bulk_set()
+
+	sort entries by (key, addr), then bulk load the tree,
+	equal keys keep ascending addr order like one-by-one insertion
+*/
+void TreeIndexFile::bulk_set(IndexEntryVector & entries)
 {
-	auto range = mTreeIndexTable.equal_range(attr_ref);
-	TreeIndexTable::iterator begin = range.first;
-	TreeIndexTable::iterator end = range.second;
+	std::sort(entries.begin(), entries.end(),
+		[](const pair<attr_t, uint32_t> & a, const pair<attr_t, uint32_t> & b)
+	{
+		int cmp = BPlusTree::compare(a.first, b.first);
+		return cmp < 0 || (cmp == 0 && a.second < b.second);
+	});
+
+	mTree.bulk_load(entries);
+	for (const auto & entry : entries)
+		log_entry(entry.first, entry.second);
+}
 
-	for (auto it = begin; it != end; it++)
-		match_addrs.emplace_back(it->second);
+uint32_t TreeIndexFile::get(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
+{
+	for (auto it = mTree.lower_bound(attr_ref); it != mTree.end() && it.key() == attr_ref; ++it)
+		match_addrs.emplace_back(it.addr());
 	
 	return match_addrs.size();
 }
 
 uint32_t TreeIndexFile::get(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
 {
-	auto range = mTreeIndexTable.equal_range(attr_ref);
-	TreeIndexTable::iterator begin = range.first;
-	TreeIndexTable::iterator end = range.second;
-
-	for (auto it = begin; it != end; it++)
-		match_pairs.emplace_back(it->second, it->second);
+	for (auto it = mTree.lower_bound(attr_ref); it != mTree.end() && it.key() == attr_ref; ++it)
+		match_pairs.emplace_back(it.addr(), it.addr());
 
 	return match_pairs.size();
 }
@@ -358,282 +595,639 @@ uint32_t TreeIndexFile::get(const attr_t & attr_ref, const relation_type_t rel_t
 
 uint32_t TreeIndexFile::get(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	auto range = mTreeIndexTable.equal_range(attr_ref);
-	TreeIndexTable::iterator begin = range.first;
-	TreeIndexTable::iterator end = range.second;
+	for (auto it = mTree.lower_bound(attr_ref); it != mTree.end() && it.key() == attr_ref; ++it)
+		match_pairs.emplace_back(fix_addr, it.addr());
+
+	return match_pairs.size();
+}
+
+/*
+	TreeIndexFile::get_batch()
+
+	probes are (key, probe addr), sorted here so that lookups walk the leaves
+	forward from the previous match, output is (probe addr, record addr)
+*/
+uint32_t TreeIndexFile::get_batch(IndexEntryVector & probes, std::vector<AddrPair>& match_pairs)
+{
+	std::sort(probes.begin(), probes.end(),
+		[](const pair<attr_t, uint32_t> & a, const pair<attr_t, uint32_t> & b)
+	{
+		return BPlusTree::compare(a.first, b.first) < 0;
+	});
 
-	for (auto it = begin; it != end; it++)
-		match_pairs.emplace_back(fix_addr, it->second);
+	BPlusTree::const_iterator finger = mTree.begin();
+	for (const auto & probe : probes)
+	{
+		finger = mTree.lower_bound(probe.first, finger);
+		for (auto it = finger; it != mTree.end() && it.key() == probe.first; ++it)
+			match_pairs.emplace_back(probe.second, it.addr());
+	}
 
 	return match_pairs.size();
 }
 
 uint32_t TreeIndexFile::get_not(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
 {
-	auto range = mTreeIndexTable.equal_range(attr_ref);
-	TreeIndexTable::iterator begin = range.first;
-	TreeIndexTable::iterator end = range.second;
+	BPlusTree::const_iterator begin = mTree.lower_bound(attr_ref);
+	BPlusTree::const_iterator end = mTree.upper_bound(attr_ref);
 	
-	for (auto it = mTreeIndexTable.begin(); it != begin; it++)
-		match_addrs.emplace_back(it->second);
-	for (auto it = end; it != mTreeIndexTable.end(); it++)
-		match_addrs.emplace_back(it->second);
+	for (auto it = mTree.begin(); it != begin; ++it)
+		match_addrs.emplace_back(it.addr());
+	for (auto it = end; it != mTree.end(); ++it)
+		match_addrs.emplace_back(it.addr());
 
 	return match_addrs.size();
 }
 
 uint32_t TreeIndexFile::get_not(const attr_t & attr_ref, std::vector<AddrPair> & match_pairs)
 {
-	auto range = mTreeIndexTable.equal_range(attr_ref);
-	TreeIndexTable::iterator begin = range.first;
-	TreeIndexTable::iterator end = range.second;
+	BPlusTree::const_iterator begin = mTree.lower_bound(attr_ref);
+	BPlusTree::const_iterator end = mTree.upper_bound(attr_ref);
 
-	for (auto it = mTreeIndexTable.begin(); it != begin; it++)
-		match_pairs.emplace_back(it->second, it->second);
-	for (auto it = end; it != mTreeIndexTable.end(); it++)
-		match_pairs.emplace_back(it->second, it->second);
+	for (auto it = mTree.begin(); it != begin; ++it)
+		match_pairs.emplace_back(it.addr(), it.addr());
+	for (auto it = end; it != mTree.end(); ++it)
+		match_pairs.emplace_back(it.addr(), it.addr());
 
 	return match_pairs.size();
 }
 
 uint32_t TreeIndexFile::get_not(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	auto range = mTreeIndexTable.equal_range(attr_ref);
+	BPlusTree::const_iterator begin = mTree.lower_bound(attr_ref);
+	BPlusTree::const_iterator end = mTree.upper_bound(attr_ref);
 	
-	TreeIndexTable::iterator begin = range.first;
-	TreeIndexTable::iterator end = range.second;
+	for (auto it = mTree.begin(); it != begin; ++it)
+		match_pairs.emplace_back(fix_addr, it.addr());
 	
-	for (auto it = mTreeIndexTable.begin(); it != begin; it++)
-		match_pairs.emplace_back(fix_addr, it->second);
-	
-	for (auto it = end; it != mTreeIndexTable.end(); it++)
-		match_pairs.emplace_back(fix_addr, it->second);
+	for (auto it = end; it != mTree.end(); ++it)
+		match_pairs.emplace_back(fix_addr, it.addr());
 	
 	return match_pairs.size();
 }
 
+/*
+	TreeIndexFile::less_end()
+
+	first entry not less than attr_ref under attr_t operator<,
+	which only sees a prefix of VARCHAR, so it is coarser than the tree order
+*/
+BPlusTree::const_iterator TreeIndexFile::less_end(const attr_t & attr_ref) const
+{
+	return mTree.partition_point([&attr_ref](const attr_t & key) { return key < attr_ref; });
+}
+
+// First entry larger than attr_ref under attr_t operator<
+BPlusTree::const_iterator TreeIndexFile::large_begin(const attr_t & attr_ref) const
+{
+	return mTree.partition_point([&attr_ref](const attr_t & key) { return !(attr_ref < key); });
+}
+
 uint32_t TreeIndexFile::get_less(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
 {
-	TreeIndexTable::iterator begin = mTreeIndexTable.begin();
-	TreeIndexTable::iterator end = mTreeIndexTable.lower_bound(attr_ref);
-	for (auto it = begin; it != end; it++)
-		match_addrs.emplace_back(it->second);
+	BPlusTree::const_iterator end = less_end(attr_ref);
+	for (auto it = mTree.begin(); it != end; ++it)
+		match_addrs.emplace_back(it.addr());
 
 	return match_addrs.size();
 }
 
 uint32_t TreeIndexFile::get_less(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
 {
-	TreeIndexTable::iterator begin = mTreeIndexTable.begin();
-	TreeIndexTable::iterator end = mTreeIndexTable.lower_bound(attr_ref);
-	for (auto it = begin; it != end; it++)
-		match_pairs.emplace_back(it->second, it->second);
+	BPlusTree::const_iterator end = less_end(attr_ref);
+	for (auto it = mTree.begin(); it != end; ++it)
+		match_pairs.emplace_back(it.addr(), it.addr());
 
 	return match_pairs.size();
 }
 
 uint32_t TreeIndexFile::get_less(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	TreeIndexTable::iterator begin = mTreeIndexTable.begin();
-	TreeIndexTable::iterator end = mTreeIndexTable.lower_bound(attr_ref);
-	for (auto it = begin; it != end; it++)
-		match_pairs.emplace_back(fix_addr, it->second);
+	BPlusTree::const_iterator end = less_end(attr_ref);
+	for (auto it = mTree.begin(); it != end; ++it)
+		match_pairs.emplace_back(fix_addr, it.addr());
 
 	return match_pairs.size();
 }
 
 uint32_t TreeIndexFile::get_large(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
 {
-	TreeIndexTable::iterator begin = mTreeIndexTable.upper_bound(attr_ref);
-	TreeIndexTable::iterator end = mTreeIndexTable.end();
-	for (auto it = begin; it != end; it++)
-		match_addrs.emplace_back(it->second);
+	for (auto it = large_begin(attr_ref); it != mTree.end(); ++it)
+		match_addrs.emplace_back(it.addr());
 
 	return match_addrs.size();
 }
 
 uint32_t TreeIndexFile::get_large(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
 {
-	TreeIndexTable::iterator begin = mTreeIndexTable.upper_bound(attr_ref);
-	TreeIndexTable::iterator end = mTreeIndexTable.end();
-	for (auto it = begin; it != end; it++)
-		match_pairs.emplace_back(it->second, it->second);
+	for (auto it = large_begin(attr_ref); it != mTree.end(); ++it)
+		match_pairs.emplace_back(it.addr(), it.addr());
 
 	return match_pairs.size();
 }
 
 uint32_t TreeIndexFile::get_large(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
 {
-	TreeIndexTable::iterator begin = mTreeIndexTable.upper_bound(attr_ref);
-	TreeIndexTable::iterator end = mTreeIndexTable.end();
-	for (auto it = begin; it != end; it++)
-		match_pairs.emplace_back(fix_addr, it->second);
+	for (auto it = large_begin(attr_ref); it != mTree.end(); ++it)
+		match_pairs.emplace_back(fix_addr, it.addr());
 
 	return match_pairs.size();
 }
 
-void TreeIndexFile::write_back()
+/*
+	TreeIndexFile::get_range()
+
+	keys after large_begin(lo) are in tree order, so the ones less than hi
+	under attr_t operator< are a prefix of them even for VARCHAR
+*/
+uint32_t TreeIndexFile::get_range(const attr_t & lo, const attr_t & hi, std::vector<uint32_t>& match_addrs)
 {
-	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
-	fseek(mFile, 0, SEEK_SET);
+	for (auto it = large_begin(lo); it != mTree.end() && it.key() < hi; ++it)
+		match_addrs.emplace_back(it.addr());
+
+	return match_addrs.size();
+}
+
+/*
+	TreeIndexFile::get_prefix()
+
+	keys starting with prefix are not less than it and follow each other
+	in tree order, which compares the same chars as strncmp
+*/
+uint32_t TreeIndexFile::get_prefix(const attr_t & prefix, std::vector<uint32_t>& match_addrs)
+{
+	assert(prefix.Domain() == VARCHAR_DOMAIN);
+	size_t len = strlen(prefix.Varchar());
+	for (auto it = mTree.lower_bound(prefix); it != mTree.end() && strncmp(it.key().Varchar(), prefix.Varchar(), len) == 0; ++it)
+		match_addrs.emplace_back(it.addr());
+
+	return match_addrs.size();
+}
+
+/*
+	TreeIndexFile::count()
+
+	difference of two entry prefixes, bounds are the same as get()
+*/
+uint32_t TreeIndexFile::count(const attr_t & attr_ref, const relation_type_t rel_type, int64_t & key_sum) const
+{
+	int64_t below_sum, upto_sum;
+	uint32_t below, upto;
+	switch (rel_type)
+	{
+	case EQ: case NEQ:
+		below = mTree.count_prefix([&attr_ref](const attr_t & key) { return BPlusTree::compare(key, attr_ref) < 0; }, below_sum);
+		upto = mTree.count_prefix([&attr_ref](const attr_t & key) { return BPlusTree::compare(key, attr_ref) <= 0; }, upto_sum);
+		break;
+	case LESS:
+		below = 0;
+		below_sum = 0;
+		upto = mTree.count_prefix([&attr_ref](const attr_t & key) { return key < attr_ref; }, upto_sum);
+		break;
+	case LARGE:
+		below = mTree.count_prefix([&attr_ref](const attr_t & key) { return !(attr_ref < key); }, below_sum);
+		upto = mTree.total(upto_sum);
+		break;
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unkown relation type");
+	}
+
+	key_sum = upto_sum - below_sum;
+	if (rel_type != NEQ)
+		return upto - below;
 
-	for (TreeIndexTable::iterator it = mTreeIndexTable.begin(); it != mTreeIndexTable.end(); it++)
+	int64_t all_sum;
+	uint32_t all = mTree.total(all_sum);
+	key_sum = all_sum - key_sum;
+	return all - (upto - below);
+}
+
+uint32_t TreeIndexFile::count_range(const attr_t & lo, const attr_t & hi, int64_t & key_sum) const
+{
+	int64_t below_sum, upto_sum;
+	uint32_t below = mTree.count_prefix([&lo](const attr_t & key) { return !(lo < key); }, below_sum);
+	uint32_t upto = mTree.count_prefix([&hi](const attr_t & key) { return key < hi; }, upto_sum);
+
+	// Empty range, hi is not above lo
+	if (upto <= below)
 	{
-		if (mKeydomain == INTEGER_DOMAIN)
-			write_back_pair(it->first.Int(), it->second);
-		else if (mKeydomain == VARCHAR_DOMAIN)
-			write_back_pair(it->first.Varchar(), it->second);
+		key_sum = 0;
+		return 0;
 	}
+	key_sum = upto_sum - below_sum;
+	return upto - below;
 }
 
-void TreeIndexFile::read_from()
+/*
+	TreeIndexFile::write_image()
+
+	keys then addrs in tree order, a key is int32 or keysize '\0' padded chars
+*/
+uint64_t TreeIndexFile::write_image()
 {
-	assert(mKeydomain != UNDEFINED_DOMAIN && mFile != NULL);
-	fseek(mFile, 0, SEEK_SET);
+	uint32_t key_width = (mKeydomain == INTEGER_DOMAIN) ? sizeof(int32_t) : mKeysize;
+	std::vector<char> keys((size_t)mTree.size() * key_width, 0);
+	std::vector<uint32_t> addrs;
+	addrs.reserve(mTree.size());
 
-	uint32_t addr;
-	if (mKeydomain == INTEGER_DOMAIN)
+	char *dst = keys.data();
+	for (auto it = mTree.begin(); it != mTree.end(); ++it, dst += key_width)
 	{
-		int ival;
-		while (read_from_pair(&ival, &addr))
+		if (mKeydomain == INTEGER_DOMAIN)
 		{
-			mTreeIndexTable.insert(pair<attr_t, uint32_t>(attr_t(ival), addr));
+			int32_t ival = it.key().Int();
+			memcpy(dst, &ival, sizeof(int32_t));
 		}
+		else
+			strncpy(dst, it.key().Varchar(), key_width);
+		addrs.push_back(it.addr());
 	}
-	else if (mKeydomain == VARCHAR_DOMAIN)
+
+	write_section(keys.data(), keys.size());
+	write_section(addrs.data(), addrs.size() * sizeof(uint32_t));
+	return mTree.size();
+}
+
+/*
+	TreeIndexFile::load_image()
+
+	entries are already in tree order, the tree is built bottom up without sorting
+*/
+bool TreeIndexFile::load_image(const std::vector<IndexSection> & sections)
+{
+	uint32_t key_width = (mKeydomain == INTEGER_DOMAIN) ? sizeof(int32_t) : mKeysize;
+	if (sections.size() != 2 || sections[0].size % key_width != 0
+		|| sections[1].size != sections[0].size / key_width * sizeof(uint32_t))
+		throw exception_t(INDEX_BAD_FILE, "Index file does not match tree layout");
+
+	uint64_t num = sections[1].size / sizeof(uint32_t);
+	BPlusTree::EntryVector entries;
+	entries.reserve(num);
+
+	char sval[ATTR_SIZE_MAX + 1];
+	for (uint64_t i = 0; i < num; i++)
 	{
-		char sval[ATTR_SIZE_MAX + 1];
-		memset(sval, 0, ATTR_SIZE_MAX + 1);
-		while (read_from_pair(sval, &addr))
+		const char *key = sections[0].data + i * key_width;
+		uint32_t addr;
+		memcpy(&addr, sections[1].data + i * sizeof(uint32_t), sizeof(uint32_t));
+
+		if (mKeydomain == INTEGER_DOMAIN)
+		{
+			int32_t ival;
+			memcpy(&ival, key, sizeof(int32_t));
+			entries.emplace_back(attr_t(ival), addr);
+		}
+		else
 		{
-			mTreeIndexTable.insert(pair<attr_t, uint32_t>(attr_t(sval), addr));
 			memset(sval, 0, ATTR_SIZE_MAX + 1);
+			memcpy(sval, key, std::min<uint32_t>(key_width, ATTR_SIZE_MAX));
+			entries.emplace_back(attr_t(sval), addr);
 		}
 	}
+
+	mTree.clear();
+	mTree.bulk_load(entries);
+	return false;
 }
 
 void TreeIndexFile::dump()
 {
-	for (TreeIndexTable::iterator it = mTreeIndexTable.begin(); it != mTreeIndexTable.end(); it++)
+	for (auto it = mTree.begin(); it != mTree.end(); ++it)
 	{
-		cout << it->first << " -> " << it->second << endl;
+		cout << it.key() << " -> " << it.addr() << endl;
 	}
 }
 
 void TreeIndexFile::merge_eq(
 	const TreeIndexFile & a,
 	const TreeIndexFile & b, 
-	std::vector<AddrPair>& match_pairs)
+	AddrPairSink & sink)
 {
-	auto ait = a.mTreeIndexTable.begin();
-	auto bit = b.mTreeIndexTable.begin();
-	auto a_end = a.mTreeIndexTable.end();
-	auto b_end = b.mTreeIndexTable.end();
+	auto ait = a.mTree.begin();
+	auto bit = b.mTree.begin();
+	auto a_end = a.mTree.end();
+	auto b_end = b.mTree.end();
 
 	while (ait != a_end && bit != b_end)
 	{
-		if (ait->first == bit->first)
+		int cmp = BPlusTree::compare(ait.key(), bit.key());
+		if (cmp == 0)
 		{
 			auto temp_bit = bit;
-			while (temp_bit != b_end && ait->first == temp_bit->first)
+			while (temp_bit != b_end && ait.key() == temp_bit.key())
 			{
-				match_pairs.emplace_back(ait->second, temp_bit->second);
-				temp_bit++;
+				sink.put(ait.addr(), temp_bit.addr());
+				++temp_bit;
 			}
-			ait++;
+			++ait;
 		}
-		else if (ait->first < bit->first)
-			ait++;
+		else if (cmp < 0)
+			++ait;
 		else
-			bit++;
+			++bit;
 	}	
 }
 
-void TreeIndexFile::merge_neq(const TreeIndexFile & a, const TreeIndexFile & b, std::vector<AddrPair>& match_pairs)
+void TreeIndexFile::merge_neq(const TreeIndexFile & a, const TreeIndexFile & b, AddrPairSink & sink)
 {
-	for (auto it = a.mTreeIndexTable.begin(); it != a.mTreeIndexTable.end(); it++)
+	for (auto it = a.mTree.begin(); it != a.mTree.end(); ++it)
 	{
-		auto eq_range = b.mTreeIndexTable.equal_range(it->first);
-		for (auto nit = b.mTreeIndexTable.begin(); nit != eq_range.first; nit++)
-			match_pairs.emplace_back(it->second, nit->second);
-		for (auto nit = eq_range.second; nit != b.mTreeIndexTable.end(); nit++)
-			match_pairs.emplace_back(it->second, nit->second);
+		auto eq_begin = b.mTree.lower_bound(it.key());
+		auto eq_end = b.mTree.upper_bound(it.key());
+		for (auto nit = b.mTree.begin(); nit != eq_begin; ++nit)
+			sink.put(it.addr(), nit.addr());
+		for (auto nit = eq_end; nit != b.mTree.end(); ++nit)
+			sink.put(it.addr(), nit.addr());
 	}
 }
 
-void TreeIndexFile::merge_less(const TreeIndexFile & a, const TreeIndexFile & b, std::vector<AddrPair>& match_pairs)
+void TreeIndexFile::merge_less(const TreeIndexFile & a, const TreeIndexFile & b, AddrPairSink & sink)
 {
 #ifdef _OLD
-	for (auto ait = a.mTreeIndexTable.begin(); ait != a.mTreeIndexTable.end(); ait++)
+	for (auto ait = a.mTree.begin(); ait != a.mTree.end(); ++ait)
 	{
-		auto lowerbound = b.mTreeIndexTable.lower_bound(ait->first);
-		for (auto bit = b.mTreeIndexTable.begin(); bit != lowerbound; bit++)
-			match_pairs.emplace_back(ait->second, bit->second);
+		auto lowerbound = b.less_end(ait.key());
+		for (auto bit = b.mTree.begin(); bit != lowerbound; ++bit)
+			sink.put(ait.addr(), bit.addr());
 	}
 #else
-	auto ait = a.mTreeIndexTable.begin();
-	auto bit = b.mTreeIndexTable.begin();
-	auto a_end = a.mTreeIndexTable.end();
-	auto b_end = b.mTreeIndexTable.end();
+	auto ait = a.mTree.begin();
+	auto bit = b.mTree.begin();
+	auto a_end = a.mTree.end();
+	auto b_end = b.mTree.end();
 
 	while (ait != a_end && bit != b_end)
 	{
-		if (ait->first == bit->first)
+		if (ait.key() == bit.key())
 		{
-			bit++;
+			++bit;
 		}
-		else if (ait->first < bit->first)
+		else if (ait.key() < bit.key())
 		{
 			auto temp_bit = bit;
-			while (temp_bit != b_end && ait->first < temp_bit->first)
+			while (temp_bit != b_end && ait.key() < temp_bit.key())
 			{
-				match_pairs.emplace_back(ait->second, temp_bit->second);
-				temp_bit++;
+				sink.put(ait.addr(), temp_bit.addr());
+				++temp_bit;
 			}
-			ait++;
+			++ait;
 		}
 		else
-			bit++;
+			++bit;
 	}
 #endif
 }
 
-void TreeIndexFile::merge_large(const TreeIndexFile & a, const TreeIndexFile & b, std::vector<AddrPair>& match_pairs)
+void TreeIndexFile::merge_large(const TreeIndexFile & a, const TreeIndexFile & b, AddrPairSink & sink)
 {
 #ifdef _OLD
-	for (auto ait = a.mTreeIndexTable.begin(); ait != a.mTreeIndexTable.end(); ait++)
+	for (auto ait = a.mTree.begin(); ait != a.mTree.end(); ++ait)
 	{
-		auto upperbound = b.mTreeIndexTable.upper_bound(ait->first);
-		for (auto bit = upperbound; bit != b.mTreeIndexTable.end(); bit++)
-			match_pairs.emplace_back(ait->second, bit->second);
+		auto upperbound = b.large_begin(ait.key());
+		for (auto bit = upperbound; bit != b.mTree.end(); ++bit)
+			sink.put(ait.addr(), bit.addr());
 	}
 #else
 
-	auto ait = a.mTreeIndexTable.begin();
-	auto bit = b.mTreeIndexTable.begin();
-	auto a_end = a.mTreeIndexTable.end();
-	auto b_end = b.mTreeIndexTable.end();
+	// b keys less than a key form a prefix of b, which only grows as a goes up
+	auto b_begin = b.mTree.begin();
+	auto b_end = b.mTree.end();
+	auto bound = b_begin;
 
-	while (ait != a_end && bit != b_end)
+	for (auto ait = a.mTree.begin(); ait != a.mTree.end(); ++ait)
+	{
+		while (bound != b_end && bound.key() < ait.key())
+			++bound;
+		for (auto bit = b_begin; bit != bound; ++bit)
+			sink.put(ait.addr(), bit.addr());
+	}
+#endif
+}
+
+BitmapIndexFile::BitmapIndexFile(attr_domain_t keydomain, uint32_t keysize) :
+	IndexFile(keydomain, keysize, BITMAP)
+{
+}
+
+BitmapIndexFile::~BitmapIndexFile()
+{
+}
+
+bool BitmapIndexFile::set(const attr_t & attr_ref, const uint32_t record_addr)
+{
+	mBitmaps[attr_ref].add(record_addr);
+	log_entry(attr_ref, record_addr);
+	return true;
+}
+
+void BitmapIndexFile::bulk_set(IndexEntryVector & entries)
+{
+	// Ascending addrs are appended to their bitmaps in O(1)
+	std::stable_sort(entries.begin(), entries.end(),
+		[](const std::pair<attr_t, uint32_t> & a, const std::pair<attr_t, uint32_t> & b) { return a.second < b.second; });
+	for (const auto & entry : entries)
+	{
+		mBitmaps[entry.first].add(entry.second);
+		log_entry(entry.first, entry.second);
+	}
+}
+
+uint32_t BitmapIndexFile::get(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
+{
+	const RowBitmap *bitmap = find(attr_ref);
+	if (bitmap == NULL)
+		return 0;
+
+	bitmap->to_addrs(match_addrs);
+	return bitmap->size();
+}
+
+uint32_t BitmapIndexFile::get(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
+{
+	const RowBitmap *bitmap = find(attr_ref);
+	if (bitmap == NULL)
+		return 0;
+
+	bitmap->for_each([&](uint32_t addr) { match_pairs.emplace_back(addr, addr); });
+	return match_pairs.size();
+}
+
+uint32_t BitmapIndexFile::get(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
+{
+	const RowBitmap *bitmap = find(attr_ref);
+	if (bitmap == NULL)
+		return 0;
+
+	bitmap->for_each([&](uint32_t addr) { match_pairs.emplace_back(fix_addr, addr); });
+	return match_pairs.size();
+}
+
+uint32_t BitmapIndexFile::get_not(const attr_t & attr_ref, std::vector<uint32_t>& match_addrs)
+{
+	RowBitmap rows;
+	get(attr_ref, NEQ, rows);
+	rows.to_addrs(match_addrs);
+	return match_addrs.size();
+}
+
+uint32_t BitmapIndexFile::get_not(const attr_t & attr_ref, std::vector<AddrPair>& match_pairs)
+{
+	RowBitmap rows;
+	get(attr_ref, NEQ, rows);
+	rows.for_each([&](uint32_t addr) { match_pairs.emplace_back(addr, addr); });
+	return match_pairs.size();
+}
+
+uint32_t BitmapIndexFile::get_not(const attr_t & attr_ref, const uint32_t fix_addr, std::vector<AddrPair>& match_pairs)
+{
+	RowBitmap rows;
+	get(attr_ref, NEQ, rows);
+	rows.for_each([&](uint32_t addr) { match_pairs.emplace_back(fix_addr, addr); });
+	return match_pairs.size();
+}
+
+/*
+	BitmapIndexFile::get()
+
+	EQ is the bitmap of k, NEQ the union of all the others,
+	both merged container by container, nothing is sorted
+*/
+uint32_t BitmapIndexFile::get(const attr_t & attr_ref, const relation_type_t rel_type, RowBitmap & rows) const
+{
+	rows.clear();
+	const RowBitmap *eq = find(attr_ref);
+	switch (rel_type)
 	{
-		if (ait->first == bit->first)
+	case EQ:
+		if (eq != NULL)
+			rows = *eq;
+		break;
+	case NEQ:
+		for (const auto & entry : mBitmaps)
 		{
-			auto temp_bit = b.mTreeIndexTable.begin();
-			while (temp_bit != bit && ait->first > temp_bit->first)
-			{
-				match_pairs.emplace_back(ait->second, temp_bit->second);
-				temp_bit++;
-			}
-			ait++;
+			if (&entry.second == eq)
+				continue;
+			RowBitmap both;
+			RowBitmap::merge(rows, OR, entry.second, both);
+			rows = std::move(both);
 		}
-		else if (ait->first < bit->first)
+		break;
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unkown relation type");
+	}
+	return rows.size();
+}
+
+// Cardinalities are kept by containers, only NEQ visits every key
+uint32_t BitmapIndexFile::count(const attr_t & attr_ref, const relation_type_t rel_type, int64_t & key_sum) const
+{
+	if (rel_type != EQ && rel_type != NEQ)
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unkown relation type");
+
+	uint32_t num = 0;
+	key_sum = 0;
+	for (const auto & entry : mBitmaps)
+	{
+		if ((entry.first == attr_ref) != (rel_type == EQ))
+			continue;
+		uint64_t card = entry.second.size();
+		num += card;
+		if (mKeydomain == INTEGER_DOMAIN)
+			key_sum += (int64_t)card * entry.first.Int();
+	}
+	return num;
+}
+
+/*
+	BitmapIndexFile::write_image()
+
+	key slots as in TreeIndexFile but in map order, not sorted,
+	image offsets of their bitmaps (key num + 1), then bitmap images
+*/
+uint64_t BitmapIndexFile::write_image()
+{
+	uint32_t key_width = (mKeydomain == INTEGER_DOMAIN) ? sizeof(int32_t) : mKeysize;
+	std::vector<char> keys((size_t)mBitmaps.size() * key_width, 0);
+	std::vector<uint64_t> offsets(1, 0);
+	std::vector<char> images;
+
+	uint64_t entry_num = 0;
+	char *dst = keys.data();
+	for (auto it = mBitmaps.begin(); it != mBitmaps.end(); ++it, dst += key_width)
+	{
+		if (mKeydomain == INTEGER_DOMAIN)
 		{
-			ait++;
+			int32_t ival = it->first.Int();
+			memcpy(dst, &ival, sizeof(int32_t));
 		}
 		else
-			bit++;
+			strncpy(dst, it->first.Varchar(), key_width);
+
+		it->second.image(images);
+		offsets.push_back(images.size());
+		entry_num += it->second.size();
 	}
-#endif
+
+	write_section(keys.data(), keys.size());
+	write_section(offsets.data(), offsets.size() * sizeof(uint64_t));
+	write_section(images.data(), images.size());
+	return entry_num;
+}
+
+// Bitmaps are copied out of the image
+bool BitmapIndexFile::load_image(const std::vector<IndexSection>& sections)
+{
+	uint32_t key_width = (mKeydomain == INTEGER_DOMAIN) ? sizeof(int32_t) : mKeysize;
+	if (sections.size() != 3 || sections[0].size % key_width != 0
+		|| sections[1].size != (sections[0].size / key_width + 1) * sizeof(uint64_t))
+		throw exception_t(INDEX_BAD_FILE, "Index file does not match bitmap layout");
+
+	uint64_t num = sections[0].size / key_width;
+	std::vector<uint64_t> offsets(num + 1);
+	memcpy(offsets.data(), sections[1].data, sections[1].size);
+
+	mBitmaps.clear();
+	char sval[ATTR_SIZE_MAX + 1];
+	for (uint64_t i = 0; i < num; i++)
+	{
+		const char *key = sections[0].data + i * key_width;
+		attr_t key_attr;
+		if (mKeydomain == INTEGER_DOMAIN)
+		{
+			int32_t ival;
+			memcpy(&ival, key, sizeof(int32_t));
+			key_attr = ival;
+		}
+		else
+		{
+			memset(sval, 0, ATTR_SIZE_MAX + 1);
+			memcpy(sval, key, std::min<uint32_t>(key_width, ATTR_SIZE_MAX));
+			key_attr = sval;
+		}
+
+		if (offsets[i] > offsets[i + 1] || offsets[i + 1] > sections[2].size
+			|| !mBitmaps[key_attr].load(sections[2].data + offsets[i], offsets[i + 1] - offsets[i]))
+			throw exception_t(INDEX_BAD_FILE, "Index file does not match bitmap layout");
+	}
+	return false;
+}
+
+void BitmapIndexFile::dump()
+{
+	for (const auto & entry : mBitmaps)
+	{
+		const attr_t & key_attr = entry.first;
+		entry.second.for_each([&](uint32_t addr) { cout << key_attr << " -> " << addr << endl; });
+	}
+}
+
+// NULL if no row has key, keys of the other domain never match
+const RowBitmap * BitmapIndexFile::find(const attr_t & attr_ref) const
+{
+	if (attr_ref.Domain() != mKeydomain)
+		return NULL;
+	auto res = mBitmaps.find(attr_ref);
+	return (res != mBitmaps.end()) ? &res->second : NULL;
 }
 
 void IndexFile::write_back_pair(const void *src, uint32_t addr)
@@ -647,6 +1241,21 @@ void IndexFile::write_back_pair(int ival, uint32_t addr)
 	write_back_pair(&ival, addr);
 }
 
+// VARCHAR key is padded to keysize, inline chars may be shorter
+void IndexFile::write_back_pair(const attr_t & key, uint32_t addr)
+{
+	if (mKeydomain == INTEGER_DOMAIN)
+	{
+		write_back_pair(key.Int(), addr);
+		return;
+	}
+
+	char sval[ATTR_SIZE_MAX + 1];
+	memset(sval, 0, ATTR_SIZE_MAX + 1);
+	strncpy(sval, key.Varchar(), ATTR_SIZE_MAX);
+	write_back_pair(sval, addr);
+}
+
 bool IndexFile::read_from_pair(void *dst, uint32_t * addr_dst)
 {
 	if (fread(dst, mKeysize, 1, mFile) == 0)
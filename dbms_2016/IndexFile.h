@@ -1,11 +1,27 @@
 #pragma once
 
 #include "DiskFile.h"
+#include "MappedFile.h"
 #include "database_type.h"
+#include "BPlusTree.h"
+#include "FlatHashIndex.h"
+#include "RowBitmap.h"
 #include <cassert>
 #include <iostream>
+#include <unordered_map>
 
 #define INDEX_UNKOWN_RELATION_TYPE 0x1
+#define INDEX_BAD_FILE 0x2
+
+// "LTIX", little endian
+#define INDEXFILE_MAGIC 0x5849544c
+#define INDEXFILE_VERSION 1
+#define INDEXFILE_PAGE 4096
+#define INDEXFILE_SECTION_MAX 8
+
+// Entries appended after the image, beyond this the image is rewritten
+#define INDEXFILE_LOG_RATIO 4
+#define INDEXFILE_LOG_MIN 4096
 
 enum IndexExceptionType
 {
@@ -17,7 +33,8 @@ enum IndexType
 	HASH = 0, 
 	TREE = 1, 
 	PHASH = 2, 
-	PTREE = 3
+	PTREE = 3,
+	BITMAP = 4
 };
 
 struct IndexException
@@ -29,22 +46,55 @@ struct IndexException
 	IndexException(IndexExceptionType _type, std::string _msg) : type(_type), msg(_msg){}
 };
 
-typedef std::unordered_multimap<attr_t, uint32_t, attr_t_hash> HashIndexTable;
-typedef std::multimap<attr_t, uint32_t> TreeIndexTable;
-typedef std::unordered_map<attr_t, uint32_t, attr_t_hash> PrimaryIndexTable;
+typedef std::vector<std::pair<attr_t, uint32_t>> IndexEntryVector;
+
+/*
+	IndexFile format (.idx)
+
+	| header | pad | section 0 | pad | section 1 | ... | pad | log
+
+	sections are the in-memory layout of an index, page aligned so
+	they are mapped and used in place, log is (key, addr) pairs inserted
+	after the image was written, they are appended on save and replayed on load
+	files without header are a plain log, written by older versions
+*/
+struct IndexFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t type;
+	uint32_t domain;
+	uint32_t keysize;
+	uint32_t sectionNum;
+	uint64_t imageNum;		// Entries in sections
+	uint64_t logOffset;
+	uint64_t logNum;
+	uint64_t offsets[INDEXFILE_SECTION_MAX];
+	uint64_t sizes[INDEXFILE_SECTION_MAX];
+};
+
+struct IndexSection
+{
+	const char *data;
+	uint64_t size;
+};
 
 class IndexFile
 	: public DiskFile
 {
 public:
 	IndexFile(attr_domain_t keydomain, uint32_t keysize, IndexType index_type);
-	~IndexFile();
+	virtual ~IndexFile();
 
 	virtual bool set(const attr_t &attr_ref, const uint32_t record_addr) = 0;
+	virtual void bulk_set(IndexEntryVector &entries); // entries may be reordered
 	virtual uint32_t get(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs) = 0; // Filter
 	virtual uint32_t get(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs) = 0; // Reflexive
 	virtual uint32_t get(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs) = 0; // Cross filter
 
+	// Cross filter of (key, probe addr) probes, probes may be reordered
+	virtual uint32_t get_batch(IndexEntryVector &probes, std::vector<AddrPair> &match_pairs);
+
 	virtual uint32_t get_not(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs) = 0;
 	virtual uint32_t get_not(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs) = 0; // Reflexive
 	virtual uint32_t get_not(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs) = 0;
@@ -52,11 +102,41 @@ public:
 	const IndexType type() const { return mType; }
 	void write_back_pair(const void *src, uint32_t addr);
 	void write_back_pair(int ival, uint32_t addr);
+	void write_back_pair(const attr_t &key, uint32_t addr);
 	bool read_from_pair(void *dst, uint32_t * addr_dst);
+
+	// Rewrite image only if the log outgrows it, otherwise append the log
+	void write_back();
+	void read_from();
 protected:
 	IndexType mType;
 	attr_domain_t mKeydomain;
 	uint32_t mKeysize;
+
+	// Record an insertion for the next write_back()
+	void log_entry(const attr_t &key, uint32_t addr);
+
+	// Write sections by write_section(), return entry number
+	virtual uint64_t write_image() = 0;
+	void write_section(const void *data, uint64_t size);
+
+	// Use sections of a mapped image, return false if they are copied
+	virtual bool load_image(const std::vector<IndexSection> &sections) = 0;
+
+	// Stop referencing the mapped image before it is rewritten
+	virtual void release_image() = 0;
+private:
+	MappedFile mImage;
+	IndexEntryVector mLog;
+	bool mStale;			// File misses entries not in mLog
+	uint64_t mImageNum;
+	uint64_t mLogOffset;
+	uint64_t mLogNum;
+	std::vector<uint64_t> mSectionOffsets;
+	std::vector<uint64_t> mSectionSizes;
+
+	void read_log(uint64_t max_num, IndexEntryVector &entries);
+	uint64_t pad_to_page();		// Return the padded offset
 };
 
 class HashIndexFile
@@ -67,20 +147,23 @@ public:
 	~HashIndexFile();
 
 	bool set(const attr_t &attr_ref, const uint32_t record_addr);
+	void bulk_set(IndexEntryVector &entries);
 	uint32_t get(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs);
 	uint32_t get(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
 	uint32_t get(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
+	uint32_t get_batch(IndexEntryVector &probes, std::vector<AddrPair> &match_pairs);
 
 	uint32_t get_not(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs);
 	uint32_t get_not(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
 	uint32_t get_not(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
 
-	void write_back();
-	void read_from();
-
 	void dump();
+protected:
+	uint64_t write_image();
+	bool load_image(const std::vector<IndexSection> &sections);
+	void release_image();
 private:
-	HashIndexTable mHashIndexTable;
+	FlatHashIndex mHashIndex;
 };
 
 class TreeIndexFile
@@ -91,11 +174,15 @@ public:
 	~TreeIndexFile();
 
 	bool set(const attr_t &attr_ref, const uint32_t record_addr);
+	void bulk_set(IndexEntryVector &entries);
 	uint32_t get(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs);
 	uint32_t get(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
 	uint32_t get(const attr_t &attr_ref, const relation_type_t rel_type, std::vector<uint32_t> &match_addrs);
 	uint32_t get(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
 
+	// Probes are sorted by key, pairs come in that order
+	uint32_t get_batch(IndexEntryVector &probes, std::vector<AddrPair> &match_pairs);
+
 	uint32_t get_not(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs);
 	uint32_t get_not(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
 	uint32_t get_not(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
@@ -108,17 +195,79 @@ public:
 	uint32_t get_large(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
 	uint32_t get_large(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
 
-	void write_back();
-	void read_from();
+	// lo < key < hi, one descent then a bounded walk of the leaves
+	uint32_t get_range(const attr_t &lo, const attr_t &hi, std::vector<uint32_t> &match_addrs);
+
+	// VARCHAR keys starting with prefix, one descent then a bounded walk
+	uint32_t get_prefix(const attr_t &prefix, std::vector<uint32_t> &match_addrs);
+
+	// Entries of (key rel k) / (lo < key < hi) and their INTEGER key sum, from subtree counts
+	uint32_t count(const attr_t &attr_ref, const relation_type_t rel_type, int64_t &key_sum) const;
+	uint32_t count_range(const attr_t &lo, const attr_t &hi, int64_t &key_sum) const;
 
 	void dump();
 
-	static void merge_eq(const TreeIndexFile &a, const TreeIndexFile &b, std::vector<AddrPair> &match_pairs);
-	static void merge_neq(const TreeIndexFile &a, const TreeIndexFile &b, std::vector<AddrPair> &match_pairs);
-	static void merge_less(const TreeIndexFile &a, const TreeIndexFile &b, std::vector<AddrPair> &match_pairs);
-	static void merge_large(const TreeIndexFile &a, const TreeIndexFile &b, std::vector<AddrPair> &match_pairs);
+	static void merge_eq(const TreeIndexFile &a, const TreeIndexFile &b, AddrPairSink &sink);
+	static void merge_neq(const TreeIndexFile &a, const TreeIndexFile &b, AddrPairSink &sink);
+	static void merge_less(const TreeIndexFile &a, const TreeIndexFile &b, AddrPairSink &sink);
+	static void merge_large(const TreeIndexFile &a, const TreeIndexFile &b, AddrPairSink &sink);
+
+	BPlusTree::const_iterator begin() const { return mTree.begin(); }
+	BPlusTree::const_iterator end() const { return mTree.end(); }
+protected:
+	uint64_t write_image();
+	bool load_image(const std::vector<IndexSection> &sections);
+	void release_image() {}
 private:
-	TreeIndexTable mTreeIndexTable;
+	BPlusTree mTree;
+
+	BPlusTree::const_iterator less_end(const attr_t &attr_ref) const;
+	BPlusTree::const_iterator large_begin(const attr_t &attr_ref) const;
+};
+
+/*
+	BitmapIndexFile
+
+	one RowBitmap per distinct key, for attrs of few distinct values:
+	a row costs a bit of a dense container or two bytes of a sparse one
+	instead of a hash or tree entry, EQ / NEQ are unions of bitmaps,
+	counts are their cardinalities, rows come in addr order
+	IN is not supported, no predicate of the parser produces it
+*/
+class BitmapIndexFile
+	: public IndexFile
+{
+public:
+	BitmapIndexFile(attr_domain_t keydomain, uint32_t keysize);
+	~BitmapIndexFile();
+
+	bool set(const attr_t &attr_ref, const uint32_t record_addr);
+	void bulk_set(IndexEntryVector &entries);
+	uint32_t get(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs);
+	uint32_t get(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
+	uint32_t get(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
+
+	uint32_t get_not(const attr_t &attr_ref, std::vector<uint32_t> &match_addrs);
+	uint32_t get_not(const attr_t &attr_ref, std::vector<AddrPair> &match_pairs);
+	uint32_t get_not(const attr_t &attr_ref, const uint32_t fix_addr, std::vector<AddrPair> &match_pairs);
+
+	// Rows of (key rel k), EQ or NEQ
+	uint32_t get(const attr_t &attr_ref, const relation_type_t rel_type, RowBitmap &rows) const;
+
+	// Entries of (key rel k), EQ or NEQ, and their INTEGER key sum
+	uint32_t count(const attr_t &attr_ref, const relation_type_t rel_type, int64_t &key_sum) const;
+
+	uint32_t key_num() const { return mBitmaps.size(); }
+
+	void dump();
+protected:
+	uint64_t write_image();
+	bool load_image(const std::vector<IndexSection> &sections);
+	void release_image() {}
+private:
+	std::unordered_map<attr_t, RowBitmap, attr_t_hash> mBitmaps;
+
+	const RowBitmap *find(const attr_t &attr_ref) const;
 };
 
 class PrimaryIndexFile
@@ -140,11 +289,12 @@ public:
 	bool get_primary(const attr_t &attr_ref, uint32_t *match_addr);
 	bool isExist(const attr_t &attr_ref);
 
-	void write_back();
-	void read_from();
-
 	void dump();
+protected:
+	uint64_t write_image();
+	bool load_image(const std::vector<IndexSection> &sections);
+	void release_image();
 private:
-	PrimaryIndexTable mPrimaryIndexTable;
+	FlatHashIndex mPrimaryIndex;	// Posting lists of one addr
 };
 
@@ -0,0 +1,139 @@
+#include "JoinHashTable.h"
+
+#include <cstring>
+
+JoinHashTable::JoinHashTable(attr_domain_t domain, uint32_t capacity) :
+	mDomain(domain)
+{
+	// Keep load factor <= 0.5
+	uint32_t slot_num = 16;
+	while (slot_num < capacity * 2)
+		slot_num <<= 1;
+
+	mSlots.assign(slot_num, JOIN_HASH_NIL);
+	mMask = slot_num - 1;
+
+	mAddrs.reserve(capacity);
+	mNext.reserve(capacity);
+}
+
+JoinHashTable::~JoinHashTable()
+{
+}
+
+void JoinHashTable::insert(int32_t key, uint32_t addr)
+{
+	assert(mDomain == INTEGER_DOMAIN);
+
+	uint32_t h = hash(key);
+	uint32_t slot = probe(h, key);
+	if (mSlots[slot] == JOIN_HASH_NIL)
+	{
+		mSlots[slot] = mGroups.size();
+		mGroups.push_back({ h, JOIN_HASH_NIL, key, 0 });
+		add_entry(mSlots[slot], addr);
+		if (mGroups.size() * 2 > mSlots.size())
+			grow();
+	}
+	else
+	{
+		add_entry(mSlots[slot], addr);
+	}
+}
+
+void JoinHashTable::insert(const char * key, uint32_t addr)
+{
+	assert(mDomain == VARCHAR_DOMAIN);
+
+	uint32_t h = hash(key);
+	uint32_t slot = probe(h, key);
+	if (mSlots[slot] == JOIN_HASH_NIL)
+	{
+		mSlots[slot] = mGroups.size();
+		mGroups.push_back({ h, JOIN_HASH_NIL, 0, (uint32_t)mArena.size() });
+
+		size_t len = strnlen(key, ATTR_SIZE_MAX);
+		mArena.insert(mArena.end(), key, key + len);
+		mArena.push_back('\0');
+
+		add_entry(mSlots[slot], addr);
+		if (mGroups.size() * 2 > mSlots.size())
+			grow();
+	}
+	else
+	{
+		add_entry(mSlots[slot], addr);
+	}
+}
+
+uint32_t JoinHashTable::find(int32_t key) const
+{
+	if (mDomain != INTEGER_DOMAIN)
+		return JOIN_HASH_NIL;
+
+	uint32_t group_id = mSlots[probe(hash(key), key)];
+	return (group_id == JOIN_HASH_NIL) ? JOIN_HASH_NIL : mGroups[group_id].head;
+}
+
+uint32_t JoinHashTable::find(const char * key) const
+{
+	if (mDomain != VARCHAR_DOMAIN)
+		return JOIN_HASH_NIL;
+
+	uint32_t group_id = mSlots[probe(hash(key), key)];
+	return (group_id == JOIN_HASH_NIL) ? JOIN_HASH_NIL : mGroups[group_id].head;
+}
+
+/*
+	JoinHashTable::probe()
+
+	linear probing, return the slot holding key or the first empty slot
+*/
+inline uint32_t JoinHashTable::probe(uint32_t h, int32_t key) const
+{
+	uint32_t slot = h & mMask;
+	while (mSlots[slot] != JOIN_HASH_NIL)
+	{
+		const Group & group = mGroups[mSlots[slot]];
+		if (group.hash == h && group.ival == key)
+			break;
+		slot = (slot + 1) & mMask;
+	}
+	return slot;
+}
+
+inline uint32_t JoinHashTable::probe(uint32_t h, const char * key) const
+{
+	uint32_t slot = h & mMask;
+	while (mSlots[slot] != JOIN_HASH_NIL)
+	{
+		const Group & group = mGroups[mSlots[slot]];
+		if (group.hash == h && strncmp(&mArena[group.soff], key, ATTR_SIZE_MAX) == 0)
+			break;
+		slot = (slot + 1) & mMask;
+	}
+	return slot;
+}
+
+inline void JoinHashTable::add_entry(uint32_t group_id, uint32_t addr)
+{
+	Group & group = mGroups[group_id];
+	mAddrs.push_back(addr);
+	mNext.push_back(group.head);
+	group.head = mAddrs.size() - 1;
+}
+
+void JoinHashTable::grow()
+{
+	mSlots.assign(mSlots.size() * 2, JOIN_HASH_NIL);
+	mMask = mSlots.size() - 1;
+
+	// Groups are unique, only need an empty slot
+	for (uint32_t i = 0; i < mGroups.size(); i++)
+	{
+		uint32_t slot = mGroups[i].hash & mMask;
+		while (mSlots[slot] != JOIN_HASH_NIL)
+			slot = (slot + 1) & mMask;
+		mSlots[slot] = i;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "database_type.h"
+#include "HashUtil.h"
+
+#define JOIN_HASH_NIL 0xFFFFFFFF
+
+/*
+	JoinHashTable
+
+	ephemeral open-addressing hash table built per query for hash join,
+	keys are INTEGER or VARCHAR, duplicated keys share one slot
+	and chain their addrs as a posting list
+
+	usage:
+		for (uint32_t e = ht.find(key); e != JOIN_HASH_NIL; e = ht.next(e))
+			ht.addr(e)
+*/
+class JoinHashTable
+{
+	struct Group
+	{
+		uint32_t hash;
+		uint32_t head;	// first entry of posting list
+		int32_t ival;	// INTEGER key
+		uint32_t soff;	// VARCHAR key offset in arena
+	};
+public:
+	JoinHashTable(attr_domain_t domain, uint32_t capacity);
+	~JoinHashTable();
+
+	void insert(int32_t key, uint32_t addr);
+	void insert(const char *key, uint32_t addr);
+
+	uint32_t find(int32_t key) const;
+	uint32_t find(const char *key) const;
+
+	inline uint32_t next(uint32_t entry) const { return mNext[entry]; }
+	inline uint32_t addr(uint32_t entry) const { return mAddrs[entry]; }
+
+	uint32_t size() const { return mAddrs.size(); }
+	attr_domain_t domain() const { return mDomain; }
+
+	static inline uint32_t hash(int32_t key);
+	static inline uint32_t hash(const char *key);
+private:
+	attr_domain_t mDomain;
+	uint32_t mMask;
+	std::vector<uint32_t> mSlots;	// group id, JOIN_HASH_NIL if empty
+	std::vector<Group> mGroups;
+	std::vector<char> mArena;
+	std::vector<uint32_t> mAddrs;
+	std::vector<uint32_t> mNext;
+
+	inline uint32_t probe(uint32_t h, int32_t key) const;
+	inline uint32_t probe(uint32_t h, const char *key) const;
+	inline void add_entry(uint32_t group_id, uint32_t addr);
+	void grow();
+};
+
+inline uint32_t JoinHashTable::hash(int32_t key)
+{
+	return HashUtil::hash_int(key);
+}
+
+inline uint32_t JoinHashTable::hash(const char * key)
+{
+	return HashUtil::hash_varchar(key);
+}
@@ -0,0 +1,315 @@
+#include "JoinPlanner.h"
+
+#include "system.h"
+#include "LightTable.h"
+#include "JoinHashTable.h"
+#include "CostModel.h"
+
+#include <algorithm>
+
+JoinPlanner::JoinPlanner(
+	std::vector<LightTable*>& tables,
+	std::vector<const RowBitmap*>& rows,
+	std::vector<JoinEdge>& edges) :
+	mTables(tables), mRows(rows), mEdges(edges), mEstimatedRows(0)
+{
+	if (tables.size() > JOIN_PLAN_TABLE_MAX)
+		throw exception_t(JOIN_PLAN_TOO_MANY_TABLES, "Too many tables to join.");
+
+	for (int i = 0; i < tables.size(); i++)
+		mBaseRows.push_back((rows[i] != NULL) ? rows[i]->size() : tables[i]->size());
+
+	mNeighbors.assign(tables.size(), 0);
+	for (const JoinEdge & edge : edges)
+	{
+		mSelectivity.push_back(edge_selectivity(edge));
+		mNeighbors[edge.a] |= 1u << edge.b;
+		mNeighbors[edge.b] |= 1u << edge.a;
+	}
+
+	if (tables.size() <= JOIN_PLAN_DP_MAX)
+		plan_dp();
+	else
+		plan_greedy();
+}
+
+/*
+	JoinPlanner::exec()
+
+	join tables one by one in planned order,
+	columns of tables not joined yet stay empty until the end
+*/
+void JoinPlanner::exec(AddrTuples & tuples)
+{
+	tuples.addrs.assign(mTables.size(), std::vector<uint32_t>());
+	if (mOrder.empty())
+		return;
+
+	table_addrs(mOrder[0], tuples.addrs[mOrder[0]]);
+	uint32_t joined = 1u << mOrder[0];
+	for (int i = 1; i < mOrder.size(); i++)
+	{
+		join_next(tuples, joined, mOrder[i]);
+		joined |= 1u << mOrder[i];
+	}
+}
+
+// a rel b, integer and varchar are only unequal
+bool JoinPlanner::satisfy(const attr_t & a, relation_type_t rel_type, const attr_t & b)
+{
+	if (a.Domain() != b.Domain())
+		return rel_type == NEQ;
+
+	switch (rel_type)
+	{
+	case EQ: return a == b;
+	case NEQ: return a != b;
+	case LESS: return a < b;
+	case LARGE: return a > b;
+	default:
+		throw exception_t(JOIN_PLAN_UNKNOWN_RELATION, "Unknown relation type.");
+	}
+}
+
+double JoinPlanner::edge_selectivity(const JoinEdge & edge)
+{
+	LightTable *a = mTables[edge.a];
+	LightTable *b = mTables[edge.b];
+	if (edge.rel_type == LESS || edge.rel_type == LARGE)
+		return DEFAULT_SEL_RANGE;
+
+	double eq = CostModel::join_eq_rows(a->get_column_stat(edge.a_key_id), b->get_column_stat(edge.b_key_id), 1, 1);
+	if (a->get_attr_type(edge.a_key_id) != b->get_attr_type(edge.b_key_id))
+		eq = 0;
+	return (edge.rel_type == EQ) ? eq : 1 - eq;
+}
+
+// Estimated rows after joining t to the tables of joined having rows
+double JoinPlanner::extend_rows(double rows, uint32_t joined, int t)
+{
+	rows *= mBaseRows[t];
+	for (int e = 0; e < mEdges.size(); e++)
+	{
+		const JoinEdge & edge = mEdges[e];
+		if ((edge.a == t && (joined >> edge.b & 1)) || (edge.b == t && (joined >> edge.a & 1)))
+			rows *= mSelectivity[e];
+	}
+	return rows;
+}
+
+/*
+	JoinPlanner::plan_dp()
+
+	cost[S] = min over last table t of cost[S - t] + rows[S],
+	t must share an edge with S - t unless none of S does
+*/
+void JoinPlanner::plan_dp()
+{
+	int n = mTables.size();
+	uint32_t full = (n == 0) ? 0 : (uint32_t)((1ull << n) - 1);
+
+	std::vector<double> rows(full + 1, 0), cost(full + 1, COST_INFINITE);
+	std::vector<int> last(full + 1, -1);
+	for (int t = 0; t < n; t++)
+	{
+		rows[1u << t] = mBaseRows[t];
+		cost[1u << t] = 0;
+		last[1u << t] = t;
+	}
+
+	// Subsets are visited after all their subsets
+	for (uint32_t s = 1; s <= full; s++)
+	{
+		if ((s & (s - 1)) == 0)
+			continue;
+
+		bool connected = false;
+		for (int t = 0; t < n && !connected; t++)
+			connected = (s >> t & 1) && (mNeighbors[t] & (s & ~(1u << t)));
+
+		for (int t = 0; t < n; t++)
+		{
+			uint32_t rest = s & ~(1u << t);
+			if (!(s >> t & 1) || (connected && !(mNeighbors[t] & rest)))
+				continue;
+
+			double s_rows = extend_rows(rows[rest], rest, t);
+			if (cost[rest] + s_rows < cost[s])
+			{
+				rows[s] = s_rows;
+				cost[s] = cost[rest] + s_rows;
+				last[s] = t;
+			}
+		}
+	}
+
+	mOrder.clear();
+	for (uint32_t s = full; s != 0; s &= ~(1u << last[s]))
+		mOrder.push_back(last[s]);
+	std::reverse(mOrder.begin(), mOrder.end());
+	mEstimatedRows = rows[full];
+}
+
+/*
+	JoinPlanner::plan_greedy()
+
+	start from the table with the least rows, then take the neighbor
+	giving the least rows each time
+*/
+void JoinPlanner::plan_greedy()
+{
+	int n = mTables.size();
+	int first = std::min_element(mBaseRows.begin(), mBaseRows.end()) - mBaseRows.begin();
+
+	mOrder.assign(1, first);
+	uint32_t joined = 1u << first;
+	double rows = mBaseRows[first];
+	while (mOrder.size() < n)
+	{
+		bool connected = false;
+		for (int t = 0; t < n && !connected; t++)
+			connected = !(joined >> t & 1) && (mNeighbors[t] & joined);
+
+		int best = -1;
+		double best_rows = 0;
+		for (int t = 0; t < n; t++)
+		{
+			if ((joined >> t & 1) || (connected && !(mNeighbors[t] & joined)))
+				continue;
+
+			double t_rows = extend_rows(rows, joined, t);
+			if (best < 0 || t_rows < best_rows)
+			{
+				best = t;
+				best_rows = t_rows;
+			}
+		}
+
+		mOrder.push_back(best);
+		joined |= 1u << best;
+		rows = best_rows;
+	}
+	mEstimatedRows = rows;
+}
+
+/*
+	JoinPlanner::join_next()
+
+	(tuple row, t addr) pairs on the first EQ edge of same typed keys by hashing
+	the smaller side, or all pairs if none, then filtered by other edges
+*/
+void JoinPlanner::join_next(AddrTuples & tuples, uint32_t joined, int t)
+{
+	std::vector<const JoinEdge *> edges;
+	const JoinEdge *hash_edge = NULL;
+	for (const JoinEdge & edge : mEdges)
+	{
+		if (!((edge.a == t && (joined >> edge.b & 1)) || (edge.b == t && (joined >> edge.a & 1))))
+			continue;
+		if (hash_edge == NULL && edge.rel_type == EQ
+			&& mTables[edge.a]->get_attr_type(edge.a_key_id) == mTables[edge.b]->get_attr_type(edge.b_key_id))
+			hash_edge = &edge;
+		else
+			edges.push_back(&edge);
+	}
+
+	std::vector<uint32_t> t_addrs;
+	table_addrs(t, t_addrs);
+	uint32_t row_num = tuples.addrs[RowBitmap::ctz(joined)].size();
+
+	// Other edges between t and joined tables filter each pair
+	std::vector<std::pair<uint32_t, uint32_t>> matches;	// (tuple row, t addr)
+	auto emit = [&](uint32_t row, uint32_t t_addr)
+	{
+		for (const JoinEdge *edge : edges)
+		{
+			uint32_t a_addr = (edge->a == t) ? t_addr : tuples.addrs[edge->a][row];
+			uint32_t b_addr = (edge->b == t) ? t_addr : tuples.addrs[edge->b][row];
+			if (!satisfy(mTables[edge->a]->get_attr(a_addr, edge->a_key_id), edge->rel_type,
+				mTables[edge->b]->get_attr(b_addr, edge->b_key_id)))
+				return;
+		}
+		matches.emplace_back(row, t_addr);
+	};
+
+	if (hash_edge != NULL)
+	{
+		bool t_is_a = hash_edge->a == t;
+		LightTable *t_table = mTables[t];
+		int t_key_id = t_is_a ? hash_edge->a_key_id : hash_edge->b_key_id;
+		int o = t_is_a ? hash_edge->b : hash_edge->a;
+		LightTable *o_table = mTables[o];
+		int o_key_id = t_is_a ? hash_edge->b_key_id : hash_edge->a_key_id;
+		const std::vector<uint32_t> & o_addrs = tuples.addrs[o];
+		bool integer_key = t_table->get_attr_type(t_key_id) == ATTR_TYPE_INTEGER;
+
+		// Build on t addrs or tuple rows, whichever is smaller
+		bool build_t = t_addrs.size() <= row_num;
+		uint32_t build_num = build_t ? t_addrs.size() : row_num;
+		JoinHashTable hash_table(integer_key ? INTEGER_DOMAIN : VARCHAR_DOMAIN, build_num);
+		for (uint32_t i = 0; i < build_num; i++)
+		{
+			LightTable *table = build_t ? t_table : o_table;
+			uint32_t addr = build_t ? t_addrs[i] : o_addrs[i];
+			int key_id = build_t ? t_key_id : o_key_id;
+			if (integer_key)
+				hash_table.insert(table->get_int(addr, key_id), i);
+			else
+				hash_table.insert(table->get_varchar(addr, key_id), i);
+		}
+
+		uint32_t probe_num = build_t ? row_num : t_addrs.size();
+		for (uint32_t i = 0; i < probe_num; i++)
+		{
+			LightTable *table = build_t ? o_table : t_table;
+			uint32_t addr = build_t ? o_addrs[i] : t_addrs[i];
+			int key_id = build_t ? o_key_id : t_key_id;
+			uint32_t e = integer_key ?
+				hash_table.find(table->get_int(addr, key_id)) :
+				hash_table.find(table->get_varchar(addr, key_id));
+			for (; e != JOIN_HASH_NIL; e = hash_table.next(e))
+			{
+				if (build_t)
+					emit(i, t_addrs[hash_table.addr(e)]);
+				else
+					emit(hash_table.addr(e), t_addrs[i]);
+			}
+		}
+	}
+	else
+	{
+		for (uint32_t i = 0; i < row_num; i++)
+			for (uint32_t t_addr : t_addrs)
+				emit(i, t_addr);
+	}
+
+	for (int c = 0; c < tuples.addrs.size(); c++)
+	{
+		if (!(joined >> c & 1))
+			continue;
+		std::vector<uint32_t> column;
+		column.reserve(matches.size());
+		for (const std::pair<uint32_t, uint32_t> & match : matches)
+			column.push_back(tuples.addrs[c][match.first]);
+		tuples.addrs[c].swap(column);
+	}
+
+	tuples.addrs[t].clear();
+	tuples.addrs[t].reserve(matches.size());
+	for (const std::pair<uint32_t, uint32_t> & match : matches)
+		tuples.addrs[t].push_back(match.second);
+}
+
+void JoinPlanner::table_addrs(int t, std::vector<uint32_t>& addrs)
+{
+	addrs.clear();
+	if (mRows[t] != NULL)
+	{
+		mRows[t]->to_addrs(addrs);
+		return;
+	}
+
+	addrs.resize(mTables[t]->size());
+	for (uint32_t i = 0; i < addrs.size(); i++)
+		addrs[i] = i;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "database_type.h"
+#include "RowBitmap.h"
+
+class LightTable;
+
+#define JOIN_PLAN_TOO_MANY_TABLES 0x1
+#define JOIN_PLAN_UNKNOWN_RELATION 0x2
+
+// Tables of one join, a set of tables is a bit mask
+#define JOIN_PLAN_TABLE_MAX 32
+
+// Join orders are enumerated exhaustively up to this many tables, greedily beyond
+#define JOIN_PLAN_DP_MAX 12
+
+/*
+	JoinEdge
+
+	a.a_key rel b.b_key, a and b are positions of tables in the join
+*/
+struct JoinEdge
+{
+	int a;
+	int a_key_id;
+	relation_type_t rel_type;
+	int b;
+	int b_key_id;
+};
+
+/*
+	AddrTuples
+
+	rows of N joined tables, AddrPair widened to any number of tables:
+	row i is (addrs[0][i], ..., addrs[N - 1][i]) by table position,
+	during a join only columns of joined tables are filled
+*/
+struct AddrTuples
+{
+	std::vector<std::vector<uint32_t>> addrs;
+
+	inline uint32_t size() const { return addrs.empty() ? 0 : addrs[0].size(); }
+};
+
+/*
+	JoinPlanner
+
+	join of N tables, each restricted to rows left by its own predicates
+	(NULL rows is the whole table), along edges of a join graph
+
+	order is left-deep and minimizes the sum of estimated intermediate rows:
+	cardinality of a set of tables is the product of their rows and selectivities
+	of edges inside it, enumerated by dynamic programming over subsets up to
+	JOIN_PLAN_DP_MAX tables, greedily by the smallest next result beyond that,
+	a table with no edge to the joined ones is only taken if no other is left
+
+	each step hashes the smaller side on an EQ edge if any, otherwise loops,
+	other edges to the joined tables filter the step result
+	usage:
+		JoinPlanner planner(tables, rows, edges);
+		planner.exec(tuples);
+*/
+class JoinPlanner
+{
+public:
+	JoinPlanner(
+		std::vector<LightTable *> &tables,
+		std::vector<const RowBitmap *> &rows,
+		std::vector<JoinEdge> &edges);
+
+	// Positions of tables in join order
+	const std::vector<int> &order() const { return mOrder; }
+	double estimated_rows() const { return mEstimatedRows; }
+
+	void exec(AddrTuples &tuples);
+
+	static bool satisfy(const attr_t &a, relation_type_t rel_type, const attr_t &b);
+private:
+	std::vector<LightTable *> &mTables;
+	std::vector<const RowBitmap *> &mRows;
+	std::vector<JoinEdge> &mEdges;
+
+	std::vector<double> mBaseRows;
+	std::vector<double> mSelectivity;	// of each edge
+	std::vector<uint32_t> mNeighbors;	// mask of tables sharing an edge
+	std::vector<int> mOrder;
+	double mEstimatedRows;
+
+	double edge_selectivity(const JoinEdge &edge);
+	double extend_rows(double rows, uint32_t joined, int t);
+	void plan_dp();
+	void plan_greedy();
+	void join_next(AddrTuples &tuples, uint32_t joined, int t);
+	void table_addrs(int t, std::vector<uint32_t> &addrs);
+};
@@ -0,0 +1,589 @@
+#include "LightOperator.h"
+#include "LightTable.h"
+
+#include <algorithm>
+
+ScanOperator::ScanOperator(LightTable & table) :
+	mTable(table), mCur(0)
+{
+}
+
+void ScanOperator::open()
+{
+	mCur = 0;
+}
+
+uint32_t ScanOperator::next(RowBatch & batch)
+{
+	batch.clear();
+
+	uint32_t end = std::min(mCur + LIGHT_BATCH_SIZE, mTable.size());
+	for (; mCur < end; mCur++)
+		batch.put(mCur);
+	return batch.size();
+}
+
+IndexScanOperator::IndexScanOperator(LightTable & table, const Predicate & pred, IndexFile * index_file) :
+	mTable(table), mAttrId(pred.attr_id), mRelType(pred.rel_type), mK(pred.k), mKHi(pred.k_hi), mIndexFile(index_file),
+	mComposite(NULL), mKeyNum(0), mCur(0)
+{
+	assert(index_file != NULL);
+	assert(pred.rel_type != RANGE || index_file->type() == TREE);
+}
+
+IndexScanOperator::IndexScanOperator(LightTable & table, const CompositeIndex & composite, const attr_t & key, int key_num) :
+	mTable(table), mAttrId(composite.attr_ids[0]), mRelType(EQ), mK(key), mIndexFile(composite.index_file),
+	mComposite(&composite), mKeyNum(key_num), mCur(0)
+{
+	assert(key_num == composite.attr_ids.size() || composite.index_file->type() == TREE);
+}
+
+void IndexScanOperator::open()
+{
+	// Index gives addrs in key order, keep addr order like a scan
+	mAddrs.clear();
+	if (mComposite != NULL)
+		mTable.filter_composite(*mComposite, mK, mKeyNum, mAddrs);
+	else if (mRelType == RANGE)
+		static_cast<TreeIndexFile *>(mIndexFile)->get_range(mK, mKHi, mAddrs);
+	else
+		mTable.filter_with_index(mTable.get_attr_descs()[mAttrId].name, mK, mRelType, mIndexFile, mAddrs);
+	std::sort(mAddrs.begin(), mAddrs.end());
+	mCur = 0;
+}
+
+uint32_t IndexScanOperator::next(RowBatch & batch)
+{
+	batch.clear();
+
+	uint32_t end = std::min<uint32_t>(mCur + LIGHT_BATCH_SIZE, mAddrs.size());
+	for (; mCur < end; mCur++)
+		batch.put(mAddrs[mCur]);
+	return batch.size();
+}
+
+void IndexScanOperator::close()
+{
+	std::vector<uint32_t>().swap(mAddrs);
+}
+
+BitmapScanOperator::BitmapScanOperator(const RowBitmap & rows) :
+	mRows(rows), mCur(0)
+{
+}
+
+void BitmapScanOperator::open()
+{
+	mAddrs.clear();
+	mRows.to_addrs(mAddrs);
+	mCur = 0;
+}
+
+uint32_t BitmapScanOperator::next(RowBatch & batch)
+{
+	batch.clear();
+
+	uint32_t end = std::min<uint32_t>(mCur + LIGHT_BATCH_SIZE, mAddrs.size());
+	for (; mCur < end; mCur++)
+		batch.put(mAddrs[mCur]);
+	return batch.size();
+}
+
+void BitmapScanOperator::close()
+{
+	std::vector<uint32_t>().swap(mAddrs);
+}
+
+FilterOperator::FilterOperator(LightOperator * child, LightTable & table, const Predicate & pred) :
+	mChild(child), mTable(table), mAttrId(pred.attr_id), mRelType(pred.rel_type), mK(pred.k), mKHi(pred.k_hi)
+{
+	assert(child->width() == 1);
+}
+
+FilterOperator::~FilterOperator()
+{
+	delete mChild;
+}
+
+void FilterOperator::open()
+{
+	mChild->open();
+}
+
+uint32_t FilterOperator::next(RowBatch & batch)
+{
+	// Skip batches filtered out entirely, 0 means exhausted
+	while (mChild->next(batch) > 0)
+	{
+		uint32_t left = (mRelType == RANGE) ?
+			mTable.refine_range(mAttrId, mK, mKHi, batch.addrs[0]) :
+			mTable.refine(mAttrId, mK, mRelType, batch.addrs[0]);
+		if (left > 0)
+			return batch.size();
+	}
+	return 0;
+}
+
+void FilterOperator::close()
+{
+	mChild->close();
+}
+
+ProductOperator::ProductOperator(LightOperator * outer, LightOperator * inner) :
+	mOuter(outer), mInner(inner), mOuterPos(0), mInnerPos(0)
+{
+	assert(outer->width() == 1 && inner->width() == 1);
+}
+
+ProductOperator::~ProductOperator()
+{
+	delete mOuter;
+	delete mInner;
+}
+
+void ProductOperator::open()
+{
+	RowBatch inner_batch;
+	mInnerAddrs.clear();
+	mInner->open();
+	while (mInner->next(inner_batch) > 0)
+		mInnerAddrs.insert(mInnerAddrs.end(), inner_batch.addrs[0].begin(), inner_batch.addrs[0].end());
+	mInner->close();
+
+	mOuter->open();
+	mOuterBatch.clear();
+	mOuterPos = mInnerPos = 0;
+}
+
+uint32_t ProductOperator::next(RowBatch & batch)
+{
+	batch.clear();
+	if (mInnerAddrs.empty())
+		return 0;
+
+	while (!batch.full())
+	{
+		if (mOuterPos >= mOuterBatch.size())
+		{
+			if (mOuter->next(mOuterBatch) == 0)
+				break;
+			mOuterPos = mInnerPos = 0;
+		}
+
+		uint32_t outer_addr = mOuterBatch.addrs[0][mOuterPos];
+		while (mInnerPos < mInnerAddrs.size() && !batch.full())
+			batch.put(outer_addr, mInnerAddrs[mInnerPos++]);
+
+		if (mInnerPos >= mInnerAddrs.size())
+		{
+			mOuterPos++;
+			mInnerPos = 0;
+		}
+	}
+	return batch.size();
+}
+
+void ProductOperator::close()
+{
+	mOuter->close();
+	std::vector<uint32_t>().swap(mInnerAddrs);
+}
+
+HashJoinOperator::HashJoinOperator(
+	LightOperator * a, LightTable & a_table, int a_key_id,
+	LightOperator * b, LightTable & b_table, int b_key_id,
+	bool build_a) :
+	mBuild(build_a ? a : b), mProbe(build_a ? b : a),
+	mBuildTable(build_a ? a_table : b_table), mProbeTable(build_a ? b_table : a_table),
+	mBuildKeyId(build_a ? a_key_id : b_key_id), mProbeKeyId(build_a ? b_key_id : a_key_id),
+	mBuildA(build_a), mHashTable(NULL), mCodeKey(false), mProbePos(0), mEntry(JOIN_HASH_NIL)
+{
+	assert(a->width() == 1 && b->width() == 1);
+}
+
+HashJoinOperator::~HashJoinOperator()
+{
+	delete mBuild;
+	delete mProbe;
+	delete mHashTable;
+}
+
+void HashJoinOperator::open()
+{
+	RowBatch build_batch;
+	std::vector<uint32_t> build_addrs;
+	mBuild->open();
+	while (mBuild->next(build_batch) > 0)
+		build_addrs.insert(build_addrs.end(), build_batch.addrs[0].begin(), build_batch.addrs[0].end());
+	mBuild->close();
+
+	bool integer_key = mBuildTable.get_attr_type(mBuildKeyId) == ATTR_TYPE_INTEGER;
+	mCodeKey = mBuildTable.has_codes(mBuildKeyId) && mProbeTable.has_codes(mProbeKeyId);
+	if (mCodeKey)
+		mProbeTable.translate_codes(mProbeKeyId, mBuildTable, mBuildKeyId, mProbeToBuild);
+
+	delete mHashTable;
+	mHashTable = new JoinHashTable((integer_key || mCodeKey) ? INTEGER_DOMAIN : VARCHAR_DOMAIN, build_addrs.size());
+	for (uint32_t addr : build_addrs)
+	{
+		if (integer_key)
+			mHashTable->insert(mBuildTable.get_int(addr, mBuildKeyId), addr);
+		else if (mCodeKey)
+			mHashTable->insert(mBuildTable.get_code(addr, mBuildKeyId), addr);
+		else
+			mHashTable->insert(mBuildTable.get_varchar(addr, mBuildKeyId), addr);
+	}
+
+	mProbe->open();
+	mProbeBatch.clear();
+	mProbePos = 0;
+	mEntry = JOIN_HASH_NIL;
+}
+
+uint32_t HashJoinOperator::next(RowBatch & batch)
+{
+	batch.clear();
+
+	// Integer never equals to varchar
+	if (mBuildTable.get_attr_type(mBuildKeyId) != mProbeTable.get_attr_type(mProbeKeyId))
+		return 0;
+
+	bool integer_key = mHashTable->domain() == INTEGER_DOMAIN && !mCodeKey;
+	while (!batch.full())
+	{
+		if (mEntry != JOIN_HASH_NIL)
+		{
+			uint32_t probe_addr = mProbeBatch.addrs[0][mProbePos - 1];
+			if (mBuildA)
+				batch.put(mHashTable->addr(mEntry), probe_addr);
+			else
+				batch.put(probe_addr, mHashTable->addr(mEntry));
+			mEntry = mHashTable->next(mEntry);
+			continue;
+		}
+
+		if (mProbePos >= mProbeBatch.size())
+		{
+			if (mProbe->next(mProbeBatch) == 0)
+				break;
+			mProbePos = 0;
+		}
+
+		uint32_t probe_addr = mProbeBatch.addrs[0][mProbePos++];
+		if (mCodeKey)
+		{
+			int32_t code = mProbeToBuild[mProbeTable.get_code(probe_addr, mProbeKeyId)];
+			mEntry = (code < 0) ? JOIN_HASH_NIL : mHashTable->find(code);
+		}
+		else
+		{
+			mEntry = integer_key ?
+				mHashTable->find(mProbeTable.get_int(probe_addr, mProbeKeyId)) :
+				mHashTable->find(mProbeTable.get_varchar(probe_addr, mProbeKeyId));
+		}
+	}
+	return batch.size();
+}
+
+void HashJoinOperator::close()
+{
+	mProbe->close();
+	delete mHashTable;
+	mHashTable = NULL;
+	std::vector<int32_t>().swap(mProbeToBuild);
+}
+
+MergeJoinOperator::MergeJoinOperator(const TreeIndexFile & a_index, const TreeIndexFile & b_index) :
+	mAIndex(a_index), mBIndex(b_index), mInGroup(false)
+{
+}
+
+void MergeJoinOperator::open()
+{
+	mAit = mAIndex.begin();
+	mBit = mBIndex.begin();
+	mInGroup = false;
+}
+
+uint32_t MergeJoinOperator::next(RowBatch & batch)
+{
+	batch.clear();
+
+	auto a_end = mAIndex.end();
+	auto b_end = mBIndex.end();
+
+	while (!batch.full())
+	{
+		if (mInGroup)
+		{
+			if (mGroupCur != mGroupEnd)
+			{
+				batch.put(mAit.addr(), mGroupCur.addr());
+				++mGroupCur;
+				continue;
+			}
+
+			// Next a with the same key walks the same b group again
+			auto prev = mAit++;
+			if (mAit != a_end && mAit.key() == prev.key())
+			{
+				mGroupCur = mBit;
+				continue;
+			}
+			mBit = mGroupEnd;
+			mInGroup = false;
+		}
+
+		if (mAit == a_end || mBit == b_end)
+			break;
+
+		int cmp = BPlusTree::compare(mAit.key(), mBit.key());
+		if (cmp < 0)
+			++mAit;
+		else if (cmp > 0)
+			++mBit;
+		else
+		{
+			mGroupEnd = mBit;
+			while (mGroupEnd != b_end && mGroupEnd.key() == mAit.key())
+				++mGroupEnd;
+			mGroupCur = mBit;
+			mInGroup = true;
+		}
+	}
+	return batch.size();
+}
+
+SortMergeJoinOperator::SortMergeJoinOperator(
+	LightOperator * a, LightTable & a_table, int a_key_id, const TreeIndexFile * a_tree,
+	relation_type_t rel_type,
+	LightOperator * b, LightTable & b_table, int b_key_id, const TreeIndexFile * b_tree) :
+	mA(a), mB(b), mATable(a_table), mBTable(b_table), mAKeyId(a_key_id), mBKeyId(b_key_id),
+	mATree(a_tree), mBTree(b_tree), mRelType(rel_type), mAPos(0), mLo(0), mHi(0), mCur(0)
+{
+	assert(rel_type == EQ || rel_type == LESS || rel_type == LARGE);
+	assert((a == NULL || a->width() == 1) && (b == NULL || b->width() == 1));
+}
+
+SortMergeJoinOperator::~SortMergeJoinOperator()
+{
+	delete mA;
+	delete mB;
+}
+
+void SortMergeJoinOperator::open()
+{
+	mARun.clear();
+	mBRun.clear();
+
+	// Integer never equals to varchar, and is not ordered with it
+	if (mATable.get_attr_type(mAKeyId) == mBTable.get_attr_type(mBKeyId))
+	{
+		build_run(mA, mATable, mAKeyId, mATree, mARun);
+		build_run(mB, mBTable, mBKeyId, mBTree, mBRun);
+	}
+
+	mAPos = 0;
+	mLo = mHi = mCur = 0;
+	if (!mARun.empty())
+		bound();
+}
+
+uint32_t SortMergeJoinOperator::next(RowBatch & batch)
+{
+	batch.clear();
+
+	while (mAPos < mARun.size() && !batch.full())
+	{
+		if (mCur < mHi)
+		{
+			batch.put(mARun[mAPos].second, mBRun[mCur].second);
+			mCur++;
+			continue;
+		}
+		if (++mAPos < mARun.size())
+			bound();
+	}
+	return batch.size();
+}
+
+void SortMergeJoinOperator::close()
+{
+	IndexEntryVector().swap(mARun);
+	IndexEntryVector().swap(mBRun);
+}
+
+/*
+	SortMergeJoinOperator::build_run()
+
+	(key, addr) of a stream ordered by whole key then addr,
+	VARCHAR LESS/LARGE compare a prefix, which is coarser than this order
+*/
+void SortMergeJoinOperator::build_run(LightOperator * op, LightTable & table, int key_id, const TreeIndexFile * tree, IndexEntryVector & run)
+{
+	if (op == NULL && tree != NULL)
+	{
+		run.reserve(table.size());
+		for (auto it = tree->begin(); it != tree->end(); ++it)
+			run.emplace_back(it.key(), it.addr());
+		return;
+	}
+
+	if (op == NULL)
+	{
+		run.reserve(table.size());
+		for (uint32_t addr = 0; addr < table.size(); addr++)
+			run.emplace_back(table.get_attr(addr, key_id), addr);
+	}
+	else
+	{
+		RowBatch batch;
+		op->open();
+		while (op->next(batch) > 0)
+			for (uint32_t addr : batch.addrs[0])
+				run.emplace_back(table.get_attr(addr, key_id), addr);
+		op->close();
+	}
+
+	std::sort(run.begin(), run.end(), [](const std::pair<attr_t, uint32_t> & x, const std::pair<attr_t, uint32_t> & y)
+	{
+		int cmp = BPlusTree::compare(x.first, y.first);
+		return cmp < 0 || (cmp == 0 && x.second < y.second);
+	});
+}
+
+// Advance b range to the current a row
+void SortMergeJoinOperator::bound()
+{
+	const attr_t & key = mARun[mAPos].first;
+	uint32_t num = mBRun.size();
+
+	switch (mRelType)
+	{
+	case EQ:
+		while (mLo < num && BPlusTree::compare(mBRun[mLo].first, key) < 0)
+			mLo++;
+		mHi = std::max(mHi, mLo);
+		while (mHi < num && BPlusTree::compare(mBRun[mHi].first, key) == 0)
+			mHi++;
+		break;
+	case LESS:
+		while (mLo < num && !(key < mBRun[mLo].first))
+			mLo++;
+		mHi = num;
+		break;
+	case LARGE:
+		while (mHi < num && mBRun[mHi].first < key)
+			mHi++;
+		break;
+	default:
+		assert(false);
+	}
+	mCur = mLo;
+}
+
+ProjectOperator::ProjectOperator(LightOperator * child, std::vector<OutputEntry>& entries) :
+	mChild(child), mEntries(entries)
+{
+}
+
+ProjectOperator::~ProjectOperator()
+{
+	delete mChild;
+}
+
+void ProjectOperator::exec(ResultSink & sink)
+{
+	RowBatch batch;
+	int side_num = mChild->width();
+
+	mChild->open();
+	while (mChild->next(batch) > 0)
+	{
+		for (uint32_t i = 0; i < batch.size(); i++)
+		{
+			for (const OutputEntry & entry : mEntries)
+			{
+				int side = (side_num == 2 && std::get<1>(entry) == 1) ? 1 : 0;
+				sink.put(*std::get<0>(entry), batch.addrs[side][i], std::get<2>(entry));
+			}
+			sink.end_row();
+		}
+	}
+	mChild->close();
+}
+
+AggregateOperator::AggregateOperator(LightOperator * child, std::vector<OutputEntry>& entries) :
+	mChild(child), mEntries(entries)
+{
+}
+
+AggregateOperator::~AggregateOperator()
+{
+	delete mChild;
+}
+
+void AggregateOperator::exec(ResultSink & sink)
+{
+	RowBatch batch;
+	std::vector<int64_t> counters(mEntries.size(), 0);
+	bool single = mChild->width() == 1;
+
+	mChild->open();
+	while (mChild->next(batch) > 0)
+	{
+		const std::vector<uint32_t> & b_addrs = single ? batch.addrs[0] : batch.addrs[1];
+		for (int j = 0; j < mEntries.size(); j++)
+		{
+			for (uint32_t i = 0; i < batch.size(); i++)
+				accumulate(batch.addrs[0][i], b_addrs[i], mEntries[j], counters[j]);
+		}
+	}
+	mChild->close();
+
+	for (int j = 0; j < counters.size(); j++)
+		sink.put(counters[j]);
+	sink.end_row();
+}
+
+void AggregateOperator::accumulate(uint32_t a_addr, uint32_t b_addr, const OutputEntry & entry, int64_t & counter)
+{
+	bool isStar = std::get<4>(entry);
+	DatabaseAggregateType aggre_type = std::get<3>(entry);
+
+	if (isStar)
+	{
+		switch (aggre_type)
+		{
+		case COUNT:
+			counter++;
+			break;
+		default:
+			throw exception_t(ILLEGAL_AGGREGATE, "Sum(*) illegal");
+		}
+	}
+	else
+	{
+		uint32_t addr = (std::get<1>(entry) == 0) ? a_addr : b_addr;
+		int colid = std::get<2>(entry);
+		LightTable * bind_table = std::get<0>(entry);
+		uint8_t attr_type = bind_table->get_attr_type(colid);
+
+		switch (aggre_type)
+		{
+		case COUNT:
+			if (attr_type == ATTR_TYPE_INTEGER ||
+				(attr_type == ATTR_TYPE_VARCHAR
+					&& bind_table->get_varchar(addr, colid)[0] != '\0'))
+				counter++;
+			break;
+		case SUM:
+			if (attr_type == ATTR_TYPE_VARCHAR)
+				throw exception_t(ILLEGAL_AGGREGATE, "Varchar cannot sum.");
+			counter += bind_table->get_int(addr, colid);
+			break;
+		default:
+			break;
+		}
+	}
+}
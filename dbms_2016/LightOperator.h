@@ -0,0 +1,344 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <tuple>
+#include <iostream>
+
+#include "database_type.h"
+#include "IndexFile.h"
+#include "JoinHashTable.h"
+#include "RowBitmap.h"
+#include "ResultSink.h"
+
+#define LIGHT_BATCH_SIZE 1024
+
+#define ILLEGAL_AGGREGATE 0x1
+
+class LightTable;
+struct Predicate;
+struct CompositeIndex;
+
+enum DatabaseAggregateType
+{
+	NO_AGGRE, COUNT, SUM
+};
+
+// table, comb id (0: first, 1: second), attr id, aggregate type, is star
+typedef std::tuple<LightTable *, int, int, DatabaseAggregateType, bool> OutputEntry;
+
+/*
+	RowBatch
+
+	up to LIGHT_BATCH_SIZE rows exchanged between operators,
+	row i is (addrs[0][i], addrs[1][i]), single table operators only fill addrs[0]
+*/
+struct RowBatch
+{
+	std::vector<uint32_t> addrs[2];
+
+	RowBatch()
+	{
+		addrs[0].reserve(LIGHT_BATCH_SIZE);
+		addrs[1].reserve(LIGHT_BATCH_SIZE);
+	}
+
+	inline uint32_t size() const { return addrs[0].size(); }
+	inline bool full() const { return addrs[0].size() >= LIGHT_BATCH_SIZE; }
+	inline void clear() { addrs[0].clear(); addrs[1].clear(); }
+	inline void put(uint32_t addr) { addrs[0].push_back(addr); }
+	inline void put(uint32_t a_addr, uint32_t b_addr) { addrs[0].push_back(a_addr); addrs[1].push_back(b_addr); }
+};
+
+/*
+	LightOperator
+
+	pull-based operator producing row addrs batch by batch,
+	an operator owns its children
+	usage:
+		op->open();
+		while (op->next(batch) > 0)
+			...
+		op->close();
+*/
+class LightOperator
+{
+public:
+	virtual ~LightOperator() {}
+
+	virtual void open() = 0;
+
+	// Clear batch and fill next rows, return 0 when exhausted
+	virtual uint32_t next(RowBatch &batch) = 0;
+
+	virtual void close() {}
+
+	// Number of tables of a row, 1 or 2
+	virtual int width() const = 0;
+};
+
+/*
+	ScanOperator
+
+	all rows of a table in addr order
+*/
+class ScanOperator
+	: public LightOperator
+{
+public:
+	ScanOperator(LightTable &table);
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	int width() const { return 1; }
+private:
+	LightTable &mTable;
+	uint32_t mCur;
+};
+
+/*
+	IndexScanOperator
+
+	rows satisfying one predicate found via index, in addr order,
+	RANGE is one walk of a tree index, or rows of key_num leading
+	values of a composite index in one probe
+*/
+class IndexScanOperator
+	: public LightOperator
+{
+public:
+	IndexScanOperator(LightTable &table, const Predicate &pred, IndexFile *index_file);
+	IndexScanOperator(LightTable &table, const CompositeIndex &composite, const attr_t &key, int key_num);
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	void close();
+	int width() const { return 1; }
+private:
+	LightTable &mTable;
+	int mAttrId;
+	relation_type_t mRelType;
+	attr_t mK;
+	attr_t mKHi;	// RANGE only
+	IndexFile *mIndexFile;
+	const CompositeIndex *mComposite;	// NULL unless a composite probe
+	int mKeyNum;
+	std::vector<uint32_t> mAddrs;
+	uint32_t mCur;
+};
+
+/*
+	BitmapScanOperator
+
+	rows of a RowBitmap in addr order, the bitmap must outlive the operator
+*/
+class BitmapScanOperator
+	: public LightOperator
+{
+public:
+	BitmapScanOperator(const RowBitmap &rows);
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	void close();
+	int width() const { return 1; }
+private:
+	const RowBitmap &mRows;
+	std::vector<uint32_t> mAddrs;
+	uint32_t mCur;
+};
+
+/*
+	FilterOperator
+
+	drop rows of a single table stream not satisfying one predicate
+*/
+class FilterOperator
+	: public LightOperator
+{
+public:
+	FilterOperator(LightOperator *child, LightTable &table, const Predicate &pred);
+	~FilterOperator();
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	void close();
+	int width() const { return 1; }
+private:
+	LightOperator *mChild;
+	LightTable &mTable;
+	int mAttrId;
+	relation_type_t mRelType;
+	attr_t mK;
+	attr_t mKHi;	// RANGE only
+};
+
+/*
+	ProductOperator
+
+	cross product of two single table streams,
+	inner stream is drained on open
+*/
+class ProductOperator
+	: public LightOperator
+{
+public:
+	ProductOperator(LightOperator *outer, LightOperator *inner);
+	~ProductOperator();
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	void close();
+	int width() const { return 2; }
+private:
+	LightOperator *mOuter;
+	LightOperator *mInner;
+	std::vector<uint32_t> mInnerAddrs;
+	RowBatch mOuterBatch;
+	uint32_t mOuterPos;
+	uint32_t mInnerPos;
+};
+
+/*
+	HashJoinOperator
+
+	a.key = b.key, build a JoinHashTable on one stream then probe it with the other,
+	output rows are always (a addr, b addr)
+*/
+class HashJoinOperator
+	: public LightOperator
+{
+public:
+	HashJoinOperator(
+		LightOperator *a, LightTable &a_table, int a_key_id,
+		LightOperator *b, LightTable &b_table, int b_key_id,
+		bool build_a);
+	~HashJoinOperator();
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	void close();
+	int width() const { return 2; }
+private:
+	LightOperator *mBuild;
+	LightOperator *mProbe;
+	LightTable &mBuildTable;
+	LightTable &mProbeTable;
+	int mBuildKeyId;
+	int mProbeKeyId;
+	bool mBuildA;
+
+	JoinHashTable *mHashTable;
+	bool mCodeKey;						// VARCHAR key joined on dictionary codes
+	std::vector<int32_t> mProbeToBuild;	// probe code to build code, -1 if absent
+	RowBatch mProbeBatch;
+	uint32_t mProbePos;
+	uint32_t mEntry;	// next entry of current probe addr
+};
+
+/*
+	MergeJoinOperator
+
+	a.key = b.key on two tree indexes, walk both in key order
+*/
+class MergeJoinOperator
+	: public LightOperator
+{
+public:
+	MergeJoinOperator(const TreeIndexFile &a_index, const TreeIndexFile &b_index);
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	int width() const { return 2; }
+private:
+	const TreeIndexFile &mAIndex;
+	const TreeIndexFile &mBIndex;
+
+	BPlusTree::const_iterator mAit;
+	BPlusTree::const_iterator mBit;
+	BPlusTree::const_iterator mGroupEnd;	// end of b keys equal to mAit
+	BPlusTree::const_iterator mGroupCur;
+	bool mInGroup;
+};
+
+/*
+	SortMergeJoinOperator
+
+	a.key rel b.key for EQ, LESS and LARGE, both streams are drained on open
+	and sorted by key, b rows matching an a row are a contiguous range
+	whose bounds only move forward as a goes up, so output is O(n log n + output)
+
+	a NULL stream stands for all rows of its table,
+	read in the order of tree if given instead of sorted
+*/
+class SortMergeJoinOperator
+	: public LightOperator
+{
+public:
+	SortMergeJoinOperator(
+		LightOperator *a, LightTable &a_table, int a_key_id, const TreeIndexFile *a_tree,
+		relation_type_t rel_type,
+		LightOperator *b, LightTable &b_table, int b_key_id, const TreeIndexFile *b_tree);
+	~SortMergeJoinOperator();
+
+	void open();
+	uint32_t next(RowBatch &batch);
+	void close();
+	int width() const { return 2; }
+private:
+	LightOperator *mA;
+	LightOperator *mB;
+	LightTable &mATable;
+	LightTable &mBTable;
+	int mAKeyId;
+	int mBKeyId;
+	const TreeIndexFile *mATree;
+	const TreeIndexFile *mBTree;
+	relation_type_t mRelType;
+
+	IndexEntryVector mARun;
+	IndexEntryVector mBRun;
+	uint32_t mAPos;
+	uint32_t mLo;		// b range of current a row
+	uint32_t mHi;
+	uint32_t mCur;
+
+	static void build_run(LightOperator *op, LightTable &table, int key_id, const TreeIndexFile *tree, IndexEntryVector &run);
+	void bound();
+};
+
+/*
+	ProjectOperator
+
+	root of a tree, put selected attributes of each row into a sink
+*/
+class ProjectOperator
+{
+public:
+	ProjectOperator(LightOperator *child, std::vector<OutputEntry> &entries);
+	~ProjectOperator();
+
+	void exec(ResultSink &sink);
+private:
+	LightOperator *mChild;
+	std::vector<OutputEntry> &mEntries;
+};
+
+/*
+	AggregateOperator
+
+	root of a tree, fold all rows into one 64-bit counter per aggregate
+*/
+class AggregateOperator
+{
+public:
+	AggregateOperator(LightOperator *child, std::vector<OutputEntry> &entries);
+	~AggregateOperator();
+
+	void exec(ResultSink &sink);
+
+	static void accumulate(uint32_t a_addr, uint32_t b_addr, const OutputEntry &entry, int64_t &counter);
+private:
+	LightOperator *mChild;
+	std::vector<OutputEntry> &mEntries;
+};
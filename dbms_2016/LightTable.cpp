@@ -1,7 +1,11 @@
 #include "LightTable.h"
+#include "JoinHashTable.h"
+#include "WorkerPool.h"
 
 #include <algorithm>
 #include <functional>
+#include <iterator>
+#include <cstring>
 
 #define BIT_HAS_HASH 0x1
 #define BIT_HAS_TREE 0x2
@@ -23,7 +27,22 @@ bool operator <(const AddrPair & p1, const AddrPair & p2)
 		return p1.first < p2.first;
 }
 
-LightTable::LightTable()
+/*
+	FlipSink
+
+	swap pair order, used when b is iterated and a is probed
+*/
+class FlipSink
+	: public AddrPairSink
+{
+public:
+	FlipSink(AddrPairSink &sink) : mSink(sink) {}
+	void put(uint32_t b_addr, uint32_t a_addr) { mSink.put(a_addr, b_addr); }
+private:
+	AddrPairSink &mSink;
+};
+
+LightTable::LightTable() : mBulk(false), mBulkBegin(0)
 {
 }
 
@@ -36,10 +55,13 @@ LightTable::~LightTable()
 	static LightTable::join()
 
 	join two tables, and store addr pair vector in return
-	support three type of join operations:
+	support four type of join operations:
 	1. Hash join (at least one hashindex)
 	2. Merge join (require two treeindex)
-	3. Naive join (wrost case, nested loop)
+	3. Build hash join (EQ without index, build a hash table on the fly)
+	4. Sort-merge join (sort inputs on the key, LESS/LARGE without tree on b)
+	5. Naive join (wrost case, nested loop)
+	EQ join is chosen by estimated cost, see cross_join_eq
 */
 std::pair<LightTable *, LightTable *> LightTable::join_cross(
 	LightTable & a, 
@@ -47,7 +69,7 @@ std::pair<LightTable *, LightTable *> LightTable::join_cross(
 	relation_type_t rel_type, 
 	LightTable & b,
 	std::string b_keyname,
-	std::vector<AddrPair> &match_pairs)
+	AddrPairSink &sink)
 {
 	// Join operation selection
 	uint8_t a_stat = 0x0;
@@ -72,41 +94,52 @@ std::pair<LightTable *, LightTable *> LightTable::join_cross(
 	// According to relation type, choose best approach
 	switch (rel_type)
 	{
-	case EQ: case NEQ:
+	case EQ:
+		cross_join_eq(a, a_keyname, a_index_file,
+			b, b_keyname, b_index_file,
+			sink);
+		break;
+	case NEQ:
 		// 1. Hash join (always use a as iter_table, b as index_table)
 		// 2. Tree join
 		// 3. Naive
 		if ((b_stat & BIT_HAS_HASH))
 			cross_hash_join(a, a_keyname, a_index_file, 
 				rel_type, 
-				b, b_keyname, b_index_file, match_pairs);
+				b, b_keyname, b_index_file, sink);
 		else if ((a_stat & BIT_HAS_TREE) && (b_stat & BIT_HAS_TREE))
 			cross_two_tree_join(a, a_keyname, a_index_file,
 				rel_type,
-				b, b_keyname, b_index_file, match_pairs);
+				b, b_keyname, b_index_file, sink);
 		else
 			cross_naive_join(a, a_keyname,
 				rel_type,
 				b, b_keyname,
-				match_pairs);
+				sink);
 		break;
 	case LESS: case LARGE:
 		// 1. Two Tree
 		// 2. b has tree
-		// 3. Naive
+		// 3. Sort-merge, reuse order of a's tree if any
+		// 4. Naive (integer with varchar)
 		if ((a_stat & BIT_HAS_TREE) && (b_stat & BIT_HAS_TREE))
 			cross_two_tree_join(a, a_keyname, a_index_file,
 				rel_type,
-				b, b_keyname, b_index_file, match_pairs);
+				b, b_keyname, b_index_file, sink);
 		else if ((b_stat & BIT_HAS_TREE))
 			cross_one_tree_join(a, a_keyname, a_index_file,
 				rel_type,
-				b, b_keyname, b_index_file, match_pairs);
+				b, b_keyname, b_index_file, sink);
+		else if (a.get_attr_type(a.get_attr_id(a_keyname)) == b.get_attr_type(b.get_attr_id(b_keyname)))
+			cross_sort_merge_join(a, a_keyname,
+				rel_type,
+				b, b_keyname,
+				sink);
 		else
 			cross_naive_join(a, a_keyname,
 				rel_type,
 				b, b_keyname,
-				match_pairs);
+				sink);
 		break;
 	default:
 		throw exception_t(UNKNOWN_RELATION, "Unknown relation type.");
@@ -114,61 +147,131 @@ std::pair<LightTable *, LightTable *> LightTable::join_cross(
 	return std::pair<LightTable *, LightTable *>(&a, &b);
 }
 
-std::pair<LightTable *, LightTable *> LightTable::join_self(
-	LightTable & table, 
-	std::string key1, 
+std::pair<LightTable *, LightTable *> LightTable::join_cross(
+	LightTable & a,
+	std::string a_keyname,
 	relation_type_t rel_type,
-	std::string key2, 
+	LightTable & b,
+	std::string b_keyname,
+	std::vector<AddrPair> &match_pairs)
+{
+	AddrPairCollector collector(match_pairs);
+	return join_cross(a, a_keyname, rel_type, b, b_keyname, collector);
+}
+
+/*
+	LightTable::join_rows()
+
+	join after predicates of each side are applied, so only the surviving rows
+	are hashed, sorted or probed: EQ is a hash join built on the smaller side,
+	LESS/LARGE of the same type a sort-merge join (a whole side is read in
+	the order of its tree index if any), others refine b rows by each a key
+*/
+std::pair<LightTable *, LightTable *> LightTable::join_rows(
+	LightTable & a,
+	std::string a_keyname,
+	const RowBitmap * a_rows,
+	relation_type_t rel_type,
+	LightTable & b,
+	std::string b_keyname,
+	const RowBitmap * b_rows,
 	std::vector<AddrPair>& match_pairs)
 {
-	int id1 = table.get_attr_id(key1);
-	int id2 = table.get_attr_id(key2);
+	int a_key_id = a.get_attr_id(a_keyname);
+	int b_key_id = b.get_attr_id(b_keyname);
 
-	switch (rel_type)
+	if (a_key_id < 0)
+		throw exception_t(UNKNOWN_ATTR, a_keyname.c_str());
+	if (b_key_id < 0)
+		throw exception_t(UNKNOWN_ATTR, b_keyname.c_str());
+
+	LightOperator *root = NULL;
+	if (rel_type == EQ)
 	{
-	case EQ:
+		uint32_t a_num = (a_rows != NULL) ? a_rows->size() : a.size();
+		uint32_t b_num = (b_rows != NULL) ? b_rows->size() : b.size();
+		root = new HashJoinOperator(
+			(a_rows != NULL) ? (LightOperator *)new BitmapScanOperator(*a_rows) : new ScanOperator(a), a, a_key_id,
+			(b_rows != NULL) ? (LightOperator *)new BitmapScanOperator(*b_rows) : new ScanOperator(b), b, b_key_id,
+			a_num < b_num);
+	}
+	else if ((rel_type == LESS || rel_type == LARGE) && a.get_attr_type(a_key_id) == b.get_attr_type(b_key_id))
 	{
-		for (auto it = table.begin(); it != table.end(); it++)
-		{
-			uint32_t addr = it - table.begin();
-			if (it->at(id1) == it->at(id2))
-				match_pairs.emplace_back(addr, addr);
-		}
-		break;
+		root = new SortMergeJoinOperator(
+			(a_rows != NULL) ? new BitmapScanOperator(*a_rows) : NULL, a, a_key_id, (a_rows != NULL) ? NULL : a.get_tree_index(a_key_id),
+			rel_type,
+			(b_rows != NULL) ? new BitmapScanOperator(*b_rows) : NULL, b, b_key_id, (b_rows != NULL) ? NULL : b.get_tree_index(b_key_id));
 	}
-	case NEQ:
+
+	if (root != NULL)
 	{
-		for (auto it = table.begin(); it != table.end(); it++)
+		RowBatch batch;
+		root->open();
+		while (root->next(batch) > 0)
 		{
-			uint32_t addr = it - table.begin();
-			if (it->at(id1) != it->at(id2))
-				match_pairs.emplace_back(addr, addr);
+			for (uint32_t i = 0; i < batch.size(); i++)
+				match_pairs.emplace_back(batch.addrs[0][i], batch.addrs[1][i]);
 		}
-		break;
+		root->close();
+		delete root;
+		return std::pair<LightTable *, LightTable *>(&a, &b);
 	}
-	case LESS:
+
+	relation_type_t b_rel_type;
+	switch (rel_type)
 	{
-		for (auto it = table.begin(); it != table.end(); it++)
-		{
-			uint32_t addr = it - table.begin();
-			if (it->at(id1) < it->at(id2))
-				match_pairs.emplace_back(addr, addr);
-		}
-		break;
+	case NEQ: b_rel_type = NEQ; break;
+	case LESS: b_rel_type = LARGE; break;
+	case LARGE: b_rel_type = LESS; break;
+	default:
+		throw exception_t(JOIN_UNKNOWN_RELATION_TYPE, "Unknown relation type");
 	}
-	case LARGE:
+
+	std::vector<uint32_t> b_all;
+	if (b_rows != NULL)
+		b_rows->to_addrs(b_all);
+	else
 	{
-		for (auto it = table.begin(); it != table.end(); it++)
-		{
-			uint32_t addr = it - table.begin();
-			if (it->at(id1) > it->at(id2))
-				match_pairs.emplace_back(addr, addr);
-		}
-		break;
+		b_all.resize(b.size());
+		for (uint32_t i = 0; i < b_all.size(); i++)
+			b_all[i] = i;
 	}
-	default:
-		throw exception_t(UNKNOWN_RELATION, "Unknown relation type.");
+
+	std::vector<uint32_t> b_addrs;
+	auto probe = [&](uint32_t a_addr)
+	{
+		b_addrs = b_all;
+		b.refine(b_key_id, a.get_attr(a_addr, a_key_id), b_rel_type, b_addrs);
+		for (uint32_t b_addr : b_addrs)
+			match_pairs.emplace_back(a_addr, b_addr);
+	};
+
+	if (a_rows != NULL)
+		a_rows->for_each(probe);
+	else
+	{
+		for (uint32_t a_addr = 0; a_addr < a.size(); a_addr++)
+			probe(a_addr);
 	}
+	return std::pair<LightTable *, LightTable *>(&a, &b);
+}
+
+std::pair<LightTable *, LightTable *> LightTable::join_self(
+	LightTable & table, 
+	std::string key1, 
+	relation_type_t rel_type,
+	std::string key2, 
+	std::vector<AddrPair>& match_pairs)
+{
+	int id1 = table.get_attr_id(key1);
+	int id2 = table.get_attr_id(key2);
+
+	std::vector<uint32_t> match_addrs;
+	table.scan(id1, rel_type, id2, match_addrs);
+
+	for (uint32_t addr : match_addrs)
+		match_pairs.emplace_back(addr, addr);
+
 	return std::pair<LightTable *, LightTable *>(&table, &table);
 }
 
@@ -179,98 +282,53 @@ std::pair<LightTable *, LightTable *> LightTable::join_self(
 	attr_t & kAttr, 
 	std::vector<AddrPair>& match_pairs)
 {
-	uint8_t stat = 0x0;
-	IndexFile *index = table.get_index_file(key.c_str());
-	if (index != NULL)
-	{
-		IndexType type = index->type();
-		stat = (type == HASH || type == PHASH) ? BIT_HAS_HASH :
-			(type == TREE || type == PTREE) ? BIT_HAS_TREE : 0;
-	}
-	
 	int attr_id = table.get_attr_id(key);
 
-	switch (rel_type)
-	{
-	case EQ:
-		if ((stat & BIT_HAS_HASH) || (stat & BIT_HAS_TREE))
-		{
-			index->get(kAttr, match_pairs);
-		}
-		else
-		{
-			auto begin = table.begin();
-			for (auto it = table.begin(); it != table.end(); it++)
-			{
-				if (it->at(attr_id) == kAttr)
-				{
-					uint32_t addr = it - begin;
-					match_pairs.emplace_back(addr, addr);
-				}
-			}
-		}
-		break;
-	case NEQ:
-		if ((stat & BIT_HAS_HASH) || (stat & BIT_HAS_TREE))
-		{
-			index->get_not(kAttr, match_pairs);
-		}
-		else
-		{
-			auto begin = table.begin();
-			for (auto it = table.begin(); it != table.end(); it++)
-			{
-				if (it->at(attr_id) != kAttr)
-				{
-					uint32_t addr = it - begin;
-					match_pairs.emplace_back(addr, addr);
-				}
-			}
-		}
-		break;
-	case LESS:
-		if ((stat & BIT_HAS_TREE))
-		{
-			((TreeIndexFile*)index)->get_less(kAttr, match_pairs);
-		}
-		else
-		{
-			auto begin = table.begin();
-			for (auto it = table.begin(); it != table.end(); it++)
-			{
-				if (it->at(attr_id) < kAttr)
-				{
-					uint32_t addr = it - begin;
-					match_pairs.emplace_back(addr, addr);
-				}
-			}
-		}
-		break;
-	case LARGE:
-		if ((stat & BIT_HAS_TREE))
-		{
-			((TreeIndexFile*)index)->get_large(kAttr, match_pairs);
-		}
-		else
-		{
-			auto begin = table.begin();
-			for (auto it = table.begin(); it != table.end(); it++)
-			{
-				if (it->at(attr_id) > kAttr)
-				{
-					uint32_t addr = it - begin;
-					match_pairs.emplace_back(addr, addr);
-				}
-			}
-		}
-		break;
-	default:
-		throw exception_t(UNKNOWN_RELATION, "Unknown relation type.");
-	}
+	// Index or scan, whichever is cheaper
+	std::vector<uint32_t> match_addrs;
+	table.filter(attr_id, kAttr, rel_type, match_addrs);
+
+	for (uint32_t addr : match_addrs)
+		match_pairs.emplace_back(addr, addr);
+
+	return std::pair<LightTable *, LightTable *>(&table, &table);
+}
+
+std::pair<LightTable *, LightTable *> LightTable::join_self(
+	LightTable & table,
+	std::string key1,
+	relation_type_t rel_type,
+	std::string key2,
+	RowBitmap & match_rows)
+{
+	int id1 = table.get_attr_id(key1);
+	int id2 = table.get_attr_id(key2);
+
+	std::vector<uint32_t> match_addrs;
+	table.scan(id1, rel_type, id2, match_addrs);
+	match_rows.add(match_addrs);
+
+	return std::pair<LightTable *, LightTable *>(&table, &table);
+}
+
+std::pair<LightTable *, LightTable *> LightTable::join_self(
+	LightTable & table,
+	std::string key,
+	relation_type_t rel_type,
+	attr_t & kAttr,
+	RowBitmap & match_rows)
+{
+	int attr_id = table.get_attr_id(key);
+
+	// Index or scan, whichever is cheaper
+	std::vector<uint32_t> match_addrs;
+	table.filter(attr_id, kAttr, rel_type, match_addrs);
+	match_rows.add(match_addrs);
+
 	return std::pair<LightTable *, LightTable *>(&table, &table);
 }
 
-void LightTable::create(const char * tablename, AttrDesc * descs, int num)
+void LightTable::create(const char * tablename, AttrDesc * descs, int num, TableLayout layout)
 {
 	mTablename = tablename;
 
@@ -278,7 +336,7 @@ void LightTable::create(const char * tablename, AttrDesc * descs, int num)
 	std::string dat_path = mTablename + ".dat";
 
 	mTablefile.open(tbl_path.c_str(), "wb+");
-	mTablefile.create(tablename, descs, num);
+	mTablefile.create(tablename, descs, num, layout);
 
 	init_seq_types(descs, num);
 
@@ -288,8 +346,16 @@ void LightTable::create(const char * tablename, AttrDesc * descs, int num)
 		sizes[i] = mTablefile.mAttrDescPool[i].size;
 	}
 
-	mDatafile.open(dat_path.c_str(), "wb+");
-	mDatafile.init(mSeqTypes.data(), sizes, num);
+	if (layout == COLUMN_LAYOUT)
+	{
+		mColumnfile.open(dat_path.c_str(), "wb+");
+		mColumnfile.init(mSeqTypes.data(), sizes, num);
+	}
+	else
+	{
+		mDatafile.open(dat_path.c_str(), "wb+");
+		mDatafile.init(mSeqTypes.data(), sizes, num);
+	}
 }
 
 void LightTable::load(const char * tablename)
@@ -300,8 +366,6 @@ void LightTable::load(const char * tablename)
 	std::string dat_path = mTablename + ".dat";
 	
 	mTablefile.open(tbl_path.c_str(), "rb+");
-	mDatafile.open(dat_path.c_str(), "rb+");
-
 	mTablefile.read_from();
 	init_seq_types(mTablefile.mAttrDescPool.data(), mTablefile.mAttrDescPool.size());
 
@@ -311,33 +375,68 @@ void LightTable::load(const char * tablename)
 		sizes[i] = mTablefile.mAttrDescPool[i].size;
 	}
 
-	mDatafile.init(mSeqTypes.data(), sizes, mSeqTypes.size());
-	mDatafile.read_from();
+	if (layout() == COLUMN_LAYOUT)
+	{
+		mColumnfile.open(dat_path.c_str(), "rb+");
+		mColumnfile.init(mSeqTypes.data(), sizes, mSeqTypes.size());
+		mColumnfile.read_from();
+	}
+	else
+	{
+		mDatafile.open(dat_path.c_str(), "rb+");
+		mDatafile.init(mSeqTypes.data(), sizes, mSeqTypes.size());
+		mDatafile.read_from();
+	}
 }
 
 void LightTable::save()
 {
 	mTablefile.write_back();
-	mDatafile.write_back();
+	if (layout() == COLUMN_LAYOUT)
+		mColumnfile.write_back();
+	else
+		mDatafile.write_back();
 }
 
 void LightTable::create_index(const char *attr_name, IndexType type)
 {
+	if (strchr(attr_name, COMPOSITE_NAME_SEP) != NULL)
+	{
+		create_composite_index(mTablefile.get_composite_attr_ids(attr_name), type);
+		return;
+	}
+
 	const AttrDesc &desc = mTablefile.get_attr_desc(attr_name);
 	std::string idx_path = mTablename + "_" + std::string(attr_name) + ".idx";
 	
 	IndexFile & idx_file = mTablefile.create_index(desc, type, idx_path.c_str());
-	if (mDatafile.size() > 0)
+	if (size() > 0)
 	{
 		int attr_id = get_attr_id(desc.name);
-		for(int i = 0; i < mDatafile.size(); i++)
+		for(uint32_t i = 0; i < size(); i++)
 		{
-			AttrTuple & tuple = mDatafile.get(i);
-			idx_file.set(tuple[attr_id], i);
+			idx_file.set(get_attr(i, attr_id), i);
 		}
+		analyze(attr_id);
 	}
 }
 
+void LightTable::create_index(const std::vector<std::string>& attr_names, IndexType type)
+{
+	std::vector<int> attr_ids;
+	for (const std::string & attr_name : attr_names)
+		attr_ids.push_back(get_attr_id(mTablefile.get_attr_desc(attr_name.c_str()).name));
+	create_composite_index(attr_ids, type);
+}
+
+void LightTable::drop_index(const char * attr_name)
+{
+	if (strchr(attr_name, COMPOSITE_NAME_SEP) != NULL)
+		mTablefile.drop_composite_index(attr_name);
+	else
+		mTablefile.drop_index(mTablefile.get_attr_desc(attr_name));
+}
+
 void LightTable::insert(AttrTuple & tuple)
 {
 	const auto &header = mTablefile.get_header();
@@ -356,109 +455,572 @@ void LightTable::insert(AttrTuple & tuple)
 	}
 
 	update_index(tuple, addr);
+	update_stat(tuple);
 }
 
 /*
-	LightTable::find()
-	
-	if specified attribute has index, use index to find all matched addrs
-	if not, use exhaustive search to find all matched addrs
+	LightTable::bulk_begin()
+
+	start bulk ingest, primary key index is still maintained per row for
+	duplicate check, table without primary key checks duplicates by tuple hash
 */
-uint32_t LightTable::filter(
-	const char * attr_name, 
-	attr_t &attr, 
-	relation_type_t rel_type, 
-	std::vector<uint32_t> & match_addrs)
+void LightTable::bulk_begin()
 {
-	uint32_t match_num = 0;
+	if (mBulk)
+		return;
 
-	// Check if attr has index
-	IndexFile *index_file = mTablefile.get_index_file(attr_name);
-	if (index_file != NULL)
+	mBulk = true;
+	mBulkBegin = size();
+
+	if (mTablefile.get_header().primaryKeyIndex < 0)
 	{
-		filter_with_index(attr_name, attr, rel_type, index_file, match_addrs);
+		mBulkRows.reserve(size());
+		for (uint32_t addr = 0; addr < size(); addr++)
+			mBulkRows.emplace(hash_tuple(get_tuple(addr)), addr);
 	}
-	else
-	{
-		filter_naive(attr_name, attr, rel_type, match_addrs);
-	}	
-	return match_num;
-}
-
-AttrTuple & LightTable::get_tuple(uint32_t index)
-{
-	return mDatafile.get(index);
 }
 
-int LightTable::get_attr_id(std::string attr_name)
-{
-	int key_id = mTablefile.get_attr_id(attr_name.c_str());
-
-	if (key_id < 0)
-		throw exception_t(UNKNOWN_ATTR, attr_name.c_str());
-	return key_id;
-}
+/*
+	LightTable::bulk_append()
 
-const AttrDescPool & LightTable::get_attr_descs()
+	append tuples, duplicated tuples are skipped
+	return number of appended tuples
+*/
+uint32_t LightTable::bulk_append(std::vector<AttrTuple>& tuples)
 {
-	return mTablefile.get_attr_descs();
-}
+	assert(mBulk);
 
-bool LightTable::has_attr(std::string attr_name)
-{
-	return mTablefile.get_attr_id(attr_name.c_str()) >= 0;
-}
+	int pk_index = mTablefile.get_header().primaryKeyIndex;
+	PrimaryIndexFile *pk_file = NULL;
+	if (pk_index >= 0)
+		pk_file = static_cast<PrimaryIndexFile*>(get_index_file(mTablefile.get_pk_attr_name()));
 
-uint32_t LightTable::size()
-{
-	return mDatafile.size();
+	uint32_t appended = 0;
+	for (AttrTuple & tuple : tuples)
+	{
+		if (pk_file != NULL)
+		{
+			if (pk_file->isExist(tuple[pk_index]))
+				continue;
+			pk_file->set(tuple[pk_index], append(tuple));
+		}
+		else
+		{
+			size_t hash = hash_tuple(tuple);
+			auto range = mBulkRows.equal_range(hash);
+			auto it = range.first;
+			for (; it != range.second && !equal_tuple(it->second, tuple); it++);
+			if (it != range.second)
+				continue;
+			mBulkRows.emplace(hash, append(tuple));
+		}
+		update_stat(tuple);
+		appended++;
+	}
+	return appended;
 }
 
-uint32_t LightTable::tuple_size()
-{
-	return mTablefile.get_header().attrNum;
-}
+/*
+	LightTable::bulk_end()
 
-uint8_t LightTable::get_attr_type(int i)
+	build secondary indexes from rows appended since bulk_begin(),
+	each index is fed once with sorted entries
+*/
+void LightTable::bulk_end()
 {
-	if (i < 0 || i >= mTablefile.mTableHeader.attrNum)
-		throw exception_t(0, "Array out of bound.");
-	return mTablefile.mAttrDescPool[i].type;
-}
+	if (!mBulk)
+		return;
 
-void LightTable::dump()
-{
-	mTablefile.dump_info();
-}
+	// Range predicates compare codes only on sorted dictionaries
+	if (layout() == COLUMN_LAYOUT)
+		mColumnfile.seal();
 
-void LightTable::dump(LightTable & a, LightTable & b, std::vector<AddrPair>& match_pairs)
-{
-	for (auto pair : match_pairs)
+	const AttrDescPool & descs = mTablefile.get_attr_descs();
+	int pk_index = mTablefile.get_header().primaryKeyIndex;
+	for (int i = 0; i < descs.size(); i++)
 	{
-		uint32_t addr_a = pair.first;
-		uint32_t addr_b = pair.second;
-
-		auto ta = a.get_tuple(addr_a);
-		auto tb = b.get_tuple(addr_b);
+		IndexFile *index_file = mTablefile.get_index_file(descs[i].name);
+		if (index_file == NULL || i == pk_index)
+			continue;
+
+		IndexEntryVector entries;
+		entries.reserve(size() - mBulkBegin);
+		for (uint32_t addr = mBulkBegin; addr < size(); addr++)
+			entries.emplace_back(get_attr(addr, i), addr);
+		index_file->bulk_set(entries);
+	}
+	for (auto & entry : mTablefile.mCompositeMap)
+	{
+		const CompositeIndex & composite = entry.second;
+		std::vector<attr_t> values(composite.attr_ids.size());
 
-		for (auto e : ta)
-			std::cout << e << '\t';
-		for ( auto e : tb)
-			std::cout << e << '\t';
-		std::cout << "\n";
+		IndexEntryVector entries;
+		entries.reserve(size() - mBulkBegin);
+		for (uint32_t addr = mBulkBegin; addr < size(); addr++)
+		{
+			for (int j = 0; j < values.size(); j++)
+				values[j] = get_attr(addr, composite.attr_ids[j]);
+			entries.emplace_back(LightTableFile::composite_key(values), addr);
+		}
+		composite.index_file->bulk_set(entries);
 	}
+
+	mBulk = false;
+	std::unordered_multimap<size_t, uint32_t>().swap(mBulkRows);
 }
 
-AttrTupleIterator LightTable::begin()
+/*
+	LightTable::find()
+	
+	if specified attribute has index, use index to find all matched addrs
+	if not, use exhaustive search to find all matched addrs
+*/
+uint32_t LightTable::filter(
+	const char * attr_name, 
+	attr_t &attr, 
+	relation_type_t rel_type, 
+	std::vector<uint32_t> & match_addrs)
+{
+	int attr_id = mTablefile.get_attr_id(attr_name);
+	if (attr_id < 0)
+		throw exception_t(UNKNOWN_ATTR, attr_name);
+
+	return filter(attr_id, attr, rel_type, match_addrs);
+}
+
+/*
+	LightTable::filter_conjunction()
+
+	evaluate AND of predicates on this table,
+	the predicate with least estimated cost is evaluated by index or scan,
+	or EQ predicates by one probe of a composite index if it costs less,
+	the others refine its result in ascending selectivity
+*/
+uint32_t LightTable::filter_conjunction(std::vector<Predicate>& predicates, std::vector<uint32_t>& match_addrs)
+{
+	assert(!predicates.empty());
+
+	fuse_ranges(predicates);
+	for (Predicate & pred : predicates)
+		pred.selectivity = estimate_selectivity(pred);
+
+	std::stable_sort(predicates.begin(), predicates.end(),
+		[](const Predicate & p1, const Predicate & p2) { return p1.selectivity < p2.selectivity; });
+
+	// Driving predicate: access cost + residual cost on its output
+	double residual_row = (layout() == COLUMN_LAYOUT) ? COST_SCAN_COLUMN : COST_SCAN_ROW;
+	int first = 0;
+	double first_cost = COST_INFINITE;
+	for (int i = 0; i < predicates.size(); i++)
+	{
+		const Predicate & pred = predicates[i];
+		double cost = filter_cost(pred.attr_id, pred.rel_type, pred.selectivity)
+			+ pred.selectivity * size() * residual_row * (predicates.size() - 1);
+		if (cost < first_cost)
+		{
+			first = i;
+			first_cost = cost;
+		}
+	}
+
+	std::vector<int> covered;
+	attr_t key;
+	double selectivity, composite_cost;
+	const CompositeIndex *composite = match_composite(predicates, covered, key, selectivity, composite_cost);
+	if (composite != NULL)
+	{
+		// Predicates a lossy key covers are checked again
+		int residual = predicates.size() - (composite->lossy ? 0 : covered.size());
+		composite_cost += selectivity * size() * residual_row * residual;
+	}
+
+	std::vector<bool> done(predicates.size(), false);
+	if (composite != NULL && composite_cost < first_cost)
+	{
+		filter_composite(*composite, key, covered.size(), match_addrs);
+		for (int i : covered)
+			done[i] = !composite->lossy;
+	}
+	else
+	{
+		std::rotate(predicates.begin(), predicates.begin() + first, predicates.begin() + first + 1);
+
+		const Predicate & driver = predicates[0];
+		if (driver.rel_type == RANGE)
+			filter_range(driver.attr_id, driver.k, driver.k_hi, match_addrs);
+		else
+			filter(driver.attr_id, driver.k, driver.rel_type, match_addrs);
+		done[0] = true;
+	}
+
+	// Keep addr order, postings are intersected in it
+	std::sort(match_addrs.begin(), match_addrs.end());
+
+	for (int i = 0; i < predicates.size() && !match_addrs.empty(); i++)
+	{
+		if (done[i])
+			continue;
+
+		const Predicate & pred = predicates[i];
+
+		// Index ANDing if reading and sorting the posting is cheaper than checking every candidate
+		double posting_cost = index_cost(pred) + pred.selectivity * size() * COST_SORT_STEP;
+		if (posting_cost >= match_addrs.size() * residual_row)
+		{
+			refine(pred, match_addrs);
+			continue;
+		}
+
+		std::vector<uint32_t> posting, both;
+		index_posting(pred, posting);
+		std::set_intersection(match_addrs.begin(), match_addrs.end(), posting.begin(), posting.end(),
+			std::back_inserter(both));
+		match_addrs.swap(both);
+	}
+
+	return match_addrs.size();
+}
+
+/*
+	LightTable::filter_tree()
+
+	AND: predicates are a conjunction, nested terms refine its rows,
+	without predicates the first nested term drives
+	OR: predicates with an index cheaper than a scan are united as
+	bitmaps of their postings, nested terms too, the others are residual
+	filters on rows not matched yet, a scan if nothing matched before
+*/
+void LightTable::filter_tree(PredicateTree & tree, RowBitmap & match_rows)
+{
+	std::vector<uint32_t> addrs;
+	if (tree.merge_type == AND)
+	{
+		assert(!tree.predicates.empty() || !tree.children.empty());
+
+		int first = 0;
+		if (!tree.predicates.empty())
+			filter_conjunction(tree.predicates, addrs);
+		else
+		{
+			RowBitmap rows;
+			filter_tree(tree.children[first++], rows);
+			rows.to_addrs(addrs);
+		}
+
+		for (int i = first; i < tree.children.size() && !addrs.empty(); i++)
+			refine_tree(tree.children[i], addrs);
+		match_rows = RowBitmap(addrs);
+		return;
+	}
+
+	if (tree.merge_type != OR)
+		throw exception_t(UNSUPPORT_MERGE_TYPE, "Unsupport merge type.");
+
+	// Index ORing
+	RowBitmap rows;
+	PredicateTree residual;
+	residual.merge_type = OR;
+	for (Predicate & pred : tree.predicates)
+	{
+		pred.selectivity = estimate_selectivity(pred);
+		if (index_cost(pred) >= CostModel::scan(size(), get_attr_type(pred.attr_id), layout() == COLUMN_LAYOUT))
+		{
+			residual.predicates.push_back(pred);
+			continue;
+		}
+
+		RowBitmap pred_rows, both;
+		index_rows(pred, pred_rows);
+		RowBitmap::merge(rows, OR, pred_rows, both);
+		rows = std::move(both);
+	}
+	for (PredicateTree & child : tree.children)
+	{
+		RowBitmap child_rows, both;
+		filter_tree(child, child_rows);
+		RowBitmap::merge(rows, OR, child_rows, both);
+		rows = std::move(both);
+	}
+
+	if (!residual.predicates.empty() && rows.empty())
+	{
+		// Nothing to skip, first one is a scan
+		const Predicate & pred = residual.predicates[0];
+		if (pred.rel_type == RANGE)
+			scan_range(pred.attr_id, pred.k, pred.k_hi, addrs);
+		else
+			scan(pred.attr_id, pred.k, pred.rel_type, addrs);
+		rows = RowBitmap(addrs);
+		residual.predicates.erase(residual.predicates.begin());
+	}
+	if (!residual.predicates.empty())
+	{
+		RowBitmap rest, both;
+		RowBitmap::complement(rows, size(), rest);
+		addrs.clear();
+		rest.to_addrs(addrs);
+		refine_tree(residual, addrs);
+		RowBitmap::merge(rows, OR, RowBitmap(addrs), both);
+		rows = std::move(both);
+	}
+	match_rows = std::move(rows);
+}
+
+/*
+	LightTable::count_with_index()
+
+	predicates must fuse into one on an attr with tree index,
+	count and key_sum (sum of attr_id) come from its subtree counts,
+	or all be EQ / NEQ on attrs with bitmap index, count is the
+	cardinality of the AND of their bitmaps, key_sum is only known
+	for one predicate, attr_id is -1 otherwise
+	return false if rows have to be read
+*/
+bool LightTable::count_with_index(std::vector<Predicate>& predicates, int & attr_id, uint32_t & count, int64_t & key_sum)
+{
+	fuse_ranges(predicates);
+
+	bool bitmaps = !predicates.empty();
+	for (const Predicate & pred : predicates)
+		bitmaps = bitmaps && get_bitmap_index(pred.attr_id) != NULL && (pred.rel_type == EQ || pred.rel_type == NEQ);
+	if (bitmaps && predicates.size() == 1)
+	{
+		attr_id = predicates[0].attr_id;
+		count = get_bitmap_index(attr_id)->count(predicates[0].k, predicates[0].rel_type, key_sum);
+		return true;
+	}
+	if (bitmaps)
+	{
+		RowBitmap rows;
+		for (int i = 0; i < predicates.size(); i++)
+		{
+			const Predicate & pred = predicates[i];
+			RowBitmap pred_rows, both;
+			get_bitmap_index(pred.attr_id)->get(pred.k, pred.rel_type, pred_rows);
+			if (i == 0)
+				rows = std::move(pred_rows);
+			else
+			{
+				RowBitmap::merge(rows, AND, pred_rows, both);
+				rows = std::move(both);
+			}
+		}
+		attr_id = -1;
+		count = rows.size();
+		key_sum = 0;
+		return true;
+	}
+
+	if (predicates.size() != 1)
+		return false;
+
+	const Predicate & pred = predicates[0];
+	TreeIndexFile *tree = get_tree_index(pred.attr_id);
+	attr_domain_t domain = (get_attr_type(pred.attr_id) == ATTR_TYPE_INTEGER) ? INTEGER_DOMAIN : VARCHAR_DOMAIN;
+	if (tree == NULL || pred.k.Domain() != domain)
+		return false;
+
+	attr_id = pred.attr_id;
+	if (pred.rel_type == RANGE)
+		count = tree->count_range(pred.k, pred.k_hi, key_sum);
+	else
+		count = tree->count(pred.k, pred.rel_type, key_sum);
+	return true;
+}
+
+/*
+	LightTable::analyze()
+
+	rebuild statistics of attributes: row number, distinct number,
+	for INTEGER also min, max and an equi-depth histogram
+	VARCHAR distinct number is counted on hash values
+*/
+void LightTable::analyze()
+{
+	for (int i = 0; i < tuple_size(); i++)
+		analyze(i);
+}
+
+void LightTable::analyze(int attr_id)
+{
+	ColumnStat & stat = mTablefile.get_column_stat(attr_id);
+	memset(&stat, 0, sizeof(ColumnStat));
+
+	uint32_t rows = size();
+	if (rows == 0)
+		return;
+
+	bool is_int = get_attr_type(attr_id) == ATTR_TYPE_INTEGER;
+
+	std::vector<int32_t> values(rows);
+	for (uint32_t i = 0; i < rows; i++)
+		values[i] = is_int ? get_int(i, attr_id) : (int32_t)JoinHashTable::hash(get_varchar(i, attr_id));
+	std::sort(values.begin(), values.end());
+
+	stat.rowNum = rows;
+	stat.distinctNum = 1;
+	for (uint32_t i = 1; i < rows; i++)
+		stat.distinctNum += (values[i] != values[i - 1]);
+
+	if (is_int)
+	{
+		stat.minValue = values.front();
+		stat.maxValue = values.back();
+		for (int b = 0; b <= STAT_HISTOGRAM_BUCKETS; b++)
+			stat.bounds[b] = values[(uint64_t)b * (rows - 1) / STAT_HISTOGRAM_BUCKETS];
+	}
+}
+
+/*
+	LightTable::get_column_stat()
+
+	analyze lazily, when never analyzed or table grows too much
+*/
+const ColumnStat & LightTable::get_column_stat(int attr_id)
+{
+	const ColumnStat & stat = mTablefile.get_column_stat(attr_id);
+	if (stat.rowNum == 0 || size() > stat.rowNum + stat.rowNum / STAT_STALE_RATIO)
+		analyze(attr_id);
+	return stat;
+}
+
+double LightTable::estimate_selectivity(int attr_id, relation_type_t rel_type, const attr_t & attr)
+{
+	return CostModel::selectivity(get_column_stat(attr_id), get_attr_type(attr_id), rel_type, attr);
+}
+
+double LightTable::estimate_selectivity(const Predicate & pred)
+{
+	if (pred.rel_type == RANGE)
+		return CostModel::range_selectivity(get_column_stat(pred.attr_id), get_attr_type(pred.attr_id), pred.k, pred.k_hi);
+	return estimate_selectivity(pred.attr_id, pred.rel_type, pred.k);
+}
+
+AttrTuple LightTable::get_tuple(uint32_t index)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.get(index);
+	return mDatafile.get(index);
+}
+
+attr_t LightTable::get_attr(uint32_t index, int attr_id)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.get_attr(index, attr_id);
+	return mDatafile.get(index).at(attr_id);
+}
+
+int LightTable::get_int(uint32_t index, int attr_id)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.get_int(index, attr_id);
+	return mDatafile.get(index).at(attr_id).Int();
+}
+
+const char * LightTable::get_varchar(uint32_t index, int attr_id)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.get_varchar(index, attr_id);
+	return mDatafile.get(index).at(attr_id).Varchar();
+}
+
+bool LightTable::has_codes(int attr_id)
+{
+	return layout() == COLUMN_LAYOUT && get_attr_type(attr_id) == ATTR_TYPE_VARCHAR;
+}
+
+int32_t LightTable::get_code(uint32_t index, int attr_id)
+{
+	assert(has_codes(attr_id));
+	return mColumnfile.code_column(attr_id)[index];
+}
+
+void LightTable::translate_codes(int attr_id, LightTable & other, int other_id, std::vector<int32_t>& codes)
+{
+	assert(has_codes(attr_id) && other.has_codes(other_id));
+	mColumnfile.translate(attr_id, other.mColumnfile, other_id, codes);
+}
+
+int LightTable::get_attr_id(std::string attr_name)
+{
+	int key_id = mTablefile.get_attr_id(attr_name.c_str());
+
+	if (key_id < 0)
+		throw exception_t(UNKNOWN_ATTR, attr_name.c_str());
+	return key_id;
+}
+
+const AttrDescPool & LightTable::get_attr_descs()
+{
+	return mTablefile.get_attr_descs();
+}
+
+bool LightTable::has_attr(std::string attr_name)
+{
+	return mTablefile.get_attr_id(attr_name.c_str()) >= 0;
+}
+
+uint32_t LightTable::size()
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.size();
+	return mDatafile.size();
+}
+
+uint32_t LightTable::tuple_size()
+{
+	return mTablefile.get_header().attrNum;
+}
+
+uint8_t LightTable::get_attr_type(int i)
+{
+	if (i < 0 || i >= mTablefile.mTableHeader.attrNum)
+		throw exception_t(0, "Array out of bound.");
+	return mTablefile.mAttrDescPool[i].type;
+}
+
+void LightTable::dump()
+{
+	mTablefile.dump_info();
+}
+
+void LightTable::dump(LightTable & a, LightTable & b, std::vector<AddrPair>& match_pairs)
+{
+	for (auto pair : match_pairs)
+	{
+		uint32_t addr_a = pair.first;
+		uint32_t addr_b = pair.second;
+
+		auto ta = a.get_tuple(addr_a);
+		auto tb = b.get_tuple(addr_b);
+
+		for (auto e : ta)
+			std::cout << e << '\t';
+		for ( auto e : tb)
+			std::cout << e << '\t';
+		std::cout << "\n";
+	}
+}
+
+AttrTupleIterator LightTable::begin()
 {
+	assert(layout() == ROW_LAYOUT);
 	return mDatafile.begin();
 }
 
 AttrTupleIterator LightTable::end()
 {
+	assert(layout() == ROW_LAYOUT);
 	return mDatafile.end();
 }
 
+inline uint32_t LightTable::append(AttrTuple & tuple)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.put(tuple);
+	return mDatafile.put(tuple);
+}
+
 inline uint32_t LightTable::insert_with_pk(AttrTuple & tuple)
 {
 	// lookup index
@@ -471,7 +1033,7 @@ inline uint32_t LightTable::insert_with_pk(AttrTuple & tuple)
 	if (idx_file->isExist(tuple[pk_index]))
 		throw exception_t(INSERT_DUPLICATE_TUPLE, "Duplicated tuple");
 
-	uint32_t addr = mDatafile.put(tuple);
+	uint32_t addr = append(tuple);
 
 	idx_file->set(tuple[pk_index], addr);
 
@@ -481,11 +1043,48 @@ inline uint32_t LightTable::insert_with_pk(AttrTuple & tuple)
 inline uint32_t LightTable::insert_no_pk(AttrTuple & tuple)
 {
 	// brute search
-	auto res = std::find(mDatafile.begin(), mDatafile.end(), tuple);
-	if (res != mDatafile.end())
-		throw exception_t(INSERT_DUPLICATE_TUPLE, "Duplicated tuple");
+	if (layout() == COLUMN_LAYOUT)
+	{
+		for (uint32_t i = 0; i < mColumnfile.size(); i++)
+			if (mColumnfile.equal(i, tuple))
+				throw exception_t(INSERT_DUPLICATE_TUPLE, "Duplicated tuple");
+	}
+	else
+	{
+		auto res = std::find(mDatafile.begin(), mDatafile.end(), tuple);
+		if (res != mDatafile.end())
+			throw exception_t(INSERT_DUPLICATE_TUPLE, "Duplicated tuple");
+	}
 
-	return mDatafile.put(tuple);
+	return append(tuple);
+}
+
+inline size_t LightTable::hash_tuple(const AttrTuple & tuple)
+{
+	size_t hash = 0;
+	for (const attr_t & attr : tuple)
+		hash = hash * 31 + attr_t_hash()(attr);
+	return hash;
+}
+
+inline bool LightTable::equal_tuple(uint32_t addr, const AttrTuple & tuple)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.equal(addr, tuple);
+	return mDatafile.get(addr) == tuple;
+}
+
+inline void LightTable::update_stat(AttrTuple & tuple)
+{
+	// Distinct number and histogram are refreshed by analyze
+	for (int i = 0; i < mSeqTypes.size(); i++)
+	{
+		ColumnStat & stat = mTablefile.mColumnStatPool[i];
+		if (stat.rowNum == 0 || mSeqTypes[i] != SEQ_INT)
+			continue;
+		stat.minValue = std::min(stat.minValue, tuple[i].Int());
+		stat.maxValue = std::max(stat.maxValue, tuple[i].Int());
+	}
 }
 
 inline void LightTable::update_index(AttrTuple & tuple, uint32_t addr)
@@ -501,11 +1100,267 @@ inline void LightTable::update_index(AttrTuple & tuple, uint32_t addr)
 			index_file->set(attr, addr);
 		}
 	}
+
+	for (auto & entry : mTablefile.mCompositeMap)
+	{
+		const CompositeIndex & composite = entry.second;
+		std::vector<attr_t> values;
+		for (int attr_id : composite.attr_ids)
+			values.push_back(tuple[attr_id]);
+		composite.index_file->set(LightTableFile::composite_key(values), addr);
+	}
+}
+
+/*
+	LightTable::create_composite_index()
+
+	rows already in the table are fed once with sorted entries like bulk_end()
+*/
+void LightTable::create_composite_index(const std::vector<int>& attr_ids, IndexType type)
+{
+	std::string idx_path = mTablename + "_" + mTablefile.get_composite_name(attr_ids) + ".idx";
+
+	IndexFile & idx_file = mTablefile.create_index(attr_ids, type, idx_path.c_str());
+	if (size() > 0)
+	{
+		std::vector<attr_t> values(attr_ids.size());
+		IndexEntryVector entries;
+		entries.reserve(size());
+		for (uint32_t addr = 0; addr < size(); addr++)
+		{
+			for (int j = 0; j < values.size(); j++)
+				values[j] = get_attr(addr, attr_ids[j]);
+			entries.emplace_back(LightTableFile::composite_key(values), addr);
+		}
+		idx_file.bulk_set(entries);
+		for (int attr_id : attr_ids)
+			analyze(attr_id);
+	}
+}
+
+/*
+	LightTable::filter()
+
+	use index or scan, whichever has less estimated cost
+*/
+uint32_t LightTable::filter(int attr_id, const attr_t & attr, relation_type_t rel_type, std::vector<uint32_t>& match_addrs)
+{
+	const char *attr_name = mTablefile.mAttrDescPool[attr_id].name;
+	IndexFile *index_file = get_index_file(attr_name);
+	if (index_file == NULL)
+		return scan(attr_id, attr, rel_type, match_addrs);
+
+	double selectivity = estimate_selectivity(attr_id, rel_type, attr);
+	double index_cost = CostModel::index_lookup(index_file->type(), rel_type, size(), selectivity);
+	double scan_cost = CostModel::scan(size(), get_attr_type(attr_id), layout() == COLUMN_LAYOUT);
+
+	if (index_cost < scan_cost)
+		return filter_with_index(attr_name, attr, rel_type, index_file, match_addrs);
+	return scan(attr_id, attr, rel_type, match_addrs);
+}
+
+/*
+	LightTable::filter_range()
+
+	a tree index is walked from lo until hi once, instead of two
+	half-open walks intersected, otherwise one scan checks both bounds
+*/
+uint32_t LightTable::filter_range(int attr_id, const attr_t & lo, const attr_t & hi, std::vector<uint32_t>& match_addrs)
+{
+	TreeIndexFile *tree = get_tree_index(attr_id);
+	if (tree != NULL)
+	{
+		double selectivity = CostModel::range_selectivity(get_column_stat(attr_id), get_attr_type(attr_id), lo, hi);
+		double index_cost = CostModel::index_lookup(TREE, RANGE, size(), selectivity);
+		double scan_cost = CostModel::scan(size(), get_attr_type(attr_id), layout() == COLUMN_LAYOUT);
+		if (index_cost < scan_cost)
+			return tree->get_range(lo, hi, match_addrs);
+	}
+	return scan_range(attr_id, lo, hi, match_addrs);
+}
+
+/*
+	LightTable::fuse_ranges()
+
+	LARGE and LESS on the same attr become one RANGE predicate,
+	the tightest bound is kept if an attr has several,
+	bounds of the other domain are left alone
+*/
+void LightTable::fuse_ranges(std::vector<Predicate>& predicates)
+{
+	std::vector<Predicate> fused;
+	for (const Predicate & pred : predicates)
+	{
+		attr_domain_t domain = (get_attr_type(pred.attr_id) == ATTR_TYPE_INTEGER) ? INTEGER_DOMAIN : VARCHAR_DOMAIN;
+		bool bound = (pred.rel_type == LESS || pred.rel_type == LARGE) && pred.k.Domain() == domain;
+
+		auto it = fused.end();
+		if (bound)
+			it = std::find_if(fused.begin(), fused.end(), [&pred](const Predicate & f)
+			{
+				return f.attr_id == pred.attr_id && f.k.Domain() == pred.k.Domain()
+					&& (f.rel_type == LESS || f.rel_type == LARGE || f.rel_type == RANGE);
+			});
+		if (it == fused.end())
+		{
+			fused.push_back(pred);
+			continue;
+		}
+
+		// Bounds of both, LESS k is an upper bound, LARGE k a lower one
+		Predicate & f = *it;
+		bool has_lo = f.rel_type != LESS, has_hi = f.rel_type != LARGE;
+		attr_t lo = f.k, hi = (f.rel_type == RANGE) ? f.k_hi : f.k;
+		if (pred.rel_type == LARGE)
+		{
+			lo = (has_lo && !(lo < pred.k)) ? lo : pred.k;
+			has_lo = true;
+		}
+		else
+		{
+			hi = (has_hi && !(pred.k < hi)) ? hi : pred.k;
+			has_hi = true;
+		}
+
+		if (has_lo && has_hi)
+		{
+			f.rel_type = RANGE;
+			f.k = lo;
+			f.k_hi = hi;
+		}
+		else
+			f.k = has_lo ? lo : hi;
+	}
+	predicates.swap(fused);
+}
+
+double LightTable::filter_cost(int attr_id, relation_type_t rel_type, double selectivity)
+{
+	double cost = CostModel::scan(size(), get_attr_type(attr_id), layout() == COLUMN_LAYOUT);
+
+	IndexFile *index_file = get_index_file(mTablefile.mAttrDescPool[attr_id].name);
+	if (index_file != NULL)
+		cost = std::min(cost, CostModel::index_lookup(index_file->type(), rel_type, size(), selectivity));
+	return cost;
+}
+
+// Lookup cost of pred on its index, COST_INFINITE without a usable one
+double LightTable::index_cost(const Predicate & pred)
+{
+	if (pred.rel_type == RANGE)
+	{
+		if (get_tree_index(pred.attr_id) == NULL)
+			return COST_INFINITE;
+		return CostModel::index_lookup(TREE, RANGE, size(), pred.selectivity);
+	}
+
+	IndexFile *index_file = get_index_file(mTablefile.mAttrDescPool[pred.attr_id].name);
+	if (index_file == NULL)
+		return COST_INFINITE;
+	return CostModel::index_lookup(index_file->type(), pred.rel_type, size(), pred.selectivity);
+}
+
+uint32_t LightTable::index_posting(const Predicate & pred, std::vector<uint32_t>& addrs)
+{
+	if (pred.rel_type == RANGE)
+		get_tree_index(pred.attr_id)->get_range(pred.k, pred.k_hi, addrs);
+	else
+	{
+		const char *attr_name = mTablefile.mAttrDescPool[pred.attr_id].name;
+		filter_with_index(attr_name, pred.k, pred.rel_type, get_index_file(attr_name), addrs);
+	}
+
+	// Hash buckets and tree leaves are in key order
+	std::sort(addrs.begin(), addrs.end());
+	return addrs.size();
+}
+
+// Bitmap index rows are taken as they are, other postings are turned into a bitmap
+void LightTable::index_rows(const Predicate & pred, RowBitmap & rows)
+{
+	BitmapIndexFile *bitmap = get_bitmap_index(pred.attr_id);
+	if (bitmap != NULL && (pred.rel_type == EQ || pred.rel_type == NEQ))
+	{
+		bitmap->get(pred.k, pred.rel_type, rows);
+		return;
+	}
+
+	std::vector<uint32_t> addrs;
+	index_posting(pred, addrs);
+	rows = RowBitmap(addrs);
+}
+
+/*
+	LightTable::match_composite()
+
+	a composite index whose leading attrs all have an EQ predicate, all of
+	them for a HASH index, one or more for a TREE index, the one of least
+	lookup cost is chosen, selectivity is the product of the covered ones
+	return NULL if none matches
+*/
+const CompositeIndex * LightTable::match_composite(
+	const std::vector<Predicate>& predicates,
+	std::vector<int>& covered,
+	attr_t & key,
+	double & selectivity,
+	double & cost)
+{
+	const CompositeIndex *best = NULL;
+	cost = COST_INFINITE;
+	for (auto & entry : mTablefile.mCompositeMap)
+	{
+		const CompositeIndex & composite = entry.second;
+		std::vector<int> positions;
+		double composite_selectivity = 1.0;
+		for (int attr_id : composite.attr_ids)
+		{
+			attr_domain_t domain = (get_attr_type(attr_id) == ATTR_TYPE_INTEGER) ? INTEGER_DOMAIN : VARCHAR_DOMAIN;
+			auto it = std::find_if(predicates.begin(), predicates.end(), [attr_id, domain](const Predicate & pred)
+			{
+				return pred.attr_id == attr_id && pred.rel_type == EQ && pred.k.Domain() == domain;
+			});
+			if (it == predicates.end())
+				break;
+			positions.push_back(it - predicates.begin());
+			composite_selectivity *= it->selectivity;
+		}
+
+		IndexType type = composite.index_file->type();
+		if (positions.empty() || (type == HASH && positions.size() < composite.attr_ids.size()))
+			continue;
+
+		double lookup_cost = CostModel::index_lookup(type, EQ, size(), composite_selectivity);
+		if (lookup_cost < cost)
+		{
+			best = &composite;
+			covered.swap(positions);
+			selectivity = composite_selectivity;
+			cost = lookup_cost;
+		}
+	}
+
+	if (best != NULL)
+	{
+		std::vector<attr_t> values;
+		for (int i : covered)
+			values.push_back(predicates[i].k);
+		key = LightTableFile::composite_key(values);
+	}
+	return best;
+}
+
+uint32_t LightTable::filter_composite(const CompositeIndex & composite, const attr_t & key, int key_num, std::vector<uint32_t>& match_addrs)
+{
+	if (key_num == composite.attr_ids.size())
+		composite.index_file->get(key, match_addrs);
+	else
+		static_cast<TreeIndexFile *>(composite.index_file)->get_prefix(key, match_addrs);
+	return match_addrs.size();
 }
 
 uint32_t LightTable::filter_with_index(
 	const char * attr_name, 
-	attr_t & attr, 
+	const attr_t & attr, 
 	relation_type_t rel_type, 
 	IndexFile *index_file, 
 	std::vector<uint32_t>& match_addrs)
@@ -536,31 +1391,127 @@ uint32_t LightTable::filter_with_index(
 	return match_addrs.size();
 }
 
-uint32_t LightTable::filter_naive(const char * attr_name, attr_t & attr, relation_type_t rel_type, std::vector<uint32_t>& match_addrs)
+uint32_t LightTable::filter_naive(const char * attr_name, const attr_t & attr, relation_type_t rel_type, std::vector<uint32_t>& match_addrs)
 {
 	int attr_id = mTablefile.get_attr_id(attr_name);
 	if (attr_id < 0)
 		throw exception_t(UNKNOWN_ATTR, attr_name);
 
-	for (AttrTupleIterator it = begin(); it != end(); it++)
+	return scan(attr_id, attr, rel_type, match_addrs);
+}
+
+/*
+	LightTable::scan()
+
+	exhaustive search on one attribute,
+	column layout compare on the contiguous column directly,
+	morsels are scanned by WorkerPool and gathered in addr order
+*/
+uint32_t LightTable::scan(int attr_id, const attr_t & attr, relation_type_t rel_type, std::vector<uint32_t>& match_addrs)
+{
+	std::vector<std::vector<uint32_t>> bufs(WorkerPool::morsel_num(size()));
+	WorkerPool::instance().run(size(), [&](const Morsel & m)
+	{
+		scan(attr_id, attr, rel_type, m.begin, m.end, bufs[m.id]);
+	});
+	WorkerPool::gather(bufs, match_addrs);
+	return match_addrs.size();
+}
+
+uint32_t LightTable::scan_range(int attr_id, const attr_t & lo, const attr_t & hi, std::vector<uint32_t>& match_addrs)
+{
+	std::vector<std::vector<uint32_t>> bufs(WorkerPool::morsel_num(size()));
+	WorkerPool::instance().run(size(), [&](const Morsel & m)
+	{
+		scan_range(attr_id, lo, hi, m.begin, m.end, bufs[m.id]);
+	});
+	WorkerPool::gather(bufs, match_addrs);
+	return match_addrs.size();
+}
+
+uint32_t LightTable::scan(int id1, relation_type_t rel_type, int id2, std::vector<uint32_t>& match_addrs)
+{
+	std::vector<std::vector<uint32_t>> bufs(WorkerPool::morsel_num(size()));
+	WorkerPool::instance().run(size(), [&](const Morsel & m)
+	{
+		scan(id1, rel_type, id2, m.begin, m.end, bufs[m.id]);
+	});
+	WorkerPool::gather(bufs, match_addrs);
+	return match_addrs.size();
+}
+
+uint32_t LightTable::scan(int attr_id, const attr_t & attr, relation_type_t rel_type, uint32_t begin, uint32_t end, std::vector<uint32_t>& match_addrs)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.scan(attr_id, rel_type, attr, begin, end, match_addrs);
+
+	for (uint32_t addr = begin; addr < end; addr++)
+	{
+		const attr_t & value = mDatafile.get(addr).at(attr_id);
+		switch (rel_type)
+		{
+		case EQ:
+			if (value == attr)
+				match_addrs.push_back(addr);
+			break;
+		case NEQ:
+			if (value != attr)
+				match_addrs.push_back(addr);
+			break;
+		case LESS:
+			if (value < attr)
+				match_addrs.push_back(addr);
+			break;
+		case LARGE:
+			if (value > attr)
+				match_addrs.push_back(addr);
+			break;
+		default:
+			throw exception_t(UNKNOWN_RELATION, "Unknown relation type.");
+		}
+	}
+	return match_addrs.size();
+}
+
+uint32_t LightTable::scan_range(int attr_id, const attr_t & lo, const attr_t & hi, uint32_t begin, uint32_t end, std::vector<uint32_t>& match_addrs)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.scan_range(attr_id, lo, hi, begin, end, match_addrs);
+
+	for (uint32_t addr = begin; addr < end; addr++)
+	{
+		const attr_t & value = mDatafile.get(addr).at(attr_id);
+		if (value > lo && value < hi)
+			match_addrs.push_back(addr);
+	}
+	return match_addrs.size();
+}
+
+uint32_t LightTable::scan(int id1, relation_type_t rel_type, int id2, uint32_t begin, uint32_t end, std::vector<uint32_t>& match_addrs)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.scan(id1, rel_type, id2, begin, end, match_addrs);
+
+	for (uint32_t addr = begin; addr < end; addr++)
 	{
+		const AttrTuple & tuple = mDatafile.get(addr);
 		switch (rel_type)
 		{
 		case EQ:
-			if (it->at(attr_id) == attr)
-				match_addrs.push_back(it - begin());
+			if (tuple.at(id1) == tuple.at(id2))
+				match_addrs.push_back(addr);
 			break;
 		case NEQ:
-			if (it->at(attr_id) != attr)
-				match_addrs.push_back(it - begin());
+			if (tuple.at(id1) != tuple.at(id2))
+				match_addrs.push_back(addr);
 			break;
 		case LESS:
-			if (it->at(attr_id) < attr)
-				match_addrs.push_back(it - begin());
+			if (tuple.at(id1) < tuple.at(id2))
+				match_addrs.push_back(addr);
 			break;
 		case LARGE:
-			if (it->at(attr_id) > attr)
-				match_addrs.push_back(it - begin());
+			if (tuple.at(id1) > tuple.at(id2))
+				match_addrs.push_back(addr);
 			break;
 		default:
 			throw exception_t(UNKNOWN_RELATION, "Unknown relation type.");
@@ -569,6 +1520,98 @@ uint32_t LightTable::filter_naive(const char * attr_name, attr_t & attr, relatio
 	return match_addrs.size();
 }
 
+/*
+	LightTable::refine()
+
+	residual filter, keep addrs satisfy (attr rel k)
+*/
+uint32_t LightTable::refine(int attr_id, const attr_t & attr, relation_type_t rel_type, std::vector<uint32_t>& addrs)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.refine(attr_id, rel_type, attr, addrs);
+
+	uint32_t out = 0;
+	for (uint32_t i = 0; i < addrs.size(); i++)
+	{
+		const attr_t & value = mDatafile.get(addrs[i]).at(attr_id);
+		bool match;
+		switch (rel_type)
+		{
+		case EQ: match = value == attr; break;
+		case NEQ: match = value != attr; break;
+		case LESS: match = value < attr; break;
+		case LARGE: match = value > attr; break;
+		default:
+			throw exception_t(UNKNOWN_RELATION, "Unknown relation type.");
+		}
+		if (match)
+			addrs[out++] = addrs[i];
+	}
+	addrs.resize(out);
+	return out;
+}
+
+uint32_t LightTable::refine_range(int attr_id, const attr_t & lo, const attr_t & hi, std::vector<uint32_t>& addrs)
+{
+	if (layout() == COLUMN_LAYOUT)
+		return mColumnfile.refine_range(attr_id, lo, hi, addrs);
+
+	uint32_t out = 0;
+	for (uint32_t i = 0; i < addrs.size(); i++)
+	{
+		const attr_t & value = mDatafile.get(addrs[i]).at(attr_id);
+		if (value > lo && value < hi)
+			addrs[out++] = addrs[i];
+	}
+	addrs.resize(out);
+	return out;
+}
+
+uint32_t LightTable::refine(const Predicate & pred, std::vector<uint32_t>& addrs)
+{
+	if (pred.rel_type == RANGE)
+		return refine_range(pred.attr_id, pred.k, pred.k_hi, addrs);
+	return refine(pred.attr_id, pred.k, pred.rel_type, addrs);
+}
+
+/*
+	LightTable::refine_tree()
+
+	residual filter of a tree on ascending addrs,
+	a term of OR only checks addrs no earlier term matched
+*/
+void LightTable::refine_tree(PredicateTree & tree, std::vector<uint32_t>& addrs)
+{
+	int terms = tree.predicates.size() + tree.children.size();
+	if (tree.merge_type == AND)
+	{
+		for (int i = 0; i < terms && !addrs.empty(); i++)
+		{
+			if (i < tree.predicates.size())
+				refine(tree.predicates[i], addrs);
+			else
+				refine_tree(tree.children[i - tree.predicates.size()], addrs);
+		}
+		return;
+	}
+
+	std::vector<uint32_t> rest;
+	rest.swap(addrs);
+	for (int i = 0; i < terms && !rest.empty(); i++)
+	{
+		std::vector<uint32_t> matched(rest), left;
+		if (i < tree.predicates.size())
+			refine(tree.predicates[i], matched);
+		else
+			refine_tree(tree.children[i - tree.predicates.size()], matched);
+
+		addrs.insert(addrs.end(), matched.begin(), matched.end());
+		std::set_difference(rest.begin(), rest.end(), matched.begin(), matched.end(), std::back_inserter(left));
+		rest.swap(left);
+	}
+	std::sort(addrs.begin(), addrs.end());
+}
+
 inline IndexFile * LightTable::get_index_file(const char * name)
 {
 	auto res = mTablefile.mIndexFileMap.find(name);
@@ -576,69 +1619,288 @@ inline IndexFile * LightTable::get_index_file(const char * name)
 	{
 		return res->second;
 	}
-	return nullptr;
-}
+	return nullptr;
+}
+
+inline TreeIndexFile * LightTable::get_tree_index(int attr_id)
+{
+	// PTREE is not a TreeIndexFile
+	IndexFile *index_file = get_index_file(mTablefile.mAttrDescPool[attr_id].name);
+	if (index_file != NULL && index_file->type() == TREE)
+		return static_cast<TreeIndexFile *>(index_file);
+	return NULL;
+}
+
+inline BitmapIndexFile * LightTable::get_bitmap_index(int attr_id)
+{
+	IndexFile *index_file = get_index_file(mTablefile.mAttrDescPool[attr_id].name);
+	if (index_file != NULL && index_file->type() == BITMAP)
+		return static_cast<BitmapIndexFile *>(index_file);
+	return NULL;
+}
+
+inline void LightTable::init_seq_types(AttrDesc *descs, int num)
+{
+	mSeqTypes.clear();
+	mSeqTypes.resize(num);
+	for (int i = 0; i < num; i++)
+	{
+		switch (descs[i].type)
+		{
+		case ATTR_TYPE_INTEGER:
+			mSeqTypes[i] = SEQ_INT;
+			break;
+		case ATTR_TYPE_VARCHAR:
+			mSeqTypes[i] = SEQ_VARCHAR;
+			break;
+		default:
+			throw exception_t(ATTR_TYPE_TO_SEQ_TYPE_ERROR, "Attr type to seq type error.");
+		}
+	}
+}
+
+void LightTable::get_selectid_from_names(std::vector<std::string>& names, std::vector<int>& ids)
+{
+	ids.clear();
+	ids.resize(names.size());
+	for (int i = 0; i < names.size(); i++)
+	{
+		int id = mTablefile.get_attr_id(names[i].c_str());
+		if (id < 0)
+			throw exception_t(UNKNOWN_ATTR, names[i].c_str());
+		ids[i] = id;
+	}
+}
+
+/*
+	join_hash
+
+	always use a to iter, b to index
+
+*/
+inline void LightTable::cross_hash_join(
+	LightTable & a, std::string a_keyname, IndexFile * a_index,
+	relation_type_t rel_type, 
+	LightTable & b, std::string b_keyname, IndexFile * b_index,
+	AddrPairSink &sink)
+{
+	assert(rel_type == EQ || rel_type == NEQ);
+
+	int a_key_id = a.get_attr_id(a_keyname.c_str());
+	int b_key_id = b.get_attr_id(b_keyname.c_str());
+
+	switch (rel_type)
+	{
+	case EQ:
+		cross_hash_join_eq(a, a_key_id, b, b_index, sink);
+		break;
+	case NEQ:
+		cross_hash_join_neq(a, a_key_id, b, b_index, sink);
+		break;
+	default:
+		assert(false); // Hash index only support EQ, NEQ
+	}
+}
+
+/*
+	cross_build_hash_join
+
+	EQ join without usable index,
+	build a JoinHashTable on the smaller table then probe with the other one
+*/
+void LightTable::cross_build_hash_join(
+	LightTable & a, std::string a_keyname,
+	LightTable & b, std::string b_keyname,
+	AddrPairSink &sink)
+{
+	int a_key_id = a.get_attr_id(a_keyname);
+	int b_key_id = b.get_attr_id(b_keyname);
+
+	uint8_t a_type = a.get_attr_type(a_key_id);
+	uint8_t b_type = b.get_attr_type(b_key_id);
+
+	// Integer never equals to varchar
+	if (a_type != b_type)
+		return;
+
+	bool build_a = a.size() < b.size();
+	LightTable & build_table = build_a ? a : b;
+	LightTable & probe_table = build_a ? b : a;
+	int build_key_id = build_a ? a_key_id : b_key_id;
+	int probe_key_id = build_a ? b_key_id : a_key_id;
+
+	if (a_type == ATTR_TYPE_INTEGER)
+	{
+		JoinHashTable table(INTEGER_DOMAIN, build_table.size());
+		for (uint32_t i = 0; i < build_table.size(); i++)
+			table.insert(build_table.get_int(i, build_key_id), i);
+
+		for (uint32_t probe_addr = 0; probe_addr < probe_table.size(); probe_addr++)
+		{
+			int32_t key = probe_table.get_int(probe_addr, probe_key_id);
+			for (uint32_t e = table.find(key); e != JOIN_HASH_NIL; e = table.next(e))
+			{
+				if (build_a)
+					sink.put(table.addr(e), probe_addr);
+				else
+					sink.put(probe_addr, table.addr(e));
+			}
+		}
+	}
+	else if (build_table.has_codes(build_key_id) && probe_table.has_codes(probe_key_id))
+	{
+		// Probe codes are translated to build codes once per distinct value
+		std::vector<int32_t> probe_to_build;
+		probe_table.translate_codes(probe_key_id, build_table, build_key_id, probe_to_build);
 
-inline void LightTable::init_seq_types(AttrDesc *descs, int num)
-{
-	mSeqTypes.clear();
-	mSeqTypes.resize(num);
-	for (int i = 0; i < num; i++)
+		JoinHashTable table(INTEGER_DOMAIN, build_table.size());
+		for (uint32_t i = 0; i < build_table.size(); i++)
+			table.insert(build_table.get_code(i, build_key_id), i);
+
+		for (uint32_t probe_addr = 0; probe_addr < probe_table.size(); probe_addr++)
+		{
+			int32_t key = probe_to_build[probe_table.get_code(probe_addr, probe_key_id)];
+			if (key < 0)
+				continue;
+			for (uint32_t e = table.find(key); e != JOIN_HASH_NIL; e = table.next(e))
+			{
+				if (build_a)
+					sink.put(table.addr(e), probe_addr);
+				else
+					sink.put(probe_addr, table.addr(e));
+			}
+		}
+	}
+	else
 	{
-		switch (descs[i].type)
+		JoinHashTable table(VARCHAR_DOMAIN, build_table.size());
+		for (uint32_t i = 0; i < build_table.size(); i++)
+			table.insert(build_table.get_varchar(i, build_key_id), i);
+
+		for (uint32_t probe_addr = 0; probe_addr < probe_table.size(); probe_addr++)
 		{
-		case ATTR_TYPE_INTEGER:
-			mSeqTypes[i] = SEQ_INT;
-			break;
-		case ATTR_TYPE_VARCHAR:
-			mSeqTypes[i] = SEQ_VARCHAR;
-			break;
-		default:
-			throw exception_t(ATTR_TYPE_TO_SEQ_TYPE_ERROR, "Attr type to seq type error.");
+			const char *key = probe_table.get_varchar(probe_addr, probe_key_id);
+			for (uint32_t e = table.find(key); e != JOIN_HASH_NIL; e = table.next(e))
+			{
+				if (build_a)
+					sink.put(table.addr(e), probe_addr);
+				else
+					sink.put(probe_addr, table.addr(e));
+			}
 		}
 	}
 }
 
-void LightTable::get_selectid_from_names(std::vector<std::string>& names, std::vector<int>& ids)
+/*
+	cross_sort_merge_join
+
+	sort both tables on the key, or take the order of a tree index,
+	then each a row matches a contiguous range of b rows
+*/
+void LightTable::cross_sort_merge_join(
+	LightTable & a, std::string a_keyname,
+	relation_type_t rel_type,
+	LightTable & b, std::string b_keyname,
+	AddrPairSink &sink)
 {
-	ids.clear();
-	ids.resize(names.size());
-	for (int i = 0; i < names.size(); i++)
+	int a_key_id = a.get_attr_id(a_keyname);
+	int b_key_id = b.get_attr_id(b_keyname);
+
+	if (a_key_id < 0)
+		throw exception_t(UNKNOWN_ATTR, a_keyname.c_str());
+	if (b_key_id < 0)
+		throw exception_t(UNKNOWN_ATTR, b_keyname.c_str());
+
+	SortMergeJoinOperator join(
+		NULL, a, a_key_id, a.get_tree_index(a_key_id),
+		rel_type,
+		NULL, b, b_key_id, b.get_tree_index(b_key_id));
+
+	RowBatch batch;
+	join.open();
+	while (join.next(batch) > 0)
 	{
-		int id = mTablefile.get_attr_id(names[i].c_str());
-		if (id < 0)
-			throw exception_t(UNKNOWN_ATTR, names[i].c_str());
-		ids[i] = id;
+		for (uint32_t i = 0; i < batch.size(); i++)
+			sink.put(batch.addrs[0][i], batch.addrs[1][i]);
 	}
+	join.close();
 }
 
 /*
-	join_hash
-
-	always use a to iter, b to index
-
+	cross_join_eq
+
+	choose the EQ join with least estimated cost
+	1. probe b's index with a
+	2. probe a's index with b, pairs are flipped back to (a, b)
+	3. merge two tree indexes
+	4. sort-merge, one side is in tree order
+	5. build hash table on the smaller table
 */
-inline void LightTable::cross_hash_join(
+void LightTable::cross_join_eq(
 	LightTable & a, std::string a_keyname, IndexFile * a_index,
-	relation_type_t rel_type, 
 	LightTable & b, std::string b_keyname, IndexFile * b_index,
-	std::vector<AddrPair> &match_pairs)
+	AddrPairSink &sink)
 {
-	assert(rel_type == EQ || rel_type == NEQ);
+	enum { PROBE_B, PROBE_A, MERGE, SORT_MERGE, BUILD } approach = BUILD;
 
-	int a_key_id = a.get_attr_id(a_keyname.c_str());
-	int b_key_id = b.get_attr_id(b_keyname.c_str());
+	int a_key_id = a.get_attr_id(a_keyname);
+	int b_key_id = b.get_attr_id(b_keyname);
+	uint32_t a_rows = a.size();
+	uint32_t b_rows = b.size();
 
-	switch (rel_type)
+	double out_rows = CostModel::join_eq_rows(a.get_column_stat(a_key_id), b.get_column_stat(b_key_id), a_rows, b_rows);
+	double best_cost = CostModel::build_hash_join(std::min(a_rows, b_rows), std::max(a_rows, b_rows), out_rows);
+	double cost;
+
+	if (b_index != NULL && (cost = CostModel::index_join(b_index->type(), a_rows, b_rows, out_rows)) < best_cost)
 	{
-	case EQ:
-		cross_hash_join_eq(a, a_key_id, b, b_index, match_pairs);
+		approach = PROBE_B;
+		best_cost = cost;
+	}
+	if (a_index != NULL && (cost = CostModel::index_join(a_index->type(), b_rows, a_rows, out_rows)) < best_cost)
+	{
+		approach = PROBE_A;
+		best_cost = cost;
+	}
+	if (a_index != NULL && b_index != NULL
+		&& (a_index->type() == TREE || a_index->type() == PTREE)
+		&& (b_index->type() == TREE || b_index->type() == PTREE)
+		&& (cost = CostModel::merge_join(a_rows, b_rows, out_rows)) < best_cost)
+	{
+		approach = MERGE;
+		best_cost = cost;
+	}
+
+	// Two trees are merged in place above
+	bool a_sorted = a.get_tree_index(a_key_id) != NULL;
+	bool b_sorted = b.get_tree_index(b_key_id) != NULL;
+	if (!(a_sorted && b_sorted)
+		&& (cost = CostModel::sort_merge_join(a_rows, a_sorted, b_rows, b_sorted, out_rows)) < best_cost)
+	{
+		approach = SORT_MERGE;
+		best_cost = cost;
+	}
+
+	switch (approach)
+	{
+	case PROBE_B:
+		cross_hash_join_eq(a, a_key_id, b, b_index, sink);
 		break;
-	case NEQ:
-		cross_hash_join_neq(a, a_key_id, b, b_index, match_pairs);
+	case PROBE_A:
+	{
+		FlipSink flip_sink(sink);
+		cross_hash_join_eq(b, b_key_id, a, a_index, flip_sink);
+		break;
+	}
+	case MERGE:
+		cross_two_tree_join(a, a_keyname, a_index, EQ, b, b_keyname, b_index, sink);
+		break;
+	case SORT_MERGE:
+		cross_sort_merge_join(a, a_keyname, EQ, b, b_keyname, sink);
 		break;
 	default:
-		assert(false); // Hash index only support EQ, NEQ
+		cross_build_hash_join(a, a_keyname, b, b_keyname, sink);
+		break;
 	}
 }
 
@@ -647,14 +1909,40 @@ inline void LightTable::cross_hash_join_eq(
 	int iter_key_id,
 	LightTable & fix_table, 
 	IndexFile * fix_index, 
-	std::vector<AddrPair>& match_pairs)
+	AddrPairSink &sink)
 {
-	for (auto it = iter_table.begin(); it != iter_table.end(); it++)
+	// Probe a wave of morsels in parallel, then drain to sink in addr order,
+	// bounds the buffered pairs when sink aggregates
+	WorkerPool & pool = WorkerPool::instance();
+	const uint32_t wave_size = pool.size() * MORSEL_SIZE;
+	const uint32_t num = iter_table.size();
+
+	std::vector<std::vector<AddrPair>> bufs;
+	for (uint32_t wave_begin = 0; wave_begin < num; wave_begin += wave_size)
 	{
-		uint32_t iter_addr = it - iter_table.begin();
-		attr_t & iter_key_attr = it->at(iter_key_id);
-
-		fix_index->get(iter_key_attr, iter_addr, match_pairs);
+		uint32_t wave_num = std::min(wave_size, num - wave_begin);
+		bufs.resize(WorkerPool::morsel_num(wave_num));
+		pool.run(wave_num, [&](const Morsel & m)
+		{
+			// Lookups of a morsel are batched, the index may prefetch or reorder them
+			IndexEntryVector probes;
+			probes.reserve(m.end - m.begin);
+			for (uint32_t iter_addr = wave_begin + m.begin; iter_addr < wave_begin + m.end; iter_addr++)
+				probes.emplace_back(iter_table.get_attr(iter_addr, iter_key_id), iter_addr);
+
+			// Back to iter addr order, fix addrs of a key are ascending like get()
+			std::vector<AddrPair> & buf = bufs[m.id];
+			fix_index->get_batch(probes, buf);
+			if (!std::is_sorted(buf.begin(), buf.end()))
+				std::sort(buf.begin(), buf.end());
+		});
+
+		for (auto & buf : bufs)
+		{
+			for (const AddrPair & pair : buf)
+				sink.put(pair.first, pair.second);
+			buf.clear();
+		}
 	}
 }
 
@@ -663,14 +1951,17 @@ inline void LightTable::cross_hash_join_neq(
 	int iter_key_id, 
 	LightTable & fix_table, 
 	IndexFile * fix_index, 
-	std::vector<AddrPair>& match_pairs)
+	AddrPairSink &sink)
 {
-	for (auto it = iter_table.begin(); it != iter_table.end(); it++)
+	std::vector<uint32_t> fix_addrs;
+	for (uint32_t iter_addr = 0; iter_addr < iter_table.size(); iter_addr++)
 	{
-		uint32_t iter_addr = it - iter_table.begin();
-		attr_t & iter_key_attr = it->at(iter_key_id);
+		attr_t iter_key_attr = iter_table.get_attr(iter_addr, iter_key_id);
 
-		fix_index->get_not(iter_key_attr, iter_addr, match_pairs);
+		fix_addrs.clear();
+		fix_index->get_not(iter_key_attr, fix_addrs);
+		for (uint32_t fix_addr : fix_addrs)
+			sink.put(iter_addr, fix_addr);
 	}
 }
 
@@ -678,7 +1969,7 @@ void LightTable::cross_two_tree_join(
 	LightTable & a, std::string a_keyname, IndexFile * a_index,
 	relation_type_t rel_type, 
 	LightTable & b, std::string b_keyname, IndexFile * b_index,
-	std::vector<AddrPair> &match_pairs)
+	AddrPairSink &sink)
 {
 	assert(a_index != NULL && b_index != NULL);
 
@@ -689,16 +1980,16 @@ void LightTable::cross_two_tree_join(
 	switch (rel_type)
 	{
 	case EQ:
-		TreeIndexFile::merge_eq(ta, tb, match_pairs);
+		TreeIndexFile::merge_eq(ta, tb, sink);
 		break;
 	case NEQ:
-		TreeIndexFile::merge_neq(ta, tb, match_pairs);
+		TreeIndexFile::merge_neq(ta, tb, sink);
 		break;
 	case LESS:
-		TreeIndexFile::merge_less(ta, tb, match_pairs);
+		TreeIndexFile::merge_less(ta, tb, sink);
 		break;
 	case LARGE:
-		TreeIndexFile::merge_large(ta, tb, match_pairs);
+		TreeIndexFile::merge_large(ta, tb, sink);
 		break;
 	default:
 		throw exception_t(UNKNOWN_RELATION, "Unknown relation type");
@@ -710,7 +2001,7 @@ inline void LightTable::cross_one_tree_join(
 	LightTable & a, std::string a_keyname, IndexFile * a_index, 
 	relation_type_t rel_type,
 	LightTable & b, std::string b_keyname, IndexFile * b_index, 
-	std::vector<AddrPair>& match_pairs)
+	AddrPairSink &sink)
 {
 	assert(b_index != NULL && b_index->type() == TREE);
 	
@@ -720,43 +2011,28 @@ inline void LightTable::cross_one_tree_join(
 	int iter_key_id = a.mTablefile.get_attr_id(a_keyname.c_str());
 	//int b_key_id = b.mTablefile.get_attr_id(b_keyname.c_str());
 
+	// a.key rel b.key => b.key rel' a.key
+	relation_type_t b_rel_type;
 	switch (rel_type)
 	{
-	case EQ:
-		for (auto it = iter_table.begin(); it != iter_table.end(); it++)
-		{
-			uint32_t iter_addr = it - iter_table.begin();
-			attr_t & iter_key_attr = it->at(iter_key_id);
-			tindex.get(iter_key_attr, iter_addr, match_pairs);
-		}
-		break;
-	case NEQ:
-		for (auto it = iter_table.begin(); it != iter_table.end(); it++)
-		{
-			uint32_t iter_addr = it - iter_table.begin();
-			attr_t & iter_key_attr = it->at(iter_key_id);
-			tindex.get_not(iter_key_attr, iter_addr, match_pairs);
-		}
-		break;
-	case LESS:
-		for (auto it = iter_table.begin(); it != iter_table.end(); it++)
-		{
-			uint32_t iter_addr = it - iter_table.begin();
-			attr_t & iter_key_attr = it->at(iter_key_id);
-			tindex.get_less(iter_key_attr, iter_addr, match_pairs);
-		}
-		break;
-	case LARGE:
-		for (auto it = iter_table.begin(); it != iter_table.end(); it++)
-		{
-			uint32_t iter_addr = it - iter_table.begin();
-			attr_t & iter_key_attr = it->at(iter_key_id);
-			tindex.get_large(iter_key_attr, iter_addr, match_pairs);
-		}
-		break;
+	case EQ: b_rel_type = EQ; break;
+	case NEQ: b_rel_type = NEQ; break;
+	case LESS: b_rel_type = LARGE; break;
+	case LARGE: b_rel_type = LESS; break;
 	default:
 		throw exception_t(UNKNOWN_RELATION, "Unknown relation type");
 	}
+
+	std::vector<uint32_t> b_addrs;
+	for (uint32_t iter_addr = 0; iter_addr < iter_table.size(); iter_addr++)
+	{
+		attr_t iter_key_attr = iter_table.get_attr(iter_addr, iter_key_id);
+
+		b_addrs.clear();
+		tindex.get(iter_key_attr, b_rel_type, b_addrs);
+		for (uint32_t b_addr : b_addrs)
+			sink.put(iter_addr, b_addr);
+	}
 }
 
 inline void LightTable::map(
@@ -771,12 +2047,11 @@ inline void LightTable::map(
 	}
 	else
 	{
-		auto begin = onto_table->begin();
-		auto end = onto_table->end();
+		uint32_t onto_size = onto_table->size();
 
 		for (uint32_t addr : addrs)
-			for (auto it = begin; it != end; it++)
-				match_pairs.emplace_back(addr, it - begin);
+			for (uint32_t i = 0; i < onto_size; i++)
+				match_pairs.emplace_back(addr, i);
 	}
 
 }
@@ -786,9 +2061,12 @@ inline void LightTable::product(
 	LightTable * b, 
 	std::vector<AddrPair>& match_pairs)
 {
-	for (auto ait = a->begin(); ait != a->end(); ait++)
-		for (auto bit = b->begin(); bit != b->end(); bit++)
-			match_pairs.emplace_back(ait - a->begin(), bit - b->begin());
+	uint32_t a_size = a->size();
+	uint32_t b_size = b->size();
+
+	for (uint32_t ai = 0; ai < a_size; ai++)
+		for (uint32_t bi = 0; bi < b_size; bi++)
+			match_pairs.emplace_back(ai, bi);
 }
 
 std::vector<AddrPair> LightTable::product(
@@ -806,17 +2084,147 @@ std::vector<AddrPair> LightTable::product(
 	return match_pairs;
 }
 
+/*
+	LightTable::access_path()
+
+	the most selective predicate drives an index scan if cheaper than a scan,
+	or EQ predicates a composite index probe if it costs less,
+	the others are filters in ascending selectivity
+*/
+LightOperator * LightTable::access_path(std::vector<Predicate>& predicates)
+{
+	fuse_ranges(predicates);
+	for (Predicate & pred : predicates)
+		pred.selectivity = estimate_selectivity(pred);
+
+	std::stable_sort(predicates.begin(), predicates.end(),
+		[](const Predicate & p1, const Predicate & p2) { return p1.selectivity < p2.selectivity; });
+
+	LightOperator *op = NULL;
+	std::vector<bool> done(predicates.size(), false);
+	if (!predicates.empty())
+	{
+		const Predicate & pred = predicates[0];
+		IndexFile *index_file = (pred.rel_type == RANGE) ?
+			get_tree_index(pred.attr_id) : get_index_file(mTablefile.mAttrDescPool[pred.attr_id].name);
+		double scan_cost = CostModel::scan(size(), get_attr_type(pred.attr_id), layout() == COLUMN_LAYOUT);
+		double index_cost = (index_file != NULL) ?
+			CostModel::index_lookup(index_file->type(), pred.rel_type, size(), pred.selectivity) : COST_INFINITE;
+
+		// A composite probe and the others are weighed with the filters left on their output
+		std::vector<int> covered;
+		attr_t key;
+		double selectivity, composite_cost;
+		double first_cost = std::min(index_cost, scan_cost);
+		const CompositeIndex *composite = match_composite(predicates, covered, key, selectivity, composite_cost);
+		if (composite != NULL)
+		{
+			double residual_row = (layout() == COLUMN_LAYOUT) ? COST_SCAN_COLUMN : COST_SCAN_ROW;
+			int residual = predicates.size() - (composite->lossy ? 0 : covered.size());
+			composite_cost += selectivity * size() * residual_row * residual;
+			first_cost += pred.selectivity * size() * residual_row * (predicates.size() - 1);
+		}
+
+		if (composite != NULL && composite_cost < first_cost)
+		{
+			op = new IndexScanOperator(*this, *composite, key, covered.size());
+			for (int i : covered)
+				done[i] = !composite->lossy;
+		}
+		else if (index_cost < scan_cost)
+		{
+			op = new IndexScanOperator(*this, pred, index_file);
+			done[0] = true;
+		}
+	}
+	if (op == NULL)
+		op = new ScanOperator(*this);
+
+	for (int i = 0; i < predicates.size(); i++)
+		if (!done[i])
+			op = new FilterOperator(op, *this, predicates[i]);
+	return op;
+}
+
+/*
+	LightTable::join_path()
+
+	LESS/LARGE is a sort-merge join, a side without predicate is read
+	in the order of its tree index if any
+	EQ merges two tree indexes if no predicate and it is cheaper,
+	sort-merges if one side is in tree order and it is cheaper,
+	otherwise hash join built on the side with less estimated rows
+*/
+LightOperator * LightTable::join_path(
+	LightTable & a, int a_key_id, std::vector<Predicate>& a_predicates,
+	relation_type_t rel_type,
+	LightTable & b, int b_key_id, std::vector<Predicate>& b_predicates)
+{
+	TreeIndexFile *a_tree = a_predicates.empty() ? a.get_tree_index(a_key_id) : NULL;
+	TreeIndexFile *b_tree = b_predicates.empty() ? b.get_tree_index(b_key_id) : NULL;
+
+	if (rel_type != EQ)
+	{
+		return new SortMergeJoinOperator(
+			a_predicates.empty() ? NULL : a.access_path(a_predicates), a, a_key_id, a_tree,
+			rel_type,
+			b_predicates.empty() ? NULL : b.access_path(b_predicates), b, b_key_id, b_tree);
+	}
+
+	LightOperator *a_op = a.access_path(a_predicates);
+	LightOperator *b_op = b.access_path(b_predicates);
+
+	double a_rows = a.size();
+	double b_rows = b.size();
+	for (const Predicate & pred : a_predicates)
+		a_rows *= pred.selectivity;
+	for (const Predicate & pred : b_predicates)
+		b_rows *= pred.selectivity;
+
+	double out_rows = CostModel::join_eq_rows(a.get_column_stat(a_key_id), b.get_column_stat(b_key_id), a_rows, b_rows);
+	double hash_cost = CostModel::build_hash_join(std::min(a_rows, b_rows), std::max(a_rows, b_rows), out_rows);
+
+	if (a_tree != NULL && b_tree != NULL)
+	{
+		if (CostModel::merge_join(a.size(), b.size(), out_rows) < hash_cost)
+		{
+			delete a_op;
+			delete b_op;
+			return new MergeJoinOperator(*a_tree, *b_tree);
+		}
+	}
+	else if ((a_tree != NULL || b_tree != NULL)
+		&& CostModel::sort_merge_join(a_rows, a_tree != NULL, b_rows, b_tree != NULL, out_rows) < hash_cost)
+	{
+		if (a_tree != NULL)
+		{
+			delete a_op;
+			a_op = NULL;
+		}
+		if (b_tree != NULL)
+		{
+			delete b_op;
+			b_op = NULL;
+		}
+		return new SortMergeJoinOperator(a_op, a, a_key_id, a_tree, EQ, b_op, b, b_key_id, b_tree);
+	}
+
+	return new HashJoinOperator(a_op, a, a_key_id, b_op, b, b_key_id, a_rows < b_rows);
+}
+
 void LightTable::cross_naive_join(
 	LightTable & a, std::string a_keyname, 
 	relation_type_t rel_type, 
 	LightTable & b, std::string b_keyname,
-	std::vector<AddrPair> &match_pairs)
+	AddrPairSink &sink)
 {
 	/*
 		foreach a in table_a:
 			foreach b in table_b:
 				if a.a_key rel b.b_key
-					match_pairs.push(<a.id, b.id>)
+					sink.put(a.id, b.id)
+
+		inner loop is a scan on b with a.a_key as constant (b.b_key rel' a.a_key)
 	*/
 	int a_key_id = a.mTablefile.get_attr_id(a_keyname.c_str());
 	int b_key_id = b.mTablefile.get_attr_id(b_keyname.c_str());
@@ -826,35 +2234,27 @@ void LightTable::cross_naive_join(
 	if (b_key_id < 0)
 		throw exception_t(UNKNOWN_ATTR, b_keyname.c_str());
 
-	for (AttrTupleIterator ait = a.begin(); ait != a.end(); ait++)
+	relation_type_t b_rel_type;
+	switch (rel_type)
 	{
-		for (AttrTupleIterator bit = b.begin(); bit != b.end(); bit++)
-		{	
-			int a_id = ait - a.begin();
-			int b_id = bit - b.begin();
+	case EQ: b_rel_type = EQ; break;
+	case NEQ: b_rel_type = NEQ; break;
+	case LESS: b_rel_type = LARGE; break;
+	case LARGE: b_rel_type = LESS; break;
+	default:
+		throw exception_t(JOIN_UNKNOWN_RELATION_TYPE, "Unknown relation type");
+	}
 
-			switch (rel_type)
-			{
-			case EQ:
-				if (ait->at(a_key_id) == bit->at(b_key_id))
-					match_pairs.push_back({ a_id, b_id});
-				break;
-			case NEQ:
-				if (!(ait->at(a_key_id) == bit->at(b_key_id)))
-					match_pairs.push_back({ a_id, b_id });
-				break;
-			case LESS:
-				if ((ait->at(a_key_id) < bit->at(b_key_id)))
-					match_pairs.push_back({ a_id, b_id });
-				break;
-			case LARGE:
-				if ((ait->at(a_key_id) > bit->at(b_key_id)))
-					match_pairs.push_back({ a_id, b_id });
-				break;
-			default:
-				throw exception_t(JOIN_UNKNOWN_RELATION_TYPE, "Unknown relation type");
-			}
-		}
+	std::vector<uint32_t> b_addrs;
+	for (uint32_t a_id = 0; a_id < a.size(); a_id++)
+	{
+		attr_t a_key_attr = a.get_attr(a_id, a_key_id);
+
+		b_addrs.clear();
+		b.scan(b_key_id, a_key_attr, b_rel_type, b_addrs);
+
+		for (uint32_t b_id : b_addrs)
+			sink.put(a_id, b_id);
 	}
 }
 
@@ -888,229 +2288,123 @@ void LightTable::merge(
 	c.resize(it - c.begin());
 }
 
+/*
+	Merge a reflexive term of table T with pairs where T is at side,
+	AND keeps pairs whose T addr is in rows,
+	OR adds every row of other for each addr in rows to the pairs not covered by them
+*/
+static void merge_reflexive(
+	const RowBitmap & rows,
+	int side,
+	merge_type_t merge_type,
+	const std::vector<AddrPair> & pairs,
+	LightTable * other,
+	std::vector<AddrPair> & c)
+{
+	for (const AddrPair & pair : pairs)
+	{
+		bool in_rows = rows.contains(side == 0 ? pair.first : pair.second);
+		if (in_rows == (merge_type == AND))
+			c.push_back(pair);
+	}
+
+	if (merge_type == OR)
+	{
+		uint32_t other_size = other->size();
+		rows.for_each([&](uint32_t addr)
+		{
+			for (uint32_t i = 0; i < other_size; i++)
+			{
+				if (side == 0)
+					c.emplace_back(addr, i);
+				else
+					c.emplace_back(i, addr);
+			}
+		});
+	}
+}
+
 std::pair<LightTable *, LightTable *> LightTable::merge(
 	std::pair<LightTable *, LightTable *> left_comb,
-	std::vector<AddrPair>& left, 
-	merge_type_t merge_type, 
+	WhereRows & left,
+	merge_type_t merge_type,
 	std::pair<LightTable *, LightTable *> right_comb,
-	std::vector<AddrPair>& right, 
-	std::vector<AddrPair>& c,
-	std::vector<LightTable*>  & from_tables)
+	WhereRows & right,
+	WhereRows & c,
+	std::vector<LightTable*> & from_tables)
 {
 	assert(left_comb.first != NULL && left_comb.second != NULL);
 	assert(right_comb.first != NULL && right_comb.second != NULL);
 
-	// AB AB (no AB, BA for now) => AB
+	if (merge_type != AND && merge_type != OR)
+		throw exception_t(UNSUPPORT_MERGE_TYPE, "Unsupported merge type.");
+
 	bool a_reflex = left_comb.first == left_comb.second;
 	bool b_reflex = right_comb.first == right_comb.second;
 
 	if (!a_reflex && !b_reflex)
 	{
+		// AB AB (no AB, BA for now) => AB
 		if (left_comb.first != right_comb.first)
 			throw exception_t(TABLE_COMB_ERROR, "Table combination error, no AB, BA");
-		merge(left, merge_type, right, c);
-		return std::pair<LightTable *, LightTable *>(left_comb.first, left_comb.second);
+		merge(left.pairs, merge_type, right.pairs, c.pairs);
+		return left_comb;
 	}
-	else if(a_reflex && b_reflex)
+	else if (a_reflex && b_reflex)
 	{
-		// AA, AA => AA
+		// AA AA => AA, product with the other table is left to the caller
 		if (left_comb.first == right_comb.first)
 		{
-			if (from_tables.size() == 1)
-			{
-				merge(left, merge_type, right, c);
-				return std::pair<LightTable *, LightTable *>(left_comb.first, left_comb.first);
-			}
-			else if(from_tables.size() == 2)
-			{
-				std::vector<AddrPair> tmp(left.size());
-				if (left.begin() != left.end())
-					std::sort(left.begin(), left.end());
-				if (right.begin() != right.end())
-					std::sort(right.begin(), right.end());
-
-				std::vector<AddrPair>::iterator it;
-
-				tmp.resize(left.size() + right.size());
-
-				switch (merge_type)
-				{
-				case AND:
-					it = std::set_intersection(left.begin(), left.end(), right.begin(), right.end(), tmp.begin());
-					break;
-				case OR:
-					it = std::set_union(left.begin(), left.end(), right.begin(), right.end(), tmp.begin());
-					break;
-				default:
-					break;
-				}
-				c.resize(it - c.begin());
-
-				LightTable *other = (from_tables[0] == left_comb.first) ? from_tables[1] : from_tables[0];
-				for (auto ait = left.begin(); ait != left.end(); ait++)
-					for (int i = 0; i < other->size(); i++)
-						c.emplace_back(ait->first, i);
-				return std::pair<LightTable *, LightTable *>(left_comb.first, other);
-			}
-		}
-		else
-		{
-			// AA BB => AB
-			for (int ai = 0; ai < left.size(); ai++)
-				for (int bi = 0; bi < right.size(); bi++)
-					c.emplace_back(left[ai].first, right[bi].second);
-			return std::pair<LightTable *, LightTable *>( left_comb.first , right_comb.second );
-		}
-	}
-	else if (a_reflex)
-	{
-		// AA AB => AB
-		if(right_comb.second == left_comb.first)
-			throw exception_t(TABLE_COMB_ERROR, "Table combination error, no AA, BA");
-		if (left.begin() != left.end())
-			std::sort(left.begin(), left.end());
-		if (right.begin() != right.end())
-			std::sort(right.begin(), right.end());
-		switch (merge_type)
-		{
-			case AND:
-			{
-				int ai = 0, bi = 0;
-				while (ai < left.size() && bi < right.size())
-				{
-					if (left[ai].first == right[bi].first)
-					{
-						c.emplace_back(left[ai].first, right[bi].second);
-						bi++;
-					}
-					else if(left[ai].first < right[bi].first)
-					{
-						ai++;
-					}
-					else
-					{
-						bi++;
-					}
-				}
-			}
-			break;
-			case OR:
-			{
-				// A is unique
-				int li = 0, ri = 0;
-				while (li < left.size() && ri < right.size())
-				{
-					if (left[li].first == right[ri].first)
-					{
-						ri++;
-					}
-					else if (left[li].first < right[ri].first)
-					{
-						for (int i = 0; i < right_comb.second->size(); i++)
-							c.emplace_back(left[li].first, i);
-						li++;
-					}
-					else
-					{
-						c.emplace_back(right[ri].first, right[ri].second);
-						ri++;
-					}
-				}
-
-				while (li < left.size())
-				{
-					for (int i = 0; i < right_comb.second->size(); i++)
-						c.emplace_back(left[li].first, i);
-					li++;
-				}
-
-				while (ri < right.size())
-				{
-					c.emplace_back(right[ri].first, right[ri].second);
-					ri++;
-				}
-			}
-			break;
-		default:
-			break;
+			RowBitmap::merge(left.rows, merge_type, right.rows, c.rows);
+			return left_comb;
 		}
-		
 
-		return std::pair<LightTable *, LightTable *>( left_comb.first , right_comb.second );
-	}
-	else
-	{
-		// AB AA => AB
-		if (!(left_comb.first == right_comb.first))
-			throw exception_t(TABLE_COMB_ERROR, "Table combination error, no BA, AA");
-		if (left.begin() != left.end())
-			std::sort(left.begin(), left.end());
-		if (right.begin() != right.end())
-			std::sort(right.begin(), right.end());
-		switch (merge_type)
+		// AA BB => AB
+		LightTable *b_table = right_comb.first;
+		if (merge_type == AND)
 		{
-		case AND:
-		{
-			int li = 0, ri = 0;
-			while (li < left.size() && ri < right.size())
+			left.rows.for_each([&](uint32_t a_addr)
 			{
-				if (left[li].first == right[ri].first)
-				{
-					c.emplace_back(left[li].first, left[li].second);
-					li++;
-				}
-				else if (left[li].first < right[ri].first)
-				{
-					li++;
-				}
-				else
-				{
-					ri++;
-				}
-			}
+				right.rows.for_each([&](uint32_t b_addr) { c.pairs.emplace_back(a_addr, b_addr); });
+			});
 		}
-		break;
-		case OR:
+		else
 		{
-			// Right is unique
-			int li = 0, ri = 0;
-			while (li < left.size() && ri < right.size())
+			for (uint32_t a_addr = 0; a_addr < left_comb.first->size(); a_addr++)
 			{
-				if (left[li].first == right[ri].first)
-				{
-					li++;
-				}
-				else if (left[li].first < right[ri].first)
+				if (left.rows.contains(a_addr))
 				{
-					c.emplace_back(right[ri].first, right[ri].second);
-					li++;
+					for (uint32_t b_addr = 0; b_addr < b_table->size(); b_addr++)
+						c.pairs.emplace_back(a_addr, b_addr);
 				}
 				else
-				{
-					for (int i = 0; i < left_comb.second->size(); i++)
-						c.emplace_back(right[ri].first, i);
-					ri++;
-				}
-			}
-
-			while (ri < right.size())
-			{
-				for (int i = 0; i < left_comb.second->size(); i++)
-					c.emplace_back(right[ri].first, i);
-				ri++;
-			}
-
-			while (li < left.size())
-			{
-				c.emplace_back(left[li].first, left[li].second);
-				li++;
+					right.rows.for_each([&](uint32_t b_addr) { c.pairs.emplace_back(a_addr, b_addr); });
 			}
 		}
-		break;
-		default:
-			break;
-		}
-
-		return std::pair<LightTable *, LightTable *>(left_comb.first , left_comb.second);
+		return std::pair<LightTable *, LightTable *>(left_comb.first, b_table);
+	}
+	else if (a_reflex)
+	{
+		// AA AB, AA BA => AB, BA
+		LightTable *table = left_comb.first;
+		if (right_comb.first != table && right_comb.second != table)
+			throw exception_t(TABLE_COMB_ERROR, "Table combination error, no AA, BC");
+		int side = (right_comb.first == table) ? 0 : 1;
+		LightTable *other = (side == 0) ? right_comb.second : right_comb.first;
+
+		merge_reflexive(left.rows, side, merge_type, right.pairs, other, c.pairs);
+		return right_comb;
+	}
+	else
+	{
+		// AB AA, BA AA => AB, BA
+		LightTable *table = right_comb.first;
+		if (left_comb.first != table && left_comb.second != table)
+			throw exception_t(TABLE_COMB_ERROR, "Table combination error, no BC, AA");
+		int side = (left_comb.first == table) ? 0 : 1;
+		LightTable *other = (side == 0) ? left_comb.second : left_comb.first;
+
+		merge_reflexive(right.rows, side, merge_type, left.pairs, other, c.pairs);
+		return left_comb;
 	}
 }
@@ -5,7 +5,11 @@
 
 #include "LightTableFile.h"
 #include "SequenceFile.h"
+#include "ColumnFile.h"
 #include "IndexFile.h"
+#include "CostModel.h"
+#include "LightOperator.h"
+#include "RowBitmap.h"
 
 #define ATTR_TYPE_TO_SEQ_TYPE_ERROR 0x1
 #define INSERT_DUPLICATE_TUPLE 0x2
@@ -16,15 +20,60 @@
 #define UNSUPPORT_RELATION 0x7
 #define UNSUPPORT_MERGE_TYPE 0x8
 
+// Re-analyze attribute after table grows by 1 / STAT_STALE_RATIO
+#define STAT_STALE_RATIO 10
+
 std::ostream &operator <<(std::ostream &os, const AttrTuple tuple);
 
+/*
+	Predicate
+
+	(attr rel k) on one table, selectivity is filled by planner
+	RANGE is (k < attr < k_hi), fused from LARGE and LESS on the same attr
+*/
+struct Predicate
+{
+	int attr_id;
+	relation_type_t rel_type;
+	attr_t k;
+	double selectivity;
+	attr_t k_hi;
+};
+
+/*
+	PredicateTree
+
+	AND / OR of predicates and nested terms on one table,
+	a nested term has the other merge type
+*/
+struct PredicateTree
+{
+	merge_type_t merge_type;
+	std::vector<Predicate> predicates;
+	std::vector<PredicateTree> children;
+};
+
+/*
+	WhereRows
+
+	rows satisfying a where clause term, a term on one table (reflexive comb)
+	is a bitmap of its addrs, a term on two tables is (a addr, b addr) pairs
+*/
+struct WhereRows
+{
+	RowBitmap rows;
+	std::vector<AddrPair> pairs;
+};
+
 /*
 	LightTable
 
-	designed for working with LightTableFile, SequenceFile
+	designed for working with LightTableFile, SequenceFile (row layout) or ColumnFile (column layout)
 */
 class LightTable
 {
+	friend class IndexScanOperator;
+	friend class FilterOperator;
 public:
 	LightTable();
 	~LightTable();
@@ -38,6 +87,14 @@ public:
 		std::string b_keyname,
 		std::vector<AddrPair> &match_pairs);
 
+	static std::pair<LightTable *, LightTable *> join_cross(
+		LightTable & a,
+		std::string a_keyname,
+		relation_type_t rel_type,
+		LightTable & b,
+		std::string b_keyname,
+		AddrPairSink &sink);
+
 	// Self join (Generate a reflexive pair)
 	static std::pair<LightTable *, LightTable *> join_self(
 		LightTable & table, 
@@ -53,13 +110,40 @@ public:
 		attr_t & kAttr,
 		std::vector<AddrPair> &match_pairs);
 
+	// Cross join of rows left by single table predicates, NULL rows is the whole table
+	static std::pair<LightTable *, LightTable *> join_rows(
+		LightTable & a,
+		std::string a_keyname,
+		const RowBitmap * a_rows,
+		relation_type_t rel_type,
+		LightTable & b,
+		std::string b_keyname,
+		const RowBitmap * b_rows,
+		std::vector<AddrPair> &match_pairs);
+
+	// Self join into a bitmap of addrs instead of reflexive pairs
+	static std::pair<LightTable *, LightTable *> join_self(
+		LightTable & table,
+		std::string key1,
+		relation_type_t rel_type,
+		std::string key2,
+		RowBitmap &match_rows);
+
+	static std::pair<LightTable *, LightTable *> join_self(
+		LightTable & table,
+		std::string key,
+		relation_type_t rel_type,
+		attr_t & kAttr,
+		RowBitmap &match_rows);
+
+	// AND/OR of two where terms, bitmaps of the same table are merged word by word
 	static std::pair<LightTable *, LightTable *> merge(
 		std::pair<LightTable *, LightTable *> a_comb,
-		std::vector<AddrPair>& a,
+		WhereRows & a,
 		merge_type_t merge_type,
 		std::pair<LightTable *, LightTable *> b_comb,
-		std::vector<AddrPair>& b,
-		std::vector<AddrPair>& c,
+		WhereRows & b,
+		WhereRows & c,
 		std::vector<LightTable*> & from_tables);
 
 	static inline void map(
@@ -77,21 +161,71 @@ public:
 		std::vector<AddrPair> & reflexive_pairs, 
 		LightTable * b);
 
-	void create(const char *tablename, AttrDesc *descs, int num);
+	// Operator producing rows of table satisfying all predicates
+	LightOperator *access_path(std::vector<Predicate> & predicates);
+
+	// Operator producing (a, b) of a.a_key rel b.b_key, rows of each side satisfy its predicates
+	static LightOperator *join_path(
+		LightTable & a,
+		int a_key_id,
+		std::vector<Predicate> & a_predicates,
+		relation_type_t rel_type,
+		LightTable & b,
+		int b_key_id,
+		std::vector<Predicate> & b_predicates);
+
+	void create(const char *tablename, AttrDesc *descs, int num, TableLayout layout = ROW_LAYOUT);
 	void create_index(const char *attr_name, IndexType type);
+	// Composite index over attrs in order, attr_name "a,b" above is the same
+	void create_index(const std::vector<std::string> &attr_names, IndexType type);
+	void drop_index(const char *attr_name);
 
 	void load(const char *tablename);
 	void save();
 
 	void insert(AttrTuple &tuple);
 
+	// Bulk ingest, indexes except primary key are built once in bulk_end()
+	void bulk_begin();
+	uint32_t bulk_append(std::vector<AttrTuple> &tuples);
+	void bulk_end();
+
 	uint32_t filter(
 		const char *attr_name, 
 		attr_t & attr, 
 		relation_type_t find_type, 
 		std::vector<uint32_t> & match_addrs);
+
+	uint32_t filter_conjunction(
+		std::vector<Predicate> & predicates,
+		std::vector<uint32_t> & match_addrs);
+
+	// Index postings of tree predicates are intersected or united, the others are residual filters
+	void filter_tree(PredicateTree & tree, RowBitmap & match_rows);
+
+	// Rows satisfying predicates counted on a tree index, without reading them
+	bool count_with_index(
+		std::vector<Predicate> & predicates,
+		int & attr_id,
+		uint32_t & count,
+		int64_t & key_sum);
+
+	void analyze();
+	void analyze(int attr_id);
+	const ColumnStat &get_column_stat(int attr_id);
+	double estimate_selectivity(int attr_id, relation_type_t rel_type, const attr_t & attr);
+	double estimate_selectivity(const Predicate & pred);
 	
-	AttrTuple &get_tuple(uint32_t index);
+	AttrTuple get_tuple(uint32_t index);
+	attr_t get_attr(uint32_t index, int attr_id);
+	int get_int(uint32_t index, int attr_id);
+	const char *get_varchar(uint32_t index, int attr_id);
+
+	// VARCHAR of column layout is dictionary encoded, EQ join compares codes
+	bool has_codes(int attr_id);
+	int32_t get_code(uint32_t index, int attr_id);
+	void translate_codes(int attr_id, LightTable &other, int other_id, std::vector<int32_t> &codes);
+
 	int get_attr_id(std::string attr_name);
 	const AttrDescPool & get_attr_descs();
 	bool has_attr(std::string attr_name);
@@ -99,6 +233,7 @@ public:
 	uint32_t tuple_size();
 	uint8_t get_attr_type(int i);
 	std::string name() { return mTablename; }
+	TableLayout layout() { return mTablefile.get_layout(); }
 
 	void dump();
 	static void dump(LightTable & a, LightTable & b, std::vector<AddrPair> & match_pairs);
@@ -110,26 +245,134 @@ private:
 	LightTableFile mTablefile;
 	std::vector<SequenceElementType> mSeqTypes;
 	SequenceFile<attr_t> mDatafile;
+	ColumnFile mColumnfile;
 
+	// Rows appended since bulk_begin() start at mBulkBegin
+	bool mBulk;
+	uint32_t mBulkBegin;
+	std::unordered_multimap<size_t, uint32_t> mBulkRows;
+
+	inline uint32_t append(AttrTuple &tuple);
+	inline size_t hash_tuple(const AttrTuple &tuple);
+	inline bool equal_tuple(uint32_t addr, const AttrTuple &tuple);
 	inline uint32_t insert_with_pk(AttrTuple &tuple);
 	inline uint32_t insert_no_pk(AttrTuple &tuple);
 	
+	void create_composite_index(const std::vector<int> &attr_ids, IndexType type);
 	inline void update_index(AttrTuple &tuple, uint32_t addr);
+	inline void update_stat(AttrTuple &tuple);
+
+	uint32_t filter(
+		int attr_id,
+		const attr_t & attr,
+		relation_type_t rel_type,
+		std::vector<uint32_t> & match_addrs);
+
+	// lo < attr < hi by a tree index range or one scan comparing both bounds
+	uint32_t filter_range(
+		int attr_id,
+		const attr_t & lo,
+		const attr_t & hi,
+		std::vector<uint32_t> & match_addrs);
+
+	void fuse_ranges(std::vector<Predicate> & predicates);
+
+	double filter_cost(int attr_id, relation_type_t rel_type, double selectivity);
+	double index_cost(const Predicate & pred);
+
+	// Addrs of pred read from its index, ascending
+	uint32_t index_posting(const Predicate & pred, std::vector<uint32_t> & addrs);
+	void index_rows(const Predicate & pred, RowBitmap & rows);
+	
+	// Composite index probed by EQ predicates of its leading attrs, covered in key order
+	const CompositeIndex *match_composite(
+		const std::vector<Predicate> & predicates,
+		std::vector<int> & covered,
+		attr_t & key,
+		double & selectivity,
+		double & cost);
+
+	// Rows of a composite key of key_num leading values, in key order
+	uint32_t filter_composite(
+		const CompositeIndex & composite,
+		const attr_t & key,
+		int key_num,
+		std::vector<uint32_t> & match_addrs);
 	
 	uint32_t filter_with_index(
 		const char *attr_name, 
-		attr_t & attr, 
+		const attr_t & attr, 
 		relation_type_t find_type, 
 		IndexFile *index_file,
 		std::vector<uint32_t> & match_addrs);
 
 	uint32_t filter_naive(
 		const char *attr_name, 
-		attr_t & attr,
+		const attr_t & attr,
 		relation_type_t find_type, 
 		std::vector<uint32_t> & match_addrs);
+
+	uint32_t scan(
+		int attr_id,
+		const attr_t & attr,
+		relation_type_t rel_type,
+		std::vector<uint32_t> & match_addrs);
+
+	uint32_t scan(
+		int attr_id1,
+		relation_type_t rel_type,
+		int attr_id2,
+		std::vector<uint32_t> & match_addrs);
+
+	// Rows [begin, end) only, one morsel of scan()
+	uint32_t scan(
+		int attr_id,
+		const attr_t & attr,
+		relation_type_t rel_type,
+		uint32_t begin,
+		uint32_t end,
+		std::vector<uint32_t> & match_addrs);
+
+	uint32_t scan(
+		int attr_id1,
+		relation_type_t rel_type,
+		int attr_id2,
+		uint32_t begin,
+		uint32_t end,
+		std::vector<uint32_t> & match_addrs);
+
+	uint32_t refine(
+		int attr_id,
+		const attr_t & attr,
+		relation_type_t rel_type,
+		std::vector<uint32_t> & addrs);
+
+	uint32_t scan_range(
+		int attr_id,
+		const attr_t & lo,
+		const attr_t & hi,
+		std::vector<uint32_t> & match_addrs);
+
+	uint32_t scan_range(
+		int attr_id,
+		const attr_t & lo,
+		const attr_t & hi,
+		uint32_t begin,
+		uint32_t end,
+		std::vector<uint32_t> & match_addrs);
+
+	uint32_t refine_range(
+		int attr_id,
+		const attr_t & lo,
+		const attr_t & hi,
+		std::vector<uint32_t> & addrs);
+
+	uint32_t refine(const Predicate & pred, std::vector<uint32_t> & addrs);
+	void refine_tree(PredicateTree & tree, std::vector<uint32_t> & addrs);
 	
 	inline IndexFile *get_index_file(const char *name);
+	inline TreeIndexFile *get_tree_index(int attr_id);
+	inline BitmapIndexFile *get_bitmap_index(int attr_id);
 	inline void init_seq_types(AttrDesc *descs, int num);
 	void get_selectid_from_names(std::vector<std::string> &names, std::vector<int> &ids);
 
@@ -139,7 +382,7 @@ private:
 		relation_type_t rel_type,
 		LightTable & b,
 		std::string b_keyname,
-		std::vector<AddrPair> &match_pairs);
+		AddrPairSink &sink);
 
 	static inline void cross_hash_join(
 		LightTable & a,
@@ -149,21 +392,45 @@ private:
 		LightTable & b,
 		std::string b_keyname,
 		IndexFile *b_index,
-		std::vector<AddrPair> &match_pairs);
+		AddrPairSink &sink);
+
+	static void cross_join_eq(
+		LightTable & a,
+		std::string a_keyname,
+		IndexFile *a_index,
+		LightTable & b,
+		std::string b_keyname,
+		IndexFile *b_index,
+		AddrPairSink &sink);
+
+	static void cross_build_hash_join(
+		LightTable & a,
+		std::string a_keyname,
+		LightTable & b,
+		std::string b_keyname,
+		AddrPairSink &sink);
+
+	static void cross_sort_merge_join(
+		LightTable & a,
+		std::string a_keyname,
+		relation_type_t rel_type,
+		LightTable & b,
+		std::string b_keyname,
+		AddrPairSink &sink);
 
 	static inline void LightTable::cross_hash_join_eq(
 		LightTable & iter_table,
 		int iter_key_id,
 		LightTable & fix_table,
 		IndexFile * fix_index,
-		std::vector<AddrPair>& match_pairs);
+		AddrPairSink &sink);
 
 	static inline void LightTable::cross_hash_join_neq(
 		LightTable & iter_table,
 		int iter_key_id,
 		LightTable & fix_table,
 		IndexFile * fix_index,
-		std::vector<AddrPair>& match_pairs);
+		AddrPairSink &sink);
 
 	static inline void cross_two_tree_join(
 		LightTable & a,
@@ -176,7 +443,7 @@ private:
 		std::string b_keyname,
 		IndexFile *b_index,
 		
-		std::vector<AddrPair> &match_pairs);
+		AddrPairSink &sink);
 
 	static inline void cross_one_tree_join(
 		LightTable & a,
@@ -189,7 +456,7 @@ private:
 		std::string b_keyname,
 		IndexFile *b_index,
 		
-		std::vector<AddrPair> &match_pairs);
+		AddrPairSink &sink);
 
 	static void merge(
 		std::vector<AddrPair> &a,
@@ -2,9 +2,9 @@
 
 #include "system.h"
 
-LightTableFile::LightTableFile(const char *tablename, AttrDesc *descs, int num)
+LightTableFile::LightTableFile(const char *tablename, AttrDesc *descs, int num, TableLayout layout)
 {
-	create(tablename, descs, num);
+	create(tablename, descs, num, layout);
 }
 
 LightTableFile::LightTableFile()
@@ -18,16 +18,20 @@ LightTableFile::~LightTableFile()
 		delete it->second;
 }
 
-inline void LightTableFile::create(const char *tablename, AttrDesc * descs, int num)
+inline void LightTableFile::create(const char *tablename, AttrDesc * descs, int num, TableLayout layout)
 {
 	strncpy(mTableHeader.name, tablename, TABLE_NAME_MAX);
 	mTableHeader.attrNum = num;
 	mTableHeader.rowsize = 0;
 	mTableHeader.primaryKeyIndex = -1;
+	mTableHeader.layout = layout;
 
 	mAttrDescPool.clear();
 	mAttrDescPool.assign(descs, descs + num);
 
+	mColumnStatPool.clear();
+	mColumnStatPool.resize(num);
+
 	for (int i = 0; i < mTableHeader.attrNum; i++)
 	{
 		mTableHeader.rowsize += mAttrDescPool[i].size;
@@ -60,6 +64,111 @@ inline IndexFile & LightTableFile::create_index(const AttrDesc & desc, IndexType
 	return *idxFile;
 }
 
+void LightTableFile::drop_index(const AttrDesc & desc)
+{
+	auto res = mIndexFileMap.find(desc.name);
+	if (res == mIndexFileMap.end())
+		throw exception_t(INDEX_NOT_EXIST, "Index not exist");
+	if (desc.constraint & ATTR_CONSTRAINT_PRIMARY_KEY)
+		throw exception_t(DROP_PRIMARY_INDEX, "Cannot drop primary key index");
+
+	delete res->second;
+	mIndexFileMap.erase(res);
+	remove(get_index_file_name_str(desc.name).c_str());
+}
+
+/*
+	LightTableFile::create_index()
+
+	composite index over attr_ids in order, its file is kept in mIndexFileMap
+	under its name too, so it is written back and read like the others
+*/
+IndexFile & LightTableFile::create_index(const std::vector<int>& attr_ids, IndexType type, const char * idx_path)
+{
+	std::string name = get_composite_name(attr_ids);
+	if (name.size() >= ATTR_NAME_MAX)
+		throw exception_t(COMPOSITE_INDEX_ERROR, "Composite index name too long");
+
+	CompositeIndex composite = gen_composite(attr_ids, type);
+	auto res = mIndexFileMap.insert({ name, composite.index_file });
+	if (!res.second)
+	{
+		delete composite.index_file;
+		throw exception_t(DUPLICATE_INDEX_FILE, "Duplicated index file");
+	}
+	mCompositeMap[name] = composite;
+	composite.index_file->open(idx_path, "wb+");
+	return *composite.index_file;
+}
+
+void LightTableFile::drop_composite_index(const char * name)
+{
+	auto res = mCompositeMap.find(name);
+	auto file = mIndexFileMap.find(name);
+	if (res == mCompositeMap.end() || file == mIndexFileMap.end())
+		throw exception_t(INDEX_NOT_EXIST, "Index not exist");
+
+	mCompositeMap.erase(res);
+	delete file->second;
+	mIndexFileMap.erase(file);
+	remove(get_index_file_name_str(name).c_str());
+}
+
+std::string LightTableFile::get_composite_name(const std::vector<int>& attr_ids)
+{
+	std::string name;
+	for (int attr_id : attr_ids)
+	{
+		if (!name.empty())
+			name += COMPOSITE_NAME_SEP;
+		name += mAttrDescPool.at(attr_id).name;
+	}
+	return name;
+}
+
+std::vector<int> LightTableFile::get_composite_attr_ids(const char * name)
+{
+	std::vector<int> attr_ids;
+	std::string names(name);
+	size_t begin = 0;
+	while (begin <= names.size())
+	{
+		size_t end = names.find(COMPOSITE_NAME_SEP, begin);
+		if (end == std::string::npos)
+			end = names.size();
+		const AttrDesc &desc = get_attr_desc(names.substr(begin, end - begin).c_str());
+		attr_ids.push_back(get_attr_id(desc.name));
+		begin = end + 1;
+	}
+	return attr_ids;
+}
+
+/*
+	LightTableFile::composite_key()
+
+	INTEGER is 8 hex digits with the sign bit flipped, VARCHAR is its chars,
+	each value is followed by COMPOSITE_KEY_SEP, so keys are ordered by
+	their values and the key of leading values is a prefix of the keys
+	starting with them, the key is cut at ATTR_SIZE_MAX by attr_t
+*/
+attr_t LightTableFile::composite_key(const std::vector<attr_t>& values)
+{
+	std::string key;
+	char digits[9];
+	for (const attr_t & value : values)
+	{
+		if (value.Domain() == INTEGER_DOMAIN)
+		{
+			sprintf(digits, "%08x", (uint32_t)value.Int() ^ 0x80000000u);
+			key += digits;
+		}
+		else
+			key += value.Varchar();
+		key += COMPOSITE_KEY_SEP;
+	}
+	return attr_t(key.c_str());
+}
+
 const AttrDesc &LightTableFile::get_attr_desc(const char * attr_name)
 {
 	auto res = mAttrDescTable.find(attr_name);
@@ -102,13 +211,26 @@ const char * LightTableFile::get_pk_attr_name()
 
 inline void LightTableFile::write_back()
 {
-	fseek(mFile, 0, SEEK_SET);
+	// Reopen truncated, records of dropped indexes must not be left at the end
+	FILE *file = freopen(mFilepath.c_str(), "wb+", mFile);
+	if (file == NULL)
+	{
+		// freopen() closed the old stream already
+		mFile = NULL;
+		throw exception_t(TABLE_FILE_ERROR, "Cannot rewrite table file");
+	}
+	mFile = file;
 
+	table_file_tag_t tag = { TABLEFILE_MAGIC, TABLEFILE_VERSION };
+	fwrite(&tag, sizeof(table_file_tag_t), 1, mFile);
 	fwrite(&mTableHeader, sizeof(TableHeader), 1, mFile);
 	
 	if(!mAttrDescPool.empty())
 		fwrite(&mAttrDescPool[0], sizeof(AttrDesc) * mAttrDescPool.size(), 1, mFile);
 
+	if (!mColumnStatPool.empty())
+		fwrite(&mColumnStatPool[0], sizeof(ColumnStat) * mColumnStatPool.size(), 1, mFile);
+
 	for (IndexFileMap::iterator it = mIndexFileMap.begin(); it != mIndexFileMap.end(); it++)
 	{
 		table_index_record_t idx_record(it->first, it->second->get_filepath(), it->second->type());
@@ -123,19 +245,52 @@ inline void LightTableFile::read_from()
 {
 	fseek(mFile, 0, SEEK_SET);
 
-	fread(&mTableHeader, sizeof(TableHeader), 1, mFile);
+	table_file_tag_t tag = { 0, 0 };
+	fread(&tag, sizeof(table_file_tag_t), 1, mFile);
+	if (tag.magic == TABLEFILE_MAGIC)
+	{
+		if (tag.version > TABLEFILE_VERSION)
+			throw exception_t(TABLE_FILE_ERROR, "Unsupported table file version");
+		fread(&mTableHeader, sizeof(TableHeader), 1, mFile);
+	}
+	else
+	{
+		// Written before layout, rows are in SequenceFile
+		table_legacy_header_t legacy;
+		fseek(mFile, 0, SEEK_SET);
+		fread(&legacy, sizeof(table_legacy_header_t), 1, mFile);
+		memcpy(mTableHeader.name, legacy.name, TABLE_NAME_MAX);
+		mTableHeader.attrNum = legacy.attrNum;
+		mTableHeader.rowsize = legacy.rowsize;
+		mTableHeader.primaryKeyIndex = legacy.primaryKeyIndex;
+		mTableHeader.layout = ROW_LAYOUT;
+	}
 	
 	mAttrDescPool.resize(mTableHeader.attrNum);
 
 	if (!mAttrDescPool.empty())
 		fread(&mAttrDescPool[0], sizeof(AttrDesc) * mAttrDescPool.size(), 1, mFile);
+
+	// Files without stats are not analyzed, rowNum 0
+	mColumnStatPool.assign(mTableHeader.attrNum, ColumnStat());
+
+	if (tag.magic == TABLEFILE_MAGIC && tag.version >= TABLEFILE_VERSION_STATS && !mColumnStatPool.empty())
+		fread(&mColumnStatPool[0], sizeof(ColumnStat) * mColumnStatPool.size(), 1, mFile);
 	
 	build_attr_desc_index();
 	
 	table_index_record_t index_record;
 	while (fread(&index_record, sizeof(table_index_record_t), 1, mFile))
 	{
-		IndexFile *idx_file = gen_indexfile(get_attr_desc(index_record.attr_name), index_record.index_type);
+		IndexFile *idx_file;
+		if (strchr(index_record.attr_name, COMPOSITE_NAME_SEP) != NULL)
+		{
+			CompositeIndex composite = gen_composite(get_composite_attr_ids(index_record.attr_name), index_record.index_type);
+			mCompositeMap[index_record.attr_name] = composite;
+			idx_file = composite.index_file;
+		}
+		else
+			idx_file = gen_indexfile(get_attr_desc(index_record.attr_name), index_record.index_type);
 		
 		auto res = mIndexFileMap.insert({ index_record.attr_name, idx_file });
 		if (!res.second)
@@ -153,14 +308,16 @@ void LightTableFile::dump_info()
 {
 	printf("Table Name: %s\n", mTableHeader.name);
 	printf("Table Attr num: %d\n", mTableHeader.attrNum);
-	printf("Name\tType\tSize\tPrimaryKey\tIndex\n");
+	printf("Table Layout: %s\n", (mTableHeader.layout == COLUMN_LAYOUT) ? "COLUMN" : "ROW");
+	printf("Name\tType\tSize\tPrimaryKey\tDistinct\tIndex\n");
 	for (int i = 0; i < mTableHeader.attrNum; i++)
 	{
-		printf("%s\t%s\t%d\t%d\t",
+		printf("%s\t%s\t%d\t%d\t%u\t",
 			mAttrDescPool[i].name,
 			kAttrTypeNames[mAttrDescPool[i].type],
 			mAttrDescPool[i].size,
-			(mAttrDescPool[i].constraint & ATTR_CONSTRAINT_PRIMARY_KEY ? 1 : 0));
+			(mAttrDescPool[i].constraint & ATTR_CONSTRAINT_PRIMARY_KEY ? 1 : 0),
+			mColumnStatPool[i].distinctNum);
 		
 		auto res = mIndexFileMap.find(mAttrDescPool[i].name);
 		if (res != mIndexFileMap.end())
@@ -169,6 +326,11 @@ void LightTableFile::dump_info()
 		}
 		printf("\n");
 	}
+	for (auto it = mCompositeMap.begin(); it != mCompositeMap.end(); it++)
+	{
+		printf("(%s)\t\t\t\t\t%s(%d)\n",
+			it->first.c_str(), it->second.index_file->get_filepath().c_str(), it->second.index_file->type());
+	}
 }
 
 inline void LightTableFile::build_attr_desc_index()
@@ -211,9 +373,59 @@ inline IndexFile * LightTableFile::gen_indexfile(const AttrDesc & desc, IndexTyp
 	case TREE:
 		return new TreeIndexFile(domain, desc.size);
 		break;
+	case BITMAP:
+		return new BitmapIndexFile(domain, desc.size);
+		break;
 	default:
 		throw exception_t(UNSUPPORTED_INDEX_TYPE, "Unsupported index type");
 	}
 
 	return nullptr;
 }
+
+/*
+	LightTableFile::gen_composite()
+
+	HASH or TREE of VARCHAR keys wide enough for every value of attr_ids,
+	up to ATTR_SIZE_MAX, wider ones make a lossy index
+*/
+CompositeIndex LightTableFile::gen_composite(const std::vector<int>& attr_ids, IndexType index_type)
+{
+	if (attr_ids.size() < 2)
+		throw exception_t(COMPOSITE_INDEX_ERROR, "Composite index needs two attrs or more");
+
+	uint32_t width = 0;
+	for (int attr_id : attr_ids)
+	{
+		const AttrDesc &desc = mAttrDescPool.at(attr_id);
+		switch (desc.type)
+		{
+		case ATTR_TYPE_INTEGER:
+			width += 8 + 1;
+			break;
+		case ATTR_TYPE_VARCHAR:
+			width += std::min<uint32_t>(desc.size, ATTR_SIZE_MAX) + 1;
+			break;
+		default:
+			throw exception_t(TYPE_UNDEFINED, "Cannot set_table index, unknown type.");
+		}
+	}
+
+	CompositeIndex composite;
+	composite.attr_ids = attr_ids;
+	composite.lossy = width > ATTR_SIZE_MAX;
+
+	uint32_t keysize = std::min<uint32_t>(width, ATTR_SIZE_MAX);
+	switch (index_type)
+	{
+	case HASH:
+		composite.index_file = new HashIndexFile(VARCHAR_DOMAIN, keysize);
+		break;
+	case TREE:
+		composite.index_file = new TreeIndexFile(VARCHAR_DOMAIN, keysize);
+		break;
+	default:
+		throw exception_t(UNSUPPORTED_INDEX_TYPE, "Unsupported composite index type");
+	}
+	return composite;
+}
@@ -10,11 +10,38 @@
 #define UNSUPPORTED_INDEX_TYPE 0x3
 #define DUPLICATE_INDEX_FILE 0x4
 #define ATTR_NOT_FOUND 0x5
+#define INDEX_NOT_EXIST 0x6
+#define DROP_PRIMARY_INDEX 0x7
+#define TABLE_FILE_ERROR 0x8
+#define COMPOSITE_INDEX_ERROR 0x9
+
+// Name of a composite index is its attr names joined by this
+#define COMPOSITE_NAME_SEP ','
+// Ends each value of a composite key, below any printable char
+#define COMPOSITE_KEY_SEP '\x01'
 
 typedef table_attr_desc_t AttrDesc;
 typedef table_header_t TableHeader;
+typedef table_layout_t TableLayout;
+typedef table_column_stat_t ColumnStat;
 typedef std::unordered_map<std::string, int> AttrDescTable;
 typedef std::vector<AttrDesc> AttrDescPool;
+typedef std::vector<ColumnStat> ColumnStatPool;
+
+/*
+	CompositeIndex
+
+	index over an ordered list of attrs, its key is their values encoded
+	into one VARCHAR by LightTableFile::composite_key(), in the order of
+	the values so a tree index finds a leading part of them as a prefix
+	lossy if a key may be cut at ATTR_SIZE_MAX, its matches must be checked
+*/
+struct CompositeIndex
+{
+	std::vector<int> attr_ids;
+	IndexFile *index_file;
+	bool lossy;
+};
 
 /*
 	LightTableFile
@@ -30,18 +57,31 @@ class LightTableFile
 
 	typedef std::pair<std::string, IndexFile*> IndexRecord;
 	typedef std::unordered_map<std::string, IndexFile*> IndexFileMap;
+	typedef std::unordered_map<std::string, CompositeIndex> CompositeIndexMap;
 public:
-	LightTableFile(const char *tablename, AttrDesc *descs, int num);
+	LightTableFile(const char *tablename, AttrDesc *descs, int num, TableLayout layout);
 	LightTableFile();
 	~LightTableFile();
 	
-	inline void create(const char *tablename, AttrDesc *descs, int num);
+	inline void create(const char *tablename, AttrDesc *descs, int num, TableLayout layout);
 	inline IndexFile & create_index(const AttrDesc &desc, IndexType type, const char *idx_path);
+	void drop_index(const AttrDesc &desc);
+
+	// HASH or TREE over two or more attrs, named by get_composite_name()
+	IndexFile & create_index(const std::vector<int> &attr_ids, IndexType type, const char *idx_path);
+	void drop_composite_index(const char *name);
+	std::string get_composite_name(const std::vector<int> &attr_ids);
+	std::vector<int> get_composite_attr_ids(const char *name);
+
+	// Key of the leading values of a composite index
+	static attr_t composite_key(const std::vector<attr_t> &values);
 
 	const AttrDesc &get_attr_desc(const char *attr_name);
 	const AttrDescPool &get_attr_descs();
 	const int get_attr_id(const char *attr_name);
+	ColumnStat &get_column_stat(int attr_id) { return mColumnStatPool.at(attr_id); }
 	const TableHeader &get_header() { return mTableHeader; }
+	TableLayout get_layout() { return mTableHeader.layout; }
 	IndexFile *get_index_file(const char *attr_name);
 	const char *get_pk_attr_name();
 
@@ -53,10 +93,13 @@ private:
 	TableHeader mTableHeader;
 	AttrDescTable mAttrDescTable;
 	AttrDescPool mAttrDescPool;
+	ColumnStatPool mColumnStatPool;
 	IndexFileMap mIndexFileMap;
+	CompositeIndexMap mCompositeMap;	// Index files are owned by mIndexFileMap
 
 	inline void build_attr_desc_index();
 	std::string get_index_file_name_str(const char *attr_name);
 	inline IndexFile *gen_indexfile(const AttrDesc &desc, IndexType index_type);
+	CompositeIndex gen_composite(const std::vector<int> &attr_ids, IndexType index_type);
 };
 
@@ -0,0 +1,240 @@
+#include "MappedFile.h"
+
+#include "system.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+	mData(NULL), mSize(0),
+#ifdef _WIN32
+	mFileHandle(INVALID_HANDLE_VALUE), mMapHandle(NULL)
+#else
+	mFd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+}
+
+bool MappedFile::map(const char * filepath)
+{
+	unmap();
+
+#ifdef _WIN32
+	mFileHandle = CreateFileA(filepath, GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(mFileHandle, &file_size) || file_size.QuadPart == 0)
+	{
+		unmap();
+		return false;
+	}
+
+	mMapHandle = CreateFileMappingA(mFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapHandle == NULL)
+	{
+		unmap();
+		return false;
+	}
+
+	mData = (const char *)MapViewOfFile(mMapHandle, FILE_MAP_READ, 0, 0, 0);
+	if (mData == NULL)
+	{
+		unmap();
+		return false;
+	}
+	mSize = (size_t)file_size.QuadPart;
+#else
+	mFd = ::open(filepath, O_RDONLY);
+	if (mFd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(mFd, &st) != 0 || st.st_size == 0)
+	{
+		unmap();
+		return false;
+	}
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, mFd, 0);
+	if (addr == MAP_FAILED)
+	{
+		unmap();
+		return false;
+	}
+	mData = (const char *)addr;
+	mSize = st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::unmap()
+{
+#ifdef _WIN32
+	if (mData != NULL)
+		UnmapViewOfFile(mData);
+	if (mMapHandle != NULL)
+		CloseHandle(mMapHandle);
+	if (mFileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(mFileHandle);
+	mMapHandle = NULL;
+	mFileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (mData != NULL)
+		munmap((void *)mData, mSize);
+	if (mFd >= 0)
+		::close(mFd);
+	mFd = -1;
+#endif
+	mData = NULL;
+	mSize = 0;
+}
+
+uint32_t DatFile::width(SequenceElementType type, uint32_t size)
+{
+	if (type == SEQ_INT)
+		return sizeof(int32_t);
+	return std::min<uint32_t>(size, ATTR_SIZE_MAX) + 1;
+}
+
+bool DatFile::match(const MappedFile & file)
+{
+	if (file.size() < sizeof(Header))
+		return false;
+	const Header *header = (const Header *)file.data();
+	return header->magic == DATFILE_MAGIC;
+}
+
+// Block table entry of DATFILE_VERSION_PLAIN
+struct PlainBlock
+{
+	uint32_t type;
+	uint32_t width;
+	uint64_t offset;
+};
+
+uint32_t DatFile::parse(
+	const MappedFile & file,
+	const SequenceElementType * types,
+	const uint32_t * sizes,
+	int num,
+	std::vector<BlockRef>& blocks)
+{
+	const Header *header = (const Header *)file.data();
+	if (header->version != DATFILE_VERSION && header->version != DATFILE_VERSION_PLAIN)
+		throw exception_t(MAPFILE_BAD_FORMAT, "Unsupported data file version");
+
+	const size_t block_size = (header->version == DATFILE_VERSION) ? sizeof(Block) : sizeof(PlainBlock);
+	if (header->colNum != (uint32_t)num || file.size() < sizeof(Header) + num * block_size)
+		throw exception_t(MAPFILE_BAD_FORMAT, "Data file does not match table");
+
+	blocks.resize(num);
+	for (int i = 0; i < num; i++)
+	{
+		Block block = {};
+		if (header->version == DATFILE_VERSION)
+		{
+			block = ((const Block *)(file.data() + sizeof(Header)))[i];
+		}
+		else
+		{
+			const PlainBlock & plain = ((const PlainBlock *)(file.data() + sizeof(Header)))[i];
+			block.type = plain.type;
+			block.width = plain.width;
+			block.offset = plain.offset;
+		}
+
+		if (block.type != types[i])
+			throw exception_t(MAPFILE_BAD_FORMAT, "Corrupted column block");
+
+		BlockRef & ref = blocks[i];
+		ref.encoding = (BlockEncoding)block.encoding;
+		ref.dictNum = 0;
+		ref.dict = NULL;
+		switch (block.encoding)
+		{
+		case PLAIN_ENCODING:
+			if (block.width != width(types[i], sizes[i]))
+				throw exception_t(MAPFILE_BAD_FORMAT, "Corrupted column block");
+			break;
+		case DICT_ENCODING:
+			if (types[i] != SEQ_VARCHAR || block.width != sizeof(int32_t)
+				|| block.dictOffset + (uint64_t)width(types[i], sizes[i]) * block.dictNum > file.size())
+				throw exception_t(MAPFILE_BAD_FORMAT, "Corrupted dictionary block");
+			ref.dictNum = block.dictNum;
+			ref.dict = file.data() + block.dictOffset;
+			break;
+		default:
+			throw exception_t(MAPFILE_BAD_FORMAT, "Unknown block encoding");
+		}
+
+		if (block.offset + (uint64_t)block.width * header->rowNum > file.size())
+			throw exception_t(MAPFILE_BAD_FORMAT, "Corrupted column block");
+		ref.data = file.data() + block.offset;
+	}
+	return header->rowNum;
+}
+
+void DatFile::write_header(
+	FILE * file,
+	const SequenceElementType * types,
+	const uint32_t * sizes,
+	int num,
+	uint32_t row_num,
+	const uint32_t * dict_nums,
+	std::vector<Block>& blocks)
+{
+	Header header = { DATFILE_MAGIC, DATFILE_VERSION, (uint32_t)num, row_num };
+	blocks.assign(num, Block());
+
+	uint64_t offset = sizeof(Header) + num * sizeof(Block);
+	for (int i = 0; i < num; i++)
+	{
+		Block & block = blocks[i];
+		const uint32_t value_width = width(types[i], sizes[i]);
+		const bool dict = dict_nums != NULL && types[i] == SEQ_VARCHAR;
+
+		offset = (offset + DATFILE_ALIGN - 1) / DATFILE_ALIGN * DATFILE_ALIGN;
+		block.type = types[i];
+		block.width = dict ? sizeof(int32_t) : value_width;
+		block.offset = offset;
+		block.encoding = dict ? DICT_ENCODING : PLAIN_ENCODING;
+		offset += (uint64_t)block.width * row_num;
+
+		if (dict)
+		{
+			offset = (offset + DATFILE_ALIGN - 1) / DATFILE_ALIGN * DATFILE_ALIGN;
+			block.dictNum = dict_nums[i];
+			block.dictOffset = offset;
+			offset += (uint64_t)value_width * dict_nums[i];
+		}
+	}
+
+	fseek(file, 0, SEEK_SET);
+	fwrite(&header, sizeof(Header), 1, file);
+	fwrite(blocks.data(), sizeof(Block), num, file);
+}
+
+void DatFile::pad_to(FILE * file, uint64_t offset)
+{
+	static const char zeros[DATFILE_ALIGN] = { 0 };
+	uint64_t pos = (uint64_t)ftell(file);
+	if (pos < offset)
+		fwrite(zeros, 1, offset - pos, file);
+}
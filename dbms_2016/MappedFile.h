@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <vector>
+
+#include "database_type.h"
+
+#define MAPFILE_BAD_FORMAT 0x1
+
+// "LTDF", little endian
+#define DATFILE_MAGIC 0x4644544c
+#define DATFILE_VERSION 2
+#define DATFILE_VERSION_PLAIN 1	// Blocks without encoding, still readable
+#define DATFILE_ALIGN 64
+
+/*
+	MappedFile
+
+	read-only memory mapping of a whole file,
+	pages are faulted in by the OS when touched
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Return false if file is empty or cannot be mapped
+	bool map(const char *filepath);
+	void unmap();
+
+	const char *data() const { return mData; }
+	size_t size() const { return mSize; }
+	bool mapped() const { return mData != NULL; }
+private:
+	const char *mData;
+	size_t mSize;
+#ifdef _WIN32
+	void *mFileHandle;
+	void *mMapHandle;
+#else
+	int mFd;
+#endif
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+/*
+	DatFile
+
+	versioned on-disk format of table data (.dat)
+
+	| header | block table | pad | column block 0 | pad | column block 1 | ...
+
+	each column block is rowNum fixed-width values,
+	INTEGER is int32, VARCHAR is '\0' padded char[width],
+	a DICT_ENCODING VARCHAR block is rowNum int32 codes followed by
+	dictNum distinct '\0' padded values in ascending order, code is index into them
+	blocks are aligned to DATFILE_ALIGN so INTEGER block can be read in place
+*/
+namespace DatFile
+{
+	enum BlockEncoding
+	{
+		PLAIN_ENCODING, DICT_ENCODING
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t colNum;
+		uint32_t rowNum;
+	};
+
+	struct Block
+	{
+		uint32_t type;
+		uint32_t width;			// Bytes per row, int32 code if DICT_ENCODING
+		uint64_t offset;
+		uint32_t encoding;
+		uint32_t dictNum;
+		uint64_t dictOffset;
+	};
+
+	// Block of a parsed file
+	struct BlockRef
+	{
+		const char *data;
+		BlockEncoding encoding;
+		uint32_t dictNum;
+		const char *dict;
+	};
+
+	// Width of a value in column block, VARCHAR keeps its terminator
+	uint32_t width(SequenceElementType type, uint32_t size);
+
+	// File is written by DatFile format, old files are plain rows
+	bool match(const MappedFile &file);
+
+	// Validate header against table schema, return block of each column
+	uint32_t parse(
+		const MappedFile &file,
+		const SequenceElementType *types,
+		const uint32_t *sizes,
+		int num,
+		std::vector<BlockRef> &blocks);
+
+	// Write header and block table, return layout of each column block
+	// VARCHAR column i is DICT_ENCODING with dict_nums[i] values if dict_nums is not NULL
+	void write_header(
+		FILE *file,
+		const SequenceElementType *types,
+		const uint32_t *sizes,
+		int num,
+		uint32_t row_num,
+		const uint32_t *dict_nums,
+		std::vector<Block> &blocks);
+
+	// Pad file with zeros up to offset of next block
+	void pad_to(FILE *file, uint64_t offset);
+}
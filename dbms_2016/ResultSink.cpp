@@ -0,0 +1,212 @@
+#include "ResultSink.h"
+
+#include "system.h"
+#include "LightTable.h"
+
+#include <cstring>
+
+ResultSink::ResultSink(std::ostream & os) :
+	mOs(os), mBuf(new char[RESULT_BUFFER_SIZE]), mLen(0)
+{
+}
+
+ResultSink::~ResultSink()
+{
+	delete[] mBuf;
+}
+
+void ResultSink::flush()
+{
+	if (mLen > 0)
+		mOs.write(mBuf, mLen);
+	mLen = 0;
+	mOs.flush();
+}
+
+void ResultSink::put(const attr_t & attr)
+{
+	switch (attr.Domain())
+	{
+	case INTEGER_DOMAIN:
+		put(attr.Int());
+		break;
+	case VARCHAR_DOMAIN:
+		put(attr.Varchar());
+		break;
+	default:
+		put("");
+		break;
+	}
+}
+
+void ResultSink::put(LightTable & table, uint32_t addr, int attr_id)
+{
+	if (table.get_attr_type(attr_id) == ATTR_TYPE_INTEGER)
+		put(table.get_int(addr, attr_id));
+	else
+		put(table.get_varchar(addr, attr_id));
+}
+
+ResultSink * ResultSink::create(ResultFormat format, std::ostream & os)
+{
+	switch (format)
+	{
+	case TSV_FORMAT: return new TsvSink(os);
+	case CSV_FORMAT: return new CsvSink(os);
+	case BINARY_FORMAT: return new BinarySink(os);
+	default:
+		throw exception_t(RESULT_UNKNOWN_FORMAT, "Unknown result format.");
+	}
+}
+
+void ResultSink::write(const char * str, uint32_t len)
+{
+	if (len > RESULT_BUFFER_SIZE)
+	{
+		reserve(RESULT_BUFFER_SIZE);
+		mOs.write(str, len);
+		return;
+	}
+	reserve(len);
+	memcpy(mBuf + mLen, str, len);
+	mLen += len;
+}
+
+void ResultSink::write_int(int64_t value)
+{
+	// Digits backwards, INT64_MIN has no positive int64_t
+	char digits[21];
+	int pos = sizeof(digits);
+	uint64_t mag = (value < 0) ? 0ull - (uint64_t)value : (uint64_t)value;
+	do
+	{
+		digits[--pos] = '0' + mag % 10;
+		mag /= 10;
+	} while (mag != 0);
+	if (value < 0)
+		digits[--pos] = '-';
+	write(digits + pos, sizeof(digits) - pos);
+}
+
+void TsvSink::put(int64_t value)
+{
+	write_int(value);
+	write('\t');
+}
+
+void TsvSink::put(const char * value)
+{
+	if (value[0] == '\0')
+		write("NULL", 4);
+	else
+		write(value, strlen(value));
+	write('\t');
+}
+
+void TsvSink::end_row()
+{
+	write('\n');
+}
+
+inline void CsvSink::separate()
+{
+	if (!mFirst)
+		write(',');
+	mFirst = false;
+}
+
+void CsvSink::put(int64_t value)
+{
+	separate();
+	write_int(value);
+}
+
+void CsvSink::put(const char * value)
+{
+	separate();
+	uint32_t len = strlen(value);
+	if (strpbrk(value, ",\"\r\n") == NULL)
+	{
+		write(value, len);
+		return;
+	}
+
+	// Quote, double inner quotes
+	write('"');
+	for (uint32_t i = 0; i < len; i++)
+	{
+		if (value[i] == '"')
+			write('"');
+		write(value[i]);
+	}
+	write('"');
+}
+
+void CsvSink::end_row()
+{
+	write('\n');
+	mFirst = true;
+}
+
+void BinarySink::put(int64_t value)
+{
+	std::vector<char> & col = column(ATTR_TYPE_INTEGER);
+	col.insert(col.end(), (const char *)&value, (const char *)&value + sizeof(value));
+}
+
+void BinarySink::put(const char * value)
+{
+	std::vector<char> & col = column(ATTR_TYPE_VARCHAR);
+	uint8_t len = strnlen(value, UINT8_MAX);
+	col.push_back((char)len);
+	col.insert(col.end(), value, value + len);
+}
+
+void BinarySink::end_row()
+{
+	if (mCol != mColumns.size())
+		throw exception_t(RESULT_COLUMN_MISMATCH, "Result rows have different columns.");
+	mCol = 0;
+	mFixed = true;
+	if (++mRows >= RESULT_BINARY_BLOCK)
+		write_block();
+}
+
+// End of a result, next one may have other columns
+void BinarySink::flush()
+{
+	if (mRows > 0)
+		write_block();
+	ResultSink::flush();
+
+	mColumns.clear();
+	mTypes.clear();
+	mCol = 0;
+	mFixed = false;
+}
+
+// Column of next cell, added while the first row is put
+std::vector<char>& BinarySink::column(uint8_t type)
+{
+	if (!mFixed && mCol == mColumns.size())
+	{
+		mColumns.emplace_back();
+		mTypes.push_back(type);
+	}
+	if (mCol >= mColumns.size() || mTypes[mCol] != type)
+		throw exception_t(RESULT_COLUMN_MISMATCH, "Result rows have different columns.");
+	return mColumns[mCol++];
+}
+
+void BinarySink::write_block()
+{
+	uint32_t header[2] = { mRows, (uint32_t)mColumns.size() };
+	write((const char *)header, sizeof(header));
+	for (int i = 0; i < mColumns.size(); i++)
+	{
+		write((char)mTypes[i]);
+		write(mColumns[i].data(), mColumns[i].size());
+		mColumns[i].clear();
+	}
+	mRows = 0;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <iostream>
+
+#include "database_type.h"
+
+class LightTable;
+
+#define RESULT_UNKNOWN_FORMAT 0x1
+#define RESULT_COLUMN_MISMATCH 0x2
+
+// Bytes buffered before a write to the stream
+#define RESULT_BUFFER_SIZE (1 << 20)
+
+// Rows of one block of binary format
+#define RESULT_BINARY_BLOCK 4096
+
+enum ResultFormat
+{
+	TSV_FORMAT, CSV_FORMAT, BINARY_FORMAT
+};
+
+/*
+	ResultSink
+
+	result rows are formatted cell by cell into a RESULT_BUFFER_SIZE buffer,
+	the stream only sees one write per full buffer and one on flush,
+	integers are formatted by hand instead of through operator <<
+	usage:
+		ResultSink *sink = ResultSink::create(CSV_FORMAT, std::cout);
+		sink->put(table, addr, attr_id); ...
+		sink->end_row();
+		sink->flush();
+*/
+class ResultSink
+{
+public:
+	ResultSink(std::ostream &os);
+	virtual ~ResultSink();
+
+	// INTEGER cell or aggregate counter, which may pass 2^31
+	virtual void put(int64_t value) = 0;
+
+	// VARCHAR, empty string is NULL
+	virtual void put(const char *value) = 0;
+	virtual void end_row() = 0;
+
+	// Write buffered rows to the stream
+	virtual void flush();
+
+	void put(const attr_t &attr);
+
+	// Cell of table read in its own type, no attr_t in between
+	void put(LightTable &table, uint32_t addr, int attr_id);
+
+	static ResultSink *create(ResultFormat format, std::ostream &os);
+protected:
+	std::ostream &mOs;
+	char *mBuf;
+	uint32_t mLen;
+
+	inline void reserve(uint32_t len);
+	inline void write(char c);
+	void write(const char *str, uint32_t len);
+	void write_int(int64_t value);
+};
+
+/*
+	TsvSink
+
+	each cell followed by a tab, NULL varchar is NULL, as printed before sinks
+*/
+class TsvSink
+	: public ResultSink
+{
+public:
+	TsvSink(std::ostream &os) : ResultSink(os) {}
+
+	void put(int64_t value);
+	void put(const char *value);
+	void end_row();
+};
+
+/*
+	CsvSink
+
+	RFC 4180: cells separated by commas, varchar quoted if it holds
+	a comma, quote or line break, NULL varchar is an empty cell
+*/
+class CsvSink
+	: public ResultSink
+{
+public:
+	CsvSink(std::ostream &os) : ResultSink(os), mFirst(true) {}
+
+	void put(int64_t value);
+	void put(const char *value);
+	void end_row();
+private:
+	bool mFirst;	// no comma before first cell of row
+
+	inline void separate();
+};
+
+/*
+	BinarySink
+
+	columnar blocks of at most RESULT_BINARY_BLOCK rows, native byte order:
+		uint32 rows, uint32 columns
+		per column: uint8 type (ATTR_TYPE_INTEGER, ATTR_TYPE_VARCHAR), then
+			rows int64 values, or rows (uint8 length, chars) values
+	columns and their types are fixed by the first row until flush
+*/
+class BinarySink
+	: public ResultSink
+{
+public:
+	BinarySink(std::ostream &os) : ResultSink(os), mRows(0), mCol(0), mFixed(false) {}
+
+	void put(int64_t value);
+	void put(const char *value);
+	void end_row();
+	void flush();
+private:
+	std::vector<std::vector<char>> mColumns;
+	std::vector<uint8_t> mTypes;
+	uint32_t mRows;
+	uint32_t mCol;		// next cell of current row
+	bool mFixed;		// columns known after the first row
+
+	std::vector<char> &column(uint8_t type);
+	void write_block();
+};
+
+inline void ResultSink::reserve(uint32_t len)
+{
+	if (mLen + len > RESULT_BUFFER_SIZE)
+	{
+		mOs.write(mBuf, mLen);
+		mLen = 0;
+	}
+}
+
+inline void ResultSink::write(char c)
+{
+	reserve(1);
+	mBuf[mLen++] = c;
+}
@@ -0,0 +1,386 @@
+#include "RowBitmap.h"
+
+#include "system.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#define LOW_MASK ((1u << ROW_BITMAP_CONTAINER_BITS) - 1)
+
+RowBitmap::RowBitmap()
+{
+}
+
+RowBitmap::RowBitmap(const std::vector<uint32_t>& addrs)
+{
+	add(addrs);
+}
+
+void RowBitmap::add(uint32_t addr)
+{
+	Container & cont = container(addr >> ROW_BITMAP_CONTAINER_BITS);
+	uint16_t low = addr & LOW_MASK;
+
+	if (cont.dense())
+	{
+		uint64_t bit = 1ull << (low % 64);
+		if (!(cont.words[low / 64] & bit))
+		{
+			cont.words[low / 64] |= bit;
+			cont.card++;
+		}
+		return;
+	}
+
+	if (cont.array.empty() || cont.array.back() < low)
+		cont.array.push_back(low);
+	else
+	{
+		auto it = std::lower_bound(cont.array.begin(), cont.array.end(), low);
+		if (*it == low)
+			return;
+		cont.array.insert(it, low);
+	}
+	cont.card++;
+
+	// Array outgrows the bitset
+	if (cont.card > ROW_BITMAP_ARRAY_MAX)
+	{
+		std::vector<uint64_t> words;
+		to_words(cont, words);
+		set_words(cont, words);
+	}
+}
+
+void RowBitmap::add(const std::vector<uint32_t>& addrs)
+{
+	if (std::is_sorted(addrs.begin(), addrs.end()))
+	{
+		for (uint32_t addr : addrs)
+			add(addr);
+		return;
+	}
+
+	// Index lookups come in key order
+	std::vector<uint32_t> sorted(addrs);
+	std::sort(sorted.begin(), sorted.end());
+	for (uint32_t addr : sorted)
+		add(addr);
+}
+
+bool RowBitmap::contains(uint32_t addr) const
+{
+	uint32_t key = addr >> ROW_BITMAP_CONTAINER_BITS;
+	auto it = std::lower_bound(mContainers.begin(), mContainers.end(), key,
+		[](const Container & cont, uint32_t k) { return cont.key < k; });
+	if (it == mContainers.end() || it->key != key)
+		return false;
+
+	uint16_t low = addr & LOW_MASK;
+	if (it->dense())
+		return (it->words[low / 64] >> (low % 64)) & 1;
+	return std::binary_search(it->array.begin(), it->array.end(), low);
+}
+
+uint64_t RowBitmap::size() const
+{
+	uint64_t num = 0;
+	for (const Container & cont : mContainers)
+		num += cont.card;
+	return num;
+}
+
+void RowBitmap::to_addrs(std::vector<uint32_t>& addrs) const
+{
+	addrs.reserve(addrs.size() + size());
+	for_each([&](uint32_t addr) { addrs.push_back(addr); });
+}
+
+/*
+	RowBitmap::merge()
+
+	containers are matched by key like a merge of two sorted lists,
+	AND keeps matched keys only, OR keeps all
+*/
+void RowBitmap::merge(const RowBitmap & a, merge_type_t merge_type, const RowBitmap & b, RowBitmap & c)
+{
+	if (merge_type != AND && merge_type != OR)
+		throw exception_t(BITMAP_UNSUPPORT_MERGE_TYPE, "Unsupported merge type.");
+
+	std::vector<Container> out;
+	auto ait = a.mContainers.begin(), bit = b.mContainers.begin();
+	auto a_end = a.mContainers.end(), b_end = b.mContainers.end();
+
+	while (ait != a_end || bit != b_end)
+	{
+		if (bit == b_end || (ait != a_end && ait->key < bit->key))
+		{
+			if (merge_type == OR)
+				out.push_back(*ait);
+			++ait;
+		}
+		else if (ait == a_end || bit->key < ait->key)
+		{
+			if (merge_type == OR)
+				out.push_back(*bit);
+			++bit;
+		}
+		else
+		{
+			Container cont;
+			cont.key = ait->key;
+			if (merge_type == AND)
+				intersect(*ait, *bit, cont);
+			else
+				unite(*ait, *bit, cont);
+			if (cont.card > 0)
+				out.push_back(std::move(cont));
+			++ait;
+			++bit;
+		}
+	}
+	c.mContainers.swap(out);
+}
+
+void RowBitmap::subtract(const RowBitmap & a, const RowBitmap & b, RowBitmap & c)
+{
+	std::vector<Container> out;
+	auto bit = b.mContainers.begin();
+	for (const Container & cont : a.mContainers)
+	{
+		while (bit != b.mContainers.end() && bit->key < cont.key)
+			++bit;
+		if (bit == b.mContainers.end() || bit->key != cont.key)
+		{
+			out.push_back(cont);
+			continue;
+		}
+
+		Container diff;
+		diff.key = cont.key;
+		difference(cont, *bit, diff);
+		if (diff.card > 0)
+			out.push_back(std::move(diff));
+	}
+	c.mContainers.swap(out);
+}
+
+void RowBitmap::complement(const RowBitmap & a, uint32_t row_num, RowBitmap & c)
+{
+	// All rows, full words then the tail
+	RowBitmap all;
+	for (uint32_t key = 0; (uint64_t)key << ROW_BITMAP_CONTAINER_BITS < row_num; key++)
+	{
+		uint32_t begin = key << ROW_BITMAP_CONTAINER_BITS;
+		uint32_t num = std::min<uint32_t>(row_num - begin, LOW_MASK + 1);
+
+		std::vector<uint64_t> words(ROW_BITMAP_WORDS, 0);
+		std::fill(words.begin(), words.begin() + num / 64, ~0ull);
+		if (num % 64 != 0)
+			words[num / 64] = (1ull << (num % 64)) - 1;
+
+		Container cont;
+		cont.key = key;
+		set_words(cont, words);
+		all.mContainers.push_back(std::move(cont));
+	}
+	subtract(all, a, c);
+}
+
+void RowBitmap::image(std::vector<char>& buf) const
+{
+	uint32_t num = mContainers.size();
+	buf.insert(buf.end(), (const char *)&num, (const char *)&num + sizeof(uint32_t));
+	for (const Container & cont : mContainers)
+	{
+		buf.insert(buf.end(), (const char *)&cont.key, (const char *)&cont.key + sizeof(uint32_t));
+		buf.insert(buf.end(), (const char *)&cont.card, (const char *)&cont.card + sizeof(uint32_t));
+		if (cont.dense())
+			buf.insert(buf.end(), (const char *)cont.words.data(), (const char *)(cont.words.data() + ROW_BITMAP_WORDS));
+		else
+			buf.insert(buf.end(), (const char *)cont.array.data(), (const char *)(cont.array.data() + cont.card));
+	}
+}
+
+// Return false if data is not one whole image
+bool RowBitmap::load(const char * data, uint64_t size)
+{
+	const char *end = data + size;
+	uint32_t num;
+	if (size < sizeof(uint32_t))
+		return false;
+	memcpy(&num, data, sizeof(uint32_t));
+	data += sizeof(uint32_t);
+
+	std::vector<Container> containers(num);
+	for (Container & cont : containers)
+	{
+		if ((uint64_t)(end - data) < 2 * sizeof(uint32_t))
+			return false;
+		memcpy(&cont.key, data, sizeof(uint32_t));
+		memcpy(&cont.card, data + sizeof(uint32_t), sizeof(uint32_t));
+		data += 2 * sizeof(uint32_t);
+
+		// Dense iff card is above ROW_BITMAP_ARRAY_MAX, as set_words() keeps it
+		bool dense = cont.card > ROW_BITMAP_ARRAY_MAX;
+		uint64_t bytes = dense ? ROW_BITMAP_WORDS * sizeof(uint64_t) : (uint64_t)cont.card * sizeof(uint16_t);
+		if (cont.card > LOW_MASK + 1 || (uint64_t)(end - data) < bytes)
+			return false;
+		if (dense)
+		{
+			cont.words.resize(ROW_BITMAP_WORDS);
+			memcpy(cont.words.data(), data, bytes);
+		}
+		else
+		{
+			cont.array.resize(cont.card);
+			memcpy(cont.array.data(), data, bytes);
+		}
+		data += bytes;
+	}
+	if (data != end)
+		return false;
+
+	mContainers.swap(containers);
+	return true;
+}
+
+// Find or insert the container of key, keys are mostly ascending
+RowBitmap::Container & RowBitmap::container(uint32_t key)
+{
+	if (!mContainers.empty() && mContainers.back().key == key)
+		return mContainers.back();
+
+	auto it = mContainers.end();
+	if (!mContainers.empty() && mContainers.back().key > key)
+	{
+		it = std::lower_bound(mContainers.begin(), mContainers.end(), key,
+			[](const Container & cont, uint32_t k) { return cont.key < k; });
+		if (it->key == key)
+			return *it;
+	}
+
+	Container cont;
+	cont.key = key;
+	return *mContainers.insert(it, std::move(cont));
+}
+
+void RowBitmap::to_words(const Container & src, std::vector<uint64_t>& words)
+{
+	if (src.dense())
+	{
+		words = src.words;
+		return;
+	}
+	words.assign(ROW_BITMAP_WORDS, 0);
+	for (uint16_t low : src.array)
+		words[low / 64] |= 1ull << (low % 64);
+}
+
+// Take words, stored as array if sparse enough
+void RowBitmap::set_words(Container & dst, std::vector<uint64_t>& words)
+{
+	uint32_t card = 0;
+	for (uint64_t word : words)
+		card += popcount(word);
+
+	dst.card = card;
+	dst.array.clear();
+	if (card > ROW_BITMAP_ARRAY_MAX)
+	{
+		dst.words.swap(words);
+		return;
+	}
+
+	std::vector<uint64_t>().swap(dst.words);
+	dst.array.reserve(card);
+	for (uint32_t w = 0; w < ROW_BITMAP_WORDS; w++)
+	{
+		for (uint64_t word = words[w]; word != 0; word &= word - 1)
+			dst.array.push_back(w * 64 + ctz(word));
+	}
+}
+
+void RowBitmap::intersect(const Container & a, const Container & b, Container & c)
+{
+	if (a.dense() && b.dense())
+	{
+		std::vector<uint64_t> words(ROW_BITMAP_WORDS);
+		for (uint32_t w = 0; w < ROW_BITMAP_WORDS; w++)
+			words[w] = a.words[w] & b.words[w];
+		set_words(c, words);
+		return;
+	}
+
+	// Result is at most the sparse side, probe it into the other
+	if (a.dense() || b.dense())
+	{
+		const Container & sparse = a.dense() ? b : a;
+		const Container & dense = a.dense() ? a : b;
+		for (uint16_t low : sparse.array)
+			if ((dense.words[low / 64] >> (low % 64)) & 1)
+				c.array.push_back(low);
+	}
+	else
+	{
+		std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+			std::back_inserter(c.array));
+	}
+	c.card = c.array.size();
+}
+
+void RowBitmap::unite(const Container & a, const Container & b, Container & c)
+{
+	if (!a.dense() && !b.dense() && a.card + b.card <= ROW_BITMAP_ARRAY_MAX)
+	{
+		std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+			std::back_inserter(c.array));
+		c.card = c.array.size();
+		return;
+	}
+
+	std::vector<uint64_t> words;
+	to_words(a.dense() ? a : b, words);
+	const Container & other = a.dense() ? b : a;
+	if (other.dense())
+	{
+		for (uint32_t w = 0; w < ROW_BITMAP_WORDS; w++)
+			words[w] |= other.words[w];
+	}
+	else
+	{
+		for (uint16_t low : other.array)
+			words[low / 64] |= 1ull << (low % 64);
+	}
+	set_words(c, words);
+}
+
+void RowBitmap::difference(const Container & a, const Container & b, Container & c)
+{
+	if (!a.dense())
+	{
+		for (uint16_t low : a.array)
+		{
+			bool in_b = b.dense() ? ((b.words[low / 64] >> (low % 64)) & 1)
+				: std::binary_search(b.array.begin(), b.array.end(), low);
+			if (!in_b)
+				c.array.push_back(low);
+		}
+		c.card = c.array.size();
+		return;
+	}
+
+	std::vector<uint64_t> words = a.words;
+	if (b.dense())
+	{
+		for (uint32_t w = 0; w < ROW_BITMAP_WORDS; w++)
+			words[w] &= ~b.words[w];
+	}
+	else
+	{
+		for (uint16_t low : b.array)
+			words[low / 64] &= ~(1ull << (low % 64));
+	}
+	set_words(c, words);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "database_type.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define BITMAP_UNSUPPORT_MERGE_TYPE 0x1
+
+// Rows of a container share the high 16 bits of addr
+#define ROW_BITMAP_CONTAINER_BITS 16
+#define ROW_BITMAP_WORDS 1024
+
+// Containers up to this cardinality are sorted arrays, larger ones are bitsets
+#define ROW_BITMAP_ARRAY_MAX 4096
+
+/*
+	RowBitmap
+
+	compressed set of row addrs of one table, Roaring style:
+	addrs are split by their high 16 bits into containers,
+	a sparse container is a sorted array of low 16 bits,
+	a dense one is a 65536 bit bitset, so AND/OR/ANDNOT of dense
+	containers are word-parallel and a sparse one costs its size only
+
+	usage:
+		RowBitmap c;
+		RowBitmap::merge(a, AND, b, c);
+		c.for_each([&](uint32_t addr) { ... });
+*/
+class RowBitmap
+{
+	struct Container
+	{
+		Container() : key(0), card(0) {}
+
+		uint32_t key;					// high bits of addrs
+		uint32_t card;
+		std::vector<uint16_t> array;	// card <= ROW_BITMAP_ARRAY_MAX
+		std::vector<uint64_t> words;	// otherwise
+
+		inline bool dense() const { return !words.empty(); }
+	};
+public:
+	RowBitmap();
+	RowBitmap(const std::vector<uint32_t> &addrs);
+
+	// Ascending addrs are appended in O(1)
+	void add(uint32_t addr);
+	void add(const std::vector<uint32_t> &addrs);
+
+	bool contains(uint32_t addr) const;
+	uint64_t size() const;
+	bool empty() const { return mContainers.empty(); }
+	void clear() { mContainers.clear(); }
+
+	// Addrs in ascending order
+	template <class Func>
+	inline void for_each(Func func) const;
+	void to_addrs(std::vector<uint32_t> &addrs) const;
+
+	// c = a AND b, a OR b
+	static void merge(const RowBitmap &a, merge_type_t merge_type, const RowBitmap &b, RowBitmap &c);
+
+	// c = a AND NOT b
+	static void subtract(const RowBitmap &a, const RowBitmap &b, RowBitmap &c);
+
+	// c = addrs in [0, row_num) not in a
+	static void complement(const RowBitmap &a, uint32_t row_num, RowBitmap &c);
+
+	// Portable image appended to buf: container number, then key, card and array or words of each
+	void image(std::vector<char> &buf) const;
+	bool load(const char *data, uint64_t size);
+
+	static inline uint32_t popcount(uint64_t word);
+	static inline uint32_t ctz(uint64_t word);
+private:
+	std::vector<Container> mContainers;	// ascending key
+
+	Container &container(uint32_t key);
+	static void to_words(const Container &src, std::vector<uint64_t> &words);
+	static void set_words(Container &dst, std::vector<uint64_t> &words);
+	static void intersect(const Container &a, const Container &b, Container &c);
+	static void unite(const Container &a, const Container &b, Container &c);
+	static void difference(const Container &a, const Container &b, Container &c);
+};
+
+template<class Func>
+inline void RowBitmap::for_each(Func func) const
+{
+	for (const Container & cont : mContainers)
+	{
+		uint32_t high = cont.key << ROW_BITMAP_CONTAINER_BITS;
+		if (!cont.dense())
+		{
+			for (uint16_t low : cont.array)
+				func(high | low);
+			continue;
+		}
+
+		for (uint32_t w = 0; w < ROW_BITMAP_WORDS; w++)
+		{
+			for (uint64_t word = cont.words[w]; word != 0; word &= word - 1)
+				func(high | (w * 64 + ctz(word)));
+		}
+	}
+}
+
+inline uint32_t RowBitmap::popcount(uint64_t word)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (uint32_t)__popcnt64(word);
+#elif defined(_MSC_VER)
+	return __popcnt((uint32_t)word) + __popcnt((uint32_t)(word >> 32));
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+// Lowest set bit of a nonzero word
+inline uint32_t RowBitmap::ctz(uint64_t word)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long bit;
+	_BitScanForward64(&bit, word);
+	return bit;
+#elif defined(_MSC_VER)
+	unsigned long bit;
+	if (_BitScanForward(&bit, (uint32_t)word))
+		return bit;
+	_BitScanForward(&bit, (uint32_t)(word >> 32));
+	return bit + 32;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
@@ -0,0 +1,391 @@
+#include "ScanKernel.h"
+
+#include "system.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#endif
+
+#ifdef SCAN_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#define SCAN_TARGET_SSE2
+#define SCAN_TARGET_AVX2
+#else
+#include <immintrin.h>
+#define SCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Rows per output block, matched addrs are buffered on stack then appended
+#define SCAN_BLOCK_SIZE 1024
+
+typedef uint32_t *(*ConstKernel)(const int32_t *, uint32_t, uint32_t, int32_t, uint32_t *);
+typedef uint32_t *(*PairKernel)(const int32_t *, const int32_t *, uint32_t, uint32_t, uint32_t *);
+typedef uint32_t *(*RangeKernel)(const int32_t *, uint32_t, uint32_t, int32_t, int32_t, uint32_t *);
+
+template <relation_type_t REL>
+static inline bool match(int32_t a, int32_t b)
+{
+	switch (REL)
+	{
+	case EQ: return a == b;
+	case NEQ: return a != b;
+	case LESS: return a < b;
+	default: return a > b;
+	}
+}
+
+/*
+	Scalar kernels, branch free
+*/
+template <relation_type_t REL>
+static uint32_t *scan_const_scalar(const int32_t *values, uint32_t begin, uint32_t end, int32_t k, uint32_t *out)
+{
+	for (uint32_t i = begin; i < end; i++)
+	{
+		*out = i;
+		out += match<REL>(values[i], k);
+	}
+	return out;
+}
+
+template <relation_type_t REL>
+static uint32_t *scan_pair_scalar(const int32_t *a, const int32_t *b, uint32_t begin, uint32_t end, uint32_t *out)
+{
+	for (uint32_t i = begin; i < end; i++)
+	{
+		*out = i;
+		out += match<REL>(a[i], b[i]);
+	}
+	return out;
+}
+
+static uint32_t *scan_range_scalar(const int32_t *values, uint32_t begin, uint32_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+	for (uint32_t i = begin; i < end; i++)
+	{
+		*out = i;
+		out += (values[i] > lo) & (values[i] < hi);
+	}
+	return out;
+}
+
+#ifdef SCAN_X86
+static inline uint32_t *emit(uint32_t mask, uint32_t base, uint32_t *out)
+{
+	while (mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long bit;
+		_BitScanForward(&bit, mask);
+#else
+		uint32_t bit = __builtin_ctz(mask);
+#endif
+		*out++ = base + bit;
+		mask &= mask - 1;
+	}
+	return out;
+}
+
+/*
+	SSE2 kernels, 4 lanes
+*/
+template <relation_type_t REL>
+SCAN_TARGET_SSE2 static inline uint32_t mask_sse2(__m128i a, __m128i b)
+{
+	__m128i cmp;
+	switch (REL)
+	{
+	case EQ: case NEQ: cmp = _mm_cmpeq_epi32(a, b); break;
+	case LESS: cmp = _mm_cmpgt_epi32(b, a); break;
+	default: cmp = _mm_cmpgt_epi32(a, b); break;
+	}
+	uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(cmp));
+	return (REL == NEQ) ? (mask ^ 0xF) : mask;
+}
+
+template <relation_type_t REL>
+SCAN_TARGET_SSE2 static uint32_t *scan_const_sse2(const int32_t *values, uint32_t begin, uint32_t end, int32_t k, uint32_t *out)
+{
+	const __m128i kv = _mm_set1_epi32(k);
+	uint32_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+		out = emit(mask_sse2<REL>(v, kv), i, out);
+	}
+	return scan_const_scalar<REL>(values, i, end, k, out);
+}
+
+template <relation_type_t REL>
+SCAN_TARGET_SSE2 static uint32_t *scan_pair_sse2(const int32_t *a, const int32_t *b, uint32_t begin, uint32_t end, uint32_t *out)
+{
+	uint32_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		out = emit(mask_sse2<REL>(va, vb), i, out);
+	}
+	return scan_pair_scalar<REL>(a, b, i, end, out);
+}
+
+SCAN_TARGET_SSE2 static uint32_t *scan_range_sse2(const int32_t *values, uint32_t begin, uint32_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+	const __m128i lov = _mm_set1_epi32(lo);
+	const __m128i hiv = _mm_set1_epi32(hi);
+	uint32_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+		__m128i cmp = _mm_and_si128(_mm_cmpgt_epi32(v, lov), _mm_cmpgt_epi32(hiv, v));
+		out = emit(_mm_movemask_ps(_mm_castsi128_ps(cmp)), i, out);
+	}
+	return scan_range_scalar(values, i, end, lo, hi, out);
+}
+
+/*
+	AVX2 kernels, 8 lanes
+*/
+template <relation_type_t REL>
+SCAN_TARGET_AVX2 static inline uint32_t mask_avx2(__m256i a, __m256i b)
+{
+	__m256i cmp;
+	switch (REL)
+	{
+	case EQ: case NEQ: cmp = _mm256_cmpeq_epi32(a, b); break;
+	case LESS: cmp = _mm256_cmpgt_epi32(b, a); break;
+	default: cmp = _mm256_cmpgt_epi32(a, b); break;
+	}
+	uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(cmp));
+	return (REL == NEQ) ? (mask ^ 0xFF) : mask;
+}
+
+template <relation_type_t REL>
+SCAN_TARGET_AVX2 static uint32_t *scan_const_avx2(const int32_t *values, uint32_t begin, uint32_t end, int32_t k, uint32_t *out)
+{
+	const __m256i kv = _mm256_set1_epi32(k);
+	uint32_t i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+		out = emit(mask_avx2<REL>(v, kv), i, out);
+	}
+	return scan_const_scalar<REL>(values, i, end, k, out);
+}
+
+template <relation_type_t REL>
+SCAN_TARGET_AVX2 static uint32_t *scan_pair_avx2(const int32_t *a, const int32_t *b, uint32_t begin, uint32_t end, uint32_t *out)
+{
+	uint32_t i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		out = emit(mask_avx2<REL>(va, vb), i, out);
+	}
+	return scan_pair_scalar<REL>(a, b, i, end, out);
+}
+
+SCAN_TARGET_AVX2 static uint32_t *scan_range_avx2(const int32_t *values, uint32_t begin, uint32_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+	const __m256i lov = _mm256_set1_epi32(lo);
+	const __m256i hiv = _mm256_set1_epi32(hi);
+	uint32_t i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+		__m256i cmp = _mm256_and_si256(_mm256_cmpgt_epi32(v, lov), _mm256_cmpgt_epi32(hiv, v));
+		out = emit(_mm256_movemask_ps(_mm256_castsi256_ps(cmp)), i, out);
+	}
+	return scan_range_scalar(values, i, end, lo, hi, out);
+}
+#endif
+
+static ScanKernel::Isa detect_isa()
+{
+#ifdef SCAN_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// AVX2 also requires OS to save ymm registers
+	if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+			return ScanKernel::AVX2;
+	}
+	if (sse2)
+		return ScanKernel::SSE2;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return ScanKernel::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return ScanKernel::SSE2;
+#endif
+#endif
+	return ScanKernel::SCALAR;
+}
+
+template <relation_type_t REL>
+static ConstKernel select_const_kernel()
+{
+	switch (ScanKernel::isa())
+	{
+#ifdef SCAN_X86
+	case ScanKernel::AVX2: return scan_const_avx2<REL>;
+	case ScanKernel::SSE2: return scan_const_sse2<REL>;
+#endif
+	default: return scan_const_scalar<REL>;
+	}
+}
+
+template <relation_type_t REL>
+static PairKernel select_pair_kernel()
+{
+	switch (ScanKernel::isa())
+	{
+#ifdef SCAN_X86
+	case ScanKernel::AVX2: return scan_pair_avx2<REL>;
+	case ScanKernel::SSE2: return scan_pair_sse2<REL>;
+#endif
+	default: return scan_pair_scalar<REL>;
+	}
+}
+
+static RangeKernel select_range_kernel()
+{
+	switch (ScanKernel::isa())
+	{
+#ifdef SCAN_X86
+	case ScanKernel::AVX2: return scan_range_avx2;
+	case ScanKernel::SSE2: return scan_range_sse2;
+#endif
+	default: return scan_range_scalar;
+	}
+}
+
+ScanKernel::Isa ScanKernel::isa()
+{
+	static const Isa detected = detect_isa();
+	return detected;
+}
+
+const char * ScanKernel::isa_name()
+{
+	switch (isa())
+	{
+	case AVX2: return "AVX2";
+	case SSE2: return "SSE2";
+	default: return "SCALAR";
+	}
+}
+
+uint32_t ScanKernel::scan_int(
+	const int32_t * values,
+	uint32_t num,
+	relation_type_t rel_type,
+	int32_t k,
+	std::vector<uint32_t>& match_addrs)
+{
+	return scan_int(values, 0, num, rel_type, k, match_addrs);
+}
+
+uint32_t ScanKernel::scan_int(
+	const int32_t * values,
+	uint32_t begin,
+	uint32_t end,
+	relation_type_t rel_type,
+	int32_t k,
+	std::vector<uint32_t>& match_addrs)
+{
+	ConstKernel kernel;
+	switch (rel_type)
+	{
+	case EQ: kernel = select_const_kernel<EQ>(); break;
+	case NEQ: kernel = select_const_kernel<NEQ>(); break;
+	case LESS: kernel = select_const_kernel<LESS>(); break;
+	case LARGE: kernel = select_const_kernel<LARGE>(); break;
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unknown relation type.");
+	}
+
+	uint32_t block[SCAN_BLOCK_SIZE];
+	for (uint32_t block_begin = begin; block_begin < end; block_begin += SCAN_BLOCK_SIZE)
+	{
+		uint32_t block_end = (end - block_begin > SCAN_BLOCK_SIZE) ? block_begin + SCAN_BLOCK_SIZE : end;
+		uint32_t *out = kernel(values, block_begin, block_end, k, block);
+		match_addrs.insert(match_addrs.end(), block, out);
+	}
+	return match_addrs.size();
+}
+
+uint32_t ScanKernel::scan_int_range(
+	const int32_t * values,
+	uint32_t begin,
+	uint32_t end,
+	int32_t lo,
+	int32_t hi,
+	std::vector<uint32_t>& match_addrs)
+{
+	RangeKernel kernel = select_range_kernel();
+
+	uint32_t block[SCAN_BLOCK_SIZE];
+	for (uint32_t block_begin = begin; block_begin < end; block_begin += SCAN_BLOCK_SIZE)
+	{
+		uint32_t block_end = (end - block_begin > SCAN_BLOCK_SIZE) ? block_begin + SCAN_BLOCK_SIZE : end;
+		uint32_t *out = kernel(values, block_begin, block_end, lo, hi, block);
+		match_addrs.insert(match_addrs.end(), block, out);
+	}
+	return match_addrs.size();
+}
+
+uint32_t ScanKernel::scan_int(
+	const int32_t * a,
+	relation_type_t rel_type,
+	const int32_t * b,
+	uint32_t num,
+	std::vector<uint32_t>& match_addrs)
+{
+	return scan_int(a, rel_type, b, 0, num, match_addrs);
+}
+
+uint32_t ScanKernel::scan_int(
+	const int32_t * a,
+	relation_type_t rel_type,
+	const int32_t * b,
+	uint32_t begin,
+	uint32_t end,
+	std::vector<uint32_t>& match_addrs)
+{
+	PairKernel kernel;
+	switch (rel_type)
+	{
+	case EQ: kernel = select_pair_kernel<EQ>(); break;
+	case NEQ: kernel = select_pair_kernel<NEQ>(); break;
+	case LESS: kernel = select_pair_kernel<LESS>(); break;
+	case LARGE: kernel = select_pair_kernel<LARGE>(); break;
+	default:
+		throw exception_t(UNKNOWN_RELATION_TYPE, "Unknown relation type.");
+	}
+
+	uint32_t block[SCAN_BLOCK_SIZE];
+	for (uint32_t block_begin = begin; block_begin < end; block_begin += SCAN_BLOCK_SIZE)
+	{
+		uint32_t block_end = (end - block_begin > SCAN_BLOCK_SIZE) ? block_begin + SCAN_BLOCK_SIZE : end;
+		uint32_t *out = kernel(a, b, block_begin, block_end, block);
+		match_addrs.insert(match_addrs.end(), block, out);
+	}
+	return match_addrs.size();
+}
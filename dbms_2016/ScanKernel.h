@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "database_type.h"
+
+/*
+	ScanKernel
+
+	predicate kernels over a contiguous int32 column,
+	AVX2 / SSE2 / scalar implementation is selected at runtime
+*/
+namespace ScanKernel
+{
+	enum Isa
+	{
+		SCALAR, SSE2, AVX2
+	};
+
+	Isa isa();
+	const char *isa_name();
+
+	// values[i] rel k
+	uint32_t scan_int(
+		const int32_t *values,
+		uint32_t num,
+		relation_type_t rel_type,
+		int32_t k,
+		std::vector<uint32_t> &match_addrs);
+
+	// values[i] rel k, i in [begin, end)
+	uint32_t scan_int(
+		const int32_t *values,
+		uint32_t begin,
+		uint32_t end,
+		relation_type_t rel_type,
+		int32_t k,
+		std::vector<uint32_t> &match_addrs);
+
+	// lo < values[i] < hi, i in [begin, end), both bounds in one pass
+	uint32_t scan_int_range(
+		const int32_t *values,
+		uint32_t begin,
+		uint32_t end,
+		int32_t lo,
+		int32_t hi,
+		std::vector<uint32_t> &match_addrs);
+
+	// a[i] rel b[i]
+	uint32_t scan_int(
+		const int32_t *a,
+		relation_type_t rel_type,
+		const int32_t *b,
+		uint32_t num,
+		std::vector<uint32_t> &match_addrs);
+
+	// a[i] rel b[i], i in [begin, end)
+	uint32_t scan_int(
+		const int32_t *a,
+		relation_type_t rel_type,
+		const int32_t *b,
+		uint32_t begin,
+		uint32_t end,
+		std::vector<uint32_t> &match_addrs);
+}
@@ -5,20 +5,17 @@
 #include "DiskFile.h"
 #include "database_type.h"
 #include "database_util.h"
+#include "MappedFile.h"
 
 #define SEQFILE_UNEXPECTED_TYPE 0x1
 #define SEQFILE_BAD_POS 0x2
 #define SEQFILE_STRING_MAX_LEN 64
 
-enum SequenceElementType
-{
-	SEQ_INT, SEQ_VARCHAR
-};
-
 /*
 	SequenceFile
 
 	No paging mechnisim file, fast sequential read/write
+	on-disk format is DatFile, loaded through a memory mapping
 
 	In memory, just a vector
 */
@@ -52,7 +49,7 @@ private:
 	TypeVector mTypes;
 	SizeVector mSizes;
 
-	inline bool read_tuple();
+	inline E decode(const char *value, int i, uint32_t size);
 };
 
 template<class E>
@@ -99,80 +96,138 @@ inline void SequenceFile<E>::init(const SequenceElementType * types, SizeVector
 	mSizes.assign(sizes.begin(), sizes.end());
 }
 
+/*
+	SequenceFile::write_back()
+
+	write tuples in DatFile format, one column block at a time
+*/
 template<class E>
 inline void SequenceFile<E>::write_back()
 {	
 	assert(!mTypes.empty());
 
-	fseek(mFile, 0, SEEK_SET);
 	const int tuple_size = mTypes.size();
-	
-	int ival;
-	char sval[ATTR_SIZE_MAX + 2];
+	const uint32_t row_num = mTuples.size();
+
+	std::vector<DatFile::Block> blocks;
+	DatFile::write_header(mFile, mTypes.data(), mSizes.data(), tuple_size, row_num, NULL, blocks);
 
-	for (TupleVector::iterator it = mTuples.begin(); it != mTuples.end(); it++)
+	std::vector<char> block;
+	for (int i = 0; i < tuple_size; i++)
 	{
-		std::stringstream ss;
-		const Tuple & tuple = *it;
+		const uint32_t width = DatFile::width(mTypes[i], mSizes[i]);
+		block.assign((size_t)width * row_num, 0);
 
-		for (int i = 0; i < tuple_size; i++)
+		for (uint32_t r = 0; r < row_num; r++)
 		{
+			char *value = &block[(size_t)r * width];
 			if (mTypes[i] == SEQ_INT)
 			{
-				ival = tuple[i].Int();
-				fwrite(&ival, mSizes[i], 1, mFile);
+				int32_t ival = mTuples[r][i].Int();
+				memcpy(value, &ival, sizeof(int32_t));
 			}
-			else if(mTypes[i] == SEQ_VARCHAR)
+			else if (mTypes[i] == SEQ_VARCHAR)
 			{
-				memset(sval, 0, ATTR_SIZE_MAX + 2);
-				strncpy(sval, tuple[i].Varchar(), ATTR_SIZE_MAX);
-				fwrite(sval, mSizes[i], 1, mFile);
+				strncpy(value, mTuples[r][i].Varchar(), width - 1);
 			}
 		}
 
-		//fprintf(mFile, "%s\n", ss.str().c_str());
+		DatFile::pad_to(mFile, blocks[i].offset);
+		fwrite(block.data(), 1, block.size(), mFile);
 	}
+	fflush(mFile);
 }
 
-template<class E>
-inline void SequenceFile<E>::read_from()
-{
-	fseek(mFile, 0, SEEK_SET);
-	while (read_tuple());
-}
+/*
+	SequenceFile::read_from()
 
+	map data file and decode tuples from memory,
+	files written before DatFile are decoded row by row
+*/
 template<class E>
-inline bool SequenceFile<E>::read_tuple()
+inline void SequenceFile<E>::read_from()
 {
 	assert(!mTypes.empty());
 
-	int ival = 0;
-	char sval[ATTR_SIZE_MAX + 2];
-
-	Tuple tuple;
-	tuple.resize(mTypes.size());
+	MappedFile file;
+	if (!file.map(mFilepath.c_str()))
+		return;
 
-	for (int i = 0; i < mTypes.size(); i++)
+	if (DatFile::match(file))
 	{
-		switch (mTypes[i])
+		std::vector<DatFile::BlockRef> blocks;
+		uint32_t row_num = DatFile::parse(file, mTypes.data(), mSizes.data(), mTypes.size(), blocks);
+
+		mTuples.resize(row_num);
+		for (uint32_t r = 0; r < row_num; r++)
+			mTuples[r].resize(mTypes.size());
+
+		for (int i = 0; i < mTypes.size(); i++)
 		{
-		case SEQ_INT:
-			if (fread(&ival, mSizes[i], 1, mFile) == 0)
-				return false;
-			tuple[i] = ival;
-			break;
-		case SEQ_VARCHAR:
-			memset(sval, 0, ATTR_SIZE_MAX + 2);
-			if (fread(sval, mSizes[i], 1, mFile) == 0)
-				return false;
-			tuple[i] = sval;
-			break;
-		default:
-			throw exception_t(SEQFILE_UNEXPECTED_TYPE, "Unexpected type");
+			const uint32_t width = DatFile::width(mTypes[i], mSizes[i]);
+			const uint32_t size = (mTypes[i] == SEQ_VARCHAR) ? width - 1 : width;	// VARCHAR keeps a terminating byte
+			const DatFile::BlockRef & block = blocks[i];
+			if (block.encoding == DatFile::DICT_ENCODING)
+			{
+				// Written by ColumnFile, decode each distinct value once
+				std::vector<E> dict(block.dictNum);
+				for (uint32_t d = 0; d < block.dictNum; d++)
+					dict[d] = decode(block.dict + (size_t)d * width, i, size);
+
+				const int32_t *codes = (const int32_t *)block.data;
+				for (uint32_t r = 0; r < row_num; r++)
+				{
+					if ((uint32_t)codes[r] >= block.dictNum)
+						throw exception_t(MAPFILE_BAD_FORMAT, "Corrupted dictionary code");
+					mTuples[r][i] = dict[codes[r]];
+				}
+			}
+			else
+			{
+				for (uint32_t r = 0; r < row_num; r++)
+					mTuples[r][i] = decode(block.data + (size_t)r * width, i, size);
+			}
 		}
 	}
+	else
+	{
+		uint32_t rowsize = 0;
+		for (uint32_t size : mSizes)
+			rowsize += size;
 
-	mTuples.push_back(tuple);
+		uint32_t row_num = file.size() / rowsize;
+		mTuples.resize(row_num);
+		for (uint32_t r = 0; r < row_num; r++)
+		{
+			const char *row = file.data() + (size_t)r * rowsize;
+			mTuples[r].resize(mTypes.size());
+			for (int i = 0; i < mTypes.size(); i++)
+			{
+				mTuples[r][i] = decode(row, i, mSizes[i]);
+				row += mSizes[i];
+			}
+		}
+	}
+}
 
-	return true;
+template<class E>
+inline E SequenceFile<E>::decode(const char *value, int i, uint32_t size)
+{
+	switch (mTypes[i])
+	{
+	case SEQ_INT:
+	{
+		int32_t ival = 0;
+		memcpy(&ival, value, std::min<uint32_t>(size, sizeof(int32_t)));
+		return E(ival);
+	}
+	case SEQ_VARCHAR:
+	{
+		char sval[ATTR_SIZE_MAX + 2] = { 0 };
+		memcpy(sval, value, strnlen(value, std::min<uint32_t>(size, ATTR_SIZE_MAX)));
+		return E(sval);
+	}
+	default:
+		throw exception_t(SEQFILE_UNEXPECTED_TYPE, "Unexpected type");
+	}
 }
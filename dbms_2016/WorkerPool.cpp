@@ -0,0 +1,115 @@
+#include "WorkerPool.h"
+
+#include "system.h"
+
+// Set on pool threads, nested run() executes inline
+static thread_local bool tInWorker = false;
+
+WorkerPool & WorkerPool::instance()
+{
+	static WorkerPool pool((workers > 0) ? workers : std::thread::hardware_concurrency());
+	return pool;
+}
+
+WorkerPool::WorkerPool(int worker_num) :
+	mWorkerNum((worker_num > 0) ? worker_num : 1), mStop(false), mGeneration(0),
+	mTask(NULL), mNum(0), mMorselNum(0), mNextMorsel(0), mBusy(0)
+{
+	// Calling thread is worker 0
+	for (int i = 1; i < mWorkerNum; i++)
+		mThreads.emplace_back(&WorkerPool::work, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	for (auto & thread : mThreads)
+		thread.join();
+}
+
+void WorkerPool::run(uint32_t num, const Task & task)
+{
+	uint32_t morsels = morsel_num(num);
+
+	// Not worth waking workers
+	if (morsels <= 1 || mWorkerNum == 1 || tInWorker)
+	{
+		for (uint32_t id = 0; id < morsels; id++)
+		{
+			uint32_t begin = id * MORSEL_SIZE;
+			task({ 0, id, begin, (num - begin > MORSEL_SIZE) ? begin + MORSEL_SIZE : num });
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTask = &task;
+		mNum = num;
+		mMorselNum = morsels;
+		mNextMorsel = 0;
+		mBusy = mWorkerNum;
+		mError = std::exception_ptr();
+		mGeneration++;
+	}
+	mWake.notify_all();
+
+	tInWorker = true;
+	consume(0);
+	tInWorker = false;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mBusy--;
+	mDone.wait(lock, [this] { return mBusy == 0; });
+	mTask = NULL;
+
+	if (mError)
+		std::rethrow_exception(mError);
+}
+
+void WorkerPool::work(int worker)
+{
+	tInWorker = true;
+	uint64_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [&] { return mStop || mGeneration != seen; });
+			if (mStop)
+				return;
+			seen = mGeneration;
+		}
+
+		consume(worker);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (--mBusy == 0)
+			mDone.notify_all();
+	}
+}
+
+void WorkerPool::consume(int worker)
+{
+	for (uint32_t id = mNextMorsel++; id < mMorselNum; id = mNextMorsel++)
+	{
+		uint32_t begin = id * MORSEL_SIZE;
+		uint32_t end = (mNum - begin > MORSEL_SIZE) ? begin + MORSEL_SIZE : mNum;
+		try
+		{
+			(*mTask)({ worker, id, begin, end });
+		}
+		catch (...)
+		{
+			// Keep the first error, skip the remaining morsels
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mError)
+				mError = std::current_exception();
+			mNextMorsel = mMorselNum;
+		}
+	}
+}
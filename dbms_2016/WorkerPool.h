@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+// Rows of a table processed by one task
+#define MORSEL_SIZE 16384
+
+/*
+	Morsel
+
+	rows [begin, end) of the id-th morsel, run by worker
+	worker is in [0, WorkerPool::size()), the calling thread is worker 0
+*/
+struct Morsel
+{
+	int worker;
+	uint32_t id;
+	uint32_t begin;
+	uint32_t end;
+};
+
+/*
+	WorkerPool
+
+	morsel-driven parallelism, split [0, num) into morsels,
+	idle workers take the next morsel until none is left,
+	tasks keep their results in per-morsel or per-worker buffers
+	usage:
+		std::vector<std::vector<uint32_t>> bufs(WorkerPool::morsel_num(n));
+		WorkerPool::instance().run(n, [&](const Morsel &m) { ... bufs[m.id] ... });
+*/
+class WorkerPool
+{
+public:
+	typedef std::function<void(const Morsel &)> Task;
+
+	static WorkerPool &instance();
+
+	// Block until task is done on every morsel of [0, num)
+	void run(uint32_t num, const Task &task);
+
+	int size() const { return mWorkerNum; }
+
+	static uint32_t morsel_num(uint32_t num) { return (num + MORSEL_SIZE - 1) / MORSEL_SIZE; }
+
+	// Concatenate per-morsel buffers in morsel order
+	template <class T>
+	static void gather(std::vector<std::vector<T>> &buffers, std::vector<T> &out);
+private:
+	WorkerPool(int worker_num);
+	~WorkerPool();
+
+	int mWorkerNum;
+	std::vector<std::thread> mThreads;
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	bool mStop;
+	uint64_t mGeneration;
+
+	// Current job
+	const Task *mTask;
+	uint32_t mNum;
+	uint32_t mMorselNum;
+	std::atomic<uint32_t> mNextMorsel;
+	int mBusy;
+	std::exception_ptr mError;
+
+	void work(int worker);
+	void consume(int worker);
+};
+
+template <class T>
+inline void WorkerPool::gather(std::vector<std::vector<T>> &buffers, std::vector<T> &out)
+{
+	size_t total = out.size();
+	for (auto & buffer : buffers)
+		total += buffer.size();
+	out.reserve(total);
+
+	for (auto & buffer : buffers)
+	{
+		out.insert(out.end(), buffer.begin(), buffer.end());
+		std::vector<T>().swap(buffer);
+	}
+}
@@ -20,10 +20,23 @@ struct table_attr_desc_t
 	unsigned char constraint;
 };
 
+/*
+	table_layout_t
+
+	in-memory layout of table data
+	ROW_LAYOUT: tuple vector (SequenceFile)
+	COLUMN_LAYOUT: one array per attribute (ColumnFile)
+*/
+enum table_layout_t
+{
+	ROW_LAYOUT = 0,
+	COLUMN_LAYOUT = 1
+};
+
 /*
 	table_header_t
 
-	store table name, number of attribute
+	store table name, number of attribute, data layout
 */
 struct table_header_t
 {
@@ -31,6 +44,53 @@ struct table_header_t
 	unsigned int attrNum;
 	unsigned int rowsize;
 	int primaryKeyIndex;
+	table_layout_t layout;
+};
+
+/*
+	table_file_tag_t
+
+	leads a LightTableFile (.tbl) since table_header_t has layout,
+	files without it start with table_legacy_header_t and are ROW_LAYOUT
+	magic ends with 0x7f, which no table name starts with
+*/
+#define TABLEFILE_MAGIC 0x7f4c5442
+#define TABLEFILE_VERSION 1
+#define TABLEFILE_VERSION_STATS 1	// table_column_stat_t of each attr follow attr descs
+
+struct table_file_tag_t
+{
+	unsigned int magic;
+	unsigned int version;
+};
+
+// table_header_t of files without table_file_tag_t
+struct table_legacy_header_t
+{
+	char name[TABLE_NAME_MAX];
+	unsigned int attrNum;
+	unsigned int rowsize;
+	int primaryKeyIndex;
+};
+
+/*
+	table_column_stat_t
+
+	statistics of one attribute, stored after attribute descs
+	from TABLEFILE_VERSION_STATS on, older table files have none
+	rowNum: number of rows when analyzed (0 means not analyzed)
+	distinctNum: number of distinct values
+	minValue, maxValue, bounds: INTEGER only, bounds is an equi-depth histogram
+*/
+#define STAT_HISTOGRAM_BUCKETS 16
+
+struct table_column_stat_t
+{
+	unsigned int rowNum;
+	unsigned int distinctNum;
+	int minValue;
+	int maxValue;
+	int bounds[STAT_HISTOGRAM_BUCKETS + 1];
 };
 
 /*
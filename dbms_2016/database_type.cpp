@@ -1,5 +1,8 @@
 #include "database_type.h"
 
+#include <mutex>
+#include <string>
+
 const char *kAttrTypeNames[] = { "NULL", "INTEGER", "VARCHAR" };
 
 unary_op_type_t operator -(const unary_op_type_t u)
@@ -14,4 +17,29 @@ unary_op_type_t operator *(const unary_op_type_t a, const unary_op_type_t b)
 
 inline c_unique::c_unique() { current = 0; }
 
-inline int c_unique::operator()() { return ++current; }
\ No newline at end of file
+inline int c_unique::operator()() { return ++current; }
+
+#define STRING_POOL_SHARDS 16
+
+struct StringPoolShard
+{
+	std::mutex lock;
+	std::unordered_set<std::string> strings;
+};
+
+/*
+	StringPool::intern()
+
+	sharded by hash so parallel scans materializing tuples rarely wait,
+	unordered_set nodes never move, c_str() of an element is stable
+*/
+const char * StringPool::intern(const char * str, size_t len)
+{
+	static StringPoolShard shards[STRING_POOL_SHARDS];
+
+	std::string key(str, len);
+	StringPoolShard & shard = shards[std::hash<std::string>{}(key) % STRING_POOL_SHARDS];
+
+	std::lock_guard<std::mutex> guard(shard.lock);
+	return shard.strings.insert(std::move(key)).first->c_str();
+}
@@ -8,6 +8,7 @@
 #include <stack>
 #include <iostream>
 #include <cassert>
+#include <cstring>
 
 #define ATTR_NUM_MAX 5
 #define ATTR_NAME_MAX 45
@@ -54,9 +55,10 @@ enum unary_op_type_t
 	POS, NEG
 };
 
+// RANGE is LARGE and LESS on one attribute fused into a Predicate
 enum relation_type_t
 {
-	EQ, NEQ, LESS, LARGE
+	EQ, NEQ, LESS, LARGE, RANGE
 };
 
 enum merge_type_t
@@ -71,105 +73,93 @@ enum attr_domain_t
 	UNDEFINED_DOMAIN
 };
 
+// Type of a stored column, used by SequenceFile and ColumnFile
+enum SequenceElementType
+{
+	SEQ_INT, SEQ_VARCHAR
+};
+
 unary_op_type_t operator -(const unary_op_type_t u);
 
 unary_op_type_t operator *(const unary_op_type_t a, const unary_op_type_t b);
 
+// Varchar up to this length is stored inside attr_t, longer one is interned in StringPool
+#define ATTR_INLINE_MAX 14
+
+/*
+	StringPool
+
+	process-wide dictionary of long varchar values,
+	equal strings are interned to one pointer which lives until exit,
+	so the pointer is a handle that can be compared and hashed directly
+
+	nothing is ever freed: long literals of every query and long keys of
+	ColumnFile dictionaries stay interned after their tables are closed,
+	memory grows with the distinct long strings the process has seen
+*/
+class StringPool
+{
+public:
+	static const char *intern(const char *str, size_t len);
+};
+
+/*
+	attr_t
+
+	16-byte value: integer, varchar of at most ATTR_INLINE_MAX chars inline,
+	or handle of an interned varchar. Unused bytes are always zero,
+	so equality compares two words without looking at strings
+*/
 struct attr_t
 {
 	union attr_value_t
 	{
 		int integer;
-		char varchar[ATTR_SIZE_MAX];
-		attr_value_t(int _val) : integer(_val) {}
-		attr_value_t(const char *_str) : varchar{ 0 }
-		{
-#ifdef _STRDUP_VER_
-			varchar = _strdup(_str); 
-#else
-			strncpy(varchar, _str, ATTR_SIZE_MAX);
-#endif
-		}
-
-		attr_value_t() : varchar{0} {}
-		~attr_value_t() {}
-
-		attr_value_t& operator=(int _val)
-		{
-			integer = _val;
-			return *this;
-		}
-
-		attr_value_t& operator=(const char *_val)
-		{
-#ifdef _STRDUP_VER_
-			varchar = _strdup(_str);
-#else
-			strncpy(varchar, _val, ATTR_SIZE_MAX);
-#endif
-			return *this;
-		}
+		const char *interned;
+		char varchar[ATTR_INLINE_MAX + 2];	// Last byte is tag
+		uint64_t words[2];
 	};
 
 public:
-	attr_t(int _val) : value(_val), domain(INTEGER_DOMAIN) {}
+	attr_t(int _val) { set_int(_val); }
 
-	attr_t(const char *_str) : value(_str), domain(VARCHAR_DOMAIN) {}
+	attr_t(const char *_str) { set_varchar(_str); }
 
-	attr_t(const attr_t& _attr) : domain(_attr.domain)
-	{
-		if (_attr.domain == INTEGER_DOMAIN) value = _attr.value.integer;
-		else if (_attr.domain == VARCHAR_DOMAIN) value = _attr.value.varchar;
-	}
+	attr_t(const attr_t& _attr) = default;
 
-	attr_t() : domain(UNDEFINED_DOMAIN) {}
+	attr_t() { clear(UNDEFINED_DOMAIN); }
 
 	~attr_t() {}
 
 	inline size_t size()
 	{
-		return (domain == INTEGER_DOMAIN) ? sizeof(int) :
-			(domain == VARCHAR_DOMAIN) ? strlen(value.varchar) :
+		return (Domain() == INTEGER_DOMAIN) ? sizeof(int) :
+			(Domain() == VARCHAR_DOMAIN) ? strlen(Varchar()) :
 			0;
 	}
 
 	inline void init_as(attr_domain_t _domain)
 	{
-		domain = _domain;
+		clear(_domain);
 	}
 
-	inline attr_domain_t Domain() const { return domain; }
+	inline attr_domain_t Domain() const { return (attr_domain_t)(tag() & ATTR_TAG_DOMAIN); }
 	inline int Int() const { return value.integer; }
-	inline const char *Varchar() const { return value.varchar; }
+	inline const char *Varchar() const { return (tag() & ATTR_TAG_INTERNED) ? value.interned : value.varchar; }
 
-	attr_t &operator=(const attr_t& _attr)
-	{
-		domain = _attr.domain;
-		if (domain == INTEGER_DOMAIN) value = _attr.value.integer;
-		else if (_attr.domain == VARCHAR_DOMAIN) value = _attr.value.varchar;
-		return *this;
-	}
+	attr_t &operator=(const attr_t& _attr) = default;
 
-	attr_t &operator=(int _val) { domain = INTEGER_DOMAIN; value = _val; return (*this); }
-	attr_t &operator=(const char *_val)
-	{
-#ifdef _STRDUP_VER_
-		if (domain == VARCHAR_DOMAIN)
-			delete value.varchar;
-#endif
-		domain = VARCHAR_DOMAIN;
-		value = _val;
-		return (*this);
-	}
+	attr_t &operator=(int _val) { set_int(_val); return (*this); }
+	attr_t &operator=(const char *_val) { set_varchar(_val); return (*this); }
 
 	friend std::ostream& operator <<(std::ostream& os, const attr_t &attr)
 	{
-		switch (attr.domain)
+		switch (attr.Domain())
 		{
 		case INTEGER_DOMAIN:
 			return os << attr.value.integer;
 		case VARCHAR_DOMAIN:
-			return os << ((attr.value.varchar[0] != '\0') ? attr.value.varchar : "NULL");
+			return os << ((attr.Varchar()[0] != '\0') ? attr.Varchar() : "NULL");
 		default:
 			return os << "null";
 		}
@@ -191,18 +181,10 @@ public:
 		else return false;
 	}
 
+	// Domain, inline chars and interned handle are all in the two words
 	inline friend bool operator==(const attr_t &a, const attr_t &b)
 	{
-		if (a.Domain() != b.Domain()) return false;
-		switch (a.domain)
-		{
-		case INTEGER_DOMAIN:
-			return a.value.integer == b.value.integer;
-		case VARCHAR_DOMAIN:
-			return strncmp(a.value.varchar, b.value.varchar, ATTR_SIZE_MAX) == 0;
-		default: // NULL TYPE
-			return true;
-		}
+		return a.value.words[0] == b.value.words[0] && a.value.words[1] == b.value.words[1];
 	}
 
 	inline friend bool operator!=(const attr_t &a, const attr_t &b)
@@ -212,29 +194,70 @@ public:
 
 	inline attr_t operator -()
 	{
-		if (domain != INTEGER_DOMAIN)
+		if (Domain() != INTEGER_DOMAIN)
 			throw ATTR_UNSUPPORTED_OP;
 		return attr_t(-value.integer);
 	}
 	
 	inline attr_t operator *(const unary_op_type_t op)
 	{
-		if (domain != INTEGER_DOMAIN)
+		if (Domain() != INTEGER_DOMAIN)
 			throw ATTR_UNSUPPORTED_OP;
 		return (op == POS) ? attr_t(value.integer) : attr_t(-value.integer);
 	}
+
+	friend struct attr_t_hash;
 private:
-	attr_domain_t domain;
+	static const uint8_t ATTR_TAG_DOMAIN = 0x3;
+	static const uint8_t ATTR_TAG_INTERNED = 0x4;
+
 	attr_value_t value;
+
+	inline uint8_t tag() const { return (uint8_t)value.varchar[ATTR_INLINE_MAX + 1]; }
+
+	inline void clear(attr_domain_t _domain)
+	{
+		value.words[0] = 0;
+		value.words[1] = 0;
+		value.varchar[ATTR_INLINE_MAX + 1] = (char)_domain;
+	}
+
+	inline void set_int(int _val)
+	{
+		clear(INTEGER_DOMAIN);
+		value.integer = _val;
+	}
+
+	inline void set_varchar(const char *_str)
+	{
+		size_t len = 0;
+		while (len < ATTR_SIZE_MAX && _str[len] != '\0')
+			len++;
+
+		clear(VARCHAR_DOMAIN);
+		if (len <= ATTR_INLINE_MAX)
+		{
+			memcpy(value.varchar, _str, len);
+		}
+		else
+		{
+			value.interned = StringPool::intern(_str, len);
+			value.varchar[ATTR_INLINE_MAX + 1] |= ATTR_TAG_INTERNED;
+		}
+	}
 };
 
+static_assert(sizeof(attr_t) == 16, "attr_t should be two words");
+
 struct attr_t_hash {
 	size_t operator() (const attr_t &attr) const {
 		assert(attr.Domain() != UNDEFINED_DOMAIN);
 		if (attr.Domain() == INTEGER_DOMAIN)
 			return std::hash<int>{}(attr.Int());
-		else
-			return std::hash<std::string>{}(attr.Varchar());
+
+		// Inline chars or interned handle, never the string itself
+		uint64_t h = (attr.value.words[0] * 0x9E3779B97F4A7C15ULL) ^ attr.value.words[1];
+		return (size_t)(h ^ (h >> 29));
 	}
 };
 
@@ -248,4 +271,31 @@ struct addr_pair_hash {
 	}
 };
 
+/*
+	AddrPairSink
+
+	consumer of join output, receives each matched (a addr, b addr) once
+*/
+class AddrPairSink
+{
+public:
+	virtual ~AddrPairSink() {}
+	virtual void put(uint32_t a_addr, uint32_t b_addr) = 0;
+};
+
+/*
+	AddrPairCollector
+
+	sink which stores pairs into a vector
+*/
+class AddrPairCollector
+	: public AddrPairSink
+{
+public:
+	AddrPairCollector(std::vector<AddrPair> &pairs) : mPairs(pairs) {}
+	void put(uint32_t a_addr, uint32_t b_addr) { mPairs.emplace_back(a_addr, b_addr); }
+private:
+	std::vector<AddrPair> &mPairs;
+};
+
 
@@ -26,6 +26,9 @@
 #include "LightTableFile.h"
 #include "LightTable.h"
 #include "DatabaseLite.h"
+#include "ScanKernel.h"
+#include "WorkerPool.h"
+#include "Benchmark.h"
 
 #include "test.h"
 
@@ -285,6 +288,93 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (i < argc)
+	{
+		if (strcmp("-c", argv[i]) == 0)
+		{
+			i++;
+			columnar = true;
+		}
+	}
+
+	if (i < argc)
+	{
+		if (strcmp("-t", argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				workers = atoi(argv[i++]);
+		}
+	}
+
+	// -f tsv|csv|bin, format of select results
+	ResultFormat format = TSV_FORMAT;
+	if (i + 1 < argc)
+	{
+		if (strcmp("-f", argv[i]) == 0)
+		{
+			const char *name = argv[i + 1];
+			if (strcmp(name, "tsv") == 0)
+				format = TSV_FORMAT;
+			else if (strcmp(name, "csv") == 0)
+				format = CSV_FORMAT;
+			else if (strcmp(name, "bin") == 0)
+				format = BINARY_FORMAT;
+			else
+			{
+				Error("Unknown result format %s, use -f tsv|csv|bin\n", name);
+				return -1;
+			}
+			i += 2;
+		}
+	}
+
+	// -o <path>, select results to a file instead of stdout
+	static std::ofstream result_file;
+	if (i + 1 < argc && strcmp("-o", argv[i]) == 0)
+	{
+		result_file.open(argv[i + 1], std::ios::out | std::ios::binary);
+		if (!result_file)
+		{
+			Error("Cannot open %s\n", argv[i + 1]);
+			return -1;
+		}
+		i += 2;
+	}
+	gDb.set_output(result_file.is_open() ? result_file : std::cout, format);
+
+	// -b <rows> <out.json> [baseline.json]
+	if (i + 2 < argc)
+	{
+		if (strcmp("-b", argv[i]) == 0)
+		{
+			Benchmark bench(strtoull(argv[i + 1], NULL, 10));
+			const char *json_path = argv[i + 2];
+			const char *baseline_path = (i + 3 < argc) ? argv[i + 3] : NULL;
+
+			int regressions = 0;
+			try
+			{
+				bench.run();
+				bench.write_json(json_path);
+				if (baseline_path != NULL)
+					regressions = bench.compare(baseline_path);
+			}
+			catch (exception_t e)
+			{
+				Error("Benchmark failed: %s\n", e.msg.c_str());
+				return -1;
+			}
+			return regressions > 0 ? 1 : 0;
+		}
+	}
+
+	if (report)
+	{
+		printf("Scan kernel: %s\n", ScanKernel::isa_name());
+		printf("Workers: %d\n", WorkerPool::instance().size());
+	}
+
 	for (; i < argc; i++)
 	{
 		if(interactive)
@@ -14,6 +14,8 @@ bool quiet = false;
 bool pause_at_exit = true;
 bool interactive = false;
 bool report = false;
+bool columnar = false;
+int workers = 0; // 0: one per hardware thread
 
 void fatal_error()
 {
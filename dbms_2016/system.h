@@ -12,6 +12,8 @@ extern bool quiet;
 extern bool pause_at_exit;
 extern bool interactive;
 extern bool report;
+extern bool columnar;
+extern int workers;
 
 extern std::streambuf *console_out;
 
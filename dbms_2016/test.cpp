@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 #include <ctime>
+#include <sstream>
 
 #include "DataPage.h"
 #include "BitmapPageFreeMapFile.h"
@@ -12,6 +13,8 @@
 #include "DatabaseFile.h"
 #include "Bit.h"
 #include "Database.h"
+#include "ColumnFile.h"
+#include "DatabaseLite.h"
 
 #include "SQLParser.h"
 #include "SQLParserResult.h"
@@ -440,4 +443,96 @@ void test_dbms_table_iterator()
 		rt1->print_record(pDescs, 4, record1);
 	}
 	printf("Count: %d\n", count);
-}
\ No newline at end of file
+}
+
+/*
+	test_columnfile_upgrade_plain()
+
+	DATFILE_VERSION_PLAIN file of VARCHAR(40), INTEGER, INTEGER
+	is rewritten with a dictionary on write_back(), values must survive it
+	distinct names make the dictionary cover the old INTEGER blocks
+*/
+void test_columnfile_upgrade_plain()
+{
+	struct PlainBlock { uint32_t type; uint32_t width; uint64_t offset; };
+
+	const uint32_t row_num = 1000;
+	SequenceElementType types[3] = { SEQ_VARCHAR, SEQ_INT, SEQ_INT };
+	std::vector<uint32_t> sizes = { 40, 4, 4 };
+	char name[41];
+
+	FILE *file = fopen("test_plain.dat", "wb");
+	DatFile::Header header = { DATFILE_MAGIC, DATFILE_VERSION_PLAIN, 3, row_num };
+	PlainBlock blocks[3];
+	uint64_t offset = sizeof(header) + sizeof(blocks);
+	for (int i = 0; i < 3; i++)
+	{
+		offset = (offset + DATFILE_ALIGN - 1) / DATFILE_ALIGN * DATFILE_ALIGN;
+		blocks[i] = { (uint32_t)types[i], DatFile::width(types[i], sizes[i]), offset };
+		offset += (uint64_t)blocks[i].width * row_num;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(blocks, sizeof(blocks), 1, file);
+	for (int i = 0; i < 3; i++)
+	{
+		DatFile::pad_to(file, blocks[i].offset);
+		for (uint32_t r = 0; r < row_num; r++)
+		{
+			if (types[i] == SEQ_VARCHAR)
+			{
+				memset(name, 0, sizeof(name));
+				sprintf(name, "name%u", r);
+				fwrite(name, sizeof(name), 1, file);
+			}
+			else
+			{
+				int32_t ival = (i == 1) ? (int32_t)r * 3 - 500 : -(int32_t)r;
+				fwrite(&ival, sizeof(int32_t), 1, file);
+			}
+		}
+	}
+	fclose(file);
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		ColumnFile cf;
+		cf.init(types, sizes, 3);
+		cf.open("test_plain.dat", "rb+");
+		cf.read_from();
+
+		uint32_t bad = 0;
+		for (uint32_t r = 0; r < row_num; r++)
+		{
+			sprintf(name, "name%u", r);
+			if (strcmp(cf.get_varchar(r, 0), name) != 0 || cf.get_int(r, 1) != (int32_t)r * 3 - 500 || cf.get_int(r, 2) != -(int32_t)r)
+				bad++;
+		}
+		printf("Pass %d: %u rows, %u bad\n", pass, cf.size(), bad);
+		cf.write_back();
+	}
+}
+
+/*
+	test_database_lite_multiway_sum()
+
+	COUNT and SUM over a join of three tables go past 2^31,
+	expected row: 1000000	30000000000
+*/
+void test_database_lite_multiway_sum()
+{
+	DatabaseLite db("test_multiway.dbs");
+	std::stringstream ss;
+	ss << "CREATE TABLE MA (ID int, Val int);\n";
+	ss << "CREATE TABLE MB (ID int, Val int);\n";
+	ss << "CREATE TABLE MC (ID int, Val int);\n";
+	for (int i = 0; i < 100; i++)
+	{
+		ss << "INSERT INTO MA VALUES(" << i << ", 30000);\n";
+		ss << "INSERT INTO MB VALUES(" << i << ", 1);\n";
+		ss << "INSERT INTO MC VALUES(" << i << ", 1);\n";
+	}
+	ss << "SELECT COUNT(*), SUM(MA.Val) FROM MA, MB, MC WHERE MA.Val = 30000 AND MB.Val = MC.Val;\n";
+
+	std::string command = ss.str();
+	db.exec(command);
+}
@@ -42,4 +42,8 @@ void test_recordtable_primarykey();
 void test_dbms_table_create();
 void test_dbms_table_read();
 void test_dbms_table_create_duplicate();
-void test_dbms_table_iterator();
\ No newline at end of file
+void test_dbms_table_iterator();
+
+void test_columnfile_upgrade_plain();
+
+void test_database_lite_multiway_sum();